@@ -0,0 +1,249 @@
+#include "dsp_process.h"
+#include "dsp_os.h"
+#include "dsp_sim.h"
+
+//------------------------------------------------------------------------------------
+// Automatic EQ
+//
+// Fits peaking/shelf filters to a frequency response as the 'a' command does on the
+// device, and prints them as lines for dsp_config.h and as 'c' commands. The response
+// is read from a text file of "<freq> <dB>" lines (as measurement programs export
+// them; lines starting with '*' or '#' are skipped) or, without one, taken from the
+// simulated room of dsp_room_sim. The result is checked by evaluating the designed
+// coefficients in double precision on a dense grid.
+//------------------------------------------------------------------------------------
+
+#define AUTOEQ_ROOM_LEN       16384                     // Simulated room impulse response length in samples
+#define AUTOEQ_CHECK_POINTS   1000                      // Frequencies the result is checked at
+#define AUTOEQ_MAX_LINES      100000                    // Largest response file read
+
+typedef struct autoeq_curve_t {
+  int          count;
+  double*      freq;
+  double*      dB;
+} autoeq_curve_t;
+
+static esp_err_t autoeq_read( const char* path, autoeq_curve_t* curve ) {
+
+  FILE*     file = fopen( path, "r" );
+  char      line[256];
+  double    freq;
+  double    dB;
+
+  if( file == NULL ) {
+    return( ESP_ERR_NOT_FOUND );
+  }
+
+  curve->count = 0;
+  curve->freq = (double*) malloc( AUTOEQ_MAX_LINES*sizeof( double ) );
+  curve->dB = (double*) malloc( AUTOEQ_MAX_LINES*sizeof( double ) );
+  if( curve->freq == NULL || curve->dB == NULL ) {
+    fclose( file );
+    return( ESP_FAIL );
+  }
+
+  while( fgets( line, sizeof( line ), file ) != NULL && curve->count < AUTOEQ_MAX_LINES ) {
+    if( line[0] == '*' || line[0] == '#' || sscanf( line, "%lf%*[ ,;\t]%lf", &freq, &dB ) != 2 || freq <= 0 ) {
+      continue;
+    }
+    // Frequencies must rise
+    if( curve->count > 0 && freq <= curve->freq[curve->count - 1] ) {
+      fclose( file );
+      return( ESP_ERR_INVALID_ARG );
+    }
+    curve->freq[curve->count] = freq;
+    curve->dB[curve->count] = dB;
+    ++curve->count;
+  }
+
+  fclose( file );
+
+  return( curve->count >= 2 ? ESP_OK : ESP_ERR_INVALID_ARG );
+}
+
+// Curve value at a frequency, interpolated on a log frequency scale and held beyond its ends
+static float autoeq_at( const autoeq_curve_t* curve, double freq ) {
+
+  int       i = 1;
+
+  if( freq <= curve->freq[0] ) {
+    return( (float) curve->dB[0] );
+  }
+  while( i < curve->count - 1 && curve->freq[i] < freq ) {
+    ++i;
+  }
+  if( freq >= curve->freq[i] ) {
+    return( (float) curve->dB[i] );
+  }
+
+  return( (float) ( curve->dB[i - 1] + ( curve->dB[i] - curve->dB[i - 1] )*log( freq/curve->freq[i - 1] )/log( curve->freq[i]/curve->freq[i - 1] ) ) );
+}
+
+// Response of the simulated room, 1/6 octave smoothed as the 'a' command takes it
+static esp_err_t autoeq_room( const float* freq, float* response ) {
+
+  float*      room = dsp_sim_room( AUTOEQ_ROOM_LEN, 0 );
+  dsp_fft_t   fft;
+
+  if( room == NULL || dsp_fft_init( &fft, AUTOEQ_ROOM_LEN ) != ESP_OK ) {
+    return( ESP_FAIL );
+  }
+
+  dsp_fft_forward( &fft, room );
+  for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+    response[p] = dsp_measure_band( room, AUTOEQ_ROOM_LEN, freq[p], 1/6.0 );
+  }
+
+  dsp_fft_free( &fft );
+  free( room );
+
+  return( ESP_OK );
+}
+
+// Gain in dB of a cascade of biquads, evaluated directly in double precision as a reference
+static double autoeq_gain( const float coeffs[][5], int num_filters, double freq ) {
+
+  double    w = 2*PI*freq/DSP_SAMPLE_RATE;
+  double    c1 = cos( w );
+  double    s1 = sin( w );
+  double    c2 = cos( 2*w );
+  double    s2 = sin( 2*w );
+  double    gain = 0;
+
+  for( int k = 0; k < num_filters; ++k ) {
+    const float*  b = coeffs[k];
+    double        num_re = b[0] + b[1]*c1 + b[2]*c2;
+    double        num_im = -b[1]*s1 - b[2]*s2;
+    double        den_re = 1 + b[3]*c1 + b[4]*c2;
+    double        den_im = -b[3]*s1 - b[4]*s2;
+
+    gain += 10*log10( ( num_re*num_re + num_im*num_im )/( den_re*den_re + den_im*den_im ) );
+  }
+
+  return( gain );
+}
+
+
+int main( int argc, char* argv[] ) {
+
+  static dsp_fit_t  fit;
+  const char*       response_path = NULL;
+  const char*       target_path = NULL;
+  autoeq_curve_t    curve;
+  autoeq_curve_t    target_curve;
+  int               max_filters = DSP_MAX_FILTERS;
+  int               channel_id = 0;
+  int               first = 0;
+  float             response[DSP_FIT_POINTS];
+  float             target[DSP_FIT_POINTS];
+  double            freq;
+  double            error;
+  double            level = 0;
+  double            rms_before = 0;
+  double            rms_after = 0;
+  double            worst = 0;
+  int64_t           start_us;
+  int64_t           fit_us;
+  esp_err_t         res;
+
+  for( int i = 1; i < argc; ++i ) {
+    if( strcmp( argv[i], "-t" ) == 0 && i + 1 < argc ) {
+      target_path = argv[++i];
+    } else if( strcmp( argv[i], "-n" ) == 0 && i + 1 < argc ) {
+      max_filters = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-c" ) == 0 && i + 1 < argc ) {
+      channel_id = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-f" ) == 0 && i + 1 < argc ) {
+      first = atoi( argv[++i] );
+    } else if( argv[i][0] != '-' && response_path == NULL ) {
+      response_path = argv[i];
+    } else {
+      fprintf( stderr, "Usage: %s [-t target_file] [-n max_filters] [-c channel] [-f first_filter] [response_file]\n", argv[0] );
+      return( 1 );
+    }
+  }
+
+  if( max_filters < 1 || first < 0 || first + max_filters > DSP_MAX_FILTERS || channel_id < 0 || channel_id >= DSP_NUM_CHANNELS ) {
+    fprintf( stderr, "Invalid arguments\n" );
+    return( 1 );
+  }
+
+  dsp_fit_init( &fit );
+
+  if( response_path != NULL ) {
+    res = autoeq_read( response_path, &curve );
+    if( res != ESP_OK ) {
+      fprintf( stderr, "Unable to read a response from '%s'\n", response_path );
+      return( 1 );
+    }
+    for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+      response[p] = autoeq_at( &curve, fit.freq[p] );
+    }
+    printf( "Fitting the response in '%s' (%d points)\n", response_path, curve.count );
+  } else {
+    if( autoeq_room( fit.freq, response ) != ESP_OK ) {
+      fprintf( stderr, "Initialization failed\n" );
+      return( 1 );
+    }
+    printf( "Fitting the simulated room (%d samples)\n", AUTOEQ_ROOM_LEN );
+  }
+
+  for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+    target[p] = 0;
+  }
+  if( target_path != NULL ) {
+    if( autoeq_read( target_path, &target_curve ) != ESP_OK ) {
+      fprintf( stderr, "Unable to read a target from '%s'\n", target_path );
+      return( 1 );
+    }
+    for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+      target[p] = autoeq_at( &target_curve, fit.freq[p] );
+    }
+  }
+
+  start_us = dsp_os_time_us();
+  res = dsp_fit_run( &fit, response, target, max_filters );
+  fit_us = dsp_os_time_us() - start_us;
+  if( res != ESP_OK ) {
+    fprintf( stderr, "The response cannot be fitted\n" );
+    return( 1 );
+  }
+
+  dsp_fit_info( &fit );
+
+  // Check the real coefficients between the fit points, against the same level the fit used
+  for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+    level += ( response[p] - target[p] )/DSP_FIT_POINTS;
+  }
+  for( int i = 0; i < AUTOEQ_CHECK_POINTS; ++i ) {
+    freq = DSP_FIT_LOW_HZ*pow( DSP_FIT_HIGH_HZ/DSP_FIT_LOW_HZ, (double) i/( AUTOEQ_CHECK_POINTS - 1 ) );
+    error = ( response_path != NULL ? autoeq_at( &curve, freq ) : 0 ) - ( target_path != NULL ? autoeq_at( &target_curve, freq ) : 0 ) - level;
+    if( response_path == NULL ) {
+      // The simulated response is only known at the fit points: interpolate it
+      double  x = ( DSP_FIT_POINTS - 1 )*log( freq/DSP_FIT_LOW_HZ )/log( DSP_FIT_HIGH_HZ/DSP_FIT_LOW_HZ );
+      int     p = x < DSP_FIT_POINTS - 1 ? (int) x : DSP_FIT_POINTS - 2;
+
+      error += response[p] + ( x - p )*( response[p + 1] - response[p] );
+    }
+    rms_before += error*error/AUTOEQ_CHECK_POINTS;
+    error += autoeq_gain( fit.coeffs, fit.num_filters, freq );
+    rms_after += error*error/AUTOEQ_CHECK_POINTS;
+    worst = fabs( error ) > worst ? fabs( error ) : worst;
+  }
+
+  printf( "\n// dsp_config.h, filters %d to %d\n", first, first + fit.num_filters - 1 );
+  for( int k = 0; k < fit.num_filters; ++k ) {
+    printf( "      {%.15f,%.15f,%.15f,%.15f,%.15f},\n", fit.coeffs[k][0], fit.coeffs[k][1], fit.coeffs[k][2], fit.coeffs[k][3], fit.coeffs[k][4] );
+  }
+  printf( "\n// Serial commands\n" );
+  for( int k = 0; k < fit.num_filters; ++k ) {
+    printf( "c %d %d %.9g %.9g %.9g %.9g %.9g\n", channel_id, first + k, fit.coeffs[k][0], fit.coeffs[k][1], fit.coeffs[k][2], fit.coeffs[k][3], fit.coeffs[k][4] );
+  }
+  printf( "n %d %d\n\n", channel_id, first + fit.num_filters );
+
+  printf( "I-SIM: Checked at %d frequencies with the designed coefficients: RMS error %.2f dB -> %.2f dB, worst %.2f dB (dips not limited)\n",
+    AUTOEQ_CHECK_POINTS, sqrt( rms_before ), sqrt( rms_after ), worst );
+  printf( "I-SIM: Fit took %.1f ms for %d filter evaluations\n", fit_us/1000.0, fit.evaluations );
+
+  return( 0 );
+}
@@ -0,0 +1,1162 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include "dsp_process.h"
+#include "dsp_config.h"
+#include "dsp_os.h"
+#include "dsp_sim.h"
+#include "dsp_wav.h"
+
+//------------------------------------------------------------------------------------
+// Offline WAV processor
+//
+// Runs WAV files through dsp_filter(), block by block in the device's block size, and
+// writes the result as the codec would get it (16 bit, or 24 bit with DSP_SAMPLE_BITS
+// 32) to <name>_dsp.wav, next to the input or in the directory given with -o. The
+// channels come from dsp_config.h as built, or from a file in the same format given
+// with -c (a copy of dsp_config.h with a new tuning: the initializer of the
+// dsp_channel_t array is read, and FIR coefficients may be float arrays defined in the
+// same file). The files are streamed, so a soundtrack of hours takes no more memory than
+// a block. Each I2S slot takes the WAV channel of the same number, or the one given
+// with -m (e.g. "-m 0,1" for the front of a 5.1 track); a mono file feeds every slot.
+// The input must be at DSP_SAMPLE_RATE, which the filters are designed for.
+//
+// dsp_filter() keeps its work buffers in statics (the device has one audio path), so
+// files are processed in parallel by a pool of worker processes (-j, one per CPU by
+// default) rather than threads; the channels of a file are processed together, as on
+// the device, since the input mix couples them. Each file gets a report,
+// <name>_dsp.txt, with the clipping events (block resolution) and the peaks and
+// limiter activity of each channel, and a summary is printed as each file completes.
+// The exit status is 1 if a file could not be processed, 2 if any channel clipped.
+//
+// With -t it checks itself: the config file (if any) must match the built-in channels,
+// and synthetic files in every sample format must come out exactly as a direct run of
+// dsp_filter() over the same signal. The files go to the -o directory, or to
+// batch_test next to the executable.
+//------------------------------------------------------------------------------------
+
+#define BATCH_MAX_FIR_ARRAYS  8                         // Float arrays a config file may define
+#define BATCH_MAX_EVENTS      1000                      // Clipping events listed in a report
+#define BATCH_EVENT_GAP_S     0.5                       // Clipping closer than this is one event
+#define BATCH_IO_BUFFER       ( 1 << 20 )
+#define BATCH_TEST_SECONDS    20
+#define BATCH_TEST_DIR        "batch_test"                // Next to the executable, unless given with -o
+
+#if DSP_SAMPLE_BITS == 32
+#define BATCH_OUT_BYTES       3                         // 24 bit samples, as the codec takes them
+#else
+#define BATCH_OUT_BYTES       2
+#endif
+
+#define ARRAY_LEN( a )        ( (int) ( sizeof( a )/sizeof( a[0] ) ) )
+
+typedef struct batch_channel_t {
+  double       input_peak;                       // Largest input in the channel's I2S slot, relative to full scale
+  double       output_peak;                      // Largest output, relative to full scale
+  uint64_t     full_scale;                       // Output samples at full scale
+  int          clipping;                         // Samples over full scale before the limiter
+  int          limited;                          // Samples reduced by the soft knee
+  double       clip_peak;                        // Largest value before the limiter, relative to full scale (0 if no clipping)
+  float        limiter_gain;                     // Lowest limiter gain
+  int          events;                           // Clipping events
+} batch_channel_t;
+
+typedef struct batch_result_t {
+  esp_err_t    status;                           // ESP_FAIL until the worker has finished the file
+  uint64_t     frames;
+  double       wall_seconds;
+  batch_channel_t  channels[DSP_NUM_CHANNELS];
+} batch_result_t;
+
+typedef struct batch_event_t {                          // Clipping event being gathered
+  bool         open;
+  uint64_t     start;                            // First and last frame of the blocks that clipped
+  uint64_t     end;
+  int          clipping;
+  double       peak;
+} batch_event_t;
+
+typedef struct batch_parser_t {                         // Config file tokenizer
+  const char*  path;
+  const char*  pos;
+  int          line;
+  char         kind;                             // 'n' number, 's' string, 'i' identifier, 0 end, else the character
+  char         text[256];
+  double       number;
+} batch_parser_t;
+
+static  dsp_channel_t   batch_channels[DSP_NUM_CHANNELS];   // Channel config of every file
+static  const char*     batch_config_path = NULL;
+static  const char*     batch_out_dir = NULL;
+static  int             batch_block_frames = DSP_BLOCK_FRAMES;
+static  int             batch_slots[DSP_NUM_CHANNELS];      // WAV channel of each I2S slot, -1 for the default
+static  char            batch_fir_names[BATCH_MAX_FIR_ARRAYS][256];
+static  float*          batch_fir_arrays[BATCH_MAX_FIR_ARRAYS];
+static  int             batch_fir_lens[BATCH_MAX_FIR_ARRAYS];
+static  int             batch_fir_count = 0;
+
+
+//------------------------------------------------------------------------------------
+// Config file in the format of dsp_config.h. Comments and preprocessor lines are
+// skipped; values must be literals (numbers, strings, NULL or the name of an array).
+//------------------------------------------------------------------------------------
+
+static void batch_next( batch_parser_t* p ) {
+
+  const char* start;
+  char*       end;
+  int         len;
+
+  for( ;; ) {
+    while( isspace( (unsigned char) *p->pos ) ) {
+      p->line += *p->pos++ == '\n';
+    }
+    if( p->pos[0] == '/' && p->pos[1] == '/' ) {
+      p->pos += strcspn( p->pos, "\n" );
+    } else if( p->pos[0] == '/' && p->pos[1] == '*' ) {
+      for( p->pos += 2; *p->pos != 0 && !( p->pos[0] == '*' && p->pos[1] == '/' ); ++p->pos ) {
+        p->line += *p->pos == '\n';
+      }
+      p->pos += *p->pos != 0 ? 2 : 0;
+    } else if( *p->pos == '#' ) {
+      p->pos += strcspn( p->pos, "\n" );
+    } else {
+      break;
+    }
+  }
+
+  start = p->pos;
+  p->text[0] = 0;
+
+  if( *p->pos == 0 ) {
+    p->kind = 0;
+  } else if( *p->pos == '"' ) {
+    for( ++p->pos; *p->pos != 0 && *p->pos != '"' && *p->pos != '\n'; ++p->pos ) {
+      p->pos += p->pos[0] == '\\' && p->pos[1] != 0;
+    }
+    len = p->pos - start - 1 < (int) sizeof( p->text ) - 1 ? p->pos - start - 1 : sizeof( p->text ) - 1;
+    memcpy( p->text, start + 1, len );
+    p->text[len] = 0;
+    p->pos += *p->pos == '"';
+    p->kind = 's';
+  } else if( isdigit( (unsigned char) *p->pos ) || ( strchr( "+-.", *p->pos ) != NULL &&
+             ( isdigit( (unsigned char) p->pos[1] ) || ( p->pos[1] == '.' && isdigit( (unsigned char) p->pos[2] ) ) ) ) ) {
+    p->number = strtod( p->pos, &end );
+    p->pos = end;
+    p->pos += strspn( p->pos, "fFlL" );
+    p->kind = 'n';
+  } else if( isalpha( (unsigned char) *p->pos ) || *p->pos == '_' ) {
+    while( isalnum( (unsigned char) *p->pos ) || *p->pos == '_' ) {
+      ++p->pos;
+    }
+    len = p->pos - start < (int) sizeof( p->text ) - 1 ? p->pos - start : sizeof( p->text ) - 1;
+    memcpy( p->text, start, len );
+    p->text[len] = 0;
+    p->kind = 'i';
+  } else {
+    p->kind = *p->pos++;
+  }
+}
+
+static esp_err_t batch_syntax( batch_parser_t* p, const char* expected ) {
+
+  printf( "E-SIM: %s:%d: %s expected\n", p->path, p->line, expected );
+  return( ESP_FAIL );
+}
+
+// Step over a separating comma, if any
+static void batch_comma( batch_parser_t* p ) {
+
+  if( p->kind == ',' ) {
+    batch_next( p );
+  }
+}
+
+static esp_err_t batch_number( batch_parser_t* p, float* value ) {
+
+  if( p->kind != 'n' ) {
+    return( batch_syntax( p, "A number" ) );
+  }
+  *value = (float) p->number;
+  batch_next( p );
+
+  return( ESP_OK );
+}
+
+static esp_err_t batch_integer( batch_parser_t* p, int* value ) {
+
+  if( p->kind != 'n' || p->number != (int) p->number ) {
+    return( batch_syntax( p, "A whole number" ) );
+  }
+  *value = (int) p->number;
+  batch_next( p );
+
+  return( ESP_OK );
+}
+
+// A list of numbers in braces into a fixed array (max_count > 0, the rest stays 0) or a
+// new one that grows as needed (max_count 0)
+static esp_err_t batch_list( batch_parser_t* p, float** values, int max_count, int* count ) {
+
+  int       size = max_count;
+  float*    grown;
+
+  *count = 0;
+  if( p->kind != '{' ) {
+    return( batch_syntax( p, "'{'" ) );
+  }
+  batch_next( p );
+
+  while( p->kind != '}' ) {
+    if( *count == size ) {
+      if( max_count > 0 ) {
+        return( batch_syntax( p, "'}'" ) );
+      }
+      size = size > 0 ? size*2 : 1024;
+      grown = (float*) realloc( *values, size*sizeof( float ) );
+      if( grown == NULL ) {
+        return( batch_syntax( p, "A shorter array" ) );
+      }
+      *values = grown;
+    }
+    if( batch_number( p, &( *values )[( *count )++] ) != ESP_OK ) {
+      return( ESP_FAIL );
+    }
+    batch_comma( p );
+  }
+  batch_next( p );
+
+  return( ESP_OK );
+}
+
+// NULL, or the name of a float array defined earlier in the file
+static esp_err_t batch_array( batch_parser_t* p, const float** array, int* len ) {
+
+  if( p->kind != 'i' ) {
+    return( batch_syntax( p, "NULL or the name of an array" ) );
+  }
+
+  *array = NULL;
+  *len = 0;
+  if( strcmp( p->text, "NULL" ) != 0 && strcmp( p->text, "nullptr" ) != 0 ) {
+    for( int i = 0; i < batch_fir_count && *array == NULL; ++i ) {
+      if( strcmp( p->text, batch_fir_names[i] ) == 0 ) {
+        *array = batch_fir_arrays[i];
+        *len = batch_fir_lens[i];
+      }
+    }
+    if( *array == NULL ) {
+      return( batch_syntax( p, "An array defined earlier" ) );
+    }
+  }
+  batch_next( p );
+
+  return( ESP_OK );
+}
+
+// One dsp_channel_t initializer; fields left out are 0, as in C
+static esp_err_t batch_channel( batch_parser_t* p, dsp_channel_t* channel ) {
+
+  float*    values;
+  int       count;
+  int       fir_len = 0;
+  esp_err_t res = ESP_OK;
+
+  memset( channel, 0, sizeof( dsp_channel_t ) );
+  channel->name = (char*) "";
+
+  if( p->kind != '{' ) {
+    return( batch_syntax( p, "'{'" ) );
+  }
+  batch_next( p );
+
+  for( int field = 0; p->kind != '}' && res == ESP_OK; ++field ) {
+    switch( field ) {
+      case 0:
+        if( p->kind != 's' ) {
+          return( batch_syntax( p, "The channel name" ) );
+        }
+        channel->name = strdup( p->text );
+        batch_next( p );
+        break;
+      case 1:
+        res = batch_number( p, &channel->gain_dB );
+        break;
+      case 2:
+        res = batch_number( p, &channel->delay_millis );
+        break;
+      case 3:
+        res = batch_integer( p, &channel->num_filters );
+        break;
+      case 4:
+        if( p->kind != '{' ) {
+          return( batch_syntax( p, "'{'" ) );
+        }
+        batch_next( p );
+        for( int filter_id = 0; p->kind != '}' && res == ESP_OK; ++filter_id ) {
+          if( filter_id == DSP_MAX_FILTERS ) {
+            return( batch_syntax( p, "'}'" ) );
+          }
+          values = channel->coeffs[filter_id];
+          res = batch_list( p, &values, 5, &count );
+          batch_comma( p );
+        }
+        batch_next( p );
+        break;
+      case 5:
+        res = batch_integer( p, &channel->decimation );
+        break;
+      case 6:
+        res = batch_integer( p, &channel->fir_taps );
+        break;
+      case 7:
+        res = batch_array( p, &channel->fir_coeffs, &fir_len );
+        break;
+      case 8:
+        values = channel->mix;
+        res = batch_list( p, &values, DSP_NUM_CHANNELS, &count );
+        break;
+      case 9:
+        res = batch_array( p, (const float**) &values, &count );
+        break;
+      default:
+        return( batch_syntax( p, "'}'" ) );
+    }
+    batch_comma( p );
+  }
+  batch_next( p );
+
+  if( res == ESP_OK && channel->fir_taps > fir_len ) {
+    printf( "E-SIM: %s:%d: Channel '%s' has %d FIR taps but %d coefficients\n", p->path, p->line, channel->name, channel->fir_taps, fir_len );
+    res = ESP_FAIL;
+  }
+
+  return( res );
+}
+
+static esp_err_t batch_load_config( const char* path, dsp_channel_t* channels ) {
+
+  batch_parser_t  parser;
+  batch_parser_t* p = &parser;
+  FILE*           file;
+  char*           text;
+  long            len;
+  char            name[256];
+  bool            is_channels;
+  bool            is_float;
+  int             depth;
+  int             count;
+  bool            found = false;
+  esp_err_t       res = ESP_OK;
+
+  file = fopen( path, "rb" );
+  if( file == NULL ) {
+    printf( "E-SIM: Unable to open '%s'\n", path );
+    return( ESP_FAIL );
+  }
+  fseek( file, 0, SEEK_END );
+  len = ftell( file );
+  fseek( file, 0, SEEK_SET );
+  text = (char*) malloc( len + 1 );
+  if( text == NULL || fread( text, 1, len, file ) != (size_t) len ) {
+    printf( "E-SIM: Unable to read '%s'\n", path );
+    fclose( file );
+    free( text );
+    return( ESP_FAIL );
+  }
+  fclose( file );
+  text[len] = 0;
+
+  p->path = path;
+  p->pos = text;
+  p->line = 1;
+  batch_next( p );
+
+  // Declarations: the dsp_channel_t array and float arrays are read, others skipped
+  while( p->kind != 0 && res == ESP_OK ) {
+    name[0] = 0;
+    is_channels = false;
+    is_float = false;
+    depth = 0;
+    while( p->kind != 0 && ( depth > 0 || ( p->kind != '=' && p->kind != ';' ) ) ) {
+      if( p->kind == 'i' && depth == 0 ) {
+        is_channels |= strcmp( p->text, "dsp_channel_t" ) == 0;
+        is_float |= strcmp( p->text, "float" ) == 0;
+        strcpy( name, p->text );
+      }
+      depth += ( p->kind == '[' || p->kind == '(' ) - ( p->kind == ']' || p->kind == ')' );
+      batch_next( p );
+    }
+    if( p->kind == '=' ) {
+      batch_next( p );
+      if( is_channels && !found ) {
+        if( p->kind != '{' ) {
+          res = batch_syntax( p, "'{'" );
+        }
+        batch_next( p );
+        for( count = 0; p->kind != '}' && res == ESP_OK; ++count ) {
+          if( count == DSP_NUM_CHANNELS ) {
+            printf( "E-SIM: %s:%d: More channels than the %d of the build\n", path, p->line, DSP_NUM_CHANNELS );
+            res = ESP_FAIL;
+          } else {
+            res = batch_channel( p, &channels[count] );
+            batch_comma( p );
+          }
+        }
+        if( res == ESP_OK && count != DSP_NUM_CHANNELS ) {
+          printf( "E-SIM: %s:%d: %d channels, the build has %d\n", path, p->line, count, DSP_NUM_CHANNELS );
+          res = ESP_FAIL;
+        }
+        batch_next( p );
+        found = true;
+      } else if( is_float && p->kind == '{' && batch_fir_count < BATCH_MAX_FIR_ARRAYS ) {
+        strcpy( batch_fir_names[batch_fir_count], name );
+        batch_fir_arrays[batch_fir_count] = NULL;
+        res = batch_list( p, &batch_fir_arrays[batch_fir_count], 0, &batch_fir_lens[batch_fir_count] );
+        ++batch_fir_count;
+      } else {
+        for( depth = 0; p->kind != 0 && ( depth > 0 || p->kind != ';' ); batch_next( p ) ) {
+          depth += ( p->kind == '{' ) - ( p->kind == '}' );
+        }
+      }
+    }
+    if( res == ESP_OK && p->kind != ';' ) {
+      res = batch_syntax( p, "';'" );
+    }
+    batch_next( p );
+  }
+  free( text );
+
+  if( res == ESP_OK && !found ) {
+    printf( "E-SIM: %s: No dsp_channel_t array\n", path );
+    res = ESP_FAIL;
+  }
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Sample conversion. Every input format is first aligned to the top of 32 bits, then
+// rounded to the I2S word as the codec would deliver it.
+//------------------------------------------------------------------------------------
+
+static inline sample_t batch_sample( int32_t value ) {
+
+#if DSP_SAMPLE_BITS == 32
+  int64_t   rounded = ( (int64_t) value + 0x80 ) & ~(int64_t) 0xff;   // 24 bits in the 32 bit slot
+
+  return( rounded > DSP_MAX_SAMPLE_VALUE ? DSP_MAX_SAMPLE_VALUE : (sample_t) rounded );
+#else
+  int32_t   rounded = ( value >> 16 ) + ( ( value >> 15 ) & 1 );
+
+  return( rounded > DSP_MAX_SAMPLE_VALUE ? DSP_MAX_SAMPLE_VALUE : (sample_t) rounded );
+#endif
+}
+
+static void batch_unpack( const dsp_wav_t* wav, const uint8_t* raw, int frames, const int* slots, sample_t* block ) {
+
+  const uint8_t*  sample;
+  int32_t         value;
+  float           x;
+
+  for( int i = 0; i < frames; ++i ) {
+    for( int slot = 0; slot < DSP_NUM_CHANNELS; ++slot ) {
+      sample = &raw[( i*wav->channels + slots[slot] )*wav->sample_bytes];
+      if( wav->format == DSP_WAV_FLOAT ) {
+        memcpy( &x, sample, sizeof( x ) );
+        x *= 2147483648.0f;
+        value = x >= 2147483520.0f ? INT32_MAX : x > -2147483648.0f ? (int32_t) lrintf( x ) : INT32_MIN;   // NaN reads as full scale down
+      } else if( wav->sample_bytes == 2 ) {
+        value = (int32_t) ( (uint32_t) sample[0] << 16 | (uint32_t) sample[1] << 24 );
+      } else if( wav->sample_bytes == 3 ) {
+        value = (int32_t) ( (uint32_t) sample[0] << 8 | (uint32_t) sample[1] << 16 | (uint32_t) sample[2] << 24 );
+      } else {
+        memcpy( &value, sample, sizeof( value ) );
+      }
+      block[i*DSP_NUM_CHANNELS + slot] = batch_sample( value );
+    }
+  }
+}
+
+static void batch_pack( const sample_t* block, int frames, uint8_t* raw ) {
+
+#if DSP_SAMPLE_BITS == 32
+  for( int i = 0; i < frames*DSP_NUM_CHANNELS; ++i ) {
+    raw[3*i] = (uint8_t) ( block[i] >> 8 );
+    raw[3*i + 1] = (uint8_t) ( block[i] >> 16 );
+    raw[3*i + 2] = (uint8_t) ( block[i] >> 24 );
+  }
+#else
+  memcpy( raw, block, frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+#endif
+}
+
+
+//------------------------------------------------------------------------------------
+// Process one file (in a worker process)
+//------------------------------------------------------------------------------------
+
+static void batch_time( char* text, int len, double seconds ) {
+
+  int       whole = (int) seconds;
+
+  snprintf( text, len, "%d:%02d:%02d.%03d", whole/3600, whole/60 % 60, whole % 60, (int) ( ( seconds - whole )*1000 ) );
+}
+
+static void batch_event_close( FILE* report, const dsp_channel_t* channel, batch_event_t* event, int* events ) {
+
+  char      start[32];
+  char      end[32];
+
+  if( !event->open ) {
+    return;
+  }
+  event->open = false;
+
+  if( ++( *events ) <= BATCH_MAX_EVENTS ) {
+    batch_time( start, sizeof( start ), (double) event->start/DSP_SAMPLE_RATE );
+    batch_time( end, sizeof( end ), (double) ( event->end + 1 )/DSP_SAMPLE_RATE );
+    fprintf( report, "  %s - %s  '%s': %d samples over full scale, peak %+.1f dBFS\n", start, end, channel->name,
+      event->clipping, 20*log10( event->peak ) );
+  } else if( *events == BATCH_MAX_EVENTS + 1 ) {
+    fprintf( report, "  (further events of '%s' not listed)\n", channel->name );
+  }
+}
+
+static void batch_output_path( const char* in_path, const char* suffix, char* path, int len ) {
+
+  const char* base = strrchr( in_path, '/' );
+  const char* ext;
+  int         dir_len;
+
+  base = base != NULL ? base + 1 : in_path;
+  ext = strrchr( base, '.' );
+  ext = ext != NULL ? ext : base + strlen( base );
+  dir_len = base - in_path;
+
+  if( batch_out_dir != NULL ) {
+    snprintf( path, len, "%s/%.*s%s", batch_out_dir, (int) ( ext - base ), base, suffix );
+  } else {
+    snprintf( path, len, "%.*s%.*s%s", dir_len, in_path, (int) ( ext - base ), base, suffix );
+  }
+}
+
+static esp_err_t batch_file( const char* in_path, batch_result_t* result ) {
+
+  dsp_channel_t   channels[DSP_NUM_CHANNELS];
+  batch_event_t   events[DSP_NUM_CHANNELS];
+  batch_channel_t* stats;
+  dsp_buffer_t*   buffers;
+  dsp_wav_t       in;
+  dsp_wav_t       out;
+  FILE*           report = NULL;
+  char            out_path[1024];
+  char            report_path[1024];
+  int             slots[DSP_NUM_CHANNELS];
+  sample_t        block[DSP_MAX_SAMPLES];
+  uint8_t*        raw = NULL;
+  uint8_t*        packed = NULL;
+  int             frames = batch_block_frames;
+  int             block_align;
+  uint64_t        remaining;
+  int             want;
+  int             got;
+  int             clipping;
+  bool            clip_flag;
+  sample_t        value;
+  double          peak;
+  int64_t         start_us = dsp_os_time_us();
+  esp_err_t       res;
+
+  memset( result, 0, sizeof( batch_result_t ) );
+  result->status = ESP_FAIL;
+  memset( events, 0, sizeof( events ) );
+  memset( &in, 0, sizeof( in ) );
+  memset( &out, 0, sizeof( out ) );
+  memcpy( channels, batch_channels, sizeof( channels ) );
+
+  in.file = fopen( in_path, "rb" );
+  if( in.file == NULL ) {
+    printf( "E-SIM: Unable to open '%s'\n", in_path );
+    return( ESP_FAIL );
+  }
+  res = dsp_wav_read_header( &in );
+  if( res != ESP_OK ) {
+    if( res == ESP_ERR_NOT_SUPPORTED ) {
+      printf( "E-SIM: '%s': sample format %d with %d bytes per sample is not supported\n", in_path, in.format, in.sample_bytes );
+    } else {
+      printf( "E-SIM: '%s' is not a WAV file\n", in_path );
+    }
+    fclose( in.file );
+    return( ESP_FAIL );
+  }
+  if( in.sample_rate != DSP_SAMPLE_RATE ) {
+    printf( "E-SIM: '%s' is at %u Hz, the filters are designed for %d Hz\n", in_path, in.sample_rate, DSP_SAMPLE_RATE );
+    fclose( in.file );
+    return( ESP_FAIL );
+  }
+  for( int slot = 0; slot < DSP_NUM_CHANNELS; ++slot ) {
+    slots[slot] = batch_slots[slot] >= 0 ? batch_slots[slot] : in.channels == 1 ? 0 : slot;
+    if( slots[slot] >= in.channels ) {
+      printf( "E-SIM: '%s' has %d channels, I2S slot %d takes channel %d\n", in_path, in.channels, slot, slots[slot] );
+      fclose( in.file );
+      return( ESP_FAIL );
+    }
+  }
+  block_align = in.channels*in.sample_bytes;
+  setvbuf( in.file, NULL, _IOFBF, BATCH_IO_BUFFER );
+
+  batch_output_path( in_path, "_dsp.wav", out_path, sizeof( out_path ) );
+  batch_output_path( in_path, "_dsp.txt", report_path, sizeof( report_path ) );
+  out.file = fopen( out_path, "wb" );
+  report = fopen( report_path, "w" );
+  raw = (uint8_t*) malloc( frames*block_align );
+  packed = (uint8_t*) malloc( frames*DSP_NUM_CHANNELS*BATCH_OUT_BYTES );
+  if( out.file == NULL || report == NULL || raw == NULL || packed == NULL ) {
+    printf( "E-SIM: Unable to create '%s' and '%s'\n", out_path, report_path );
+    res = ESP_FAIL;
+    goto done;
+  }
+  setvbuf( out.file, NULL, _IOFBF, BATCH_IO_BUFFER );
+  out.format = DSP_WAV_PCM;
+  out.channels = DSP_NUM_CHANNELS;
+  out.sample_bytes = BATCH_OUT_BYTES;
+  out.sample_rate = in.sample_rate;
+  dsp_wav_write_header( &out );
+
+  if( dsp_filter_set_block( frames ) != ESP_OK || dsp_filter_init( channels ) != ESP_OK ) {
+    printf( "E-SIM: '%s': the channel config does not initialize\n", in_path );
+    res = ESP_FAIL;
+    goto done;
+  }
+
+  fprintf( report, "Input:  %s (%d channels of %d bit %s at %u Hz), I2S slots from channels", in_path, in.channels,
+    in.sample_bytes*8, in.format == DSP_WAV_FLOAT ? "float" : "PCM", in.sample_rate );
+  for( int slot = 0; slot < DSP_NUM_CHANNELS; ++slot ) {
+    fprintf( report, "%s %d", slot > 0 ? "," : "", slots[slot] );
+  }
+  fprintf( report, "\nOutput: %s (%d channels of %d bit PCM)\nConfig: %s, blocks of %d frames\n\nClipping events:\n",
+    out_path, DSP_NUM_CHANNELS, BATCH_OUT_BYTES*8, batch_config_path != NULL ? batch_config_path : "dsp_config.h as built", frames );
+
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    result->channels[channel_id].limiter_gain = 1.0;
+  }
+
+  // Stream the file a block at a time; the last block is padded with silence
+  remaining = in.data_bytes == DSP_WAV_UNKNOWN_LEN ? UINT64_MAX : in.data_bytes/block_align;
+  while( remaining > 0 ) {
+    want = remaining < (uint64_t) frames ? (int) remaining : frames;
+    got = (int) fread( raw, block_align, want, in.file );
+    if( got == 0 ) {
+      break;
+    }
+
+    batch_unpack( &in, raw, got, slots, block );
+    if( got < frames ) {
+      memset( &block[got*DSP_NUM_CHANNELS], 0, ( frames - got )*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+    }
+    for( int i = 0; i < got*DSP_NUM_CHANNELS; ++i ) {
+      peak = fabs( (double) block[i] )/DSP_MAX_SAMPLE_VALUE;
+      stats = &result->channels[i % DSP_NUM_CHANNELS];
+      stats->input_peak = peak > stats->input_peak ? peak : stats->input_peak;
+    }
+
+    if( dsp_filter( channels, block, frames*DSP_NUM_CHANNELS*sizeof( sample_t ), &clip_flag ) != ESP_OK ) {
+      printf( "E-SIM: '%s': dsp_filter() failed at frame %llu\n", in_path, (unsigned long long) result->frames );
+      res = ESP_FAIL;
+      break;
+    }
+
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      stats = &result->channels[channel_id];
+      buffers = channels[channel_id].buffers;
+      for( int i = 0; i < got; ++i ) {
+        value = block[i*DSP_NUM_CHANNELS + channel_id];
+        peak = fabs( (double) value )/DSP_MAX_SAMPLE_VALUE;
+        stats->output_peak = peak > stats->output_peak ? peak : stats->output_peak;
+        stats->full_scale += value >= DSP_MAX_SAMPLE_VALUE || value <= -DSP_MAX_SAMPLE_VALUE;
+      }
+      stats->limiter_gain = buffers->limiter_target < stats->limiter_gain ? buffers->limiter_target : stats->limiter_gain;
+
+      // Blocks that clipped within BATCH_EVENT_GAP_S of each other make one event
+      clipping = buffers->clipping_count - stats->clipping;
+      if( clipping > 0 ) {
+        if( events[channel_id].open && result->frames - events[channel_id].end > BATCH_EVENT_GAP_S*DSP_SAMPLE_RATE ) {
+          batch_event_close( report, &channels[channel_id], &events[channel_id], &stats->events );
+        }
+        if( !events[channel_id].open ) {
+          events[channel_id].open = true;
+          events[channel_id].start = result->frames;
+          events[channel_id].clipping = 0;
+          events[channel_id].peak = 0;
+        }
+        peak = buffers->clip_peak/65536.0;
+        buffers->clip_peak = 0;
+        events[channel_id].end = result->frames + got - 1;
+        events[channel_id].clipping += clipping;
+        events[channel_id].peak = peak > events[channel_id].peak ? peak : events[channel_id].peak;
+        stats->clip_peak = peak > stats->clip_peak ? peak : stats->clip_peak;
+        stats->clipping = buffers->clipping_count;
+      }
+      stats->limited = buffers->limit_count;
+    }
+
+    batch_pack( block, got, packed );
+    if( fwrite( packed, DSP_NUM_CHANNELS*BATCH_OUT_BYTES, got, out.file ) != (size_t) got ) {
+      printf( "E-SIM: Unable to write '%s'\n", out_path );
+      res = ESP_FAIL;
+      break;
+    }
+    out.data_bytes += got*DSP_NUM_CHANNELS*BATCH_OUT_BYTES;
+    result->frames += got;
+    remaining -= got;
+    if( got < want ) {
+      break;
+    }
+  }
+
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    stats = &result->channels[channel_id];
+    batch_event_close( report, &channels[channel_id], &events[channel_id], &stats->events );
+  }
+  fprintf( report, "\n%.3f s processed\n", (double) result->frames/DSP_SAMPLE_RATE );
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    stats = &result->channels[channel_id];
+    fprintf( report, "'%s': input peak %+.1f dBFS, output peak %+.1f dBFS, %llu samples at full scale, "
+      "%d samples over full scale before the limiter (peak %+.1f dBFS) in %d events, %d samples limited, limiter down to %.2f dB\n",
+      channels[channel_id].name, 20*log10( stats->input_peak ), 20*log10( stats->output_peak ), (unsigned long long) stats->full_scale,
+      stats->clipping, 20*log10( stats->clip_peak ), stats->events, stats->limited, 20*log10f( stats->limiter_gain ) );
+  }
+  dsp_filter_deinit( channels );
+
+done:
+  fclose( in.file );
+  if( out.file != NULL ) {
+    if( dsp_wav_write_header( &out ) != ESP_OK || fclose( out.file ) != 0 ) {
+      printf( "E-SIM: Unable to write '%s'\n", out_path );
+      res = ESP_FAIL;
+    }
+  }
+  if( report != NULL ) {
+    fclose( report );
+  }
+  free( raw );
+  free( packed );
+
+  result->wall_seconds = ( dsp_os_time_us() - start_us )/1e6;
+  result->status = res;
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Worker pool: one process per file, up to 'jobs' at a time. The results live in
+// shared memory; a worker that dies leaves ESP_FAIL in its result.
+//------------------------------------------------------------------------------------
+
+static void batch_summary( const char* path, const batch_result_t* result, int done, int count ) {
+
+  const batch_channel_t*  stats;
+  double                  seconds = (double) result->frames/DSP_SAMPLE_RATE;
+
+  if( result->status != ESP_OK ) {
+    printf( "E-SIM: [%d/%d] %s: FAILED\n", done, count, path );
+    return;
+  }
+
+  printf( "I-SIM: [%d/%d] %s: %.1f s in %.2f s (%.0fx real time)\n", done, count, path, seconds, result->wall_seconds,
+    result->wall_seconds > 0 ? seconds/result->wall_seconds : 0 );
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    stats = &result->channels[channel_id];
+    printf( "I-SIM:   '%s': peak %+.1f dBFS in, %+.1f dBFS out", batch_channels[channel_id].name,
+      20*log10( stats->input_peak ), 20*log10( stats->output_peak ) );
+    if( stats->clipping > 0 ) {
+      printf( ", CLIPPED %d samples in %d events (peak %+.1f dBFS, limiter down to %.2f dB)", stats->clipping, stats->events,
+        20*log10( stats->clip_peak ), 20*log10f( stats->limiter_gain ) );
+    }
+    printf( "\n" );
+  }
+}
+
+static esp_err_t batch_run( char* const* paths, int count, int jobs, batch_result_t* results ) {
+
+  pid_t*      pids;
+  pid_t       pid;
+  int         status;
+  int         running = 0;
+  int         next = 0;
+  int         done = 0;
+  int         index;
+  esp_err_t   res = ESP_OK;
+
+  pids = (pid_t*) calloc( count, sizeof( pid_t ) );
+  if( pids == NULL ) {
+    return( ESP_FAIL );
+  }
+
+  while( next < count || running > 0 ) {
+    if( next < count && running < jobs ) {
+      results[next].status = ESP_FAIL;
+      fflush( stdout );
+      pid = fork();
+      if( pid == 0 ) {
+        exit( batch_file( paths[next], &results[next] ) == ESP_OK ? 0 : 1 );
+      }
+      if( pid < 0 ) {
+        printf( "E-SIM: Unable to start a worker for '%s'\n", paths[next] );
+        res = ESP_FAIL;
+        break;
+      }
+      pids[next++] = pid;
+      ++running;
+      continue;
+    }
+
+    pid = wait( &status );
+    if( pid < 0 ) {
+      res = ESP_FAIL;
+      break;
+    }
+    --running;
+    for( index = 0; index < next && pids[index] != pid; ++index ) {
+    }
+    if( index < next ) {
+      if( WIFSIGNALED( status ) ) {
+        printf( "E-SIM: Worker for '%s' died (signal %d)\n", paths[index], WTERMSIG( status ) );
+        results[index].status = ESP_FAIL;
+      }
+      batch_summary( paths[index], &results[index], ++done, count );
+    }
+  }
+
+  while( running > 0 && wait( &status ) > 0 ) {
+    --running;
+  }
+  free( pids );
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Self-test (-t)
+//------------------------------------------------------------------------------------
+
+static int batch_compare_config( const dsp_channel_t* loaded ) {
+
+  const dsp_channel_t*  a;
+  const dsp_channel_t*  b;
+  int                   differences = 0;
+
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    a = &loaded[channel_id];
+    b = &DSP_Channels[channel_id];
+    if( strcmp( a->name, b->name ) != 0 || a->gain_dB != b->gain_dB || a->delay_millis != b->delay_millis ||
+        a->num_filters != b->num_filters || memcmp( a->coeffs, b->coeffs, sizeof( a->coeffs ) ) != 0 ||
+        a->decimation != b->decimation || a->fir_taps != b->fir_taps || memcmp( a->mix, b->mix, sizeof( a->mix ) ) != 0 ||
+        ( a->fir_taps > 0 && memcmp( a->fir_coeffs, b->fir_coeffs, a->fir_taps*sizeof( float ) ) != 0 ) ) {
+      printf( "E-SIM: Channel %d of '%s' differs from the built-in '%s'\n", channel_id, batch_config_path, b->name );
+      ++differences;
+    }
+  }
+
+  return( differences );
+}
+
+static esp_err_t batch_test_write( const char* path, int format, int sample_bytes, int channels, const sample_t* signal, int frames ) {
+
+  dsp_wav_t   wav;
+  int32_t     value;
+  float       x;
+  uint8_t     sample[4];
+  bool        written = true;
+
+  wav.file = fopen( path, "wb" );
+  if( wav.file == NULL ) {
+    return( ESP_FAIL );
+  }
+  wav.format = format;
+  wav.channels = channels;
+  wav.sample_bytes = sample_bytes;
+  wav.sample_rate = DSP_SAMPLE_RATE;
+  wav.data_bytes = (uint64_t) frames*channels*sample_bytes;
+  dsp_wav_write_header( &wav );
+
+  for( int i = 0; i < frames*channels && written; ++i ) {
+    value = (int32_t) ( (uint32_t) signal[( i/channels )*DSP_NUM_CHANNELS + i % channels] << ( 32 - DSP_SAMPLE_BITS ) );
+    if( format == DSP_WAV_FLOAT ) {
+      x = value/2147483648.0f;
+      memcpy( sample, &x, sizeof( x ) );
+    } else {
+      value >>= 8*( 4 - sample_bytes );
+      memcpy( sample, &value, sizeof( value ) );
+    }
+    written = fwrite( sample, sample_bytes, 1, wav.file ) == 1;
+  }
+
+  return( fclose( wav.file ) == 0 && written ? ESP_OK : ESP_FAIL );
+}
+
+// Create a directory and any missing parents
+static esp_err_t batch_mkdir( const char* path ) {
+
+  char      partial[1024];
+
+  for( const char* slash = strchr( path + 1, '/' ); ; slash = strchr( slash + 1, '/' ) ) {
+    snprintf( partial, sizeof( partial ), "%.*s", slash != NULL ? (int) ( slash - path ) : (int) strlen( path ), path );
+    if( mkdir( partial, 0755 ) != 0 && errno != EEXIST ) {
+      return( ESP_FAIL );
+    }
+    if( slash == NULL ) {
+      return( ESP_OK );
+    }
+  }
+}
+
+static int batch_test( const char* dir, int jobs ) {
+
+  static const struct {
+    const char*   name;
+    int           format;
+    int           sample_bytes;
+    int           channels;
+    double        level;
+    bool          exact;                                // Holds the I2S words exactly: output must match the reference
+  } files[] = {
+    { "pcm16",        DSP_WAV_PCM,    2, DSP_NUM_CHANNELS, 0.5, DSP_SAMPLE_BITS == 16 },
+    { "pcm24",        DSP_WAV_PCM,    3, DSP_NUM_CHANNELS, 0.5, true },
+    { "pcm32",        DSP_WAV_PCM,    4, DSP_NUM_CHANNELS, 0.5, true },
+    { "float",        DSP_WAV_FLOAT,  4, DSP_NUM_CHANNELS, 0.5, true },
+    { "mono",         DSP_WAV_PCM,    2, 1,                0.5, false },
+    { "clipping",     DSP_WAV_PCM,    3, DSP_NUM_CHANNELS, 1.0, false }
+  };
+  char            paths[ARRAY_LEN( files )][256];
+  char*           path_list[ARRAY_LEN( files )];
+  char            out_path[256];
+  batch_result_t* results;
+  dsp_channel_t   channels[DSP_NUM_CHANNELS];
+  sample_t*       signal[2];
+  sample_t*       reference;
+  sample_t        block[DSP_MAX_SAMPLES];
+  uint8_t*        expected;
+  uint8_t*        actual;
+  dsp_wav_t       wav;
+  bool            clip_flag;
+  int             frames = BATCH_TEST_SECONDS*DSP_SAMPLE_RATE + 100;  // Ends with a partial block
+  int             padded = ( frames + batch_block_frames - 1 )/batch_block_frames*batch_block_frames;
+  int             out_bytes = frames*DSP_NUM_CHANNELS*BATCH_OUT_BYTES;
+  int             failures = 0;
+  int             clipped = 0;
+  int64_t         start_us;
+  double          wall_seconds;
+
+  if( batch_config_path != NULL ) {
+    failures += batch_compare_config( batch_channels );
+    printf( "I-SIM: Config '%s' %s the built-in channels\n", batch_config_path, failures == 0 ? "matches" : "DIFFERS FROM" );
+  }
+
+  // The signals, rounded to the I2S word as the codec would deliver them. The second is
+  // squared off at full scale: the high-pass filters overshoot on its edges and clip.
+  signal[0] = dsp_sim_signal( padded, 0.5 );
+  signal[1] = dsp_sim_signal( padded, 1.0 );
+  reference = (sample_t*) malloc( padded*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+  expected = (uint8_t*) malloc( out_bytes );
+  actual = (uint8_t*) malloc( out_bytes );
+  results = (batch_result_t*) mmap( NULL, sizeof( batch_result_t )*ARRAY_LEN( files ), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+  if( signal[0] == NULL || signal[1] == NULL || reference == NULL || expected == NULL || actual == NULL || results == MAP_FAILED ) {
+    printf( "E-SIM: Out of memory\n" );
+    return( 1 );
+  }
+  for( int i = 0; i < padded*DSP_NUM_CHANNELS; ++i ) {
+    signal[0][i] = batch_sample( (int32_t) ( (uint32_t) signal[0][i] << ( 32 - DSP_SAMPLE_BITS ) ) );
+    signal[1][i] = signal[1][i] >= 0 ? DSP_MAX_SAMPLE_VALUE : -DSP_MAX_SAMPLE_VALUE;
+  }
+
+  if( batch_mkdir( dir ) != ESP_OK ) {
+    printf( "E-SIM: Unable to create '%s'\n", dir );
+    return( 1 );
+  }
+  batch_out_dir = dir;
+  for( int f = 0; f < ARRAY_LEN( files ); ++f ) {
+    snprintf( paths[f], sizeof( paths[f] ), "%s/%s.wav", dir, files[f].name );
+    path_list[f] = paths[f];
+    if( batch_test_write( paths[f], files[f].format, files[f].sample_bytes, files[f].channels,
+                          signal[files[f].level < 1.0 ? 0 : 1], frames ) != ESP_OK ) {
+      printf( "E-SIM: Unable to write '%s'\n", paths[f] );
+      return( 1 );
+    }
+  }
+
+  start_us = dsp_os_time_us();
+  if( batch_run( path_list, ARRAY_LEN( files ), jobs, results ) != ESP_OK ) {
+    return( 1 );
+  }
+  wall_seconds = ( dsp_os_time_us() - start_us )/1e6;
+
+  // Reference: the signal straight through dsp_filter() in this process
+  memcpy( channels, batch_channels, sizeof( channels ) );
+  if( dsp_filter_set_block( batch_block_frames ) != ESP_OK || dsp_filter_init( channels ) != ESP_OK ) {
+    return( 1 );
+  }
+  for( int i = 0; i < padded; i += batch_block_frames ) {
+    memcpy( block, &signal[0][i*DSP_NUM_CHANNELS], batch_block_frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+    if( i + batch_block_frames > frames ) {
+      memset( &block[( frames - i )*DSP_NUM_CHANNELS], 0, ( i + batch_block_frames - frames )*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+    }
+    dsp_filter( channels, block, batch_block_frames*DSP_NUM_CHANNELS*sizeof( sample_t ), &clip_flag );
+    memcpy( &reference[i*DSP_NUM_CHANNELS], block, batch_block_frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+  }
+  dsp_filter_deinit( channels );
+  batch_pack( reference, frames, expected );
+
+  for( int f = 0; f < ARRAY_LEN( files ); ++f ) {
+    if( results[f].status != ESP_OK || results[f].frames != (uint64_t) frames ) {
+      printf( "E-SIM: '%s' processed %llu of %d frames\n", paths[f], (unsigned long long) results[f].frames, frames );
+      ++failures;
+      continue;
+    }
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      clipped += f == ARRAY_LEN( files ) - 1 && results[f].channels[channel_id].clipping > 0;
+    }
+    if( !files[f].exact ) {
+      continue;
+    }
+    batch_output_path( paths[f], "_dsp.wav", out_path, sizeof( out_path ) );
+    wav.file = fopen( out_path, "rb" );
+    if( wav.file == NULL || dsp_wav_read_header( &wav ) != ESP_OK || wav.data_bytes != (uint64_t) out_bytes ||
+        fread( actual, out_bytes, 1, wav.file ) != 1 || memcmp( actual, expected, out_bytes ) != 0 ) {
+      printf( "E-SIM: '%s' differs from dsp_filter() run directly\n", out_path );
+      ++failures;
+    }
+    if( wav.file != NULL ) {
+      fclose( wav.file );
+    }
+  }
+  if( clipped == 0 ) {
+    printf( "E-SIM: The square wave was not reported as clipping\n" );
+    ++failures;
+  }
+
+  printf( "I-SIM: %d files of %d s with %d workers in %.2f s (%.0fx real time); the exact formats match dsp_filter() run directly\n",
+    ARRAY_LEN( files ), BATCH_TEST_SECONDS, jobs, wall_seconds, ARRAY_LEN( files )*BATCH_TEST_SECONDS/wall_seconds );
+  printf( "I-SIM: %s\n", failures == 0 ? "PASSED" : "FAILED" );
+
+  free( signal[0] );
+  free( signal[1] );
+  free( reference );
+  free( expected );
+  free( actual );
+  munmap( results, sizeof( batch_result_t )*ARRAY_LEN( files ) );
+
+  return( failures == 0 ? 0 : 1 );
+}
+
+
+//------------------------------------------------------------------------------------
+// Main
+//------------------------------------------------------------------------------------
+
+int main( int argc, char* argv[] ) {
+
+  int               jobs = (int) sysconf( _SC_NPROCESSORS_ONLN );
+  bool              test = false;
+  char*             slot_list = NULL;
+  char*             end;
+  long              value;
+  char              test_dir[1024];
+  int               first = argc;
+  int               count;
+  batch_result_t*   results;
+  int64_t           start_us;
+  double            wall_seconds;
+  double            audio_seconds = 0;
+  int               failed = 0;
+  int               clipped = 0;
+  bool              clip;
+
+  for( int i = 1; i < argc && first == argc; ++i ) {
+    if( strcmp( argv[i], "-c" ) == 0 && i + 1 < argc ) {
+      batch_config_path = argv[++i];
+    } else if( strcmp( argv[i], "-o" ) == 0 && i + 1 < argc ) {
+      batch_out_dir = argv[++i];
+    } else if( strcmp( argv[i], "-j" ) == 0 && i + 1 < argc ) {
+      jobs = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-b" ) == 0 && i + 1 < argc ) {
+      batch_block_frames = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-m" ) == 0 && i + 1 < argc ) {
+      slot_list = argv[++i];
+    } else if( strcmp( argv[i], "-t" ) == 0 ) {
+      test = true;
+    } else if( argv[i][0] != '-' ) {
+      first = i;
+    } else {
+      first = 0;
+    }
+  }
+
+  for( int slot = 0; slot < DSP_NUM_CHANNELS; ++slot ) {
+    batch_slots[slot] = -1;
+  }
+  for( int slot = 0; slot_list != NULL && *slot_list != 0 && first > 0; ++slot ) {
+    value = strtol( slot_list, &end, 10 );
+    if( slot == DSP_NUM_CHANNELS || end == slot_list || value < 0 || ( *end != 0 && *end != ',' ) ) {
+      first = 0;
+    } else {
+      batch_slots[slot] = (int) value;
+    }
+    slot_list = *end == ',' ? end + 1 : end;
+  }
+
+  if( first == 0 || ( first == argc && !test ) || jobs < 1 || batch_block_frames < DSP_MIN_BLOCK_FRAMES || batch_block_frames > DSP_MAX_BLOCK_FRAMES ) {
+    fprintf( stderr, "Usage: %s [-c config.h] [-o dir] [-j jobs] [-b frames] [-m channel,...] file.wav ...\n"
+                     "       %s -t [-c config.h] [-o dir] [-j jobs] [-b frames] (self-test)\n", argv[0], argv[0] );
+    return( 1 );
+  }
+
+  if( batch_config_path != NULL ) {
+    if( batch_load_config( batch_config_path, batch_channels ) != ESP_OK ) {
+      return( 1 );
+    }
+  } else {
+    memcpy( batch_channels, DSP_Channels, sizeof( batch_channels ) );
+  }
+
+  if( test ) {
+    if( batch_out_dir == NULL ) {
+      end = strrchr( argv[0], '/' );
+      snprintf( test_dir, sizeof( test_dir ), "%.*s%s", end != NULL ? (int) ( end - argv[0] + 1 ) : 0, argv[0], BATCH_TEST_DIR );
+      batch_out_dir = test_dir;
+    }
+    return( batch_test( batch_out_dir, jobs ) );
+  }
+
+  count = argc - first;
+  results = (batch_result_t*) mmap( NULL, sizeof( batch_result_t )*count, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+  if( results == MAP_FAILED ) {
+    printf( "E-SIM: Out of memory\n" );
+    return( 1 );
+  }
+
+  start_us = dsp_os_time_us();
+  batch_run( &argv[first], count, jobs, results );
+  wall_seconds = ( dsp_os_time_us() - start_us )/1e6;
+
+  for( int f = 0; f < count; ++f ) {
+    clip = false;
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      clip |= results[f].channels[channel_id].clipping > 0;
+    }
+    failed += results[f].status != ESP_OK;
+    clipped += results[f].status == ESP_OK && clip;
+    audio_seconds += results[f].status == ESP_OK ? (double) results[f].frames/DSP_SAMPLE_RATE : 0;
+  }
+  printf( "I-SIM: %d files, %.2f h of audio in %.1f s with %d workers (%.0fx real time): %d clipped, %d failed\n", count,
+    audio_seconds/3600, wall_seconds, jobs, wall_seconds > 0 ? audio_seconds/wall_seconds : 0, clipped, failed );
+
+  return( failed > 0 ? 1 : clipped > 0 ? 2 : 0 );
+}
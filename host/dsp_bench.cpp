@@ -0,0 +1,2179 @@
+#include <time.h>
+#include <malloc.h>
+#include <unistd.h>
+#include "dsp_process.h"
+#include "dsp_os.h"
+#include "dsp_config.h"
+#include "dsp_sim.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC      1
+#else
+#define BENCH_HAVE_TSC      0
+#endif
+
+//------------------------------------------------------------------------------------
+// Host benchmark for the DSP pipeline
+//
+// Runs the real dsp_filter() (deinterleave, delay, biquad cascade, gain/clip) over a
+// synthetic stereo signal and reports the cost per sample for a range of filter counts,
+// buffer sizes and delay settings. The kernel section compares the biquad cascade
+// kernels directly on one channel and the mode section compares the processing modes.
+// The update section measures the cost of swapping in runtime parameter updates and
+// the delay section compares the delay line with the original per-sample version. The
+// width section compares the memory traffic of 16 and 32 bit samples, the engine
+// section the float and fixed-point filter engines and the limiter section the cost of
+// the output stage when the signal is driven into the limiter. The multirate section
+// runs the channels decimated against the full-rate path, the FIR section the
+// partitioned FFT convolution against a direct FIR, the mix section the input mix
+// matrix kernels and the preset section the cost of loading and switching presets.
+// The plot section checks the response plot against a double precision reference and
+// times it whole, from its caches and in the slices dsp_loop() prints it in. The log
+// section measures what logging an event costs the audio path against printing it and
+// the analyzer section checks the band levels of the real-time analyzer and its cost.
+//------------------------------------------------------------------------------------
+
+#define BENCH_SIGNAL_LEVEL    0.25                      // Peak level of the test signal relative to full scale
+#define BENCH_DEFAULT_SECONDS 2.0                       // Seconds of audio processed for each configuration
+
+static const int    bench_frames[]  = { 32, 64, 128, DSP_BLOCK_FRAMES };
+static const int    bench_delays[]  = { 0, 25, DSP_MAX_DELAY_MILLIS };
+
+typedef esp_err_t (*bench_kernel_t)( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters );
+
+static const struct {
+  const char*       name;
+  bench_kernel_t    kernel;
+  bool              df2;                                // Direct Form II (same arithmetic as the reference kernel)
+} bench_kernels[] = {
+  { "stagewise",    dsp_biquad_stagewise_f32,       true },
+  { "cascade",      dsp_biquad_cascade_f32_ansi,    true },
+  { "cascade_opt",  dsp_biquad_cascade_f32_opt,     true },
+  { "tdf2",         dsp_biquad_cascade_f32_tdf2,    false },
+  { "df1_ef",       dsp_biquad_cascade_f32_df1,     false },
+  { "tdf2_mixed",   dsp_biquad_cascade_f32_mixed,   false }
+};
+
+#define BENCH_KERNEL_OPT      2                         // Index of the fastest Direct Form II kernel
+
+#define ARRAY_LEN( a )        ( (int) ( sizeof( a )/sizeof( a[0] ) ) )
+
+static int          bench_decimation = 1;               // Decimation given to the channels (multirate section)
+static int          bench_fir_taps = 0;                 // FIR filter given to the channels (FIR section)
+static const float* bench_fir_coeffs = NULL;
+static const float  (*bench_mix)[DSP_NUM_CHANNELS] = NULL;   // Input mix matrix given to the channels (mix section), NULL for dsp_config.h
+
+
+//------------------------------------------------------------------------------------
+// Timing helpers
+//------------------------------------------------------------------------------------
+
+static inline uint64_t bench_nanos() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return( (uint64_t) ts.tv_sec*1000000000ull + ts.tv_nsec );
+}
+
+static inline uint64_t bench_cycles() {
+#if BENCH_HAVE_TSC
+  _mm_lfence();
+  return( __rdtsc() );
+#else
+  return( 0 );
+#endif
+}
+
+
+//------------------------------------------------------------------------------------
+// Capture what the DSP prints (stdout on the host) in a temporary file
+//------------------------------------------------------------------------------------
+
+static FILE* bench_capture_start( int* stdout_fd ) {
+
+  FILE*     sink = tmpfile();
+
+  fflush( stdout );
+  *stdout_fd = dup( STDOUT_FILENO );
+  dup2( fileno( sink ), STDOUT_FILENO );
+
+  return( sink );
+}
+
+// Restores stdout and returns the number of bytes captured; the file is left at its start
+static long bench_capture_end( FILE* sink, int stdout_fd ) {
+
+  long      bytes;
+
+  fflush( stdout );
+  bytes = ftell( sink );
+  dup2( stdout_fd, STDOUT_FILENO );
+  close( stdout_fd );
+  rewind( sink );
+
+  return( bytes );
+}
+
+
+//------------------------------------------------------------------------------------
+// Set up the channels for one benchmark configuration. The filters are taken from the
+// first channel in dsp_config.h, repeated as needed to reach the requested count.
+//------------------------------------------------------------------------------------
+
+static void bench_channels( dsp_channel_t* channels, int num_filters, float delay_millis ) {
+
+  const dsp_channel_t*  source = &DSP_Channels[0];
+
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    channels[channel_id] = DSP_Channels[channel_id];
+    channels[channel_id].gain_dB = 0;
+    channels[channel_id].delay_millis = delay_millis;
+    channels[channel_id].num_filters = num_filters;
+    channels[channel_id].decimation = bench_decimation;
+    channels[channel_id].fir_taps = bench_fir_taps;
+    channels[channel_id].fir_coeffs = bench_fir_coeffs;
+    if( bench_mix != NULL ) {
+      memcpy( channels[channel_id].mix, bench_mix[channel_id], sizeof( channels[channel_id].mix ) );
+    }
+    channels[channel_id].buffers = NULL;
+
+    for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+      memcpy( channels[channel_id].coeffs[filter_id], source->coeffs[filter_id % source->num_filters], sizeof( source->coeffs[0] ) );
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Run one configuration through dsp_filter(), optionally keeping the processed output.
+// With update_every > 0 an update is published (outside the timed region) to both
+// channels every update_every blocks: a gain change, or with update_coeffs a change to
+// the first filter of each channel.
+//------------------------------------------------------------------------------------
+
+typedef struct bench_result_t {
+  double      ns_per_sample;
+  double      cycles_per_sample;
+  double      min_block_us;
+  double      rt_load;                                  // Percentage of the real-time budget used
+  int         clipped_blocks;
+  int         updates;                                  // Number of updates swapped in
+  uint32_t    max_swap_latency;                         // Most blocks between publishing and swapping in an update
+  double      delay_cycles_per_block;                   // Cycles per block in the delay stage (0 with DSP_PROFILE=0)
+} bench_result_t;
+
+static esp_err_t bench_measure( const sample_t* signal, int signal_frames, int frames, float delay_millis, int num_filters,
+                                int update_every, bool update_coeffs, sample_t* output, bench_result_t* result ) {
+
+  dsp_channel_t   channels[DSP_NUM_CHANNELS];
+  sample_t        block[DSP_MAX_SAMPLES];
+  float           coeffs[DSP_NUM_CHANNELS][2][5];
+  bool            clip_flag;
+  int             blocks;
+  uint64_t        start_ns;
+  uint64_t        start_cycles;
+  uint64_t        total_ns = 0;
+  uint64_t        total_cycles = 0;
+  uint64_t        delay_cycles = 0;
+  uint64_t        block_ns;
+  uint64_t        min_block_ns = UINT64_MAX;
+  esp_err_t       res;
+  double          samples;
+
+  bench_channels( channels, num_filters, delay_millis );
+
+  res = dsp_filter_init( channels );
+  if( res != ESP_OK ) {
+    return( res );
+  }
+
+  // Coefficient updates alternate the first filter with a copy 0.2 dB down
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    for( int i = 0; i < 5; ++i ) {
+      coeffs[channel_id][0][i] = channels[channel_id].coeffs[0][i];
+      coeffs[channel_id][1][i] = channels[channel_id].coeffs[0][i]*( i < 3 ? 0.977 : 1.0 );
+    }
+  }
+
+  blocks = signal_frames/frames;
+  result->clipped_blocks = 0;
+  result->updates = 0;
+  result->max_swap_latency = 0;
+
+  for( int block_id = 0; block_id < blocks; ++block_id ) {
+    if( update_every > 0 && block_id % update_every == 0 ) {
+      for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+        if( update_coeffs ) {
+          dsp_filter_set_coeffs( channels, channel_id, 0, coeffs[channel_id][( block_id/update_every ) % 2] );
+        } else {
+          dsp_filter_set_gain( channels, channel_id, ( block_id/update_every ) % 2 ? -0.5 : 0.0 );
+        }
+      }
+    }
+
+    memcpy( block, &signal[block_id*frames*DSP_NUM_CHANNELS], frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+    dsp_profile_reset();
+
+    start_ns = bench_nanos();
+    start_cycles = bench_cycles();
+
+    res = dsp_filter( channels, block, frames*DSP_NUM_CHANNELS*sizeof( sample_t ), &clip_flag );
+
+    total_cycles += bench_cycles() - start_cycles;
+    block_ns = bench_nanos() - start_ns;
+    total_ns += block_ns;
+    delay_cycles += dsp_profile_stage_cycles( DSP_STAGE_DELAY );
+
+    if( block_ns < min_block_ns ) {
+      min_block_ns = block_ns;
+    }
+
+    if( res != ESP_OK ) {
+      dsp_filter_deinit( channels );
+      return( res );
+    }
+
+    if( clip_flag ) {
+      ++result->clipped_blocks;
+    }
+
+    if( channels[0].buffers->swap_latency > result->max_swap_latency ) {
+      result->max_swap_latency = channels[0].buffers->swap_latency;
+    }
+
+    if( output != NULL ) {
+      memcpy( &output[block_id*frames*DSP_NUM_CHANNELS], block, frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+    }
+  }
+
+  result->updates = channels[0].buffers->updates;
+
+  dsp_filter_deinit( channels );
+
+  samples = (double) blocks*frames*DSP_NUM_CHANNELS;
+
+  result->ns_per_sample = total_ns/samples;
+  result->cycles_per_sample = BENCH_HAVE_TSC ? total_cycles/samples : 0.0;
+  result->min_block_us = min_block_ns/1000.0;
+  result->rt_load = 100.0*total_ns/( blocks*1e9*frames/DSP_SAMPLE_RATE );
+  result->delay_cycles_per_block = BENCH_HAVE_TSC ? (double) delay_cycles/blocks : 0.0;
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Run one configuration and print a result line
+//------------------------------------------------------------------------------------
+
+static esp_err_t bench_run( const sample_t* signal, int signal_frames, int frames, int delay_millis, int num_filters ) {
+
+  bench_result_t  result;
+  esp_err_t       res;
+
+  res = bench_measure( signal, signal_frames, frames, delay_millis, num_filters, 0, false, NULL, &result );
+  if( res != ESP_OK ) {
+    return( res );
+  }
+
+  printf( "%6d %8d %7d %11.2f %13.2f %12.2f %11.2f %9.3f %7d\n",
+    frames, delay_millis, num_filters,
+    result.ns_per_sample,
+    result.cycles_per_sample,
+    1e3/result.ns_per_sample,
+    result.min_block_us,
+    result.rt_load,
+    result.clipped_blocks );
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Pipeline section: every frame size, delay and filter count through dsp_filter()
+//------------------------------------------------------------------------------------
+
+static esp_err_t bench_pipeline( const sample_t* signal, int signal_frames, double seconds ) {
+
+  printf( "DSP pipeline benchmark: %d channels, %d Hz, %.1f s of audio per configuration, kernel %d, mode %d, topology %d, engine %d%s\n",
+    DSP_NUM_CHANNELS, DSP_SAMPLE_RATE, seconds, DSP_BIQUAD_KERNEL, DSP_FILTER_MODE, DSP_BIQUAD_TOPOLOGY, DSP_FILTER_ENGINE,
+    BENCH_HAVE_TSC ? "" : " (no cycle counter)" );
+  printf( "%6s %8s %7s %11s %13s %12s %11s %9s %7s\n",
+    "frames", "delay_ms", "filters", "ns/sample", "cycles/sample", "Msamples/s", "min_blk_us", "rt_load%", "clipped" );
+
+  for( int f = 0; f < ARRAY_LEN( bench_frames ); ++f ) {
+    for( int d = 0; d < ARRAY_LEN( bench_delays ); ++d ) {
+      for( int num_filters = 0; num_filters <= DSP_MAX_FILTERS; ++num_filters ) {
+        if( bench_run( signal, signal_frames, bench_frames[f], bench_delays[d], num_filters ) != ESP_OK ) {
+          fprintf( stderr, "Benchmark failed for %d frames, %d ms delay, %d filters\n", bench_frames[f], bench_delays[d], num_filters );
+          return( ESP_FAIL );
+        }
+      }
+    }
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Kernel section: the biquad cascade kernels on a single channel block by block. The
+// output of each Direct Form II kernel is compared with the stagewise (reference)
+// kernel; the other topologies round differently (see dsp_noise for their accuracy).
+//------------------------------------------------------------------------------------
+
+static esp_err_t bench_kernel_section( const sample_t* signal, int signal_frames, double seconds ) {
+
+  const int       frames = DSP_BLOCK_FRAMES;
+  const int       nkernels = ARRAY_LEN( bench_kernels );
+  dsp_channel_t   channels[DSP_NUM_CHANNELS];
+  float           w[DSP_MAX_FILTERS][DSP_BIQUAD_STATE_LEN];
+  float*          input;
+  float*          output[ARRAY_LEN( bench_kernels )];
+  float           block[DSP_MAX_SAMPLES];
+  double          ns_per_sample[ARRAY_LEN( bench_kernels )];
+  double          max_diff;
+  int             blocks = signal_frames/frames;
+  uint64_t        start_ns;
+  uint64_t        total_ns;
+  esp_err_t       res = ESP_OK;
+
+  input = (float*) malloc( blocks*frames*sizeof( float ) );
+  for( int k = 0; k < nkernels; ++k ) {
+    output[k] = (float*) malloc( blocks*frames*sizeof( float ) );
+  }
+
+  for( int i = 0; i < blocks*frames; ++i ) {
+    input[i] = signal[i*DSP_NUM_CHANNELS];
+  }
+
+  printf( "\nBiquad kernel benchmark: %d frames per block, %.1f s of audio per configuration\n", frames, seconds );
+  printf( "%7s", "filters" );
+  for( int k = 0; k < nkernels; ++k ) {
+    printf( " %14s", bench_kernels[k].name );
+  }
+  printf( " %9s %12s\n", "speedup", "max_diff" );
+
+  for( int num_filters = 1; num_filters <= DSP_MAX_FILTERS && res == ESP_OK; ++num_filters ) {
+    bench_channels( channels, num_filters, 0 );
+
+    for( int k = 0; k < nkernels && res == ESP_OK; ++k ) {
+      memset( w, 0, sizeof( w ) );
+      total_ns = 0;
+
+      for( int block_id = 0; block_id < blocks; ++block_id ) {
+        memcpy( block, &input[block_id*frames], frames*sizeof( float ) );
+
+        start_ns = bench_nanos();
+        res = bench_kernels[k].kernel( block, frames, channels[0].coeffs, w, num_filters );
+        total_ns += bench_nanos() - start_ns;
+
+        if( res != ESP_OK ) {
+          break;
+        }
+
+        memcpy( &output[k][block_id*frames], block, frames*sizeof( float ) );
+      }
+
+      ns_per_sample[k] = (double) total_ns/( blocks*frames );
+    }
+
+    max_diff = 0;
+    for( int k = 1; k < nkernels; ++k ) {
+      for( int i = 0; i < blocks*frames && bench_kernels[k].df2; ++i ) {
+        max_diff = fmax( max_diff, fabs( output[k][i] - output[0][i] ) );
+      }
+    }
+
+    printf( "%7d", num_filters );
+    for( int k = 0; k < nkernels; ++k ) {
+      printf( " %11.2f ns", ns_per_sample[k] );
+    }
+    printf( " %8.2fx %12.3e\n", ns_per_sample[0]/ns_per_sample[BENCH_KERNEL_OPT], max_diff );
+  }
+
+  free( input );
+  for( int k = 0; k < nkernels; ++k ) {
+    free( output[k] );
+  }
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Mode section: the per-channel path against the stereo lockstep modes. The output of
+// each mode is compared with the per-channel path.
+//------------------------------------------------------------------------------------
+
+static esp_err_t bench_mode_section( const sample_t* signal, int signal_frames, double seconds ) {
+
+  static const struct {
+    const char*   name;
+    int           mode;
+  } modes[] = {
+    { "channel",        DSP_MODE_CHANNEL },
+    { "stereo",         DSP_MODE_STEREO },
+    { "stereo_simd",    DSP_MODE_STEREO_SIMD }
+  };
+
+  const int       frames = DSP_BLOCK_FRAMES;
+  const int       nmodes = ARRAY_LEN( modes );
+  const int       length = ( signal_frames/frames )*frames*DSP_NUM_CHANNELS;
+  sample_t*       output[ARRAY_LEN( modes )];
+  bench_result_t  result[ARRAY_LEN( modes )];
+  int             max_diff;
+  esp_err_t       res = ESP_OK;
+
+  if( dsp_filter_set_mode( DSP_MODE_STEREO ) != ESP_OK ) {
+    printf( "\nStereo lockstep modes need exactly 2 channels - mode benchmark skipped\n" );
+    dsp_filter_set_mode( DSP_FILTER_MODE );
+    return( ESP_OK );
+  }
+
+  for( int m = 0; m < nmodes; ++m ) {
+    output[m] = (sample_t*) malloc( length*sizeof( sample_t ) );
+  }
+
+  printf( "\nProcessing mode benchmark: %d frames per block, %.1f s of audio per configuration (ns/sample)\n", frames, seconds );
+  printf( "%8s %7s", "delay_ms", "filters" );
+  for( int m = 0; m < nmodes; ++m ) {
+    printf( " %12s", modes[m].name );
+  }
+  printf( " %9s %9s\n", "speedup", "max_diff" );
+
+  for( int d = 0; d < 2 && res == ESP_OK; ++d ) {
+    for( int num_filters = 0; num_filters <= DSP_MAX_FILTERS && res == ESP_OK; ++num_filters ) {
+      for( int m = 0; m < nmodes && res == ESP_OK; ++m ) {
+        dsp_filter_set_mode( modes[m].mode );
+        res = bench_measure( signal, signal_frames, frames, bench_delays[d], num_filters, 0, false, output[m], &result[m] );
+      }
+
+      if( res != ESP_OK ) {
+        break;
+      }
+
+      max_diff = 0;
+      for( int m = 1; m < nmodes; ++m ) {
+        for( int i = 0; i < length; ++i ) {
+          max_diff = max_diff > abs( output[m][i] - output[0][i] ) ? max_diff : abs( output[m][i] - output[0][i] );
+        }
+      }
+
+      printf( "%8d %7d", bench_delays[d], num_filters );
+      for( int m = 0; m < nmodes; ++m ) {
+        printf( " %12.2f", result[m].ns_per_sample );
+      }
+      printf( " %8.2fx %9d\n", result[0].ns_per_sample/result[nmodes - 1].ns_per_sample, max_diff );
+    }
+  }
+
+  dsp_filter_set_mode( DSP_FILTER_MODE );
+
+  for( int m = 0; m < nmodes; ++m ) {
+    free( output[m] );
+  }
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Update section: dsp_filter() with no updates against gain and filter updates published
+// every few blocks, swapped instantly or crossfaded. With no updates the cost and output
+// must match whatever the crossfade setting.
+//------------------------------------------------------------------------------------
+
+static esp_err_t bench_update_section( const sample_t* signal, int signal_frames, double seconds ) {
+
+  static const int  update_every[] = { 0, 16, 4, 1 };
+  static const int  xfade_blocks[] = { 0, 8 };
+
+  const int       frames = DSP_BLOCK_FRAMES;
+  const int       num_filters = DSP_Channels[0].num_filters;
+  const int       length = ( signal_frames/frames )*frames*DSP_NUM_CHANNELS;
+  sample_t*       output[2];
+  bench_result_t  result;
+  bench_result_t  baseline = { 0 };
+  int             max_diff;
+  esp_err_t       res = ESP_OK;
+
+  output[0] = (sample_t*) malloc( length*sizeof( sample_t ) );
+  output[1] = (sample_t*) malloc( length*sizeof( sample_t ) );
+
+  printf( "\nParameter update benchmark: %d frames per block, %d filters, %.1f s of audio per configuration\n", frames, num_filters, seconds );
+  printf( "%6s %7s %12s %11s %9s %8s %16s %9s\n", "xfade", "update", "update_every", "ns/sample", "overhead", "updates", "max_latency_blks", "max_diff" );
+
+  for( int x = 0; x < ARRAY_LEN( xfade_blocks ) && res == ESP_OK; ++x ) {
+    dsp_filter_set_transition( xfade_blocks[x] );
+
+    for( int kind = 0; kind < 2 && res == ESP_OK; ++kind ) {
+      for( int u = 0; u < ARRAY_LEN( update_every ) && res == ESP_OK; ++u ) {
+        if( update_every[u] == 0 && kind > 0 ) {
+          continue;
+        }
+
+        res = bench_measure( signal, signal_frames, frames, 0, num_filters, update_every[u], kind > 0,
+                             update_every[u] == 0 ? output[x > 0] : NULL, &result );
+        if( res != ESP_OK ) {
+          break;
+        }
+
+        if( x == 0 && u == 0 ) {
+          baseline = result;
+        }
+
+        printf( "%6d %7s %12d %11.2f %8.2f%% %8d %16u", xfade_blocks[x], update_every[u] == 0 ? "-" : kind > 0 ? "coeffs" : "gain",
+          update_every[u], result.ns_per_sample, 100.0*( result.ns_per_sample - baseline.ns_per_sample )/baseline.ns_per_sample,
+          result.updates, result.max_swap_latency );
+
+        // Steady state (no updates) output is compared with the instant swap run
+        if( update_every[u] == 0 && x > 0 ) {
+          max_diff = 0;
+          for( int i = 0; i < length; ++i ) {
+            max_diff = max_diff > abs( output[1][i] - output[0][i] ) ? max_diff : abs( output[1][i] - output[0][i] );
+          }
+          printf( " %9d\n", max_diff );
+        } else {
+          printf( " %9s\n", "-" );
+        }
+      }
+    }
+  }
+
+  dsp_filter_set_transition( DSP_XFADE_BLOCKS );
+
+  free( output[0] );
+  free( output[1] );
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Delay section: dsp_filter() with no filters (delay, gain and clip only) in the
+// per-channel mode against the original implementation, which had a fixed delay buffer
+// of DSP_MAX_DELAY_SAMPLES per channel and checked for wrap-around on every sample.
+// Each configuration is run BENCH_DELAY_RUNS times and the fastest run kept. Only the
+// delay stage is timed: the DSP_STAGE_DELAY mark of dsp_filter(), which copies each
+// channel out of the I2S buffer through its delay line, against the same loop of the
+// original. The output stages differ (the limiter), so whole blocks would not compare
+// the delay lines. With DSP_PROFILE=0 there is no stage timing and whole blocks are.
+//------------------------------------------------------------------------------------
+
+#define BENCH_DELAY_RUNS      5                         // Runs of each configuration, the fastest kept
+
+static esp_err_t bench_delay_reference( const sample_t* signal, int signal_frames, int frames, float delay_millis,
+                                        sample_t* output, double* cycles_per_block ) {
+
+  static sample_t   delay_buff[DSP_NUM_CHANNELS][DSP_MAX_DELAY_SAMPLES];
+  static float      buffer[DSP_MAX_SAMPLES];
+  sample_t          block[DSP_MAX_SAMPLES];
+  int               delay_samples = DSP_SAMPLE_RATE*delay_millis/1000;
+  int               delay_offset[DSP_NUM_CHANNELS] = { 0 };
+  int               blocks = signal_frames/frames;
+  volatile float    gain = 1.0;                         // Not a constant, as in dsp_filter()
+  float             scaling_factor;
+  float             sample_value;
+  float             prev_value;
+  uint64_t          start_cycles;
+  uint64_t          delay_start_cycles;
+  uint64_t          total_cycles = 0;
+  uint64_t          delay_cycles = 0;
+
+  memset( delay_buff, 0, sizeof( delay_buff ) );
+
+  for( int block_id = 0; block_id < blocks; ++block_id ) {
+    memcpy( block, &signal[block_id*frames*DSP_NUM_CHANNELS], frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+
+    start_cycles = bench_cycles();
+
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      scaling_factor = gain;
+
+      delay_start_cycles = bench_cycles();
+      if( delay_samples > 0 ) {
+        for( int i = 0; i < frames; ++i ) {
+          buffer[i] = delay_buff[channel_id][delay_offset[channel_id]];
+          delay_buff[channel_id][delay_offset[channel_id]] = block[i*DSP_NUM_CHANNELS + channel_id];
+
+          ++ delay_offset[channel_id];
+          if( delay_offset[channel_id] == delay_samples ) {
+            delay_offset[channel_id] = 0;
+          }
+        }
+      } else {
+        for( int i = 0; i < frames; ++i ) {
+          buffer[i] = block[i*DSP_NUM_CHANNELS + channel_id];
+        }
+      }
+      delay_cycles += bench_cycles() - delay_start_cycles;
+
+      prev_value = 0;
+      for( int i = 0; i < frames; ++i ) {
+        sample_value = buffer[i]*scaling_factor;
+        if( sample_value < -DSP_MAX_SAMPLE_VALUE || sample_value > DSP_MAX_SAMPLE_VALUE ) {
+          sample_value = ( ( DSP_MAX_SAMPLE_VALUE*( sample_value < 0 ? -1 : 1 ) ) + prev_value)/2;
+        }
+        block[i*DSP_NUM_CHANNELS + channel_id] = sample_value;
+        prev_value = sample_value;
+      }
+    }
+
+    total_cycles += bench_cycles() - start_cycles;
+
+    memcpy( &output[block_id*frames*DSP_NUM_CHANNELS], block, frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+  }
+
+  *cycles_per_block = (double) ( DSP_PROFILE ? delay_cycles : total_cycles )/blocks;
+
+  return( ESP_OK );
+}
+
+static esp_err_t bench_delay_section( const sample_t* signal, int signal_frames, double seconds ) {
+
+  static const float  delays[] = { 0, 1, 10, 20, 25, DSP_MAX_DELAY_MILLIS };
+
+  const int       frames = DSP_BLOCK_FRAMES;
+  const int       length = ( signal_frames/frames )*frames*DSP_NUM_CHANNELS;
+  const int       fixed_bytes = DSP_MAX_DELAY_SAMPLES*sizeof( sample_t );
+  sample_t*       output[2];
+  bench_result_t  result;
+  double          reference_cycles;
+  double          cycles;
+  double          run_cycles;
+  int             bytes;
+  int             max_diff;
+  esp_err_t       res = ESP_OK;
+
+  output[0] = (sample_t*) malloc( length*sizeof( sample_t ) );
+  output[1] = (sample_t*) malloc( length*sizeof( sample_t ) );
+
+  printf( "\nDelay line benchmark: %d frames per block, no filters, per-channel mode, %.1f s of audio per configuration, %s%s\n",
+    frames, seconds, DSP_PROFILE ? "delay stage timed" : "whole blocks timed (DSP_PROFILE = 0)", BENCH_HAVE_TSC ? "" : " (no cycle counter)" );
+  printf( "%8s %13s %12s %12s %17s %16s %8s %9s\n", "delay_ms", "bytes/channel", "before_bytes", "saved_bytes",
+    "before_cycles/blk", "after_cycles/blk", "speedup", "max_diff" );
+
+  dsp_filter_set_mode( DSP_MODE_CHANNEL );
+
+  for( int d = 0; d < ARRAY_LEN( delays ) && res == ESP_OK; ++d ) {
+    reference_cycles = 0;
+    cycles = 0;
+    for( int run = 0; run < BENCH_DELAY_RUNS && res == ESP_OK; ++run ) {
+      res = bench_delay_reference( signal, signal_frames, frames, delays[d], output[0], &run_cycles );
+      reference_cycles = run == 0 || run_cycles < reference_cycles ? run_cycles : reference_cycles;
+      if( res == ESP_OK ) {
+        res = bench_measure( signal, signal_frames, frames, delays[d], 0, 0, false, output[1], &result );
+        run_cycles = DSP_PROFILE ? result.delay_cycles_per_block : result.cycles_per_sample*frames*DSP_NUM_CHANNELS;
+        cycles = run == 0 || run_cycles < cycles ? run_cycles : cycles;
+      }
+    }
+    if( res != ESP_OK ) {
+      break;
+    }
+
+    bytes = (int) ( DSP_SAMPLE_RATE*delays[d]/1000 )*sizeof( sample_t );
+
+    // The original version truncated the delay to whole samples, so fractional delays differ by the interpolation
+    max_diff = 0;
+    for( int i = 0; i < length; ++i ) {
+      max_diff = max_diff > abs( output[1][i] - output[0][i] ) ? max_diff : abs( output[1][i] - output[0][i] );
+    }
+
+    printf( "%8.2f %13d %12d %12d %17.0f %16.0f %7.2fx %9d%s\n", delays[d], bytes, fixed_bytes, fixed_bytes - bytes,
+      reference_cycles, cycles, cycles > 0 ? reference_cycles/cycles : 0.0, max_diff,
+      delays[d]*DSP_SAMPLE_RATE/1000 != floor( delays[d]*DSP_SAMPLE_RATE/1000 ) ? " (fractional)" : "" );
+  }
+
+  dsp_filter_set_mode( DSP_FILTER_MODE );
+
+  free( output[0] );
+  free( output[1] );
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Width section: the sample width dependent work of a block at 16 and 32 bits - the
+// conversion between the interleaved I2S buffer and float, and the exchange with a
+// delay buffer - regardless of the width the DSP core was built with (BITS=...).
+//------------------------------------------------------------------------------------
+
+template<typename T>
+static void bench_width_block( T* buffer, float* work, T* delay_buff, int delay_samples, int* delay_offset, int frames ) {
+
+  T       sample;
+  int     len;
+
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    T*    lane = &buffer[channel_id];
+
+    // Delay exchange in at most two runs, as in dsp_filter
+    len = delay_samples - *delay_offset < frames ? delay_samples - *delay_offset : frames;
+    for( int i = 0; i < len; ++i ) {
+      sample = delay_buff[*delay_offset + i];
+      delay_buff[*delay_offset + i] = lane[i*DSP_NUM_CHANNELS];
+      lane[i*DSP_NUM_CHANNELS] = sample;
+    }
+    for( int i = len; i < frames; ++i ) {
+      sample = delay_buff[i - len];
+      delay_buff[i - len] = lane[i*DSP_NUM_CHANNELS];
+      lane[i*DSP_NUM_CHANNELS] = sample;
+    }
+
+    // To float and back
+    for( int i = 0; i < frames; ++i ) {
+      work[i] = lane[i*DSP_NUM_CHANNELS];
+    }
+    for( int i = 0; i < frames; ++i ) {
+      lane[i*DSP_NUM_CHANNELS] = (T) ( work[i]*0.5f );
+    }
+
+    delay_buff += delay_samples;
+  }
+
+  *delay_offset = ( *delay_offset + frames ) % delay_samples;
+}
+
+template<typename T>
+static double bench_width_measure( int frames, int delay_samples, int blocks, int* bytes_per_block ) {
+
+  T*        buffer = (T*) calloc( frames*DSP_NUM_CHANNELS, sizeof( T ) );
+  T*        delay_buff = (T*) calloc( delay_samples*DSP_NUM_CHANNELS, sizeof( T ) );
+  float     work[DSP_MAX_SAMPLES];
+  int       delay_offset = 0;
+  uint64_t  start_ns;
+
+  for( int i = 0; i < frames*DSP_NUM_CHANNELS; ++i ) {
+    buffer[i] = (T) ( i*7919 );
+  }
+
+  start_ns = bench_nanos();
+  for( int block_id = 0; block_id < blocks; ++block_id ) {
+    bench_width_block<T>( buffer, work, delay_buff, delay_samples, &delay_offset, frames );
+  }
+  start_ns = bench_nanos() - start_ns;
+
+  free( buffer );
+  free( delay_buff );
+
+  // The I2S buffer and the delayed samples are each read and written once
+  *bytes_per_block = 2*( frames + frames )*DSP_NUM_CHANNELS*sizeof( T );
+
+  return( (double) start_ns/blocks );
+}
+
+static esp_err_t bench_width_section( const sample_t* signal, int signal_frames, double seconds ) {
+
+  static const float  delays[] = { 5.8, 25, DSP_MAX_DELAY_MILLIS };
+
+  const int   frames = DSP_BLOCK_FRAMES;
+  const int   blocks = 20*( (int) ( seconds*DSP_SAMPLE_RATE/frames ) + 1 );      // Short blocks, so repeat for stable timings
+  int         delay_samples;
+  int         bytes16;
+  int         bytes32;
+  double      ns16;
+  double      ns32;
+
+  printf( "\nSample width benchmark: %d frames per block, conversion and delay exchange only, %.1f s of audio per configuration (built for %d bit)\n",
+    frames, seconds, DSP_SAMPLE_BITS );
+  printf( "%8s %13s %13s %11s %11s %9s\n", "delay_ms", "delay_bytes16", "delay_bytes32", "ns/blk_16", "ns/blk_32", "ratio" );
+
+  for( int d = 0; d < ARRAY_LEN( delays ); ++d ) {
+    delay_samples = (int) ( DSP_SAMPLE_RATE*delays[d]/1000 );
+    if( delay_samples < frames ) {
+      delay_samples = frames;
+    }
+
+    bench_width_measure<int16_t>( frames, delay_samples, blocks/10, &bytes16 );
+    ns16 = bench_width_measure<int16_t>( frames, delay_samples, blocks, &bytes16 );
+    ns32 = bench_width_measure<int32_t>( frames, delay_samples, blocks, &bytes32 );
+
+    printf( "%8.1f %13d %13d %11.0f %11.0f %8.2fx\n", delays[d],
+      (int) ( delay_samples*DSP_NUM_CHANNELS*sizeof( int16_t ) ), (int) ( delay_samples*DSP_NUM_CHANNELS*sizeof( int32_t ) ),
+      ns16, ns32, ns32/ns16 );
+  }
+
+  printf( "Per block the I2S buffer grows from %d to %d bytes; at %d Hz that is %.2f vs %.2f MB/s of buffer and delay traffic\n",
+    frames*DSP_NUM_CHANNELS*(int) sizeof( int16_t ), frames*DSP_NUM_CHANNELS*(int) sizeof( int32_t ), DSP_SAMPLE_RATE,
+    (double) bytes16*DSP_SAMPLE_RATE/frames/1e6, (double) bytes32*DSP_SAMPLE_RATE/frames/1e6 );
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Engine section: the float and fixed-point filter engines on a single channel, each
+// from the integer input block to the integer output block (no gain). Both outputs are
+// compared with a double precision Direct Form I reference for the noise floor, given
+// in dB relative to full scale; the rounding of an exact result to the output word
+// alone would give the floor on the last line.
+//------------------------------------------------------------------------------------
+
+static void bench_engine_reference( const sample_t* input, double* output, int len, float coeffs[][5], int num_filters ) {
+
+  double    w[DSP_MAX_FILTERS][4] = { { 0 } };
+  double    x;
+  double    y;
+
+  for( int i = 0; i < len; ++i ) {
+    x = input[i];
+
+    for( int s = 0; s < num_filters; ++s ) {
+      y = coeffs[s][0]*x + coeffs[s][1]*w[s][0] + coeffs[s][2]*w[s][1] - coeffs[s][3]*w[s][2] - coeffs[s][4]*w[s][3];
+      w[s][1] = w[s][0];
+      w[s][0] = x;
+      w[s][3] = w[s][2];
+      w[s][2] = y;
+      x = y;
+    }
+
+    output[i] = x;
+  }
+}
+
+static double bench_engine_noise( const sample_t* output, const double* reference, int len, double* max_error ) {
+
+  double    sum = 0;
+  double    error;
+
+  *max_error = 0;
+  for( int i = 0; i < len; ++i ) {
+    error = output[i] - reference[i];
+    sum += error*error;
+    *max_error = fmax( *max_error, fabs( error ) );
+  }
+
+  return( 10*log10( sum/len + 1e-30 ) - 20*log10( (double) DSP_MAX_SAMPLE_VALUE ) );
+}
+
+static esp_err_t bench_engine_section( const sample_t* signal, int signal_frames, double seconds ) {
+
+  const int         frames = DSP_BLOCK_FRAMES;
+  const int         blocks = signal_frames/frames;
+  const int         length = blocks*frames;
+  dsp_channel_t     channels[DSP_NUM_CHANNELS];
+  dsp_biquad_q31_t  coeffs_q31[DSP_MAX_FILTERS];
+  float             w[DSP_MAX_FILTERS][DSP_BIQUAD_STATE_LEN];
+  int32_t           state[DSP_MAX_FILTERS][6];
+  float             block[DSP_MAX_SAMPLES];
+  int32_t           block_q31[DSP_MAX_SAMPLES];
+  sample_t*         input;
+  sample_t*         output[2];
+  double*           reference;
+  uint64_t          start_ns;
+  uint64_t          start_cycles;
+  uint64_t          total_ns[2];
+  uint64_t          total_cycles[2];
+  double            noise[2];
+  double            max_error[2];
+  esp_err_t         res = ESP_OK;
+
+  input = (sample_t*) malloc( length*sizeof( sample_t ) );
+  output[0] = (sample_t*) malloc( length*sizeof( sample_t ) );
+  output[1] = (sample_t*) malloc( length*sizeof( sample_t ) );
+  reference = (double*) malloc( length*sizeof( double ) );
+
+  for( int i = 0; i < length; ++i ) {
+    input[i] = signal[i*DSP_NUM_CHANNELS];
+  }
+
+  printf( "\nFilter engine benchmark: %d frames per block, %d bit samples, %.1f s of audio per configuration (built with the %s engine)%s\n",
+    frames, DSP_SAMPLE_BITS, seconds, DSP_FILTER_ENGINE == DSP_ENGINE_FIXED ? "fixed-point" : "float", BENCH_HAVE_TSC ? "" : " (no cycle counter)" );
+  printf( "%7s %12s %12s %12s %12s %14s %14s %13s %13s\n", "filters", "float_ns", "float_cycles", "fixed_ns", "fixed_cycles",
+    "float_noise_dB", "fixed_noise_dB", "float_max_err", "fixed_max_err" );
+
+  for( int num_filters = 1; num_filters <= DSP_MAX_FILTERS && res == ESP_OK; ++num_filters ) {
+    bench_channels( channels, num_filters, 0 );
+    bench_engine_reference( input, reference, length, channels[0].coeffs, num_filters );
+    dsp_biquad_q31_quantize( channels[0].coeffs, num_filters, coeffs_q31 );
+
+    memset( w, 0, sizeof( w ) );
+    memset( state, 0, sizeof( state ) );
+    memset( total_ns, 0, sizeof( total_ns ) );
+    memset( total_cycles, 0, sizeof( total_cycles ) );
+
+    for( int block_id = 0; block_id < blocks && res == ESP_OK; ++block_id ) {
+      const sample_t*   in = &input[block_id*frames];
+      sample_t*         out = &output[0][block_id*frames];
+
+      // Float: convert, filter, truncate back as dsp_filter does
+      start_ns = bench_nanos();
+      start_cycles = bench_cycles();
+      for( int i = 0; i < frames; ++i ) {
+        block[i] = in[i];
+      }
+      res = dsp_biquad_cascade_f32( block, frames, channels[0].coeffs, w, num_filters );
+      for( int i = 0; i < frames; ++i ) {
+        out[i] = block[i];
+      }
+      total_cycles[0] += bench_cycles() - start_cycles;
+      total_ns[0] += bench_nanos() - start_ns;
+
+      // Fixed point: shift in, filter, round back
+      out = &output[1][block_id*frames];
+      start_ns = bench_nanos();
+      start_cycles = bench_cycles();
+      for( int i = 0; i < frames; ++i ) {
+        block_q31[i] = DSP_Q31_FROM_SAMPLE( in[i] );
+      }
+      if( res == ESP_OK ) {
+        res = dsp_biquad_cascade_q31( block_q31, frames, coeffs_q31, state, num_filters );
+      }
+      for( int i = 0; i < frames; ++i ) {
+        out[i] = DSP_Q31_TO_SAMPLE( block_q31[i] );
+      }
+      total_cycles[1] += bench_cycles() - start_cycles;
+      total_ns[1] += bench_nanos() - start_ns;
+    }
+
+    if( res != ESP_OK ) {
+      break;
+    }
+
+    for( int e = 0; e < 2; ++e ) {
+      noise[e] = bench_engine_noise( output[e], reference, length, &max_error[e] );
+    }
+
+    printf( "%7d %12.2f %12.2f %12.2f %12.2f %14.1f %14.1f %13.0f %13.0f\n", num_filters,
+      (double) total_ns[0]/length, BENCH_HAVE_TSC ? (double) total_cycles[0]/length : 0.0,
+      (double) total_ns[1]/length, BENCH_HAVE_TSC ? (double) total_cycles[1]/length : 0.0,
+      noise[0], noise[1], max_error[0], max_error[1] );
+  }
+
+  printf( "Rounding to the %d bit output word alone: %.1f dB\n", DSP_SAMPLE_BITS == 32 ? 24 : 16,
+    20*log10( ( DSP_SAMPLE_BITS == 32 ? 256 : 1 )/sqrt( 12.0 )/DSP_MAX_SAMPLE_VALUE ) );
+
+  free( input );
+  free( output[0] );
+  free( output[1] );
+  free( reference );
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Limiter section: the output stage with the test signal driven up to and past full
+// scale. The clamp column is the original per-sample clip handling (without the serial
+// output it also did for every clipped sample) and the knee column dsp_output_f32 with
+// a fixed gain, both on one float channel. The dsp_filter columns run the whole block
+// with no filters, so the limiter gain ramp is included; over_fs is the share of
+// samples that would have clipped and limited the share bent by the soft knee.
+//------------------------------------------------------------------------------------
+
+static double bench_limiter_clamp( const float* input, int len, int frames, float gain, sample_t* output ) {
+
+  volatile float    scaling = gain;                     // Not a constant, as in dsp_filter()
+  float             scaling_factor = scaling;
+  float             sample_value;
+  float             prev_value;
+  uint64_t          start_ns = bench_nanos();
+
+  for( int start = 0; start + frames <= len; start += frames ) {
+    prev_value = 0;
+    for( int i = start; i < start + frames; ++i ) {
+      sample_value = input[i]*scaling_factor;
+      if( sample_value < -DSP_MAX_SAMPLE_VALUE || sample_value > DSP_MAX_SAMPLE_VALUE ) {
+        sample_value = ( ( DSP_MAX_SAMPLE_VALUE*( sample_value < 0 ? -1 : 1 ) ) + prev_value)/2;
+      }
+      output[i] = sample_value;
+      prev_value = sample_value;
+    }
+  }
+
+  return( (double) ( bench_nanos() - start_ns )/len );
+}
+
+static double bench_limiter_knee( const float* input, int len, int frames, float gain, sample_t* output ) {
+
+  dsp_clip_t        clip = { 0, 0, 0 };
+  uint64_t          start_ns = bench_nanos();
+
+  for( int start = 0; start + frames <= len; start += frames ) {
+    dsp_output_f32( &input[start], frames, &output[start], 1, gain, 0.0f, &clip );
+  }
+
+  return( (double) ( bench_nanos() - start_ns )/len );
+}
+
+static esp_err_t bench_limiter_section( const sample_t* signal, int signal_frames, double seconds ) {
+
+  static const float  gains[] = { 0, 6, 9, 12, 15, 18, 24 };
+
+  const int       frames = DSP_BLOCK_FRAMES;
+  const int       blocks = signal_frames/frames;
+  const int       len = blocks*frames;
+  dsp_channel_t   channels[DSP_NUM_CHANNELS];
+  sample_t        block[DSP_MAX_SAMPLES];
+  float*          input;
+  sample_t*       output;
+  bool            clip_flag;
+  double          clamp_ns;
+  double          knee_ns;
+  uint64_t        start_ns;
+  uint64_t        total_ns;
+  int             peak;
+  int             clipping_count;
+  int             limit_count;
+  esp_err_t       res = ESP_OK;
+
+  input = (float*) malloc( len*sizeof( float ) );
+  output = (sample_t*) malloc( len*sizeof( sample_t ) );
+
+  for( int i = 0; i < len; ++i ) {
+    input[i] = signal[i*DSP_NUM_CHANNELS];
+  }
+
+  printf( "\nLimiter benchmark: %d frames per block, signal peak %.2f of full scale, knee %.2f, %.1f s of audio per configuration\n",
+    frames, BENCH_SIGNAL_LEVEL, DSP_LIMITER_KNEE, seconds );
+  printf( "%7s %9s %9s %12s %11s %13s %10s %11s\n", "gain_dB", "over_fs%", "limited%", "clamp_ns/smp", "knee_ns/smp",
+    "filter_ns/smp", "peak_out", "limiter_dB" );
+
+  for( int g = 0; g < ARRAY_LEN( gains ) && res == ESP_OK; ++g ) {
+    // The output stage alone, warmed up once
+    bench_limiter_clamp( input, len, frames, powf( 10, gains[g]/20 ), output );
+    clamp_ns = bench_limiter_clamp( input, len, frames, powf( 10, gains[g]/20 ), output );
+    knee_ns = bench_limiter_knee( input, len, frames, powf( 10, gains[g]/20 ), output );
+
+    // The whole block through dsp_filter(), with the limiter gain ramp
+    bench_channels( channels, 0, 0 );
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      channels[channel_id].gain_dB = gains[g];
+    }
+
+    res = dsp_filter_init( channels );
+    if( res != ESP_OK ) {
+      break;
+    }
+
+    total_ns = 0;
+    peak = 0;
+    for( int block_id = 0; block_id < blocks && res == ESP_OK; ++block_id ) {
+      memcpy( block, &signal[block_id*frames*DSP_NUM_CHANNELS], frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+
+      start_ns = bench_nanos();
+      res = dsp_filter( channels, block, frames*DSP_NUM_CHANNELS*sizeof( sample_t ), &clip_flag );
+      total_ns += bench_nanos() - start_ns;
+
+      for( int i = 0; i < frames*DSP_NUM_CHANNELS; ++i ) {
+        peak = abs( (int) block[i] ) > peak ? abs( (int) block[i] ) : peak;
+      }
+    }
+
+    clipping_count = 0;
+    limit_count = 0;
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      clipping_count += channels[channel_id].buffers->clipping_count;
+      limit_count += channels[channel_id].buffers->limit_count;
+    }
+
+    printf( "%7.0f %9.3f %9.3f %12.2f %11.2f %13.2f %10.4f %11.2f\n", gains[g],
+      100.0*clipping_count/( len*DSP_NUM_CHANNELS ), 100.0*limit_count/( len*DSP_NUM_CHANNELS ),
+      clamp_ns, knee_ns, (double) total_ns/( len*DSP_NUM_CHANNELS ), (double) peak/DSP_MAX_SAMPLE_VALUE,
+      20*log10f( channels[0].buffers->limiter_target ) );
+
+    dsp_filter_deinit( channels );
+  }
+
+  free( input );
+  free( output );
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Multirate section: dsp_filter() with both channels decimated, against the full-rate
+// path in the default mode. The signal is three tones within the sub band, and diff_dB
+// is the RMS difference from the full-rate output (the resampling delay taken out)
+// relative to full scale.
+//------------------------------------------------------------------------------------
+
+static esp_err_t bench_multirate_section( const sample_t* signal, int signal_frames, double seconds ) {
+
+  static const int    decimations[] = { 1, 2, 4, 8, 16 };
+  static const int    filters[] = { 2, 6, 10 };
+
+  const int       frames = DSP_BLOCK_FRAMES;
+  const int       length = ( signal_frames/frames )*frames;
+  sample_t*       tones;
+  sample_t*       output[ARRAY_LEN( decimations )];
+  bench_result_t  result[ARRAY_LEN( decimations )];
+  double          sum;
+  double          error;
+  int             delay;
+  int             count;
+  esp_err_t       res = ESP_OK;
+
+  tones = (sample_t*) malloc( length*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+  for( int d = 0; d < ARRAY_LEN( decimations ); ++d ) {
+    output[d] = (sample_t*) malloc( length*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+  }
+
+  for( int i = 0; i < length; ++i ) {
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      tones[i*DSP_NUM_CHANNELS + channel_id] = (sample_t) ( BENCH_SIGNAL_LEVEL*DSP_MAX_SAMPLE_VALUE*
+        ( 0.4*sin( 2*PI*30*i/DSP_SAMPLE_RATE ) + 0.3*sin( 2*PI*60*i/DSP_SAMPLE_RATE ) + 0.3*sin( 2*PI*120*i/DSP_SAMPLE_RATE ) ) );
+    }
+  }
+
+  printf( "\nMultirate benchmark: %d frames per block, %.1f s of audio per configuration, half-band stages of %d and %d taps\n",
+    frames, seconds, DSP_MULTIRATE_HB_SHORT, DSP_MULTIRATE_HB_LONG );
+  printf( "%8s %7s %10s %11s %13s %9s %10s\n", "delay_ms", "filters", "decimation", "passband_Hz", "ns/sample", "speedup", "diff_dB" );
+
+  for( int delay_id = 0; delay_id < 2 && res == ESP_OK; ++delay_id ) {
+    for( int f = 0; f < ARRAY_LEN( filters ) && res == ESP_OK; ++f ) {
+      for( int d = 0; d < ARRAY_LEN( decimations ) && res == ESP_OK; ++d ) {
+        bench_decimation = decimations[d];
+        res = bench_measure( tones, length, frames, bench_delays[delay_id], filters[f], 0, false, output[d], &result[d] );
+        bench_decimation = 1;
+        if( res != ESP_OK ) {
+          break;
+        }
+
+        // Compare the second half, well after the filters have settled
+        delay = dsp_multirate_delay( decimations[d] );
+        sum = 0;
+        count = 0;
+        for( int i = length/2; i + delay < length; ++i ) {
+          for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+            error = output[d][( i + delay )*DSP_NUM_CHANNELS + channel_id] - output[0][i*DSP_NUM_CHANNELS + channel_id];
+            sum += error*error;
+            ++count;
+          }
+        }
+
+        printf( "%8d %7d %10d %11.0f %13.2f %8.2fx %10.1f\n", bench_delays[delay_id], filters[f], decimations[d],
+          dsp_multirate_passband( decimations[d] ), result[d].ns_per_sample, result[0].ns_per_sample/result[d].ns_per_sample,
+          d == 0 ? -INFINITY : 10*log10( sum/count + 1e-30 ) - 20*log10( (double) DSP_MAX_SAMPLE_VALUE ) );
+      }
+    }
+  }
+
+  free( tones );
+  for( int d = 0; d < ARRAY_LEN( decimations ); ++d ) {
+    free( output[d] );
+  }
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// FIR section: the partitioned FFT convolution on one channel for several filter lengths
+// and block sizes, against a direct FIR (one multiply-add per tap and sample). err_dB is
+// the RMS difference of the partitioned output from a double precision convolution,
+// relative to full scale, and bytes_256 the RAM a filter takes with 256 frame blocks. The cost per sample grows linearly with the length, so a line
+// through the shortest and longest filters gives the longest filter that fits the
+// real-time budget of all channels; the last lines run the whole pipeline with and
+// without a filter on every channel.
+//------------------------------------------------------------------------------------
+
+static double bench_fir_direct( const float* coeffs, int taps, const float* input, int len, float* output ) {
+
+  float*      history = (float*) calloc( taps - 1 + len, sizeof( float ) );
+  float       acc;
+  uint64_t    start_ns;
+
+  memcpy( &history[taps - 1], input, len*sizeof( float ) );
+
+  start_ns = bench_nanos();
+  for( int n = 0; n < len; ++n ) {
+    const float*  x = &history[taps - 1 + n];
+
+    acc = 0;
+    for( int k = 0; k < taps; ++k ) {
+      acc += coeffs[k]*x[-k];
+    }
+    output[n] = acc;
+  }
+  start_ns = bench_nanos() - start_ns;
+
+  free( history );
+
+  return( (double) start_ns/len );
+}
+
+static esp_err_t bench_fir_section( const sample_t* signal, int signal_frames, double seconds ) {
+
+  static const int    taps[] = { 256, 1024, 4096, DSP_MAX_FIR_TAPS };
+  static const int    blocks[] = { 64, 128, 256, 512 };
+
+  const int       reference_len = 16384;
+  const double    budget_ns = 1e9/DSP_SAMPLE_RATE/DSP_NUM_CHANNELS;
+  const int       len = ( signal_frames/512 )*512;
+  float*          input;
+  float*          output;
+  float*          coeffs;
+  double*         reference;
+  double          direct_ns[ARRAY_LEN( taps )];
+  double          fir_ns[ARRAY_LEN( taps )][ARRAY_LEN( blocks )];
+  double          slope;
+  double          sum;
+  double          error;
+  int             direct_len;
+  dsp_fir_t*      fir;
+  uint64_t        start_ns;
+  uint64_t        total_ns;
+  bench_result_t  result[2];
+  esp_err_t       res = ESP_OK;
+
+  input = (float*) malloc( len*sizeof( float ) );
+  output = (float*) malloc( len*sizeof( float ) );
+  reference = (double*) malloc( reference_len*sizeof( double ) );
+
+  for( int i = 0; i < len; ++i ) {
+    input[i] = signal[i*DSP_NUM_CHANNELS];
+  }
+
+  printf( "\nFIR benchmark: partitioned convolution on one channel, %.1f s of audio per configuration (ns/sample)\n", seconds );
+  printf( "%6s %10s", "taps", "direct" );
+  for( int b = 0; b < ARRAY_LEN( blocks ); ++b ) {
+    printf( "   block_%-4d", blocks[b] );
+  }
+  printf( " %9s %8s %11s\n", "speedup", "err_dB", "bytes_256" );
+
+  for( int t = 0; t < ARRAY_LEN( taps ) && res == ESP_OK; ++t ) {
+    coeffs = dsp_sim_fir( taps[t] );
+
+    // Double precision reference over the start of the signal
+    for( int n = 0; n < reference_len && n < len; ++n ) {
+      reference[n] = 0;
+      for( int k = 0; k < taps[t] && k <= n; ++k ) {
+        reference[n] += (double) coeffs[k]*input[n - k];
+      }
+    }
+
+    // The direct FIR on enough samples for a stable timing
+    direct_len = len < 400000000/taps[t] ? len : 400000000/taps[t];
+    direct_ns[t] = bench_fir_direct( coeffs, taps[t], input, direct_len, output );
+
+    printf( "%6d %10.2f", taps[t], direct_ns[t] );
+    for( int b = 0; b < ARRAY_LEN( blocks ) && res == ESP_OK; ++b ) {
+      res = dsp_fir_create( &fir, coeffs, taps[t], blocks[b] );
+      if( res != ESP_OK ) {
+        break;
+      }
+
+      memcpy( output, input, len*sizeof( float ) );
+      total_ns = 0;
+      for( int start = 0; start + blocks[b] <= len; start += blocks[b] ) {
+        start_ns = bench_nanos();
+        dsp_fir_process( fir, &output[start], blocks[b] );
+        total_ns += bench_nanos() - start_ns;
+      }
+      fir_ns[t][b] = (double) total_ns/len;
+      dsp_fir_free( fir );
+
+      printf( " %12.2f", fir_ns[t][b] );
+    }
+
+    // Accuracy of the last run (the same for every block size), speedup at 256 frames
+    sum = 0;
+    for( int n = 0; n < reference_len && n < len; ++n ) {
+      error = output[n] - reference[n];
+      sum += error*error;
+    }
+
+    printf( " %8.1fx %8.1f %11d\n", direct_ns[t]/fir_ns[t][2], 10*log10( sum/reference_len + 1e-30 ) - 20*log10( (double) DSP_MAX_SAMPLE_VALUE ),
+      dsp_fir_memory( taps[t], 256 ) );
+
+    free( coeffs );
+  }
+
+  if( res == ESP_OK ) {
+    printf( "Longest filter per channel within the real-time budget of %d channels (%.0f ns/sample), FIR alone:\n", DSP_NUM_CHANNELS, budget_ns );
+    printf( "  direct %d taps", (int) ( budget_ns/( direct_ns[ARRAY_LEN( taps ) - 1]/taps[ARRAY_LEN( taps ) - 1] ) ) );
+    for( int b = 0; b < ARRAY_LEN( blocks ); ++b ) {
+      slope = ( fir_ns[ARRAY_LEN( taps ) - 1][b] - fir_ns[0][b] )/( taps[ARRAY_LEN( taps ) - 1] - taps[0] );
+      printf( ", block %d %d taps", blocks[b], (int) ( taps[0] + ( budget_ns - fir_ns[0][b] )/slope ) );
+    }
+    printf( "\n" );
+  }
+
+  // The whole pipeline at the default block size, with the configured filters and delays
+  if( DSP_FILTER_ENGINE == DSP_ENGINE_FIXED ) {
+    printf( "FIR filters need the float engine - pipeline comparison skipped\n" );
+  }
+
+  for( int f = 0; f < 2 && res == ESP_OK && DSP_FILTER_ENGINE != DSP_ENGINE_FIXED; ++f ) {
+    coeffs = f > 0 ? dsp_sim_fir( 4096 ) : NULL;
+    bench_fir_taps = f > 0 ? 4096 : 0;
+    bench_fir_coeffs = coeffs;
+    res = bench_measure( signal, signal_frames, DSP_BLOCK_FRAMES, 25, DSP_Channels[0].num_filters, 0, false, NULL, &result[f] );
+    bench_fir_taps = 0;
+    bench_fir_coeffs = NULL;
+    free( coeffs );
+  }
+
+  if( res == ESP_OK && DSP_FILTER_ENGINE != DSP_ENGINE_FIXED ) {
+    printf( "dsp_filter() with %d filters and 25 ms delay, %d frames per block: %.2f ns/sample (%.3f%% of real time) without FIR, "
+      "%.2f ns/sample (%.3f%%) with 4096 taps on every channel\n", DSP_Channels[0].num_filters, DSP_BLOCK_FRAMES,
+      result[0].ns_per_sample, result[0].rt_load, result[1].ns_per_sample, result[1].rt_load );
+  }
+
+  free( input );
+  free( output );
+  free( reference );
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Mix section: the input mix stage alone on the interleaved buffer for matrices that take
+// each kernel, per block and per sample, then the dense matrices through the scalar and
+// vector kernels (max_diff is the largest difference between the two in samples), and
+// the whole pipeline with a mono sum against straight through.
+//------------------------------------------------------------------------------------
+
+static esp_err_t bench_mix_section( const sample_t* signal, int signal_frames, double seconds ) {
+
+  static const struct {
+    const char*   name;
+    float         gain[DSP_NUM_CHANNELS][DSP_NUM_CHANNELS];
+  } matrices[] = {
+    { "identity",   { { 1, 0 }, { 0, 1 } } },
+    { "swap",       { { 0, 1 }, { 1, 0 } } },
+    { "left_only",  { { 0.5, 0 }, { 0, 0 } } },
+    { "scaled",     { { 0.5, 0 }, { 0, 0.5 } } },
+    { "mono_sum",   { { 0.5, 0.5 }, { 0.5, 0.5 } } },
+    { "crossfeed",  { { 0.8, 0.2 }, { -0.2, 0.8 } } }
+  };
+  static const char* const  kinds[] = { "identity", "route", "sparse", "dense" };
+
+  const int       len = ( signal_frames/DSP_MAX_BLOCK_FRAMES )*DSP_MAX_BLOCK_FRAMES;
+  sample_t*       buffer;
+  sample_t*       check;
+  dsp_mix_t       mix;
+  int             clipped[DSP_NUM_CHANNELS] = { 0 };
+  int             max_diff;
+  uint64_t        start_ns;
+  uint64_t        total_ns;
+  double          ns[2];
+  bench_result_t  result[2];
+  esp_err_t       res = ESP_OK;
+
+  buffer = (sample_t*) malloc( len*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+  check = (sample_t*) malloc( len*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+
+  printf( "\nMix benchmark: %dx%d input mix matrix, %.1f s of audio per configuration (ns per block)\n",
+    DSP_NUM_CHANNELS, DSP_NUM_CHANNELS, seconds );
+  printf( "%10s %9s", "matrix", "kernel" );
+  for( int f = 0; f < ARRAY_LEN( bench_frames ); ++f ) {
+    printf( "   block_%-4d", bench_frames[f] );
+  }
+  printf( " %10s\n", "ns/sample" );
+
+  for( int m = 0; m < ARRAY_LEN( matrices ); ++m ) {
+    dsp_mix_setup( &mix, matrices[m].gain );
+    printf( "%10s %9s", matrices[m].name, kinds[mix.kind] );
+
+    for( int f = 0; f < ARRAY_LEN( bench_frames ); ++f ) {
+      memcpy( buffer, signal, len*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+      total_ns = 0;
+      for( int start = 0; start + bench_frames[f] <= len; start += bench_frames[f] ) {
+        start_ns = bench_nanos();
+        dsp_mix_process( &mix, &buffer[start*DSP_NUM_CHANNELS], bench_frames[f], clipped );
+        total_ns += bench_nanos() - start_ns;
+      }
+      ns[0] = (double) total_ns/( len/bench_frames[f] );
+      printf( " %12.1f", ns[0] );
+    }
+    printf( " %10.3f\n", ns[0]/( bench_frames[ARRAY_LEN( bench_frames ) - 1]*DSP_NUM_CHANNELS ) );
+  }
+
+  printf( "Dense kernels at %d frames per block (ns/sample):\n%10s %10s %10s %8s %9s\n", DSP_BLOCK_FRAMES,
+    "matrix", "scalar", "vector", "speedup", "max_diff" );
+
+  for( int m = 3; m < ARRAY_LEN( matrices ); ++m ) {
+    dsp_mix_setup( &mix, matrices[m].gain );
+
+    for( int k = 0; k < 2; ++k ) {
+      memcpy( k == 0 ? check : buffer, signal, len*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+      total_ns = 0;
+      for( int start = 0; start + DSP_BLOCK_FRAMES <= len; start += DSP_BLOCK_FRAMES ) {
+        start_ns = bench_nanos();
+        if( k == 0 ) {
+          dsp_mix_dense_ansi( &mix, &check[start*DSP_NUM_CHANNELS], DSP_BLOCK_FRAMES, clipped );
+        } else {
+          dsp_mix_dense_simd( &mix, &buffer[start*DSP_NUM_CHANNELS], DSP_BLOCK_FRAMES, clipped );
+        }
+        total_ns += bench_nanos() - start_ns;
+      }
+      ns[k] = (double) total_ns/( ( len/DSP_BLOCK_FRAMES )*DSP_BLOCK_FRAMES*DSP_NUM_CHANNELS );
+    }
+
+    // The kernels round ties differently, so they may differ by one
+    max_diff = 0;
+    for( int i = 0; i < ( len/DSP_BLOCK_FRAMES )*DSP_BLOCK_FRAMES*DSP_NUM_CHANNELS; ++i ) {
+      if( abs( buffer[i] - check[i] ) > max_diff ) {
+        max_diff = abs( buffer[i] - check[i] );
+      }
+    }
+
+    printf( "%10s %10.3f %10.3f %7.2fx %9d\n", matrices[m].name, ns[0], ns[1], ns[0]/ns[1], max_diff );
+  }
+
+  // The whole pipeline at the default block size, with the configured filters and delays
+  for( int p = 0; p < 2 && res == ESP_OK; ++p ) {
+    bench_mix = matrices[p == 0 ? 0 : 4].gain;
+    res = bench_measure( signal, signal_frames, DSP_BLOCK_FRAMES, 25, DSP_Channels[0].num_filters, 0, false, NULL, &result[p] );
+    bench_mix = NULL;
+  }
+
+  if( res == ESP_OK ) {
+    printf( "dsp_filter() with %d filters and 25 ms delay, %d frames per block: %.2f ns/sample straight through, "
+      "%.2f ns/sample with the mono sum (%+.2f ns/sample)\n", DSP_Channels[0].num_filters, DSP_BLOCK_FRAMES,
+      result[0].ns_per_sample, result[1].ns_per_sample, result[1].ns_per_sample - result[0].ns_per_sample );
+  }
+
+  free( buffer );
+  free( check );
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Preset section: a full bank is written to a scratch store and loaded as at boot,
+// then the audio runs while the presets are switched in turn. The load is compared
+// with the start-up info dump, and a switch with publishing the same settings through
+// the runtime setters. The heap is watched across the switches.
+//------------------------------------------------------------------------------------
+
+static esp_err_t bench_preset_section( const sample_t* signal, int signal_frames ) {
+
+  static dsp_preset_bank_t  bank;
+  const int       frames = DSP_BLOCK_FRAMES;
+  const int       switch_every = 8;
+  dsp_channel_t   channels[DSP_NUM_CHANNELS];
+  dsp_channel_t   preset[DSP_NUM_CHANNELS];
+  sample_t        block[DSP_MAX_SAMPLES];
+  uint8_t         record[DSP_PRESET_MAX_LEN];
+  char            dir[] = "/tmp/dsp_bench_XXXXXX";
+  char            key[16];
+  char            path[64];
+  char            name[DSP_PRESET_NAME_LEN];
+  int             len;
+  bool            clip_flag;
+  int             blocks = signal_frames/frames;
+  int             flash_bytes = 0;
+  int             switches = 0;
+  int             setter_updates = 0;
+  int             preset_id;
+  int             stdout_fd;
+  FILE*           sink;
+  long            info_bytes;
+  uint64_t        start_ns;
+  uint64_t        load_ns;
+  uint64_t        info_ns;
+  uint64_t        ns;
+  uint64_t        apply_ns = 0;
+  uint64_t        apply_max_ns = 0;
+  uint64_t        setter_ns = 0;
+  uint64_t        store_ns;
+  uint32_t        max_latency = 0;
+  long            heap_allocated = 0;
+  size_t          heap;
+  esp_err_t       res;
+
+  if( mkdtemp( dir ) == NULL ) {
+    return( ESP_FAIL );
+  }
+  setenv( "DSP_STORE_DIR", dir, 1 );
+
+  bench_channels( channels, DSP_Channels[0].num_filters, 0 );
+  res = dsp_filter_init( channels );
+  if( res != ESP_OK ) {
+    return( res );
+  }
+
+  // A full bank: different filter counts, gains and delays in each preset
+  for( preset_id = 0; preset_id < DSP_MAX_PRESETS; ++preset_id ) {
+    memcpy( preset, channels, sizeof( preset ) );
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      preset[channel_id].gain_dB = -1.5f*preset_id;
+      preset[channel_id].delay_millis = 2.5f*preset_id + channel_id;
+      preset[channel_id].num_filters = ( preset_id + channel_id ) % ( DSP_Channels[0].num_filters + 1 );
+    }
+    snprintf( name, sizeof( name ), "preset %d", preset_id );
+    snprintf( key, sizeof( key ), "preset%d", preset_id );
+    len = dsp_preset_pack( name, preset, record );
+    flash_bytes += len;
+    dsp_os_store_write( key, record, len );
+  }
+  record[0] = 3;
+  dsp_os_store_write( "last", record, 1 );
+
+  start_ns = bench_nanos();
+  res = dsp_preset_load( &bank, channels );
+  load_ns = bench_nanos() - start_ns;
+
+  // The start-up info dump, written to a file to count its bytes
+  sink = bench_capture_start( &stdout_fd );
+  start_ns = bench_nanos();
+  dsp_filter_info( channels );
+  fflush( stdout );
+  info_ns = bench_nanos() - start_ns;
+  info_bytes = bench_capture_end( sink, stdout_fd );
+  fclose( sink );
+
+  printf( "\nPreset benchmark: %d presets, %d bytes of flash, %d bytes of RAM prepared (delay buffers not counted)\n",
+    DSP_MAX_PRESETS, flash_bytes, (int) sizeof( dsp_preset_bank_t ) );
+  printf( "Load and switch to preset %d: %.1f us, start-up info dump: %ld bytes, %.1f us to format here, %.0f ms at 115200 baud\n",
+    bank.current, load_ns/1000.0, info_bytes, info_ns/1000.0, info_bytes*10*1000.0/115200 );
+
+  for( int block_id = 0; block_id < blocks && res == ESP_OK; ++block_id ) {
+    if( block_id % switch_every == 0 ) {
+      preset_id = ( block_id/switch_every ) % DSP_MAX_PRESETS;
+
+      // Switches through the bank in the first half, the same settings through the setters (validated,
+      // designed and allocated) in the second. The flash write recording the choice is timed on its own.
+      if( block_id < blocks/2 ) {
+        bank.stored = preset_id;
+        heap = mallinfo2().uordblks;
+        start_ns = bench_nanos();
+        res = dsp_preset_apply( &bank, channels, preset_id );
+        ns = bench_nanos() - start_ns;
+        heap_allocated += mallinfo2().uordblks > heap ? (long) ( mallinfo2().uordblks - heap ) : 0;
+        apply_ns += ns;
+        apply_max_ns = ns > apply_max_ns ? ns : apply_max_ns;
+        ++switches;
+      } else {
+        start_ns = bench_nanos();
+        for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS && res == ESP_OK; ++channel_id ) {
+          res = dsp_filter_set_filters( channels, channel_id, 0, bank.presets[preset_id].channels[channel_id].num_filters,
+                                        bank.presets[preset_id].channels[channel_id].coeffs );
+          res |= dsp_filter_set_gain( channels, channel_id, bank.presets[preset_id].channels[channel_id].gain_dB );
+          res |= dsp_filter_set_delay( channels, channel_id, bank.presets[preset_id].channels[channel_id].delay_millis );
+        }
+        setter_ns += bench_nanos() - start_ns;
+        ++setter_updates;
+      }
+    }
+
+    memcpy( block, &signal[block_id*frames*DSP_NUM_CHANNELS], frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+    if( res == ESP_OK ) {
+      res = dsp_filter( channels, block, frames*DSP_NUM_CHANNELS*sizeof( sample_t ), &clip_flag );
+    }
+
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      max_latency = channels[channel_id].buffers->swap_latency > max_latency ? channels[channel_id].buffers->swap_latency : max_latency;
+    }
+  }
+
+  record[0] = 0;
+  start_ns = bench_nanos();
+  dsp_os_store_write( "last", record, 1 );
+  store_ns = bench_nanos() - start_ns;
+
+  if( res == ESP_OK ) {
+    printf( "Switch: %.2f us on average, %.2f us at most, %ld bytes allocated over %d switches, swapped in within %u block(s)\n",
+      apply_ns/1000.0/switches, apply_max_ns/1000.0, heap_allocated, switches, max_latency + 1 );
+    printf( "Recording the choice in the store: %.1f us (a flash write on the device)\n", store_ns/1000.0 );
+    printf( "The same settings through the setters (validate, design, allocate, publish): %.2f us on average\n",
+      setter_ns/1000.0/setter_updates );
+  }
+
+  dsp_filter_deinit( channels );
+  dsp_preset_free( &bank, channels );
+
+  for( preset_id = 0; preset_id < DSP_MAX_PRESETS; ++preset_id ) {
+    snprintf( path, sizeof( path ), "%s/preset%d.bin", dir, preset_id );
+    remove( path );
+  }
+  snprintf( path, sizeof( path ), "%s/last.bin", dir );
+  remove( path );
+  rmdir( dir );
+  unsetenv( "DSP_STORE_DIR" );
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Plot section: the response of the channels in dsp_config.h and of their sum is taken
+// from the CSV output and compared with the same responses computed in double
+// precision, with the group delay differentiated numerically. The plot is then timed
+// as a whole with all stages computed, from its caches and after one coefficient
+// change, against the original double precision gain evaluation, and one step at a
+// time to find the longest step a call of dsp_loop() can take.
+//------------------------------------------------------------------------------------
+
+// Response of a channel in double precision: real and imaginary part at a frequency
+static void bench_plot_reference( const dsp_channel_t* chan, double freq, double* re, double* im ) {
+
+  double    w = 2*PI*freq/DSP_SAMPLE_RATE;
+  double    delay = chan->delay_millis*DSP_SAMPLE_RATE/1000.0 + dsp_multirate_delay( chan->decimation );
+  double    mag = pow( 10, chan->gain_dB/20.0 );
+  double    h_re = mag*cos( w*delay );
+  double    h_im = -mag*sin( w*delay );
+  double    t;
+
+  for( int k = 0; k < chan->num_filters; ++k ) {
+    const float*  c = chan->coeffs[k];
+    double        b_re = c[0] + c[1]*cos( w ) + c[2]*cos( 2*w );
+    double        b_im = -c[1]*sin( w ) - c[2]*sin( 2*w );
+    double        a_re = 1 + c[3]*cos( w ) + c[4]*cos( 2*w );
+    double        a_im = -c[3]*sin( w ) - c[4]*sin( 2*w );
+    double        a_norm = a_re*a_re + a_im*a_im;
+    double        q_re = ( b_re*a_re + b_im*a_im )/a_norm;
+    double        q_im = ( b_im*a_re - b_re*a_im )/a_norm;
+
+    t = h_re*q_re - h_im*q_im;
+    h_im = h_re*q_im + h_im*q_re;
+    h_re = t;
+  }
+
+  *re = h_re;
+  *im = h_im;
+}
+
+// Response of a plot (a channel, or DSP_NUM_CHANNELS for the sum): gain in dB, phase in radians, group delay in ms
+static void bench_plot_response( const dsp_channel_t* channels, int plot, double freq, double* gain, double* phase, double* delay ) {
+
+  const double  step = 1e-4;                                // Relative frequency step of the numerical derivative
+  double        re[3] = { 0, 0, 0 };
+  double        im[3] = { 0, 0, 0 };
+  double        r;
+  double        i;
+
+  for( int k = 0; k < 3; ++k ) {
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      if( plot == channel_id || plot == DSP_NUM_CHANNELS ) {
+        bench_plot_reference( &channels[channel_id], freq*( 1 + ( k - 1 )*step ), &r, &i );
+        re[k] += r;
+        im[k] += i;
+      }
+    }
+  }
+
+  *gain = 10*log10( re[1]*re[1] + im[1]*im[1] );
+  *phase = atan2( im[1], re[1] );
+  *delay = -remainder( atan2( im[2], re[2] ) - atan2( im[0], re[0] ), 2*PI )/( 2*PI*2*step*freq )*1000;
+}
+
+// The gain of each channel as the original dsp_plot computed it, in double precision
+static void bench_plot_original( const dsp_channel_t* channels, float* gain ) {
+
+  double    phi;
+  double    freq;
+
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    for( int band = 0; band < DSP_PLOT_BANDS; ++band ) {
+      freq = DSP_PLOT_LOW_HZ*pow( exp( log( DSP_PLOT_HIGH_HZ/DSP_PLOT_LOW_HZ )/( DSP_PLOT_BANDS - 1 ) ), band );
+      phi = 4*pow( sin( PI*freq/DSP_SAMPLE_RATE ), 2 );
+      gain[band] = 0;
+      for( int k = 0; k < channels[channel_id].num_filters; ++k ) {
+        const float*  c = channels[channel_id].coeffs[k];
+
+        gain[band] += 10*log10( pow( (double) c[0] + c[1] + c[2], 2 ) + ( (double) c[0]*c[2]*phi - ( c[1]*( (double) c[0] + c[2] ) + 4.0*c[0]*c[2] ) )*phi ) -
+                      10*log10( pow( 1.0 + c[3] + c[4], 2 ) + ( (double) c[4]*phi - ( c[3]*( 1.0 + c[4] ) + 4.0*c[4] ) )*phi );
+      }
+    }
+  }
+}
+
+// Runs a plot to its end in slices of budget_us; returns the time taken and the bytes printed
+static uint64_t bench_plot_run( dsp_channel_t* channels, int format, int budget_us, int* polls, uint64_t* max_poll_ns, long* bytes ) {
+
+  FILE*     sink;
+  int       stdout_fd;
+  bool      more = true;
+  uint64_t  start_ns;
+  uint64_t  poll_ns;
+  uint64_t  total_ns = 0;
+
+  *polls = 0;
+  *max_poll_ns = 0;
+  sink = bench_capture_start( &stdout_fd );
+  dsp_plot_start( channels, format );
+  while( more ) {
+    start_ns = bench_nanos();
+    more = dsp_plot_poll( channels, budget_us );
+    poll_ns = bench_nanos() - start_ns;
+    total_ns += poll_ns;
+    *max_poll_ns = poll_ns > *max_poll_ns ? poll_ns : *max_poll_ns;
+    ++*polls;
+  }
+  *bytes = bench_capture_end( sink, stdout_fd );
+  fclose( sink );
+
+  return( total_ns );
+}
+
+static esp_err_t bench_plot_section() {
+
+  const int       repeats = 200;
+  dsp_channel_t   channels[DSP_NUM_CHANNELS];
+  float           gain[DSP_PLOT_BANDS];
+  char            line[128];
+  char            name[64];
+  FILE*           sink;
+  int             stdout_fd;
+  int             plot;
+  int             band;
+  int             points = 0;
+  int             polls;
+  int             stages;
+  float           freq;
+  float           plot_gain;
+  float           plot_phase;
+  float           plot_delay;
+  double          ref_gain;
+  double          ref_phase;
+  double          ref_delay;
+  double          gain_error[2] = { 0, 0 };
+  double          phase_error[2] = { 0, 0 };
+  double          delay_error[2] = { 0, 0 };
+  long            bytes;
+  uint64_t        start_ns;
+  uint64_t        original_ns;
+  uint64_t        cold_ns;
+  uint64_t        warm_ns = 0;
+  uint64_t        changed_ns = 0;
+  uint64_t        sliced_ns;
+  uint64_t        max_poll_ns;
+
+  memcpy( channels, DSP_Channels, sizeof( channels ) );
+
+  // The first plot computes every stage
+  cold_ns = bench_plot_run( channels, DSP_PLOT_CHART, 1000000, &polls, &max_poll_ns, &bytes );
+  stages = dsp_plot_stages_computed();
+
+  // Accuracy, from the CSV output
+  sink = bench_capture_start( &stdout_fd );
+  dsp_plot_start( channels, DSP_PLOT_CSV );
+  while( dsp_plot_poll( channels, 1000000 ) ) {
+  }
+  bench_capture_end( sink, stdout_fd );
+
+  while( fgets( line, sizeof( line ), sink ) != NULL ) {
+    if( sscanf( line, "%63[^,],%f,%f,%f,%f", name, &freq, &plot_gain, &plot_phase, &plot_delay ) != 5 ) {
+      continue;
+    }
+    for( plot = 0; plot < DSP_NUM_CHANNELS && strcmp( name, channels[plot].name ) != 0; ++plot ) {
+    }
+    // The exact band frequency, not the one printed: the group delay changes fast near a notch
+    band = (int) lround( log( freq/DSP_PLOT_LOW_HZ )/log( DSP_PLOT_HIGH_HZ/DSP_PLOT_LOW_HZ )*( DSP_PLOT_BANDS - 1 ) );
+    freq = DSP_PLOT_LOW_HZ*pow( DSP_PLOT_HIGH_HZ/DSP_PLOT_LOW_HZ, (double) band/( DSP_PLOT_BANDS - 1 ) );
+    bench_plot_response( channels, plot, freq, &ref_gain, &ref_phase, &ref_delay );
+
+    // The sum is compared away from its deep notches, where its phase and group delay are not defined
+    if( plot == DSP_NUM_CHANNELS && ref_gain < -20 ) {
+      continue;
+    }
+    gain_error[plot == DSP_NUM_CHANNELS] = fmax( gain_error[plot == DSP_NUM_CHANNELS], fabs( plot_gain - ref_gain ) );
+    phase_error[plot == DSP_NUM_CHANNELS] = fmax( phase_error[plot == DSP_NUM_CHANNELS], fabs( remainder( plot_phase - ref_phase*180/PI, 360 ) ) );
+    delay_error[plot == DSP_NUM_CHANNELS] = fmax( delay_error[plot == DSP_NUM_CHANNELS], fabs( plot_delay - ref_delay ) );
+    ++points;
+  }
+  fclose( sink );
+
+  if( points == 0 ) {
+    return( ESP_FAIL );
+  }
+
+  printf( "\nPlot benchmark: %d bands from %.0f to %.0f Hz, %d channels and their sum, %d bytes of RAM\n",
+    DSP_PLOT_BANDS, DSP_PLOT_LOW_HZ, DSP_PLOT_HIGH_HZ, DSP_NUM_CHANNELS, dsp_plot_memory() );
+  printf( "Against double precision (%d points): channels within %.4f dB, %.3f deg, %.4f ms; sum within %.4f dB, %.3f deg, %.4f ms\n",
+    points, gain_error[0], phase_error[0], delay_error[0], gain_error[1], phase_error[1], delay_error[1] );
+
+  // A whole chart at once: with every stage computed, from the caches and after a change to one filter
+  start_ns = bench_nanos();
+  for( int r = 0; r < repeats; ++r ) {
+    bench_plot_original( channels, gain );
+  }
+  original_ns = ( bench_nanos() - start_ns )/repeats;
+
+  for( int r = 0; r < repeats; ++r ) {
+    warm_ns += bench_plot_run( channels, DSP_PLOT_CHART, 1000000, &polls, &max_poll_ns, &bytes );
+    channels[0].coeffs[0][0] += r % 2 == 0 ? 1e-6f : -1e-6f;
+    changed_ns += bench_plot_run( channels, DSP_PLOT_CHART, 1000000, &polls, &max_poll_ns, &bytes );
+  }
+  printf( "Whole chart: %.1f us with all %d stages computed, %.1f us cached, %.1f us after one filter changed (%d stage); gain alone as the original plot computed it: %.1f us\n",
+    cold_ns/1000.0, stages, warm_ns/1000.0/repeats, changed_ns/1000.0/repeats, dsp_plot_stages_computed(), original_ns/1000.0 );
+
+  // One step per call: a call of dsp_loop() takes at most DSP_PLOT_BUDGET_US plus the longest step, and on
+  // the device the serial output of a line (a chart line is DSP_PLOT_BANDS + 9 bytes)
+  channels[0].coeffs[0][0] += 1e-6f;
+  sliced_ns = bench_plot_run( channels, DSP_PLOT_CHART, 0, &polls, &max_poll_ns, &bytes );
+  printf( "Chart in steps: %d steps, the longest %.1f us, %.1f us in total; %ld bytes, %.0f ms at 115200 baud (%.0f ms per line)\n",
+    polls, max_poll_ns/1000.0, sliced_ns/1000.0, bytes, bytes*10*1000.0/115200, ( DSP_PLOT_BANDS + 9 )*10*1000.0/115200 );
+  sliced_ns = bench_plot_run( channels, DSP_PLOT_CSV, 0, &polls, &max_poll_ns, &bytes );
+  printf( "CSV in steps: %d steps, the longest %.1f us, %.1f us in total; %ld bytes, %.0f ms at 115200 baud\n",
+    polls, max_poll_ns/1000.0, sliced_ns/1000.0, bytes, bytes*10*1000.0/115200 );
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Log section: the cost to the audio path of logging an event into the ring, with room
+// and when full, against printing the same line with SERIAL.printf() (to a file here;
+// a UART takes 87 us per character at 115200 baud). A thread then logs numbered
+// events in bursts larger than the ring while this one drains it, and every event
+// must come out in order or be counted as dropped.
+//------------------------------------------------------------------------------------
+
+#define BENCH_LOG_EVENTS      100000                    // Events logged by the producer thread
+#define BENCH_LOG_BURST       96                        // Events logged back to back, more than the ring holds
+
+static volatile bool  bench_log_done = false;
+
+static void bench_log_producer( void* arg ) {
+
+  for( int32_t seq = 0; seq < BENCH_LOG_EVENTS; ++seq ) {
+    dsp_log( DSP_LOG_DEADLINE_MISS, seq, 0, 0 );
+
+    // Sleep after each burst as the audio task blocks on I2S, letting the reader drain the ring
+    if( seq % BENCH_LOG_BURST == BENCH_LOG_BURST - 1 ) {
+      dsp_os_delay_ms( 1 );
+    }
+  }
+
+  __atomic_store_n( &bench_log_done, true, __ATOMIC_RELEASE );
+  dsp_os_task_exit();
+}
+
+static esp_err_t bench_log_section() {
+
+  const int         rounds = 20000;
+  const int         batch = DSP_LOG_RING_LEN/2;
+  dsp_log_record_t  record;
+  FILE*             sink;
+  int               stdout_fd;
+  long              bytes;
+  uint32_t          drops;
+  int32_t           expected = 0;
+  int               received = 0;
+  int               out_of_order = 0;
+  bool              done;
+  uint64_t          start_ns;
+  uint64_t          start_cycles;
+  uint64_t          log_ns = 0;
+  uint64_t          log_cycles = 0;
+  uint64_t          full_ns;
+  uint64_t          print_ns;
+
+  // Into a ring with room, drained between batches
+  for( int r = 0; r < rounds; ++r ) {
+    start_ns = bench_nanos();
+    start_cycles = bench_cycles();
+    for( int i = 0; i < batch; ++i ) {
+      dsp_log( DSP_LOG_TOO_MANY_SAMPLES, i, DSP_BLOCK_FRAMES, 0 );
+    }
+    log_cycles += bench_cycles() - start_cycles;
+    log_ns += bench_nanos() - start_ns;
+    while( dsp_log_read( &record ) ) {
+    }
+  }
+
+  // Into a full ring: every event is dropped
+  for( int i = 0; i < DSP_LOG_RING_LEN; ++i ) {
+    dsp_log( DSP_LOG_TOO_MANY_SAMPLES, i, DSP_BLOCK_FRAMES, 0 );
+  }
+  drops = dsp_log_dropped();
+  start_ns = bench_nanos();
+  for( int i = 0; i < rounds*batch; ++i ) {
+    dsp_log( DSP_LOG_TOO_MANY_SAMPLES, i, DSP_BLOCK_FRAMES, 0 );
+  }
+  full_ns = bench_nanos() - start_ns;
+  drops = dsp_log_dropped() - drops;
+
+  // The same line printed as the audio path used to, and the whole ring formatted by dsp_log_drain()
+  sink = bench_capture_start( &stdout_fd );
+  start_ns = bench_nanos();
+  for( int i = 0; i < rounds; ++i ) {
+    SERIAL.printf( "E-DSP: Too many input samples = '%d' (block size %d)", i, DSP_BLOCK_FRAMES );
+  }
+  fflush( stdout );
+  print_ns = bench_nanos() - start_ns;
+  bench_capture_end( sink, stdout_fd );
+  fclose( sink );
+
+  sink = bench_capture_start( &stdout_fd );
+  dsp_log_drain( DSP_Channels, DSP_LOG_RING_LEN );
+  bytes = bench_capture_end( sink, stdout_fd );
+  fclose( sink );
+
+  printf( "\nLog benchmark: ring of %d records of %d bytes\n", DSP_LOG_RING_LEN, (int) sizeof( dsp_log_record_t ) );
+  printf( "Logging an event: %.1f ns (%.0f cycles) with room, %.1f ns when the ring is full (%u dropped)\n",
+    (double) log_ns/rounds/batch, (double) log_cycles/rounds/batch, (double) full_ns/rounds/batch, drops );
+  printf( "Printing it with SERIAL.printf(): %.1f ns to a file, %ld bytes per line formatted by dsp_log_drain(), %.1f ms at 115200 baud\n",
+    (double) print_ns/rounds, bytes/DSP_LOG_RING_LEN, bytes*10*1000.0/115200/DSP_LOG_RING_LEN );
+
+  // Two threads
+  drops = dsp_log_dropped();
+  if( dsp_os_task_create( bench_log_producer, "bench_log", 8192, 1, 1, NULL ) != ESP_OK ) {
+    return( ESP_FAIL );
+  }
+  do {
+    done = __atomic_load_n( &bench_log_done, __ATOMIC_ACQUIRE );
+    while( dsp_log_read( &record ) ) {
+      if( record.args[0] < expected ) {
+        ++out_of_order;
+      }
+      expected = record.args[0] + 1;
+      ++received;
+    }
+  } while( !done );
+  drops = dsp_log_dropped() - drops;
+
+  printf( "Two threads: %d events logged in bursts of %d, %d read in order (%d out of order), %u dropped, %d lost\n",
+    BENCH_LOG_EVENTS, BENCH_LOG_BURST, received - out_of_order, out_of_order, drops, BENCH_LOG_EVENTS - received - (int) drops );
+
+  return( out_of_order == 0 && received + (int) drops == BENCH_LOG_EVENTS ? ESP_OK : ESP_FAIL );
+}
+
+
+//------------------------------------------------------------------------------------
+// Analyzer section: a sine at each 1/3 octave center from 20 to 200 Hz, on both inputs,
+// is filtered by the channels of dsp_config.h and analyzed. The band levels must match
+// the level of each sine times the channel's response at the band center, computed in
+// double precision (bands 50 dB below full scale and more are left out, where the
+// skirts of the louder sines dominate). Below about 40 Hz a 1/12 octave band is less
+// than three bins wide and leaves part of a sine's window lobe to its neighbours, so
+// it reads up to 1 dB low. Then the cost: copying a block on the audio side, and the
+// control loop's time per second of audio in steps of one call each.
+//------------------------------------------------------------------------------------
+
+#define BENCH_RTA_SECONDS     8.0                       // Audio analyzed per configuration (about 10 spectra)
+#define BENCH_RTA_LEVEL       0.03                      // Peak level of each sine relative to full scale
+#define BENCH_RTA_FLOOR_DB    -50                       // Bands compared down to this level
+
+static esp_err_t bench_rta_run( int bands_per_octave, int budget_us, double* max_error, int* compared, uint64_t* block_ns,
+                                uint64_t* poll_ns, uint64_t* max_poll_ns, int* polls ) {
+
+  const int       frames = DSP_BLOCK_FRAMES;
+  const int       blocks = (int) ( BENCH_RTA_SECONDS*DSP_SAMPLE_RATE/frames );
+  dsp_channel_t   channels[DSP_NUM_CHANNELS];
+  sample_t        block[DSP_MAX_SAMPLES];
+  float           freq[DSP_RTA_MAX_BANDS];
+  float           level[DSP_RTA_MAX_BANDS];
+  double          tone[DSP_RTA_MAX_BANDS];
+  double          value;
+  double          re;
+  double          im;
+  double          mix;
+  double          expected;
+  bool            clip_flag;
+  int             tones = 0;
+  int             bands;
+  FILE*           sink;
+  int             stdout_fd;
+  uint64_t        start_ns;
+  uint64_t        call_ns;
+  esp_err_t       res;
+
+  memcpy( channels, DSP_Channels, sizeof( channels ) );
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    channels[channel_id].buffers = NULL;
+  }
+  res = dsp_filter_init( channels );
+  if( res != ESP_OK ) {
+    return( res );
+  }
+
+  for( int k = -17; k <= -7; ++k ) {
+    tone[tones++] = 1000*pow( 2.0, k/3.0 );
+  }
+
+  *block_ns = 0;
+  *poll_ns = 0;
+  *max_poll_ns = 0;
+  *polls = 0;
+  sink = bench_capture_start( &stdout_fd );
+  res = dsp_rta_start( bands_per_octave, DSP_PLOT_CSV );
+
+  for( int block_id = 0; res == ESP_OK && block_id < blocks; ++block_id ) {
+    for( int i = 0; i < frames; ++i ) {
+      value = 0;
+      for( int t = 0; t < tones; ++t ) {
+        value += sin( 2*PI*tone[t]*( block_id*frames + i )/DSP_SAMPLE_RATE + 0.7*t*t );
+      }
+      for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+        block[i*DSP_NUM_CHANNELS + channel_id] = (sample_t) lround( BENCH_RTA_LEVEL*DSP_MAX_SAMPLE_VALUE*value );
+      }
+    }
+    res = dsp_filter( channels, block, frames*DSP_NUM_CHANNELS*sizeof( sample_t ), &clip_flag );
+
+    start_ns = bench_nanos();
+    dsp_rta_block( block, frames );
+    *block_ns += bench_nanos() - start_ns;
+
+    do {
+      start_ns = bench_nanos();
+      clip_flag = dsp_rta_poll( channels, budget_us );
+      call_ns = bench_nanos() - start_ns;
+      *poll_ns += call_ns;
+      *max_poll_ns = call_ns > *max_poll_ns ? call_ns : *max_poll_ns;
+      ++*polls;
+    } while( clip_flag );
+  }
+  *block_ns /= blocks;
+
+  // Only the bands centered on a sine: at 1/12 octave every fourth band
+  *max_error = 0;
+  *compared = 0;
+  for( int channel_id = 0; res == ESP_OK && channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    bands = dsp_rta_levels( channel_id, freq, level );
+    if( bands == 0 ) {
+      res = ESP_FAIL;
+      break;
+    }
+    mix = 0;
+    for( int i = 0; i < DSP_NUM_CHANNELS; ++i ) {
+      mix += channels[channel_id].mix[i];
+    }
+    for( int band = 0; band < bands; band += bands_per_octave/3 ) {
+      bench_plot_reference( &channels[channel_id], freq[band], &re, &im );
+      expected = 20*log10( BENCH_RTA_LEVEL*fabs( mix )*sqrt( re*re + im*im ) + 1e-30 );
+      if( expected > BENCH_RTA_FLOOR_DB ) {
+        *max_error = fmax( *max_error, fabs( level[band] - expected ) );
+        ++*compared;
+      }
+    }
+  }
+
+  dsp_rta_start( 0, DSP_PLOT_CSV );
+  bench_capture_end( sink, stdout_fd );
+  fclose( sink );
+  dsp_filter_deinit( channels );
+
+  return( *compared > 0 ? res : ESP_FAIL );
+}
+
+static esp_err_t bench_rta_section() {
+
+  static const int  bands[] = { 3, 12 };
+  double            max_error;
+  int               compared;
+  int               polls;
+  uint64_t          block_ns;
+  uint64_t          poll_ns;
+  uint64_t          max_poll_ns;
+  esp_err_t         res = ESP_OK;
+
+  printf( "\nAnalyzer benchmark: %d point FFT of the output decimated by %d, %.1f s of audio per run, %d bytes of RAM\n",
+    DSP_RTA_FFT_LEN, DSP_RTA_DECIMATION, BENCH_RTA_SECONDS, dsp_rta_memory() );
+
+  for( int b = 0; res == ESP_OK && b < ARRAY_LEN( bands ); ++b ) {
+    res = bench_rta_run( bands[b], DSP_RTA_BUDGET_US, &max_error, &compared, &block_ns, &poll_ns, &max_poll_ns, &polls );
+    if( res != ESP_OK ) {
+      break;
+    }
+    printf( "1/%-2d octave: %2d bands against double precision within %.2f dB; audio side %.2f us per %d frame block\n",
+      bands[b], compared, max_error, block_ns/1000.0, DSP_BLOCK_FRAMES );
+
+    // One step per call, as when every call of dsp_loop() runs over the budget
+    res = bench_rta_run( bands[b], 0, &max_error, &compared, &block_ns, &poll_ns, &max_poll_ns, &polls );
+    printf( "             in steps: %d calls, the longest %.1f us; %.2f ms of control loop per second of audio (%.3f%%)\n",
+      polls, max_poll_ns/1000.0, poll_ns/1e6/BENCH_RTA_SECONDS, poll_ns/1e7/BENCH_RTA_SECONDS );
+  }
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Main
+//------------------------------------------------------------------------------------
+
+int main( int argc, char* argv[] ) {
+
+  double      seconds = BENCH_DEFAULT_SECONDS;
+  const char* section = "all";
+  int         signal_frames;
+  sample_t*   signal;
+  esp_err_t   res = ESP_OK;
+
+  for( int i = 1; i < argc; ++i ) {
+    if( strcmp( argv[i], "-s" ) == 0 && i + 1 < argc ) {
+      seconds = atof( argv[++i] );
+    } else if( strcmp( argv[i], "-m" ) == 0 && i + 1 < argc ) {
+      section = argv[++i];
+    } else {
+      fprintf( stderr, "Usage: %s [-s seconds_of_audio_per_config] [-m all|pipeline|kernels|modes|updates|delay|width|engine|limiter|multirate|fir|mix|presets|plot|log|rta]\n", argv[0] );
+      return( 1 );
+    }
+  }
+
+  signal_frames = (int) ( seconds*DSP_SAMPLE_RATE );
+  if( signal_frames < DSP_MAX_SAMPLES ) {
+    signal_frames = DSP_MAX_SAMPLES;
+  }
+
+  signal = dsp_sim_signal( signal_frames, BENCH_SIGNAL_LEVEL );
+  if( signal == NULL ) {
+    fprintf( stderr, "Unable to allocate test signal\n" );
+    return( 1 );
+  }
+
+  if( strcmp( section, "all" ) == 0 || strcmp( section, "pipeline" ) == 0 ) {
+    res = bench_pipeline( signal, signal_frames, seconds );
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "kernels" ) == 0 ) ) {
+    res = bench_kernel_section( signal, signal_frames, seconds );
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "modes" ) == 0 ) ) {
+    res = bench_mode_section( signal, signal_frames, seconds );
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "updates" ) == 0 ) ) {
+    res = bench_update_section( signal, signal_frames, seconds );
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "delay" ) == 0 ) ) {
+    res = bench_delay_section( signal, signal_frames, seconds );
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "width" ) == 0 ) ) {
+    res = bench_width_section( signal, signal_frames, seconds );
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "engine" ) == 0 ) ) {
+    res = bench_engine_section( signal, signal_frames, seconds );
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "limiter" ) == 0 ) ) {
+    res = bench_limiter_section( signal, signal_frames, seconds );
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "multirate" ) == 0 ) ) {
+    res = bench_multirate_section( signal, signal_frames, seconds );
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "fir" ) == 0 ) ) {
+    res = bench_fir_section( signal, signal_frames, seconds );
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "mix" ) == 0 ) ) {
+    res = bench_mix_section( signal, signal_frames, seconds );
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "presets" ) == 0 ) ) {
+    res = bench_preset_section( signal, signal_frames );
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "plot" ) == 0 ) ) {
+    res = bench_plot_section();
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "log" ) == 0 ) ) {
+    res = bench_log_section();
+  }
+
+  if( res == ESP_OK && ( strcmp( section, "all" ) == 0 || strcmp( section, "rta" ) == 0 ) ) {
+    res = bench_rta_section();
+  }
+
+  free( signal );
+
+  return( res == ESP_OK ? 0 : 1 );
+}
@@ -0,0 +1,210 @@
+#include "dsp_process.h"
+#include "dsp_config.h"
+#include "dsp_os.h"
+
+//------------------------------------------------------------------------------------
+// ES8388 set-up against a mock codec
+//
+// The codec is a register file behind a dsp_i2c_t that counts the transactions and
+// models the time they take on the bus: 9 clocks per byte, one per start and stop, and
+// a fixed cost per transaction for the driver (building the command link, queueing it
+// and the interrupts). The table-driven set-up of dsp_codec.cpp must leave the register
+// file exactly as the original one write per transaction code did, for 16 and 24 bit
+// words and after switching to the microphones and back; it is then run with a
+// register that does not acknowledge and with one whose bits read back wrong, and each
+// must be reported by register. The time from power-up to the first block written is
+// estimated for both: the codec set-up, then one block read and processed.
+//------------------------------------------------------------------------------------
+
+#define SIM_LEGACY_I2C_HZ     100000                    // Clock of the original set-up
+#define SIM_OVERHEAD_US       50                        // Driver cost of one I2C transaction (ESP-IDF command link)
+#define SIM_WRITE_CLOCKS      ( 1 + 3*9 )               // Start, address, register, value
+#define SIM_READ_CLOCKS       ( 1 + 2*9 + 1 + 2*9 )     // Start, address, register, repeated start, address, value
+#define SIM_NO_FAULT          -1
+
+static  uint8_t   sim_regs[256];                        // The codec's registers
+static  int       sim_hz = DSP_CODEC_I2C_HZ;
+static  int       sim_transactions = 0;
+static  double    sim_bus_us = 0;
+static  int       sim_nack_reg = SIM_NO_FAULT;          // Register that does not acknowledge
+static  int       sim_stuck_reg = SIM_NO_FAULT;         // Register whose bits outside sim_stuck_mask read 0
+static  uint8_t   sim_stuck_mask = 0xff;
+
+// The original es8388_init() and es8388_input(), one register per transaction
+static const dsp_codec_reg_t sim_legacy_boot[] = {
+  { ES8388_DACCONTROL3, 0x04 }, { ES8388_CONTROL2, 0x50 }, { ES8388_CHIPPOWER, 0x00 }, { ES8388_MASTERMODE, 0x00 },
+  { ES8388_DACPOWER, 0x30 }, { ES8388_CONTROL1, 0x12 },
+  { ES8388_DACCONTROL1, 0x18 }, { ES8388_DACCONTROL2, 0x02 },
+  { ES8388_DACCONTROL16, 0x00 }, { ES8388_DACCONTROL17, 0x90 }, { ES8388_DACCONTROL20, 0x90 },
+  { ES8388_DACCONTROL21, 0x80 }, { ES8388_DACCONTROL23, 0x00 },
+  { ES8388_DACCONTROL5, 0x00 }, { ES8388_DACCONTROL4, 0x00 },
+  { ES8388_ADCPOWER, 0xff }, { ES8388_ADCCONTROL1, 0x33 },
+  { ES8388_ADCCONTROL2, 0x50 }, { ES8388_ADCCONTROL3, 0x00 }, { ES8388_ADCCONTROL4, 0x0e }, { ES8388_ADCCONTROL5, 0x02 },
+  { ES8388_ADCCONTROL8, 0x20 }, { ES8388_ADCCONTROL9, 0x20 },
+  { ES8388_DACCONTROL24, 0x1e }, { ES8388_DACCONTROL25, 0x1e },
+  { ES8388_DACPOWER, 0x3c }, { ES8388_DACCONTROL3, 0x00 }, { ES8388_ADCPOWER, 0x09 }
+};
+
+#define SIM_LEGACY_DAC_FORMAT 6                         // Entries of the word length (16 bit values above)
+#define SIM_LEGACY_ADC_FORMAT 19
+
+static const dsp_codec_reg_t sim_legacy_mics[] = {
+  { ES8388_ADCPOWER, 0xff }, { ES8388_ADCCONTROL1, 0x88 }, { ES8388_ADCCONTROL2, 0x00 }, { ES8388_ADCPOWER, 0x00 }
+};
+
+static const dsp_codec_reg_t sim_legacy_aux[] = {
+  { ES8388_ADCPOWER, 0xff }, { ES8388_ADCCONTROL1, 0x33 }, { ES8388_ADCCONTROL2, 0x50 }, { ES8388_ADCPOWER, 0x09 }
+};
+
+
+//------------------------------------------------------------------------------------
+// Mock bus. A transaction stops at the first message that is not acknowledged; the
+// messages before it have reached the codec.
+//------------------------------------------------------------------------------------
+
+static esp_err_t sim_i2c_write( uint8_t addr, const dsp_codec_reg_t* regs, int count ) {
+
+  ++sim_transactions;
+  sim_bus_us += SIM_OVERHEAD_US + 1e6/sim_hz;
+  for( int i = 0; i < count; ++i ) {
+    sim_bus_us += 1e6*SIM_WRITE_CLOCKS/sim_hz;
+    if( addr != DSP_CODEC_ADDR || regs[i].reg == sim_nack_reg ) {
+      return( ESP_FAIL );
+    }
+    sim_regs[regs[i].reg] = regs[i].value;
+  }
+
+  return( ESP_OK );
+}
+
+static esp_err_t sim_i2c_read( uint8_t addr, const uint8_t* regs, uint8_t* values, int count ) {
+
+  ++sim_transactions;
+  sim_bus_us += SIM_OVERHEAD_US + 1e6/sim_hz;
+  for( int i = 0; i < count; ++i ) {
+    sim_bus_us += 1e6*SIM_READ_CLOCKS/sim_hz;
+    if( addr != DSP_CODEC_ADDR || regs[i] == sim_nack_reg ) {
+      return( ESP_FAIL );
+    }
+    values[i] = regs[i] == sim_stuck_reg ? sim_regs[regs[i]] & sim_stuck_mask : sim_regs[regs[i]];
+  }
+
+  return( ESP_OK );
+}
+
+static const dsp_i2c_t sim_i2c = { sim_i2c_write, sim_i2c_read };
+
+// Power-on state of the mock: not the ES8388 defaults, just a pattern every set-up must overwrite
+static void sim_reset( int hz ) {
+
+  for( int reg = 0; reg < (int) sizeof( sim_regs ); ++reg ) {
+    sim_regs[reg] = (uint8_t) ( reg*37 + 11 );
+  }
+  sim_hz = hz;
+  sim_transactions = 0;
+  sim_bus_us = 0;
+}
+
+// The original code: one transaction per register, no read back
+static void sim_legacy( const dsp_codec_reg_t* regs, int count, int word_bits ) {
+
+  dsp_codec_reg_t   reg;
+
+  for( int i = 0; i < count; ++i ) {
+    reg = regs[i];
+    if( word_bits == 24 && ( i == SIM_LEGACY_DAC_FORMAT || i == SIM_LEGACY_ADC_FORMAT ) ) {
+      reg.value = 0x00;
+    }
+    sim_i2c_write( DSP_CODEC_ADDR, &reg, 1 );
+  }
+}
+
+static int sim_compare( const uint8_t* expected, const char* what ) {
+
+  int       differences = 0;
+
+  for( int reg = 0; reg < (int) sizeof( sim_regs ); ++reg ) {
+    if( sim_regs[reg] != expected[reg] ) {
+      printf( "E-SIM: %s: register 0x%02x is 0x%02x, the original code left 0x%02x\n", what, reg, sim_regs[reg], expected[reg] );
+      ++differences;
+    }
+  }
+
+  return( differences );
+}
+
+
+//------------------------------------------------------------------------------------
+// Main
+//------------------------------------------------------------------------------------
+
+int main( int argc, char* argv[] ) {
+
+  static const int  word_bits[] = { 16, 24 };
+  uint8_t           legacy[sizeof( sim_regs )];
+  uint8_t           legacy_mics[sizeof( sim_regs )];
+  uint8_t           legacy_aux[sizeof( sim_regs )];
+  dsp_codec_stats_t stats;
+  int               legacy_transactions;
+  double            legacy_us;
+  double            block_us = 1e6*DSP_BLOCK_FRAMES/DSP_SAMPLE_RATE;
+  int               failures = 0;
+  esp_err_t         res;
+
+  for( int w = 0; w < (int) ( sizeof( word_bits )/sizeof( word_bits[0] ) ); ++w ) {
+    sim_reset( SIM_LEGACY_I2C_HZ );
+    sim_legacy( sim_legacy_boot, sizeof( sim_legacy_boot )/sizeof( sim_legacy_boot[0] ), word_bits[w] );
+    memcpy( legacy, sim_regs, sizeof( legacy ) );
+    legacy_transactions = sim_transactions;
+    legacy_us = sim_bus_us;
+    sim_legacy( sim_legacy_mics, sizeof( sim_legacy_mics )/sizeof( sim_legacy_mics[0] ), word_bits[w] );
+    memcpy( legacy_mics, sim_regs, sizeof( legacy_mics ) );
+    sim_legacy( sim_legacy_aux, sizeof( sim_legacy_aux )/sizeof( sim_legacy_aux[0] ), word_bits[w] );
+    memcpy( legacy_aux, sim_regs, sizeof( legacy_aux ) );
+
+    sim_reset( DSP_CODEC_I2C_HZ );
+    res = dsp_codec_init( &sim_i2c, word_bits[w] );
+    dsp_codec_get_stats( &stats );
+    failures += ( res != ESP_OK ) + sim_compare( legacy, "Set-up" );
+
+    printf( "I-SIM: %d bit words: original %d writes in %d transactions at %d kHz: %.2f ms; tables %d writes and %d reads in %d transactions at %d kHz: %.2f ms (%s)\n",
+      word_bits[w], legacy_transactions, legacy_transactions, SIM_LEGACY_I2C_HZ/1000, legacy_us/1000,
+      stats.writes, stats.reads, stats.transactions, DSP_CODEC_I2C_HZ/1000, sim_bus_us/1000, res == ESP_OK ? "verified" : "FAILED" );
+    printf( "I-SIM:   power-up to first audio, set-up plus one %d frame block: original %.2f ms, tables %.2f ms\n",
+      DSP_BLOCK_FRAMES, ( legacy_us + block_us )/1000, ( sim_bus_us + block_us )/1000 );
+
+    // Microphones for a measurement, then back to AUX IN
+    sim_bus_us = 0;
+    res = dsp_codec_input( true );
+    failures += ( res != ESP_OK ) + sim_compare( legacy_mics, "Microphones" );
+    dsp_codec_get_stats( &stats );
+    printf( "I-SIM:   input switch %d writes and %d reads in %d transactions: %.2f ms\n", stats.writes, stats.reads, stats.transactions, sim_bus_us/1000 );
+    res = dsp_codec_input( false );
+    failures += ( res != ESP_OK ) + sim_compare( legacy_aux, "Back to AUX IN" );
+  }
+
+  // A register that does not acknowledge: reported by name, the rest is written
+  printf( "I-SIM: DACCONTROL17 (0x%02x) not acknowledged:\n", ES8388_DACCONTROL17 );
+  sim_reset( DSP_CODEC_I2C_HZ );
+  sim_nack_reg = ES8388_DACCONTROL17;
+  res = dsp_codec_init( &sim_i2c, 16 );
+  dsp_codec_get_stats( &stats );
+  sim_nack_reg = SIM_NO_FAULT;
+  printf( "I-SIM:   result %d, %d registers failed in %d transactions\n", res, stats.failed, stats.transactions );
+  failures += res != ESP_FAIL || stats.failed != 2 || stats.mismatched != 0;
+
+  // A register whose upper bits read 0
+  printf( "I-SIM: ADCCONTROL1 (0x%02x) reads its upper bits as 0:\n", ES8388_ADCCONTROL1 );
+  sim_reset( DSP_CODEC_I2C_HZ );
+  sim_stuck_reg = ES8388_ADCCONTROL1;
+  sim_stuck_mask = 0x0f;
+  res = dsp_codec_init( &sim_i2c, 16 );
+  dsp_codec_get_stats( &stats );
+  sim_stuck_reg = SIM_NO_FAULT;
+  printf( "I-SIM:   result 0x%x, %d registers mismatched\n", res, stats.mismatched );
+  failures += res != ESP_ERR_INVALID_RESPONSE || stats.mismatched != 1;
+
+  printf( "I-SIM: %s\n", failures == 0 ? "PASSED" : "FAILED" );
+
+  return( failures == 0 ? 0 : 1 );
+}
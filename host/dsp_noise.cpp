@@ -0,0 +1,217 @@
+#include "dsp_process.h"
+#include "dsp_config.h"
+#include "dsp_sim.h"
+
+//------------------------------------------------------------------------------------
+// Filter topology noise tool
+//
+// Runs the biquad cascade of every configured channel (dsp_config.h, gain left out)
+// through each filter topology, block by block as dsp_filter() would, and reports:
+//
+//   noise_dB     - RMS difference from a double precision Direct Form I reference over
+//                  the test signal, before rounding to the output word, in dB relative
+//                  to full scale
+//   max_err      - largest difference, in output LSBs
+//   tail_peak    - largest output, rounded to the output word as dsp_filter() does,
+//                  during the second half of a stretch of silence after the signal.
+//                  The filters have decayed by then, so anything left is a limit cycle.
+//   tail_nonzero - share of those outputs that are not zero
+//------------------------------------------------------------------------------------
+
+#define NOISE_SIGNAL_LEVEL    0.25
+#define NOISE_SIGNAL_SECONDS  2.0
+#define NOISE_TAIL_SECONDS    1.0
+
+typedef esp_err_t (*noise_kernel_t)( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters );
+
+static const struct {
+  const char*       name;
+  noise_kernel_t    kernel;                             // NULL for the fixed-point engine
+} noise_topologies[] = {
+  { "df2",          dsp_biquad_cascade_f32_opt },
+  { "tdf2",         dsp_biquad_cascade_f32_tdf2 },
+  { "df1_ef",       dsp_biquad_cascade_f32_df1 },
+  { "tdf2_mixed",   dsp_biquad_cascade_f32_mixed },
+  { "fixed_q31",    NULL }
+};
+
+#define ARRAY_LEN( a )        ( (int) ( sizeof( a )/sizeof( a[0] ) ) )
+
+#if DSP_SAMPLE_BITS == 32
+#define NOISE_LSB             256.0                     // The low byte of the 32 bit slot is not used
+#else
+#define NOISE_LSB             1.0
+#endif
+
+
+//------------------------------------------------------------------------------------
+// Double precision Direct Form I reference
+//------------------------------------------------------------------------------------
+
+static void noise_reference( const sample_t* input, double* output, int len, float coeffs[][5], int num_filters ) {
+
+  double    w[DSP_MAX_FILTERS][4] = { { 0 } };
+  double    x;
+  double    y;
+
+  for( int i = 0; i < len; ++i ) {
+    x = input[i];
+
+    for( int s = 0; s < num_filters; ++s ) {
+      y = coeffs[s][0]*x + coeffs[s][1]*w[s][0] + coeffs[s][2]*w[s][1] - coeffs[s][3]*w[s][2] - coeffs[s][4]*w[s][3];
+      w[s][1] = w[s][0];
+      w[s][0] = x;
+      w[s][3] = w[s][2];
+      w[s][2] = y;
+      x = y;
+    }
+
+    output[i] = x;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Run one topology over the input, giving the output before and after rounding to the
+// output word
+//------------------------------------------------------------------------------------
+
+static esp_err_t noise_run( int topology, const sample_t* input, int len, int frames, dsp_channel_t* channel,
+                            double* output, sample_t* output_word ) {
+
+  float             w[DSP_MAX_FILTERS][DSP_BIQUAD_STATE_LEN] = { { 0 } };
+  int32_t           state[DSP_MAX_FILTERS][6] = { { 0 } };
+  dsp_biquad_q31_t  coeffs_q31[DSP_MAX_FILTERS];
+  float             block[DSP_MAX_SAMPLES];
+  int32_t           block_q31[DSP_MAX_SAMPLES];
+  esp_err_t         res = ESP_OK;
+
+  if( noise_topologies[topology].kernel == NULL &&
+      dsp_biquad_q31_quantize( channel->coeffs, channel->num_filters, coeffs_q31 ) != ESP_OK ) {
+    return( ESP_FAIL );
+  }
+
+  for( int start = 0; start + frames <= len && res == ESP_OK; start += frames ) {
+    if( noise_topologies[topology].kernel != NULL ) {
+      for( int i = 0; i < frames; ++i ) {
+        block[i] = input[start + i];
+      }
+
+      res = noise_topologies[topology].kernel( block, frames, channel->coeffs, w, channel->num_filters );
+
+      for( int i = 0; i < frames; ++i ) {
+        output[start + i] = block[i];
+        output_word[start + i] = block[i];
+      }
+    } else {
+      for( int i = 0; i < frames; ++i ) {
+        block_q31[i] = DSP_Q31_FROM_SAMPLE( input[start + i] );
+      }
+
+      res = dsp_biquad_cascade_q31( block_q31, frames, coeffs_q31, state, channel->num_filters );
+
+      for( int i = 0; i < frames; ++i ) {
+        output[start + i] = (double) block_q31[i]*DSP_MAX_SAMPLE_VALUE/DSP_Q31_MAX_SAMPLE_VALUE;
+        output_word[start + i] = DSP_Q31_TO_SAMPLE( block_q31[i] );
+      }
+    }
+  }
+
+  return( res );
+}
+
+
+int main( int argc, char* argv[] ) {
+
+  const int         frames = DSP_BLOCK_FRAMES;
+  double            seconds = NOISE_SIGNAL_SECONDS;
+  double            tail_seconds = NOISE_TAIL_SECONDS;
+  int               signal_frames;
+  int               tail_frames;
+  int               len;
+  sample_t*         signal;
+  sample_t*         input;
+  sample_t*         output_word;
+  double*           output;
+  double*           reference;
+  double            sum;
+  double            error;
+  double            max_error;
+  double            tail_peak;
+  int               tail_nonzero;
+  dsp_channel_t*    channel;
+
+  for( int i = 1; i < argc; ++i ) {
+    if( strcmp( argv[i], "-s" ) == 0 && i + 1 < argc ) {
+      seconds = atof( argv[++i] );
+    } else if( strcmp( argv[i], "-t" ) == 0 && i + 1 < argc ) {
+      tail_seconds = atof( argv[++i] );
+    } else {
+      fprintf( stderr, "Usage: %s [-s seconds_of_signal] [-t seconds_of_silence]\n", argv[0] );
+      return( 1 );
+    }
+  }
+
+  signal_frames = ( (int) ( seconds*DSP_SAMPLE_RATE )/frames + 1 )*frames;
+  tail_frames = ( (int) ( tail_seconds*DSP_SAMPLE_RATE )/frames + 2 )*frames;
+  len = signal_frames + tail_frames;
+
+  signal = dsp_sim_signal( signal_frames, NOISE_SIGNAL_LEVEL );
+  input = (sample_t*) calloc( len, sizeof( sample_t ) );
+  output_word = (sample_t*) malloc( len*sizeof( sample_t ) );
+  output = (double*) malloc( len*sizeof( double ) );
+  reference = (double*) malloc( len*sizeof( double ) );
+
+  if( signal == NULL || input == NULL || output_word == NULL || output == NULL || reference == NULL ) {
+    fprintf( stderr, "Unable to allocate buffers\n" );
+    return( 1 );
+  }
+
+  printf( "Filter topology noise: %d bit samples, %.1f s of signal at %.2f of full scale, then %.1f s of silence, %d frames per block\n",
+    DSP_SAMPLE_BITS, seconds, NOISE_SIGNAL_LEVEL, tail_seconds, frames );
+  printf( "%-12s %7s %-12s %10s %10s %10s %13s\n", "channel", "filters", "topology", "noise_dB", "max_err", "tail_peak", "tail_nonzero%" );
+
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    channel = &DSP_Channels[channel_id];
+
+    for( int i = 0; i < signal_frames; ++i ) {
+      input[i] = signal[i*DSP_NUM_CHANNELS + channel_id];
+    }
+
+    noise_reference( input, reference, len, channel->coeffs, channel->num_filters );
+
+    for( int t = 0; t < ARRAY_LEN( noise_topologies ); ++t ) {
+      if( noise_run( t, input, len, frames, channel, output, output_word ) != ESP_OK ) {
+        printf( "%-12s %7d %-12s %10s\n", channel->name, channel->num_filters, noise_topologies[t].name, "failed" );
+        continue;
+      }
+
+      sum = 0;
+      max_error = 0;
+      for( int i = 0; i < signal_frames; ++i ) {
+        error = output[i] - reference[i];
+        sum += error*error;
+        max_error = fmax( max_error, fabs( error ) );
+      }
+
+      tail_peak = 0;
+      tail_nonzero = 0;
+      for( int i = len - tail_frames/2; i < len; ++i ) {
+        tail_peak = fmax( tail_peak, fabs( (double) output_word[i] ) );
+        tail_nonzero += output_word[i] != 0;
+      }
+
+      printf( "%-12s %7d %-12s %10.1f %10.3f %10.0f %13.2f\n", channel->name, channel->num_filters, noise_topologies[t].name,
+        10*log10( sum/signal_frames + 1e-30 ) - 20*log10( (double) DSP_MAX_SAMPLE_VALUE ),
+        max_error/NOISE_LSB, tail_peak/NOISE_LSB, 100.0*tail_nonzero/( tail_frames/2 ) );
+    }
+  }
+
+  free( signal );
+  free( input );
+  free( output_word );
+  free( output );
+  free( reference );
+
+  return( 0 );
+}
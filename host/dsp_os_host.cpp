@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "dsp_os.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#define DSP_OS_HAVE_TSC     1
+#else
+#define DSP_OS_HAVE_TSC     0
+#endif
+
+//------------------------------------------------------------------------------------
+// pthreads implementation of the OS abstraction (Linux host build)
+//
+// Tasks are created as detached threads. Real-time scheduling is requested for the
+// given priority but silently dropped when the process is not allowed to use it; the
+// core is a hint that is applied only if the machine has that many CPUs. The cycle
+// counter is the TSC on x86, calibrated against the monotonic clock on first use, and
+// the monotonic clock in nanoseconds elsewhere. Records kept in flash are files named
+// after their key in $DSP_STORE_DIR (the current directory if it is not set).
+//------------------------------------------------------------------------------------
+
+typedef struct dsp_os_start_t {
+  dsp_os_task_t   task;
+  void*           arg;
+} dsp_os_start_t;
+
+static void* dsp_os_thread( void* start_arg ) {
+
+  dsp_os_start_t  start = *(dsp_os_start_t*) start_arg;
+
+  free( start_arg );
+  start.task( start.arg );
+
+  return( NULL );
+}
+
+esp_err_t dsp_os_task_create( dsp_os_task_t task, const char* name, int stack_size, int priority, int core, void* arg ) {
+
+  pthread_t           thread;
+  pthread_attr_t      attr;
+  struct sched_param  param;
+  dsp_os_start_t*     start;
+  cpu_set_t           cpus;
+  int                 res;
+
+  start = (dsp_os_start_t*) malloc( sizeof( dsp_os_start_t ) );
+  if( start == NULL ) {
+    return( ESP_FAIL );
+  }
+  start->task = task;
+  start->arg = arg;
+
+  pthread_attr_init( &attr );
+  pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+  pthread_attr_setstacksize( &attr, stack_size < PTHREAD_STACK_MIN ? PTHREAD_STACK_MIN : stack_size );
+
+  // Try real-time priority first and fall back to normal scheduling
+  pthread_attr_setinheritsched( &attr, PTHREAD_EXPLICIT_SCHED );
+  pthread_attr_setschedpolicy( &attr, SCHED_FIFO );
+  param.sched_priority = priority < sched_get_priority_max( SCHED_FIFO ) ? priority : sched_get_priority_max( SCHED_FIFO );
+  pthread_attr_setschedparam( &attr, &param );
+
+  res = pthread_create( &thread, &attr, dsp_os_thread, start );
+  if( res != 0 ) {
+    pthread_attr_setinheritsched( &attr, PTHREAD_INHERIT_SCHED );
+    res = pthread_create( &thread, &attr, dsp_os_thread, start );
+  }
+  pthread_attr_destroy( &attr );
+
+  if( res != 0 ) {
+    free( start );
+    return( ESP_FAIL );
+  }
+
+  pthread_setname_np( thread, name );
+
+  if( core >= 0 && core < CPU_SETSIZE && core < sysconf( _SC_NPROCESSORS_ONLN ) ) {
+    CPU_ZERO( &cpus );
+    CPU_SET( core, &cpus );
+    pthread_setaffinity_np( thread, sizeof( cpus ), &cpus );
+  }
+
+  return( ESP_OK );
+}
+
+void dsp_os_task_exit() {
+  pthread_exit( NULL );
+}
+
+int64_t dsp_os_time_us() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return( (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000 );
+}
+
+void dsp_os_delay_ms( int millis ) {
+  struct timespec ts = { millis/1000, ( millis % 1000 )*1000000L };
+  nanosleep( &ts, NULL );
+}
+
+uint32_t dsp_os_cycles() {
+#if DSP_OS_HAVE_TSC
+  return( (uint32_t) __rdtsc() );
+#else
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return( (uint32_t) ( (uint64_t) ts.tv_sec*1000000000ull + ts.tv_nsec ) );
+#endif
+}
+
+uint32_t dsp_os_cycles_per_us() {
+#if DSP_OS_HAVE_TSC
+  static uint32_t   cycles_per_us = 0;
+  uint64_t          start_cycles;
+  int64_t           start_us;
+
+  if( cycles_per_us == 0 ) {
+    start_cycles = __rdtsc();
+    start_us = dsp_os_time_us();
+    dsp_os_delay_ms( 20 );
+    cycles_per_us = (uint32_t) ( ( __rdtsc() - start_cycles )/( dsp_os_time_us() - start_us ) );
+  }
+
+  return( cycles_per_us > 0 ? cycles_per_us : 1 );
+#else
+  return( 1000 );
+#endif
+}
+
+static void dsp_os_store_path( const char* key, const char* suffix, char* path, size_t len ) {
+
+  const char*   dir = getenv( "DSP_STORE_DIR" );
+
+  snprintf( path, len, "%s/%s.bin%s", dir != NULL ? dir : ".", key, suffix );
+}
+
+esp_err_t dsp_os_store_read( const char* key, void* data, size_t* len ) {
+
+  char      path[PATH_MAX];
+  FILE*     file;
+  size_t    read_len;
+  bool      truncated;
+
+  dsp_os_store_path( key, "", path, sizeof( path ) );
+  file = fopen( path, "rb" );
+  if( file == NULL ) {
+    return( ESP_ERR_NOT_FOUND );
+  }
+
+  read_len = fread( data, 1, *len, file );
+  truncated = fgetc( file ) != EOF;
+  fclose( file );
+
+  *len = read_len;
+
+  return( truncated ? ESP_FAIL : ESP_OK );
+}
+
+// Written to a new file that replaces the old one, so a record is never left half written
+esp_err_t dsp_os_store_write( const char* key, const void* data, size_t len ) {
+
+  char      path[PATH_MAX];
+  char      temp[PATH_MAX];
+  FILE*     file;
+  bool      failed;
+
+  dsp_os_store_path( key, "", path, sizeof( path ) );
+  dsp_os_store_path( key, ".tmp", temp, sizeof( temp ) );
+  file = fopen( temp, "wb" );
+  if( file == NULL ) {
+    return( ESP_FAIL );
+  }
+
+  failed = fwrite( data, 1, len, file ) != len;
+  failed |= fclose( file ) != 0;
+
+  if( failed || rename( temp, path ) != 0 ) {
+    remove( temp );
+    return( ESP_FAIL );
+  }
+
+  return( ESP_OK );
+}
@@ -0,0 +1,206 @@
+#include "dsp_process.h"
+#include "dsp_os.h"
+#include "dsp_sim.h"
+
+//------------------------------------------------------------------------------------
+// Room measurement simulation
+//
+// Runs a measurement as the 'w' command does on the device, block by block, against a
+// simulated room: every block written comes back through the I2S latency (one block
+// per DMA buffer), convolved with a known room impulse response, with noise and
+// optionally second order distortion added and quantized to the sample width. The
+// chunks are deconvolved between blocks as dsp_loop() would, then the measured impulse
+// and frequency response are compared with the true ones, and the RAM taken and the
+// deconvolution time are compared with a single transform of the whole recording and
+// with real time.
+//------------------------------------------------------------------------------------
+
+#define SIM_ROOM_DELAY        257                       // Direct sound delay in samples (2 m)
+
+static double sim_band_error( const float* measured, const float* reference, int size, double* worst_freq ) {
+
+  double    freq;
+  double    error;
+  double    worst = 0;
+
+  // 1/3 octave bands from 20 Hz to 16 kHz, as dsp_measure_report() prints them
+  for( int band = 0; band < 30; ++band ) {
+    freq = 1000*pow( 2, ( band - 17 )/3.0 );
+    error = fabs( dsp_measure_band( measured, size, freq, 1/3.0 ) - dsp_measure_band( reference, size, freq, 1/3.0 ) );
+    if( error > worst ) {
+      worst = error;
+      *worst_freq = freq;
+    }
+  }
+
+  return( worst );
+}
+
+
+int main( int argc, char* argv[] ) {
+
+  double            seconds = DSP_MEASURE_SECONDS;
+  int               ir_len = DSP_MEASURE_IR_LEN;
+  int               frames = DSP_BLOCK_FRAMES;
+  int               dma_buf_count = DSP_DMA_BUF_COUNT;
+  int               room_len = 0;
+  double            noise_dB = -90;
+  double            distortion = 0;
+  dsp_measure_t*    measure;
+  float*            room;
+  float*            played;
+  float*            reference;
+  sample_t*         buffer;
+  dsp_fft_t         fft;
+  int               latency;
+  int               total;
+  int               state = DSP_MEASURE_CAPTURING;
+  int               peak = 0;
+  int               clipped = 0;
+  int               full_size = 4;
+  int               full_memory;
+  int64_t           start_us;
+  int64_t           poll_us;
+  int64_t           poll_total_us = 0;
+  int64_t           poll_max_us = 0;
+  uint32_t          seed = 3;
+  double            y;
+  double            noise;
+  double            error = 0;
+  double            power = 0;
+  double            worst_freq = 0;
+  double            worst;
+
+  for( int i = 1; i < argc; ++i ) {
+    if( strcmp( argv[i], "-s" ) == 0 && i + 1 < argc ) {
+      seconds = atof( argv[++i] );
+    } else if( strcmp( argv[i], "-i" ) == 0 && i + 1 < argc ) {
+      ir_len = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-r" ) == 0 && i + 1 < argc ) {
+      room_len = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-f" ) == 0 && i + 1 < argc ) {
+      frames = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-d" ) == 0 && i + 1 < argc ) {
+      dma_buf_count = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-n" ) == 0 && i + 1 < argc ) {
+      noise_dB = atof( argv[++i] );
+    } else if( strcmp( argv[i], "-h" ) == 0 && i + 1 < argc ) {
+      distortion = atof( argv[++i] )/100;
+    } else {
+      fprintf( stderr, "Usage: %s [-s sweep_seconds] [-i ir_len] [-r room_ir_len] [-f frames_per_block] [-d dma_buffers] [-n noise_dBFS] [-h distortion_percent]\n", argv[0] );
+      return( 1 );
+    }
+  }
+
+  // By default the room dies away well inside the impulse response window
+  if( room_len <= 0 ) {
+    room_len = ir_len*3/4;
+  }
+
+  latency = frames*dma_buf_count;
+  if( frames < DSP_MIN_BLOCK_FRAMES || frames > DSP_MAX_BLOCK_FRAMES || dma_buf_count < 2 || room_len <= SIM_ROOM_DELAY ||
+      dsp_measure_create( &measure, seconds, ir_len, latency, 0, DSP_MEASURE_MIC_SLOT ) != ESP_OK ) {
+    fprintf( stderr, "Invalid arguments\n" );
+    return( 1 );
+  }
+
+  total = measure->chunks*measure->chunk;
+  room = dsp_sim_room( room_len, SIM_ROOM_DELAY );
+  played = (float*) calloc( total + latency + frames, sizeof( float ) );
+  buffer = (sample_t*) malloc( frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+  if( room == NULL || played == NULL || buffer == NULL ) {
+    fprintf( stderr, "Initialization failed\n" );
+    return( 1 );
+  }
+
+  printf( "Measuring: %.1f s sweep, %d sample impulse response, room %d samples, I2S latency %d samples, noise %.0f dBFS, distortion %.1f%%\n",
+    seconds, ir_len, room_len, latency, noise_dB, 100*distortion );
+
+  for( int t = 0; state == DSP_MEASURE_CAPTURING; t += frames ) {
+    // What the microphone picks up of the samples played so far
+    for( int i = 0; i < frames; ++i ) {
+      y = 0;
+      for( int k = 0; k < room_len && k <= t + i; ++k ) {
+        y += room[k]*played[t + i - k];
+      }
+      y /= DSP_MAX_SAMPLE_VALUE;
+      seed = seed*1664525 + 1013904223;
+      noise = pow( 10, noise_dB/20 )*sqrt( 3.0 )*( (int32_t) seed/2147483648.0 );
+      y = ( y + distortion*y*y + noise )*DSP_MAX_SAMPLE_VALUE;
+      if( fabs( y ) > DSP_MAX_SAMPLE_VALUE ) {
+        y = y > 0 ? DSP_MAX_SAMPLE_VALUE : -DSP_MAX_SAMPLE_VALUE;
+        ++clipped;
+      }
+      for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+        buffer[i*DSP_NUM_CHANNELS + channel_id] = channel_id == DSP_MEASURE_MIC_SLOT ? (sample_t) lrint( y ) : 0;
+      }
+    }
+
+    dsp_measure_block( measure, buffer, frames );
+    for( int i = 0; i < frames; ++i ) {
+      played[t + latency + i] = buffer[i*DSP_NUM_CHANNELS];
+    }
+
+    start_us = dsp_os_time_us();
+    state = dsp_measure_poll( measure );
+    poll_us = dsp_os_time_us() - start_us;
+    poll_total_us += poll_us;
+    poll_max_us = poll_us > poll_max_us ? poll_us : poll_max_us;
+  }
+
+  if( state != DSP_MEASURE_DONE ) {
+    fprintf( stderr, "Measurement failed\n" );
+    return( 1 );
+  }
+
+  dsp_measure_report( measure );
+  if( clipped > 0 ) {
+    printf( "I-SIM: The microphone clipped on %d samples\n", clipped );
+  }
+
+  // The true response, placed in the window as the measured one is
+  reference = (float*) calloc( measure->size, sizeof( float ) );
+  if( reference == NULL || dsp_fft_init( &fft, measure->size ) != ESP_OK ) {
+    return( 1 );
+  }
+  for( int k = 0; k < room_len && measure->pre + k < ir_len; ++k ) {
+    reference[measure->pre + k] = room[k];
+  }
+  dsp_fft_forward( &fft, reference );
+
+  // Complex error from two octaves above the start of the sweep to near its end
+  for( int k = (int) ( 4*DSP_MEASURE_START_HZ*measure->size/DSP_SAMPLE_RATE );
+       k < (int) ( 0.9*DSP_MEASURE_END_HZ*measure->size/DSP_SAMPLE_RATE ); ++k ) {
+    error += pow( measure->work[2*k] - reference[2*k], 2 ) + pow( measure->work[2*k + 1] - reference[2*k + 1], 2 );
+    power += pow( reference[2*k], 2 ) + pow( reference[2*k + 1], 2 );
+  }
+  worst = sim_band_error( measure->work, reference, measure->size, &worst_freq );
+
+  for( int m = 1; m < ir_len; ++m ) {
+    if( fabsf( measure->ir[m] ) > fabsf( measure->ir[peak] ) ) {
+      peak = m;
+    }
+  }
+
+  // A single transform of the whole recording against the whole inverse sweep
+  while( full_size < total + measure->sweep_len ) {
+    full_size <<= 1;
+  }
+  full_memory = (int) ( 3*full_size*sizeof( float ) + full_size/2*sizeof( uint16_t ) );
+
+  printf( "I-SIM: Direct sound at %d samples (true %d), response error %.1f dB in band, 1/3 octave bands within %.2f dB (worst at %.0f Hz)\n",
+    peak - measure->pre, SIM_ROOM_DELAY, 10*log10( error/power + 1e-20 ), worst, worst_freq );
+  printf( "I-SIM: RAM %d kB in %d chunks of %d samples, a single transform of the whole recording would take %d kB\n",
+    dsp_measure_memory( ir_len )/1024, measure->chunks, measure->chunk, full_memory/1024 );
+  printf( "I-SIM: Deconvolution %.1f ms in total, at most %.2f ms per block against %.2f ms of audio per chunk\n",
+    poll_total_us/1000.0, poll_max_us/1000.0, 1000.0*measure->chunk/DSP_SAMPLE_RATE );
+
+  dsp_fft_free( &fft );
+  dsp_measure_free( measure );
+  free( reference );
+  free( room );
+  free( played );
+  free( buffer );
+
+  return( 0 );
+}
@@ -0,0 +1,195 @@
+#include <time.h>
+#include "dsp_process.h"
+#include "dsp_config.h"
+#include "dsp_os.h"
+#include "dsp_sim.h"
+
+//------------------------------------------------------------------------------------
+// Real-time scheduler simulation
+//
+// Runs the audio task exactly as on the device, but against the simulated I2S clock,
+// then reports the task statistics (deadline misses, busy time, late reads) together
+// with what the simulated DMA ring saw. Extra per-block load and periodic stalls can be
+// injected to check that overload is detected, and gain updates can be published from
+// the main (control) thread while the audio task runs. The control thread reports
+// clipping and prints the log ring as dsp_loop() does on the device; raise the signal level with -a to drive
+// the limiter. The block size and DMA depth can be chosen as with the 'k' command, and
+// the latency measured through the simulated TX ring is compared with the estimate the
+// device prints. With -r both channels get a synthetic room correction FIR filter of
+// that many taps, and the stage report shows how long the filters could get. With -o
+// the audio tap streams the given points (as the 'o' command) to dsp_tap_client; with
+// -y the control thread runs the analyzer of the output (as the 'f' command).
+//------------------------------------------------------------------------------------
+
+#define SIM_SIGNAL_LEVEL      0.25
+#define SIM_CONTROL_MS        10                        // Control loop period when no updates are published
+
+static  int       sim_load_us    = 0;                   // Extra busy time added to every block
+static  int       sim_stall_us   = 0;                   // Extra busy time added every 'sim_stall_every' blocks
+static  int       sim_stall_every = 0;
+static  uint32_t  sim_blocks     = 0;
+
+
+static void sim_busy_wait( int micros ) {
+  int64_t end_us = dsp_os_time_us() + micros;
+  while( dsp_os_time_us() < end_us ) {
+  }
+}
+
+static esp_err_t sim_process( sample_t* buffer, size_t buffer_len ) {
+
+  esp_err_t   res;
+  bool        clip_flag;
+
+  res = dsp_filter( DSP_Channels, buffer, buffer_len, &clip_flag );
+
+  ++sim_blocks;
+  sim_busy_wait( sim_load_us );
+  if( sim_stall_every > 0 && ( sim_blocks % sim_stall_every ) == 0 ) {
+    sim_busy_wait( sim_stall_us );
+  }
+
+  return( res );
+}
+
+static const dsp_task_io_t  sim_io = { dsp_sim_read, sim_process, dsp_sim_write };
+
+
+int main( int argc, char* argv[] ) {
+
+  double            seconds = 2.0;
+  int               frames = DSP_BLOCK_FRAMES;
+  int               dma_buf_count = DSP_DMA_BUF_COUNT;
+  int               signal_frames = DSP_SAMPLE_RATE;
+  sample_t*         signal;
+  sample_t*         buffer;
+  dsp_sim_stats_t   sim_stats;
+  int               update_ms = 0;
+  int               updates = 0;
+  double            level = SIM_SIGNAL_LEVEL;
+  int               fir_taps = 0;
+  int               tap_points = 0;
+  int               rta_bands = 0;
+  float*            fir_coeffs = NULL;
+  int64_t           end_us;
+  int64_t           report_us;
+
+  for( int i = 1; i < argc; ++i ) {
+    if( strcmp( argv[i], "-s" ) == 0 && i + 1 < argc ) {
+      seconds = atof( argv[++i] );
+    } else if( strcmp( argv[i], "-f" ) == 0 && i + 1 < argc ) {
+      frames = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-d" ) == 0 && i + 1 < argc ) {
+      dma_buf_count = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-l" ) == 0 && i + 1 < argc ) {
+      sim_load_us = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-j" ) == 0 && i + 2 < argc ) {
+      sim_stall_every = atoi( argv[++i] );
+      sim_stall_us = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-u" ) == 0 && i + 1 < argc ) {
+      update_ms = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-a" ) == 0 && i + 1 < argc ) {
+      level = atof( argv[++i] );
+    } else if( strcmp( argv[i], "-r" ) == 0 && i + 1 < argc ) {
+      fir_taps = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-o" ) == 0 && i + 1 < argc ) {
+      tap_points = atoi( argv[++i] );
+    } else if( strcmp( argv[i], "-y" ) == 0 && i + 1 < argc ) {
+      rta_bands = atoi( argv[++i] );
+    } else {
+      fprintf( stderr, "Usage: %s [-s seconds] [-f frames_per_block] [-d dma_buffers] [-l extra_load_us] [-j every_n_blocks stall_us] [-u update_every_ms] [-a signal_level] [-r fir_taps] [-o tap_points] [-y bands_per_octave]\n", argv[0] );
+      return( 1 );
+    }
+  }
+
+  if( frames < DSP_MIN_BLOCK_FRAMES || frames > DSP_MAX_BLOCK_FRAMES || dma_buf_count < 2 || dma_buf_count > DSP_MAX_DMA_BUF_COUNT ) {
+    fprintf( stderr, "Frames per block must be between %d and %d, DMA buffers between 2 and %d\n",
+      DSP_MIN_BLOCK_FRAMES, DSP_MAX_BLOCK_FRAMES, DSP_MAX_DMA_BUF_COUNT );
+    return( 1 );
+  }
+
+  if( fir_taps > 0 ) {
+    fir_coeffs = dsp_sim_fir( fir_taps );
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      DSP_Channels[channel_id].fir_taps = fir_taps;
+      DSP_Channels[channel_id].fir_coeffs = fir_coeffs;
+    }
+  }
+
+  signal = dsp_sim_signal( signal_frames, level );
+  buffer = (sample_t*) malloc( frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+  if( signal == NULL || buffer == NULL || dsp_filter_set_block( frames ) != ESP_OK || dsp_filter_init( DSP_Channels ) != ESP_OK ) {
+    fprintf( stderr, "Initialization failed\n" );
+    return( 1 );
+  }
+
+  printf( "Simulating %.1f s: %d frames per block (%.2f ms), %d DMA buffers, extra load %d us, stall %d us every %d blocks, %d FIR taps\n",
+    seconds, frames, 1000.0*frames/DSP_SAMPLE_RATE, dma_buf_count, sim_load_us, sim_stall_us, sim_stall_every, fir_taps );
+
+  dsp_sim_init( signal, signal_frames, frames, dma_buf_count );
+
+  if( tap_points != 0 ) {
+    if( dsp_tap_set( tap_points, 1 ) != ESP_OK ) {
+      return( 1 );
+    }
+    dsp_tap_info();
+  }
+
+  if( rta_bands != 0 && dsp_rta_start( rta_bands, DSP_PLOT_CHART ) != ESP_OK ) {
+    return( 1 );
+  }
+
+  if( dsp_task_start( &sim_io, buffer, frames*DSP_NUM_CHANNELS*sizeof( sample_t ) ) != ESP_OK ) {
+    return( 1 );
+  }
+
+  end_us = dsp_os_time_us() + (int64_t) ( seconds*1e6 );
+  report_us = dsp_os_time_us() + DSP_CLIP_REPORT_MS*1000;
+  while( dsp_os_time_us() < end_us ) {
+    dsp_os_delay_ms( update_ms > 0 ? update_ms : SIM_CONTROL_MS );
+
+    if( update_ms > 0 ) {
+      // Alternate the gain of all channels, as the serial/Telnet commands would
+      ++updates;
+      for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+        dsp_filter_set_gain( DSP_Channels, channel_id, updates % 2 ? -0.5 : 0.0 );
+      }
+    }
+
+    if( dsp_os_time_us() >= report_us ) {
+      report_us += DSP_CLIP_REPORT_MS*1000;
+      dsp_filter_clip_report( DSP_Channels );
+    }
+    dsp_log_drain( DSP_Channels, DSP_LOG_DRAIN_MAX );
+    dsp_rta_poll( DSP_Channels, DSP_RTA_BUDGET_US );
+  }
+  dsp_task_stop();
+  dsp_filter_clip_report( DSP_Channels );
+  dsp_log_drain( DSP_Channels, DSP_LOG_RING_LEN );
+
+  dsp_task_info();
+  dsp_profile_info( DSP_Channels );
+  if( tap_points != 0 ) {
+    dsp_tap_info();
+  }
+  if( rta_bands != 0 ) {
+    dsp_rta_info();
+  }
+  if( update_ms > 0 ) {
+    printf( "I-SIM: Updates published/swapped in = %d/%u, last swap latency = %u blocks\n",
+      updates, DSP_Channels[0].buffers->updates, DSP_Channels[0].buffers->swap_latency );
+  }
+  dsp_sim_get_stats( &sim_stats );
+  printf( "I-SIM: Blocks read/written/dropped = %u/%u/%u\n", sim_stats.blocks_read, sim_stats.blocks_written, sim_stats.blocks_dropped );
+  printf( "I-SIM: TX underruns = %u, latency min/max = %d/%d samples (%.2f/%.2f ms), estimate %d samples (%.2f ms)\n",
+    sim_stats.blocks_underrun, sim_stats.latency_min, sim_stats.latency_max,
+    1000.0*sim_stats.latency_min/DSP_SAMPLE_RATE, 1000.0*sim_stats.latency_max/DSP_SAMPLE_RATE,
+    frames*dma_buf_count, 1000.0*frames*dma_buf_count/DSP_SAMPLE_RATE );
+
+  dsp_filter_deinit( DSP_Channels );
+  free( signal );
+  free( buffer );
+  free( fir_coeffs );
+
+  return( 0 );
+}
@@ -0,0 +1,228 @@
+#include <time.h>
+#include "dsp_sim.h"
+#include "dsp_os.h"
+
+//------------------------------------------------------------------------------------
+// Simulated I2S clock (see dsp_sim.h)
+//------------------------------------------------------------------------------------
+
+static  const sample_t*   sim_signal         = NULL;
+static  int               sim_signal_frames  = 0;
+static  int               sim_block_frames   = 0;
+static  int               sim_dma_buf_count  = 0;
+static  int64_t           sim_start_us       = 0;
+static  int64_t           sim_next_block     = 0;      // Index of the next block to deliver
+static  int64_t           sim_read_block     = 0;      // Index of the block last delivered
+static  int64_t           sim_next_slot      = 0;      // TX ring slot the next write goes to
+static  dsp_sim_stats_t   sim_stats;
+
+
+//------------------------------------------------------------------------------------
+// Build a synthetic interleaved test signal: two low-frequency tones per channel plus a
+// little noise, peaking at 'level' relative to full scale. Free the result with free().
+//------------------------------------------------------------------------------------
+
+sample_t* dsp_sim_signal( int frames, double level ) {
+
+  sample_t*   signal;
+  double      value;
+  uint32_t    seed = 1;
+
+  signal = (sample_t*) malloc( frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+  if( signal == NULL ) {
+    return( NULL );
+  }
+
+  for( int i = 0; i < frames; ++i ) {
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      seed = seed*1664525 + 1013904223;
+      value = 0.6*sin( 2*PI*( 40 + 5*channel_id )*i/DSP_SAMPLE_RATE ) +
+              0.3*sin( 2*PI*( 85 + 7*channel_id )*i/DSP_SAMPLE_RATE ) +
+              0.1*( (int32_t) seed/2147483648.0 );
+      signal[i*DSP_NUM_CHANNELS + channel_id] = (sample_t) ( value*level*DSP_MAX_SAMPLE_VALUE );
+    }
+  }
+
+  return( signal );
+}
+
+
+//------------------------------------------------------------------------------------
+// Synthetic room correction FIR filter of the given length: a low-passed impulse with
+// ringing before and after it (mixed phase, as a correction filter would be) and a
+// decaying random tail. The caller frees the coefficients.
+//------------------------------------------------------------------------------------
+
+float* dsp_sim_fir( int taps ) {
+
+  float*      coeffs;
+  int         peak = taps/8 < 64 ? taps/8 : 64;
+  double      x;
+  uint32_t    seed = 7;
+
+  coeffs = (float*) malloc( taps*sizeof( float ) );
+  if( coeffs == NULL ) {
+    return( NULL );
+  }
+
+  for( int i = 0; i < taps; ++i ) {
+    seed = seed*1664525 + 1013904223;
+    x = ( i - peak )/4.0;
+    coeffs[i] = (float) ( ( x == 0 ? 1.0 : sin( PI*x )/( PI*x ) )*exp( -fabs( x )/8 )/4 +
+                          0.02*exp( -4.0*i/taps )*( (int32_t) seed/2147483648.0 ) );
+  }
+
+  return( coeffs );
+}
+
+
+//------------------------------------------------------------------------------------
+// Synthetic room impulse response of 'len' samples as a microphone would pick it up:
+// the direct sound 'delay' samples in, a few early reflections, a decaying 45 Hz room
+// mode and a decaying random tail, all gone below -60 dB by the end. The caller frees
+// the result.
+//------------------------------------------------------------------------------------
+
+float* dsp_sim_room( int len, int delay ) {
+
+  static const int    reflection_at[]   = { 0, 83, 211, 467, 733 };
+  static const float  reflection_gain[] = { 0.5f, 0.3f, -0.2f, 0.12f, -0.08f };
+
+  float*      ir;
+  double      decay;
+  double      tau;
+  uint32_t    seed = 11;
+
+  ir = (float*) calloc( len, sizeof( float ) );
+  if( ir == NULL ) {
+    return( NULL );
+  }
+
+  for( size_t r = 0; r < sizeof( reflection_at )/sizeof( reflection_at[0] ); ++r ) {
+    if( delay + reflection_at[r] < len ) {
+      ir[delay + reflection_at[r]] += reflection_gain[r];
+    }
+  }
+
+  // The mode peaks at +6 dB whatever its decay time, so a sweep at DSP_MEASURE_LEVEL does not clip
+  tau = ( len - delay )/6.9;
+  for( int i = delay; i < len; ++i ) {
+    seed = seed*1664525 + 1013904223;
+    decay = exp( -( i - delay )/tau );
+    ir[i] += (float) ( decay*( 4/tau*sin( 2*PI*45*( i - delay )/DSP_SAMPLE_RATE ) +
+                               0.005*( (int32_t) seed/2147483648.0 ) ) );
+  }
+
+  return( ir );
+}
+
+
+esp_err_t dsp_sim_init( const sample_t* signal, int signal_frames, int block_frames, int dma_buf_count ) {
+
+  if( signal_frames < block_frames || block_frames <= 0 || dma_buf_count <= 0 ) {
+    return( ESP_FAIL );
+  }
+
+  sim_signal = signal;
+  sim_signal_frames = signal_frames;
+  sim_block_frames = block_frames;
+  sim_dma_buf_count = dma_buf_count;
+  sim_start_us = dsp_os_time_us();
+  sim_next_block = 0;
+  sim_read_block = 0;
+  sim_next_slot = dma_buf_count;
+  memset( &sim_stats, 0, sizeof( sim_stats ) );
+
+  return( ESP_OK );
+}
+
+
+esp_err_t dsp_sim_read( sample_t* buffer, size_t buffer_len, size_t* bytes_read ) {
+
+  struct timespec   due;
+  int64_t           due_us;
+  int64_t           completed;
+  int               frames;
+  int               offset;
+
+  frames = buffer_len/sizeof( sample_t )/DSP_NUM_CHANNELS;
+  if( frames != sim_block_frames ) {
+    *bytes_read = 0;
+    return( ESP_FAIL );
+  }
+
+  // Blocks already completed by the DMA but not yet read; the ring only holds so many
+  completed = ( dsp_os_time_us() - sim_start_us )*DSP_SAMPLE_RATE/( 1000000ll*sim_block_frames );
+  if( completed - sim_next_block > sim_dma_buf_count ) {
+    sim_stats.blocks_dropped += completed - sim_dma_buf_count - sim_next_block;
+    sim_next_block = completed - sim_dma_buf_count;
+  }
+
+  // Wait until the block has been completely received
+  due_us = sim_start_us + ( sim_next_block + 1 )*sim_block_frames*1000000ll/DSP_SAMPLE_RATE;
+  due.tv_sec = due_us/1000000;
+  due.tv_nsec = ( due_us % 1000000 )*1000;
+  while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL ) != 0 ) {
+  }
+
+  offset = ( sim_next_block*sim_block_frames ) % ( sim_signal_frames - sim_block_frames + 1 );
+  memcpy( buffer, &sim_signal[offset*DSP_NUM_CHANNELS], buffer_len );
+
+  sim_read_block = sim_next_block;
+  ++sim_next_block;
+  ++sim_stats.blocks_read;
+  *bytes_read = buffer_len;
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Block period 'slot' plays TX slot 'slot'. The ring starts out with 'dma_buf_count'
+// silent buffers, so a slot can be filled once the buffer it reuses, slot - count, has
+// been sent, and must be filled before it starts playing.
+//------------------------------------------------------------------------------------
+
+static inline int64_t dsp_sim_slot_us( int64_t slot ) {
+  return( sim_start_us + slot*sim_block_frames*1000000ll/DSP_SAMPLE_RATE );
+}
+
+esp_err_t dsp_sim_write( const sample_t* buffer, size_t buffer_len ) {
+
+  struct timespec   free_at;
+  int64_t           free_us;
+  int64_t           playing;
+  int               latency;
+
+  // Wait for a free buffer
+  free_us = dsp_sim_slot_us( sim_next_slot - sim_dma_buf_count + 1 );
+  free_at.tv_sec = free_us/1000000;
+  free_at.tv_nsec = ( free_us % 1000000 )*1000;
+  while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &free_at, NULL ) != 0 ) {
+  }
+
+  // A slot that has started playing went out empty; take the next one
+  playing = ( dsp_os_time_us() - sim_start_us )*DSP_SAMPLE_RATE/( 1000000ll*sim_block_frames );
+  if( playing >= sim_next_slot ) {
+    ++sim_stats.blocks_underrun;
+    sim_next_slot = playing + 1;
+  }
+
+  latency = (int) ( sim_next_slot - sim_read_block )*sim_block_frames;
+  if( sim_stats.blocks_written == 0 || latency < sim_stats.latency_min ) {
+    sim_stats.latency_min = latency;
+  }
+  if( latency > sim_stats.latency_max ) {
+    sim_stats.latency_max = latency;
+  }
+
+  ++sim_next_slot;
+  ++sim_stats.blocks_written;
+
+  return( ESP_OK );
+}
+
+
+void dsp_sim_get_stats( dsp_sim_stats_t* stats ) {
+  *stats = sim_stats;
+}
@@ -0,0 +1,34 @@
+#ifndef _DSP_SIM_H
+#define _DSP_SIM_H
+
+#include "dsp_process.h"
+
+//------------------------------------------------------------------------------------
+// Simulated I2S interface for the host build. Input blocks become available at the
+// rate the real I2S clock would deliver them, with a DMA ring of the given depth: when
+// the reader falls further behind than the ring can hold, the oldest blocks are lost.
+// Output goes to a TX ring of the same depth: a write waits for the next buffer to be
+// sent and is played once the ring has gone round, or later if the writer fell behind
+// and the slot it was due in has already started playing (an underrun). The time from
+// a block's first input sample to its first output sample is the measured latency.
+//------------------------------------------------------------------------------------
+
+typedef struct dsp_sim_stats_t {
+  uint32_t     blocks_read;                      // Blocks delivered to the reader
+  uint32_t     blocks_dropped;                   // Blocks lost because the DMA ring overflowed
+  uint32_t     blocks_written;                   // Blocks written back
+  uint32_t     blocks_underrun;                  // Writes that missed their slot in the TX ring
+  int          latency_min;                      // Smallest input to output latency, in frames
+  int          latency_max;                      // Largest input to output latency, in frames
+} dsp_sim_stats_t;
+
+sample_t* dsp_sim_signal( int frames, double level );
+float*    dsp_sim_fir( int taps );
+float*    dsp_sim_room( int len, int delay );
+
+esp_err_t dsp_sim_init( const sample_t* signal, int signal_frames, int block_frames, int dma_buf_count );
+esp_err_t dsp_sim_read( sample_t* buffer, size_t buffer_len, size_t* bytes_read );
+esp_err_t dsp_sim_write( const sample_t* buffer, size_t buffer_len );
+void      dsp_sim_get_stats( dsp_sim_stats_t* stats );
+
+#endif
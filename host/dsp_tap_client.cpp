@@ -0,0 +1,356 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include "dsp_process.h"
+#include "dsp_os.h"
+#include "dsp_wav.h"
+
+//------------------------------------------------------------------------------------
+// Audio tap client
+//
+// Connects to the audio tap of the device ('o' command) or of dsp_rt_sim -o, checks
+// every frame of the stream (magic, format, sequence numbers in order, missing blocks)
+// and writes the input and output to WAV files if asked to. With -l it runs the tap
+// in this process instead, behind a loopback connection: a thread taps numbered blocks
+// of a known pattern at real-time pace (or -x times faster, 0 for as fast as possible),
+// and every sample that arrives is checked against it. Blocks the tap dropped must be
+// exactly the ones missing from the stream.
+//------------------------------------------------------------------------------------
+
+#define TAP_MAX_CHANNELS      8
+#define TAP_MAX_PAYLOAD       ( 65535*TAP_MAX_CHANNELS*4 )
+#define TAP_IDLE_MS           2000                      // Stream ended when nothing arrives for this long
+#define TAP_LOOPBACK_IDLE_MS  500
+#define TAP_POLL_MS           100
+
+typedef struct tap_point_t {
+  const char*  wav_path;
+  dsp_wav_t    wav;
+  uint32_t     sample_rate;
+  int          channels;
+  int          sample_bytes;
+  uint32_t     blocks;
+  uint64_t     frames;
+  uint32_t     missing;                                 // Sequence numbers skipped
+  int64_t      last_sequence;
+} tap_point_t;
+
+typedef struct tap_producer_t {
+  double       speed;                                   // Times real time, 0 for as fast as possible
+  double       seconds;
+  int          decimation;
+  int          frames;
+  uint32_t     blocks;                                  // Blocks tapped at each point
+  uint64_t     cycles;                                  // Spent in dsp_tap_block()
+  bool         done;                                    // (atomic)
+} tap_producer_t;
+
+
+//------------------------------------------------------------------------------------
+// Loopback: the pattern, constant over each run of frames the tap averages
+//------------------------------------------------------------------------------------
+
+static sample_t tap_pattern( uint32_t sequence, int run, int channel ) {
+  return( (sample_t) ( ( sequence*7 + run*3 + channel*1000 ) & 0x3fff ) );
+}
+
+static void tap_producer( void* arg ) {
+
+  tap_producer_t*   producer = (tap_producer_t*) arg;
+  static sample_t   input[DSP_MAX_BLOCK_FRAMES*DSP_NUM_CHANNELS];
+  static sample_t   output[DSP_MAX_BLOCK_FRAMES*DSP_NUM_CHANNELS];
+  double            period_us = 1e6*producer->frames/DSP_SAMPLE_RATE;
+  int64_t           start_us = dsp_os_time_us();
+  uint32_t          sequence;
+  uint32_t          start;
+
+  for( sequence = 0; dsp_os_time_us() - start_us < producer->seconds*1e6; ++sequence ) {
+    for( int i = 0; i < producer->frames; ++i ) {
+      for( int ch = 0; ch < DSP_NUM_CHANNELS; ++ch ) {
+        input[i*DSP_NUM_CHANNELS + ch] = tap_pattern( sequence, i/producer->decimation, ch );
+        output[i*DSP_NUM_CHANNELS + ch] = -input[i*DSP_NUM_CHANNELS + ch];
+      }
+    }
+
+    start = dsp_os_cycles();
+    dsp_tap_block( DSP_TAP_INPUT, sequence, input, producer->frames );
+    dsp_tap_block( DSP_TAP_OUTPUT, sequence, output, producer->frames );
+    producer->cycles += dsp_os_cycles() - start;
+
+    if( producer->speed > 0 ) {
+      while( dsp_os_time_us() - start_us < ( sequence + 1 )*period_us/producer->speed ) {
+        dsp_os_delay_ms( 1 );
+      }
+    }
+  }
+
+  producer->blocks = sequence;
+  __atomic_store_n( &producer->done, true, __ATOMIC_RELEASE );
+  dsp_os_task_exit();
+}
+
+
+//------------------------------------------------------------------------------------
+// Stream
+//------------------------------------------------------------------------------------
+
+// Receive len bytes; false if the connection closed or nothing came for idle_ms
+static bool tap_recv( int fd, void* data, size_t len, int idle_ms ) {
+
+  uint8_t*  next = (uint8_t*) data;
+  ssize_t   received;
+  int       idle = 0;
+
+  while( len > 0 ) {
+    received = recv( fd, next, len, 0 );
+    if( received > 0 ) {
+      next += received;
+      len -= received;
+      idle = 0;
+    } else if( received < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) && ( idle += TAP_POLL_MS ) < idle_ms ) {
+      continue;
+    } else {
+      return( false );
+    }
+  }
+
+  return( true );
+}
+
+static int tap_connect( const char* host, const char* port ) {
+
+  struct addrinfo   hints;
+  struct addrinfo*  addr;
+  struct timeval    timeout = { 0, TAP_POLL_MS*1000 };
+  int               fd;
+
+  memset( &hints, 0, sizeof( hints ) );
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if( getaddrinfo( host, port, &hints, &addr ) != 0 ) {
+    return( -1 );
+  }
+
+  fd = socket( addr->ai_family, addr->ai_socktype, addr->ai_protocol );
+  if( fd >= 0 && connect( fd, addr->ai_addr, addr->ai_addrlen ) != 0 ) {
+    close( fd );
+    fd = -1;
+  }
+  freeaddrinfo( addr );
+
+  if( fd >= 0 ) {
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+  }
+
+  return( fd );
+}
+
+
+int main( int argc, char* argv[] ) {
+
+  static tap_producer_t producer = { 1.0, 2.0, 1, 0, 0, 0, false };
+  static tap_point_t    points[2];
+  const char*           host = "127.0.0.1";
+  const char*           port = NULL;
+  char                  port_text[16];
+  double                seconds = 0;
+  bool                  loopback = false;
+  dsp_tap_header_t      header;
+  uint8_t*              payload;
+  tap_point_t*          point;
+  dsp_tap_stats_t       stats;
+  int                   fd;
+  int                   format_errors = 0;
+  int                   order_errors = 0;
+  int                   sample_errors = 0;
+  uint64_t              bytes = 0;
+  double                audio_seconds = 0;
+  int64_t               start_us;
+  int64_t               last_us;
+  double                wall_seconds;
+  bool                  passed;
+
+  points[0].last_sequence = points[1].last_sequence = -1;
+
+  for( int i = 1; i < argc; ++i ) {
+    if( strcmp( argv[i], "-s" ) == 0 && i + 1 < argc ) {
+      seconds = atof( argv[++i] );
+    } else if( strcmp( argv[i], "-i" ) == 0 && i + 1 < argc ) {
+      points[0].wav_path = argv[++i];
+    } else if( strcmp( argv[i], "-o" ) == 0 && i + 1 < argc ) {
+      points[1].wav_path = argv[++i];
+    } else if( strcmp( argv[i], "-l" ) == 0 ) {
+      loopback = true;
+    } else if( strcmp( argv[i], "-x" ) == 0 && i + 1 < argc ) {
+      producer.speed = atof( argv[++i] );
+    } else if( strcmp( argv[i], "-e" ) == 0 && i + 1 < argc ) {
+      producer.decimation = atoi( argv[++i] );
+    } else if( argv[i][0] != '-' && port == NULL ) {
+      if( i + 1 < argc && argv[i + 1][0] != '-' ) {
+        host = argv[i++];
+      }
+      port = argv[i];
+    } else {
+      fprintf( stderr, "Usage: %s [-s seconds] [-i input.wav] [-o output.wav] [host] [port]\n"
+                       "       %s -l [-s seconds] [-x speed] [-e decimation] (loopback test)\n", argv[0], argv[0] );
+      return( 1 );
+    }
+  }
+
+  for( int p = 0; p < 2; ++p ) {
+    if( points[p].wav_path != NULL && ( points[p].wav.file = fopen( points[p].wav_path, "wb" ) ) == NULL ) {
+      fprintf( stderr, "Unable to create '%s'\n", points[p].wav_path );
+      return( 1 );
+    }
+  }
+
+  if( loopback ) {
+    if( seconds > 0 ) {
+      producer.seconds = seconds;
+    }
+    seconds = 0;
+    if( dsp_tap_listen( 0 ) != ESP_OK || dsp_tap_set( DSP_TAP_INPUT | DSP_TAP_OUTPUT, producer.decimation ) != ESP_OK ) {
+      fprintf( stderr, "Unable to start the tap (the decimation must divide %d)\n", DSP_SAMPLE_RATE );
+      return( 1 );
+    }
+    // Whole runs of the decimation per block, so each streamed frame averages equal samples
+    producer.frames = DSP_BLOCK_FRAMES - DSP_BLOCK_FRAMES % producer.decimation;
+    snprintf( port_text, sizeof( port_text ), "%d", dsp_tap_port() );
+    port = port_text;
+  } else if( port == NULL ) {
+    snprintf( port_text, sizeof( port_text ), "%d", DSP_TAP_PORT );
+    port = port_text;
+  }
+
+  fd = tap_connect( host, port );
+  payload = (uint8_t*) malloc( TAP_MAX_PAYLOAD );
+  if( fd < 0 || payload == NULL ) {
+    fprintf( stderr, "Unable to connect to %s:%s\n", host, port );
+    return( 1 );
+  }
+
+  if( loopback ) {
+    for( dsp_tap_get_stats( &stats ); !stats.connected; dsp_tap_get_stats( &stats ) ) {
+      dsp_os_delay_ms( 1 );
+    }
+    if( dsp_os_task_create( tap_producer, "tap_producer", 16384, 1, 1, &producer ) != ESP_OK ) {
+      return( 1 );
+    }
+  }
+
+  start_us = last_us = dsp_os_time_us();
+  while( seconds == 0 || dsp_os_time_us() - start_us < seconds*1e6 ) {
+    if( !tap_recv( fd, &header, sizeof( header ), loopback ? TAP_LOOPBACK_IDLE_MS : TAP_IDLE_MS ) ) {
+      break;
+    }
+
+    if( header.magic != DSP_TAP_MAGIC || ( header.point != DSP_TAP_INPUT && header.point != DSP_TAP_OUTPUT ) ||
+        header.channels < 1 || header.channels > TAP_MAX_CHANNELS || ( header.sample_bytes != 2 && header.sample_bytes != 4 ) ||
+        header.sample_rate == 0 ) {
+      // Out of step with the stream: nothing after this can be trusted
+      ++format_errors;
+      break;
+    }
+    if( !tap_recv( fd, payload, header.frames*header.channels*header.sample_bytes, TAP_IDLE_MS ) ) {
+      ++format_errors;
+      break;
+    }
+    bytes += sizeof( header ) + header.frames*header.channels*header.sample_bytes;
+    last_us = dsp_os_time_us();
+
+    point = &points[header.point == DSP_TAP_INPUT ? 0 : 1];
+    if( point->blocks == 0 ) {
+      point->sample_rate = header.sample_rate;
+      point->channels = header.channels;
+      point->sample_bytes = header.sample_bytes;
+    } else if( header.sample_rate != point->sample_rate || header.channels != point->channels || header.sample_bytes != point->sample_bytes ) {
+      ++format_errors;
+      continue;
+    }
+
+    // The loopback stream starts at block 0, a device's wherever it was
+    if( point->last_sequence >= 0 && (int64_t) header.sequence <= point->last_sequence ) {
+      ++order_errors;
+    } else if( point->last_sequence >= 0 || loopback ) {
+      point->missing += header.sequence - point->last_sequence - 1;
+    }
+    point->last_sequence = header.sequence;
+    ++point->blocks;
+    point->frames += header.frames;
+
+    if( loopback ) {
+      const sample_t* samples = (const sample_t*) payload;
+      int             sign = header.point == DSP_TAP_INPUT ? 1 : -1;
+
+      if( header.frames != producer.frames/producer.decimation || header.sample_bytes != sizeof( sample_t ) ) {
+        ++sample_errors;
+        continue;
+      }
+      for( int k = 0; k < header.frames; ++k ) {
+        for( int ch = 0; ch < header.channels; ++ch ) {
+          if( samples[k*header.channels + ch] != sign*tap_pattern( header.sequence, k, ch ) ) {
+            ++sample_errors;
+          }
+        }
+      }
+    }
+
+    if( point->wav.file != NULL ) {
+      if( point->wav.data_bytes == 0 ) {
+        point->wav.format = DSP_WAV_PCM;
+        point->wav.channels = point->channels;
+        point->wav.sample_bytes = point->sample_bytes;
+        point->wav.sample_rate = point->sample_rate;
+        dsp_wav_write_header( &point->wav );
+      }
+      fwrite( payload, 1, header.frames*header.channels*header.sample_bytes, point->wav.file );
+      point->wav.data_bytes += header.frames*header.channels*header.sample_bytes;
+    }
+  }
+  wall_seconds = ( last_us - start_us )/1e6;
+  close( fd );
+
+  for( int p = 0; p < 2; ++p ) {
+    point = &points[p];
+    if( point->wav.file != NULL ) {
+      if( point->wav.data_bytes > 0 ) {
+        dsp_wav_write_header( &point->wav );
+      }
+      fclose( point->wav.file );
+    }
+    if( point->blocks > 0 ) {
+      printf( "I-SIM: %s: %u blocks, %llu frames at %u Hz (%.2f s), %u blocks missing\n", p == 0 ? "Input" : "Output",
+        point->blocks, (unsigned long long) point->frames, point->sample_rate, (double) point->frames/point->sample_rate, point->missing );
+      audio_seconds = (double) point->frames/point->sample_rate > audio_seconds ? (double) point->frames/point->sample_rate : audio_seconds;
+    }
+  }
+  if( wall_seconds > 0 ) {
+    printf( "I-SIM: Received %.1f kB in %.2f s: %.1f kB/s, %.1fx real time\n", bytes/1024.0, wall_seconds,
+      bytes/1024.0/wall_seconds, audio_seconds/wall_seconds );
+  }
+
+  passed = format_errors == 0 && order_errors == 0;
+
+  if( loopback ) {
+    dsp_tap_get_stats( &stats );
+    printf( "I-SIM: Loopback: %u blocks tapped per point at %s, %u dropped by the tap, %u sample errors, %d format errors, %d out of order\n",
+      producer.blocks, producer.speed > 0 ? "real-time pace" : "full speed", stats.dropped, sample_errors, format_errors, order_errors );
+    if( producer.speed > 0 && stats.dropped == 0 ) {
+      printf( "I-SIM: dsp_tap_block() takes %.2f us per block of %d frames\n",
+        (double) producer.cycles/dsp_os_cycles_per_us()/( 2*producer.blocks ), producer.frames );
+    }
+    // Every block tapped either arrived or was dropped, and the dropped ones are exactly those missing
+    for( int p = 0; p < 2; ++p ) {
+      points[p].missing += producer.blocks - 1 - points[p].last_sequence;
+    }
+    passed &= __atomic_load_n( &producer.done, __ATOMIC_ACQUIRE ) && sample_errors == 0 &&
+      points[0].blocks + points[1].blocks + stats.dropped == 2*producer.blocks &&
+      points[0].missing + points[1].missing == stats.dropped;
+  }
+
+  printf( "I-SIM: Stream %s\n", passed ? "OK" : "FAILED" );
+
+  return( passed ? 0 : 1 );
+}
@@ -0,0 +1,142 @@
+#include "dsp_wav.h"
+
+//------------------------------------------------------------------------------------
+// WAV files for the host tools (see dsp_wav.h). Multi-byte fields are little-endian,
+// as on the host.
+//------------------------------------------------------------------------------------
+
+#define WAV_HEADER_BYTES      80                        // RIFF, JUNK/ds64, fmt and data chunk headers as written
+#define WAV_DS64_BYTES        28
+#define WAV_FMT_MAX_BYTES     40                        // WAVE_FORMAT_EXTENSIBLE
+
+static uint16_t wav_le16( const uint8_t* data ) {
+
+  uint16_t  value;
+
+  memcpy( &value, data, sizeof( value ) );
+  return( value );
+}
+
+static uint32_t wav_le32( const uint8_t* data ) {
+
+  uint32_t  value;
+
+  memcpy( &value, data, sizeof( value ) );
+  return( value );
+}
+
+
+//------------------------------------------------------------------------------------
+// Parse the header of a file opened for reading and leave it at the first sample.
+// Returns ESP_ERR_NOT_SUPPORTED for a sample format other than those listed above.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_wav_read_header( dsp_wav_t* wav ) {
+
+  uint8_t   header[12];
+  uint8_t   chunk[8];
+  uint8_t   fmt[WAV_FMT_MAX_BYTES];
+  uint8_t   ds64[WAV_DS64_BYTES];
+  uint64_t  ds64_data_bytes = DSP_WAV_UNKNOWN_LEN;
+  uint32_t  len;
+  uint32_t  used;
+  int       bits = 0;
+  bool      rf64;
+
+  wav->format = 0;
+
+  if( fread( header, sizeof( header ), 1, wav->file ) != 1 || memcmp( &header[8], "WAVE", 4 ) != 0 ||
+      ( memcmp( header, "RIFF", 4 ) != 0 && memcmp( header, "RF64", 4 ) != 0 ) ) {
+    return( ESP_FAIL );
+  }
+  rf64 = memcmp( header, "RF64", 4 ) == 0;
+
+  while( fread( chunk, sizeof( chunk ), 1, wav->file ) == 1 ) {
+    len = wav_le32( &chunk[4] );
+    used = 0;
+
+    if( memcmp( chunk, "fmt ", 4 ) == 0 ) {
+      used = len < sizeof( fmt ) ? len : sizeof( fmt );
+      if( used < 16 || fread( fmt, used, 1, wav->file ) != 1 ) {
+        return( ESP_FAIL );
+      }
+      wav->format = wav_le16( &fmt[0] );
+      wav->channels = wav_le16( &fmt[2] );
+      wav->sample_rate = wav_le32( &fmt[4] );
+      bits = wav_le16( &fmt[14] );
+      if( wav->format == DSP_WAV_EXTENSIBLE && used >= 26 ) {
+        wav->format = wav_le16( &fmt[24] );             // Sub-format GUID starts with the format code
+      }
+    } else if( memcmp( chunk, "ds64", 4 ) == 0 ) {
+      used = len < sizeof( ds64 ) ? len : sizeof( ds64 );
+      if( used < 16 || fread( ds64, used, 1, wav->file ) != 1 ) {
+        return( ESP_FAIL );
+      }
+      memcpy( &ds64_data_bytes, &ds64[8], sizeof( ds64_data_bytes ) );
+    } else if( memcmp( chunk, "data", 4 ) == 0 ) {
+      if( wav->format == 0 ) {
+        return( ESP_FAIL );
+      }
+      if( rf64 && len == UINT32_MAX ) {
+        wav->data_bytes = ds64_data_bytes;
+      } else {
+        wav->data_bytes = len == 0 || len == UINT32_MAX ? DSP_WAV_UNKNOWN_LEN : len;
+      }
+      wav->sample_bytes = bits/8;
+      if( wav->channels < 1 || ( wav->format == DSP_WAV_PCM && bits != 16 && bits != 24 && bits != 32 ) ||
+          ( wav->format == DSP_WAV_FLOAT && bits != 32 ) || ( wav->format != DSP_WAV_PCM && wav->format != DSP_WAV_FLOAT ) ) {
+        return( ESP_ERR_NOT_SUPPORTED );
+      }
+      return( ESP_OK );
+    }
+
+    // Skip the rest of the chunk and its pad byte
+    if( fseek( wav->file, len - used + ( len & 1 ), SEEK_CUR ) != 0 ) {
+      return( ESP_FAIL );
+    }
+  }
+
+  return( ESP_FAIL );
+}
+
+
+//------------------------------------------------------------------------------------
+// Write (or rewrite, once data_bytes is known) the header of a file opened for writing,
+// then go back to its end. The data follows the header directly.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_wav_write_header( const dsp_wav_t* wav ) {
+
+  uint32_t  header[WAV_HEADER_BYTES/4];
+  int       block_align = wav->channels*wav->sample_bytes;
+  uint64_t  riff_bytes = WAV_HEADER_BYTES - 8 + wav->data_bytes;
+  uint64_t  frames = block_align > 0 ? wav->data_bytes/block_align : 0;
+  bool      rf64 = riff_bytes > UINT32_MAX;
+  bool      written;
+
+  memset( header, 0, sizeof( header ) );
+  memcpy( &header[0], rf64 ? "RF64" : "RIFF", 4 );
+  header[1] = rf64 ? UINT32_MAX : (uint32_t) riff_bytes;
+  memcpy( &header[2], "WAVE", 4 );
+  memcpy( &header[3], rf64 ? "ds64" : "JUNK", 4 );      // Room for the 64 bit lengths of RF64
+  header[4] = WAV_DS64_BYTES;
+  if( rf64 ) {
+    memcpy( &header[5], &riff_bytes, 8 );
+    memcpy( &header[7], &wav->data_bytes, 8 );
+    memcpy( &header[9], &frames, 8 );
+  }
+  memcpy( &header[12], "fmt ", 4 );
+  header[13] = 16;
+  header[14] = wav->format | ( wav->channels << 16 );
+  header[15] = wav->sample_rate;
+  header[16] = wav->sample_rate*block_align;
+  header[17] = block_align | ( wav->sample_bytes*8 << 16 );
+  memcpy( &header[18], "data", 4 );
+  header[19] = rf64 ? UINT32_MAX : (uint32_t) wav->data_bytes;
+
+  fseek( wav->file, 0, SEEK_SET );
+  written = fwrite( header, sizeof( header ), 1, wav->file ) == 1;
+  fseek( wav->file, 0, SEEK_END );
+
+  return( written ? ESP_OK : ESP_FAIL );
+}
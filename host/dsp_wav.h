@@ -0,0 +1,30 @@
+#ifndef _DSP_WAV_H
+#define _DSP_WAV_H
+
+#include "dsp_process.h"
+
+//------------------------------------------------------------------------------------
+// WAV files for the host tools. Reading takes 16, 24 and 32 bit PCM and 32 bit float,
+// plain or WAVE_FORMAT_EXTENSIBLE, in RIFF or RF64 files; only the headers are parsed,
+// the samples are streamed. Written files are PCM with room reserved after the RIFF
+// header, so a file that grows past 4 GB becomes RF64 when its header is rewritten.
+//------------------------------------------------------------------------------------
+
+#define DSP_WAV_PCM           1                         // Format codes of the fmt chunk
+#define DSP_WAV_FLOAT         3
+#define DSP_WAV_EXTENSIBLE    0xfffe
+#define DSP_WAV_UNKNOWN_LEN   UINT64_MAX                // Data runs to the end of the file (streamed or unfinished)
+
+typedef struct dsp_wav_t {
+  FILE*        file;
+  int          format;                           // DSP_WAV_PCM or DSP_WAV_FLOAT
+  int          channels;
+  int          sample_bytes;                     // Bytes per sample of one channel
+  uint32_t     sample_rate;
+  uint64_t     data_bytes;                       // Length of the data chunk, DSP_WAV_UNKNOWN_LEN if not known
+} dsp_wav_t;
+
+esp_err_t dsp_wav_read_header( dsp_wav_t* wav );
+esp_err_t dsp_wav_write_header( const dsp_wav_t* wav );
+
+#endif
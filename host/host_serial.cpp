@@ -0,0 +1,7 @@
+#include "dsp_process.h"
+
+//------------------------------------------------------------------------------------
+// Serial/Telnet output object used by the DSP code (stdout on the host)
+//------------------------------------------------------------------------------------
+
+TelnetSpy     SerialAndTelnet;
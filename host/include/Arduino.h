@@ -0,0 +1,18 @@
+#ifndef _HOST_ARDUINO_H
+#define _HOST_ARDUINO_H
+
+//------------------------------------------------------------------------------------
+// Host (Linux) stand-in for the parts of the Arduino core used by the DSP code
+//------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef PI
+#define PI              3.1415926535897932384626433832795
+#endif
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef _HOST_TELNETSPY_H
+#define _HOST_TELNETSPY_H
+
+//------------------------------------------------------------------------------------
+// Host (Linux) stand-in for TelnetSpy - all output goes to stdout
+//------------------------------------------------------------------------------------
+
+#include <stdarg.h>
+#include "Arduino.h"
+
+class TelnetSpy {
+  public:
+    size_t printf( const char* format, ... ) __attribute__(( format( printf, 2, 3 ) )) {
+      va_list  args;
+      int      len;
+
+      va_start( args, format );
+      len = vprintf( format, args );
+      va_end( args );
+
+      return( len < 0 ? 0 : len );
+    }
+
+    size_t print( const char* text )    { return( fputs( text, stdout ) < 0 ? 0 : strlen( text ) ); }
+    size_t println( const char* text )  { return( print( text ) + println() ); }
+    size_t println()                    { return( print( "\r\n" ) ); }
+};
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _HOST_DRIVER_I2C_H
+#define _HOST_DRIVER_I2C_H
+
+#include <esp_err.h>
+
+#endif
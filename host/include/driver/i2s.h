@@ -0,0 +1,18 @@
+#ifndef _HOST_DRIVER_I2S_H
+#define _HOST_DRIVER_I2S_H
+
+//------------------------------------------------------------------------------------
+// Host (Linux) stand-in for the ESP-IDF I2S driver types used by dsp_process.h
+//------------------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <esp_err.h>
+
+typedef enum {
+  I2S_BITS_PER_SAMPLE_8BIT    = 8,
+  I2S_BITS_PER_SAMPLE_16BIT   = 16,
+  I2S_BITS_PER_SAMPLE_24BIT   = 24,
+  I2S_BITS_PER_SAMPLE_32BIT   = 32
+} i2s_bits_per_sample_t;
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _HOST_ESP_ERR_H
+#define _HOST_ESP_ERR_H
+
+//------------------------------------------------------------------------------------
+// Host (Linux) stand-in for the ESP-IDF error codes
+//------------------------------------------------------------------------------------
+
+typedef int esp_err_t;
+
+#define ESP_OK          0
+#define ESP_FAIL        -1
+#define ESP_ERR_INVALID_ARG   0x102
+#define ESP_ERR_NOT_FOUND     0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_INVALID_RESPONSE  0x108
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef _HOST_FREERTOS_H
+#define _HOST_FREERTOS_H
+
+//------------------------------------------------------------------------------------
+// Host (Linux) stand-in for FreeRTOS
+//------------------------------------------------------------------------------------
+
+#include <stdint.h>
+
+#endif
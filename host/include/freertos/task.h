@@ -0,0 +1,6 @@
+#ifndef _HOST_FREERTOS_TASK_H
+#define _HOST_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+#endif
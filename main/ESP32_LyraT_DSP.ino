@@ -71,7 +71,11 @@ void loopSerialInput() {
       dsp_command( 'r' );
     } else if( input_text.equals( "p" ) ) { // Plot freqency response curve
       dsp_command( 'p' );         
-    } else {
+    } else if( input_text.equals( "t" ) ) { // Audio task statistics
+      dsp_command( 't' );
+    } else if( input_text.equals( "b" ) ) { // Stage timing of the audio task
+      dsp_command( 'b' );
+    } else if( dsp_command_line( input_text.c_str() ) == ESP_ERR_NOT_FOUND ) {
       SERIAL.println( "??? Unknown command" );
     }
   }
@@ -204,7 +208,7 @@ void loop() {
   loopArduinoOTA();
   loopSerialInput();
 
-  // DSP processing
+  // DSP housekeeping (the audio itself runs in its own task)
   if( dsp_init_OK ) {
     dsp_loop();
   }
@@ -0,0 +1,647 @@
+#include "dsp_process.h"
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#elif defined( __ARM_NEON )
+#include <arm_neon.h>
+#endif
+
+//------------------------------------------------------------------------------------
+// Biquad cascade kernels
+//
+// All kernels filter the buffer in place through 'num_filters' Direct Form II biquads
+// using the coefficient layout of dsp_channel_t::coeffs and the state layout of
+// dsp_buffer_t::biquad_w, so they can be swapped freely (see DSP_BIQUAD_KERNEL).
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+// One pass over the buffer per filter using the Espressif biquad kernel
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_biquad_stagewise_f32( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters ) {
+
+  esp_err_t   res;
+
+  for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+    res = dsps_biquad_f32( buffer, buffer, len, coeffs[filter_id], w[filter_id] );
+    if( res != ESP_OK ) {
+      return( res );
+    }
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Single pass over the buffer running every filter on each sample (portable version)
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_biquad_cascade_f32_ansi( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters ) {
+
+  float   c[DSP_MAX_FILTERS][5];                  // Local copies so stores to the buffer cannot alias them
+  float   w0[DSP_MAX_FILTERS];
+  float   w1[DSP_MAX_FILTERS];
+  float   x;
+  float   d0;
+
+  if( num_filters < 0 || num_filters > DSP_MAX_FILTERS ) {
+    return( ESP_FAIL );
+  }
+
+  for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+    memcpy( c[filter_id], coeffs[filter_id], sizeof( c[0] ) );
+    w0[filter_id] = w[filter_id][0];
+    w1[filter_id] = w[filter_id][1];
+  }
+
+  for( int i = 0; i < len; ++i ) {
+    x = buffer[i];
+
+    for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+      d0 = x - c[filter_id][3]*w0[filter_id] - c[filter_id][4]*w1[filter_id];
+      x = c[filter_id][0]*d0 + c[filter_id][1]*w0[filter_id] + c[filter_id][2]*w1[filter_id];
+      w1[filter_id] = w0[filter_id];
+      w0[filter_id] = d0;
+    }
+
+    buffer[i] = x;
+  }
+
+  for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+    w[filter_id][0] = w0[filter_id];
+    w[filter_id][1] = w1[filter_id];
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Single pass cascade specialised for a fixed number of filters. The stage loop is
+// fully unrolled so the coefficients and state live in registers for the whole block
+// rather than being reloaded for every sample.
+//------------------------------------------------------------------------------------
+
+template <int N>
+static void dsp_biquad_cascade_n( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN] ) {
+
+  float   b0[N], b1[N], b2[N], a1[N], a2[N];
+  float   w0[N], w1[N];
+  float   x;
+  float   d0;
+
+#pragma GCC unroll 16
+  for( int s = 0; s < N; ++s ) {
+    b0[s] = coeffs[s][0];
+    b1[s] = coeffs[s][1];
+    b2[s] = coeffs[s][2];
+    a1[s] = coeffs[s][3];
+    a2[s] = coeffs[s][4];
+    w0[s] = w[s][0];
+    w1[s] = w[s][1];
+  }
+
+  for( int i = 0; i < len; ++i ) {
+    x = buffer[i];
+
+#pragma GCC unroll 16
+    for( int s = 0; s < N; ++s ) {
+      d0 = x - a1[s]*w0[s] - a2[s]*w1[s];
+      x = b0[s]*d0 + b1[s]*w0[s] + b2[s]*w1[s];
+      w1[s] = w0[s];
+      w0[s] = d0;
+    }
+
+    buffer[i] = x;
+  }
+
+#pragma GCC unroll 16
+  for( int s = 0; s < N; ++s ) {
+    w[s][0] = w0[s];
+    w[s][1] = w1[s];
+  }
+}
+
+esp_err_t dsp_biquad_cascade_f32_opt( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters ) {
+
+  switch( num_filters ) {
+    case 0  : break;
+    case 1  : dsp_biquad_cascade_n<1>( buffer, len, coeffs, w );   break;
+    case 2  : dsp_biquad_cascade_n<2>( buffer, len, coeffs, w );   break;
+    case 3  : dsp_biquad_cascade_n<3>( buffer, len, coeffs, w );   break;
+    case 4  : dsp_biquad_cascade_n<4>( buffer, len, coeffs, w );   break;
+    case 5  : dsp_biquad_cascade_n<5>( buffer, len, coeffs, w );   break;
+    case 6  : dsp_biquad_cascade_n<6>( buffer, len, coeffs, w );   break;
+    case 7  : dsp_biquad_cascade_n<7>( buffer, len, coeffs, w );   break;
+    case 8  : dsp_biquad_cascade_n<8>( buffer, len, coeffs, w );   break;
+    case 9  : dsp_biquad_cascade_n<9>( buffer, len, coeffs, w );   break;
+    case 10 : dsp_biquad_cascade_n<10>( buffer, len, coeffs, w );  break;
+    default :
+      // Filter counts beyond the unrolled range fall back to the portable kernel
+      return( dsp_biquad_cascade_f32_ansi( buffer, len, coeffs, w, num_filters ) );
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Alternative topologies (see DSP_BIQUAD_TOPOLOGY)
+//
+// The shipped subwoofer filters have poles within 0.001 of z = 1. In Direct Form II the
+// internal W values then run some 70 dB above the signal and the rounding of each
+// update in single precision shows up as a high noise floor. The kernels below trade
+// cycles for precision. They use the same coefficient layout, and the state layout
+// noted at each, within the DSP_BIQUAD_STATE_LEN floats per filter.
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+// Transposed Direct Form II. State: s1, s2. The state stays at signal level, at the
+// same cost as Direct Form II.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_biquad_cascade_f32_tdf2( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters ) {
+
+  float   c[DSP_MAX_FILTERS][5];
+  float   s1[DSP_MAX_FILTERS];
+  float   s2[DSP_MAX_FILTERS];
+  float   x;
+  float   y;
+
+  if( num_filters < 0 || num_filters > DSP_MAX_FILTERS ) {
+    return( ESP_FAIL );
+  }
+
+  for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+    memcpy( c[filter_id], coeffs[filter_id], sizeof( c[0] ) );
+    s1[filter_id] = w[filter_id][0];
+    s2[filter_id] = w[filter_id][1];
+  }
+
+  for( int i = 0; i < len; ++i ) {
+    x = buffer[i];
+
+    for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+      y = c[filter_id][0]*x + s1[filter_id];
+      s1[filter_id] = c[filter_id][1]*x - c[filter_id][3]*y + s2[filter_id];
+      s2[filter_id] = c[filter_id][2]*x - c[filter_id][4]*y;
+      x = y;
+    }
+
+    buffer[i] = x;
+  }
+
+  for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+    w[filter_id][0] = s1[filter_id];
+    w[filter_id][1] = s2[filter_id];
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Direct Form I with error feedback. State: x1, x2, y1, y2 and the rounding errors of
+// y1 and y2.
+//
+// The five products are summed as a compensated dot product: the rounding error of
+// each product (from a fused multiply-add) and of each addition (TwoSum) is collected
+// separately and added at the end. What the final rounding of y still drops is kept
+// and fed back through -a1 and -a2 on the next samples, so the recursion sees the
+// exact output. The noise floor ends up close to double precision with float
+// arithmetic only; fmaf is a single instruction where the FPU has a fused
+// multiply-add (e.g. madd.s on the ESP32, or -mfma on x86).
+//------------------------------------------------------------------------------------
+
+static inline void dsp_biquad_two_sum( float a, float b, float* sum, float* error ) {
+
+  float   bb;
+
+  *sum = a + b;
+  bb = *sum - a;
+  *error = ( a - ( *sum - bb ) ) + ( b - bb );
+}
+
+esp_err_t dsp_biquad_cascade_f32_df1( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters ) {
+
+  float   c[DSP_MAX_FILTERS][5];                  // b0, b1, b2, -a1, -a2
+  float   s[DSP_MAX_FILTERS][6];
+  float   v[5];
+  float   x;
+  float   p;
+  float   h;
+  float   e;
+  float   comp;
+
+  if( num_filters < 0 || num_filters > DSP_MAX_FILTERS ) {
+    return( ESP_FAIL );
+  }
+
+  for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+    for( int i = 0; i < 5; ++i ) {
+      c[filter_id][i] = i < 3 ? coeffs[filter_id][i] : -coeffs[filter_id][i];
+    }
+    memcpy( s[filter_id], w[filter_id], sizeof( s[0] ) );
+  }
+
+  for( int i = 0; i < len; ++i ) {
+    x = buffer[i];
+
+    for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+      float*  ws = s[filter_id];
+      float*  cs = c[filter_id];
+
+      v[0] = x;
+      v[1] = ws[0];
+      v[2] = ws[1];
+      v[3] = ws[2];
+      v[4] = ws[3];
+
+      // Feed back the errors of the previous outputs, then accumulate with compensation
+      comp = cs[3]*ws[4] + cs[4]*ws[5];
+      p = cs[0]*v[0];
+      comp += fmaf( cs[0], v[0], -p );
+
+      for( int k = 1; k < 5; ++k ) {
+        h = cs[k]*v[k];
+        comp += fmaf( cs[k], v[k], -h );
+        dsp_biquad_two_sum( p, h, &p, &e );
+        comp += e;
+      }
+
+      // Round to the output and keep what was dropped
+      x = p + comp;
+      ws[5] = ws[4];
+      ws[4] = ( p - x ) + comp;
+
+      ws[1] = ws[0];
+      ws[0] = v[0];
+      ws[3] = ws[2];
+      ws[2] = x;
+    }
+
+    buffer[i] = x;
+  }
+
+  for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+    memcpy( w[filter_id], s[filter_id], sizeof( s[0] ) );
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Transposed Direct Form II with double precision state (mixed precision). The samples
+// and coefficients stay float, the recursion runs in double. Between blocks each state
+// value is kept as a pair of floats (high part and remainder). State: s1 high, s1 low,
+// s2 high, s2 low. Double arithmetic is done in software on the ESP32, so this is the
+// slowest option there; it serves as the precision reference.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_biquad_cascade_f32_mixed( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters ) {
+
+  float   c[DSP_MAX_FILTERS][5];
+  double  s1[DSP_MAX_FILTERS];
+  double  s2[DSP_MAX_FILTERS];
+  double  x;
+  double  y;
+
+  if( num_filters < 0 || num_filters > DSP_MAX_FILTERS ) {
+    return( ESP_FAIL );
+  }
+
+  for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+    memcpy( c[filter_id], coeffs[filter_id], sizeof( c[0] ) );
+    s1[filter_id] = (double) w[filter_id][0] + w[filter_id][1];
+    s2[filter_id] = (double) w[filter_id][2] + w[filter_id][3];
+  }
+
+  for( int i = 0; i < len; ++i ) {
+    x = buffer[i];
+
+    for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+      y = c[filter_id][0]*x + s1[filter_id];
+      s1[filter_id] = c[filter_id][1]*x - c[filter_id][3]*y + s2[filter_id];
+      s2[filter_id] = c[filter_id][2]*x - c[filter_id][4]*y;
+      x = y;
+    }
+
+    buffer[i] = (float) x;
+  }
+
+  for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+    w[filter_id][0] = (float) s1[filter_id];
+    w[filter_id][1] = (float) ( s1[filter_id] - w[filter_id][0] );
+    w[filter_id][2] = (float) s2[filter_id];
+    w[filter_id][3] = (float) ( s2[filter_id] - w[filter_id][2] );
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Output stage: gain, soft-knee limiter and conversion to the output word
+//
+// Samples under DSP_LIMITER_KNEE_VALUE pass unchanged. Above it the level is bent by
+//
+//   out = knee + over/( 1 + over/range )      over = in - knee, range = full scale - knee
+//
+// which keeps the slope continuous at the knee and approaches full scale without ever
+// reaching past it, so nothing is hard clipped. Only samples over the knee pay for the
+// division. The gain ramps by 'step' per sample, which is how dsp_filter fades in the
+// block-rate gain reduction of the limiter.
+//------------------------------------------------------------------------------------
+
+#define DSP_LIMITER_RANGE   ( (float) DSP_MAX_SAMPLE_VALUE - DSP_LIMITER_KNEE_VALUE )
+
+static inline float dsp_limit_sample( dsp_clip_t* clip, float sample_value ) {
+
+  float   magnitude = fabsf( sample_value );
+  float   over;
+
+  if( magnitude > DSP_LIMITER_KNEE_VALUE ) {
+    ++clip->limit_count;
+    if( magnitude > DSP_MAX_SAMPLE_VALUE ) {
+      ++clip->clipping_count;
+    }
+    if( magnitude > clip->peak ) {
+      clip->peak = magnitude;
+    }
+
+    // fminf also catches the rounding at full scale and non-finite input
+    over = magnitude - DSP_LIMITER_KNEE_VALUE;
+    magnitude = fminf( DSP_LIMITER_KNEE_VALUE + over/( 1.0f + over/DSP_LIMITER_RANGE ), (float) DSP_MAX_SAMPLE_VALUE );
+    sample_value = copysignf( magnitude, sample_value );
+  }
+
+  return( sample_value );
+}
+
+
+//------------------------------------------------------------------------------------
+// Scale a filtered channel, limit it and write it to every 'stride'th sample of the
+// output. The clip counters are added to, not reset.
+//------------------------------------------------------------------------------------
+
+void dsp_output_f32( const float* buffer, int len, sample_t* output, int stride, float gain, float step, dsp_clip_t* clip ) {
+
+  for( int i = 0; i < len; ++i ) {
+    output[i*stride] = (sample_t) dsp_limit_sample( clip, buffer[i]*gain );
+    gain += step;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Stereo lockstep kernels
+//
+// Both channels of the interleaved buffer are converted to float, filtered, scaled and
+// written back in a single pass, with the left/right coefficients and state held as
+// pairs. The gain ramp and limiter match dsp_output_f32 exactly, and the clipping is
+// counted per lane in the dsp_stereo_t so the caller can account for it.
+//------------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------------
+// Dual-lane scalar version. The two channels form independent dependency chains, which
+// keeps the FPU pipeline busy on in-order cores such as the ESP32.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_biquad_stereo_f32_ansi( sample_t* buffer, int frames, dsp_stereo_t* stereo ) {
+
+  float   c[DSP_MAX_FILTERS][5][2];
+  float   w0[DSP_MAX_FILTERS][2];
+  float   w1[DSP_MAX_FILTERS][2];
+  int     num_filters = stereo->num_filters;
+  float   gain_l = stereo->scaling_factor[0];
+  float   gain_r = stereo->scaling_factor[1];
+  float   step_l = stereo->scaling_step[0];
+  float   step_r = stereo->scaling_step[1];
+  float   xl, xr;
+  float   dl, dr;
+
+  if( num_filters < 0 || num_filters > DSP_MAX_FILTERS ) {
+    return( ESP_FAIL );
+  }
+
+  memcpy( c, stereo->coeffs, num_filters*sizeof( c[0] ) );
+  for( int s = 0; s < num_filters; ++s ) {
+    w0[s][0] = stereo->w[s][0][0];
+    w0[s][1] = stereo->w[s][0][1];
+    w1[s][0] = stereo->w[s][1][0];
+    w1[s][1] = stereo->w[s][1][1];
+  }
+
+  for( int i = 0; i < frames; ++i ) {
+    xl = buffer[2*i];
+    xr = buffer[2*i + 1];
+
+    for( int s = 0; s < num_filters; ++s ) {
+      dl = xl - c[s][3][0]*w0[s][0] - c[s][4][0]*w1[s][0];
+      dr = xr - c[s][3][1]*w0[s][1] - c[s][4][1]*w1[s][1];
+      xl = c[s][0][0]*dl + c[s][1][0]*w0[s][0] + c[s][2][0]*w1[s][0];
+      xr = c[s][0][1]*dr + c[s][1][1]*w0[s][1] + c[s][2][1]*w1[s][1];
+      w1[s][0] = w0[s][0];
+      w1[s][1] = w0[s][1];
+      w0[s][0] = dl;
+      w0[s][1] = dr;
+    }
+
+    xl = dsp_limit_sample( &stereo->clip[0], xl*gain_l );
+    xr = dsp_limit_sample( &stereo->clip[1], xr*gain_r );
+    gain_l += step_l;
+    gain_r += step_r;
+
+    buffer[2*i] = xl;
+    buffer[2*i + 1] = xr;
+  }
+
+  for( int s = 0; s < num_filters; ++s ) {
+    stereo->w[s][0][0] = w0[s][0];
+    stereo->w[s][0][1] = w0[s][1];
+    stereo->w[s][1][0] = w1[s][0];
+    stereo->w[s][1][1] = w1[s][1];
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Vector version: one SSE/NEON register holds the left/right pair of every value. The
+// operation order matches the scalar kernels so the results are identical. Frames over
+// the limiter knee drop to the scalar limiter.
+//------------------------------------------------------------------------------------
+
+#if defined( __SSE2__ ) && !defined( DSP_NO_SIMD )
+
+esp_err_t dsp_biquad_stereo_f32_simd( sample_t* buffer, int frames, dsp_stereo_t* stereo ) {
+
+  __m128        b0[DSP_MAX_FILTERS], b1[DSP_MAX_FILTERS], b2[DSP_MAX_FILTERS];
+  __m128        a1[DSP_MAX_FILTERS], a2[DSP_MAX_FILTERS];
+  __m128        w0[DSP_MAX_FILTERS], w1[DSP_MAX_FILTERS];
+  int           num_filters = stereo->num_filters;
+  __m128        gain = _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) stereo->scaling_factor );
+  const __m128  step = _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) stereo->scaling_step );
+  const __m128  knee = _mm_set1_ps( DSP_LIMITER_KNEE_VALUE );
+  const __m128  sign = _mm_set1_ps( -0.0f );
+  __m128        x;
+  __m128        d;
+  __m128i       xi;
+#if DSP_SAMPLE_BITS != 32
+  int32_t       pair;
+#endif
+  float         lanes[4];
+
+  if( num_filters < 0 || num_filters > DSP_MAX_FILTERS ) {
+    return( dsp_biquad_stereo_f32_ansi( buffer, frames, stereo ) );
+  }
+
+  for( int s = 0; s < num_filters; ++s ) {
+    b0[s] = _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) stereo->coeffs[s][0] );
+    b1[s] = _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) stereo->coeffs[s][1] );
+    b2[s] = _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) stereo->coeffs[s][2] );
+    a1[s] = _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) stereo->coeffs[s][3] );
+    a2[s] = _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) stereo->coeffs[s][4] );
+    w0[s] = _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) stereo->w[s][0] );
+    w1[s] = _mm_loadl_pi( _mm_setzero_ps(), (const __m64*) stereo->w[s][1] );
+  }
+
+  for( int i = 0; i < frames; ++i ) {
+#if DSP_SAMPLE_BITS == 32
+    // Convert the int32 pair to float
+    x = _mm_cvtepi32_ps( _mm_loadl_epi64( (const __m128i*) &buffer[2*i] ) );
+#else
+    // Sign extend the int16 pair to int32 and convert to float
+    memcpy( &pair, &buffer[2*i], sizeof( pair ) );
+    xi = _mm_cvtsi32_si128( pair );
+    x = _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpacklo_epi16( xi, xi ), 16 ) );
+#endif
+
+    for( int s = 0; s < num_filters; ++s ) {
+      d = _mm_sub_ps( _mm_sub_ps( x, _mm_mul_ps( a1[s], w0[s] ) ), _mm_mul_ps( a2[s], w1[s] ) );
+      x = _mm_add_ps( _mm_add_ps( _mm_mul_ps( b0[s], d ), _mm_mul_ps( b1[s], w0[s] ) ), _mm_mul_ps( b2[s], w1[s] ) );
+      w1[s] = w0[s];
+      w0[s] = d;
+    }
+
+    x = _mm_mul_ps( x, gain );
+    gain = _mm_add_ps( gain, step );
+
+    if( _mm_movemask_ps( _mm_cmpgt_ps( _mm_andnot_ps( sign, x ), knee ) ) & 0x3 ) {
+      _mm_storeu_ps( lanes, x );
+      lanes[0] = dsp_limit_sample( &stereo->clip[0], lanes[0] );
+      lanes[1] = dsp_limit_sample( &stereo->clip[1], lanes[1] );
+      x = _mm_setr_ps( lanes[0], lanes[1], 0, 0 );
+    }
+
+    // Truncate to int32 (and pack back to the int16 pair)
+    xi = _mm_cvttps_epi32( x );
+#if DSP_SAMPLE_BITS == 32
+    _mm_storel_epi64( (__m128i*) &buffer[2*i], xi );
+#else
+    pair = _mm_cvtsi128_si32( _mm_packs_epi32( xi, xi ) );
+    memcpy( &buffer[2*i], &pair, sizeof( pair ) );
+#endif
+  }
+
+  for( int s = 0; s < num_filters; ++s ) {
+    _mm_storel_pi( (__m64*) stereo->w[s][0], w0[s] );
+    _mm_storel_pi( (__m64*) stereo->w[s][1], w1[s] );
+  }
+
+  return( ESP_OK );
+}
+
+#elif defined( __ARM_NEON ) && !defined( DSP_NO_SIMD )
+
+esp_err_t dsp_biquad_stereo_f32_simd( sample_t* buffer, int frames, dsp_stereo_t* stereo ) {
+
+  float32x2_t         b0[DSP_MAX_FILTERS], b1[DSP_MAX_FILTERS], b2[DSP_MAX_FILTERS];
+  float32x2_t         a1[DSP_MAX_FILTERS], a2[DSP_MAX_FILTERS];
+  float32x2_t         w0[DSP_MAX_FILTERS], w1[DSP_MAX_FILTERS];
+  int                 num_filters = stereo->num_filters;
+  float32x2_t         gain = vld1_f32( stereo->scaling_factor );
+  const float32x2_t   step = vld1_f32( stereo->scaling_step );
+  const float32x2_t   knee = vdup_n_f32( DSP_LIMITER_KNEE_VALUE );
+  float32x2_t         x;
+  float32x2_t         d;
+  uint32x2_t          limited;
+  int32x2_t           xi;
+#if DSP_SAMPLE_BITS != 32
+  int32_t             pair;
+#endif
+  float               lanes[2];
+
+  if( num_filters < 0 || num_filters > DSP_MAX_FILTERS ) {
+    return( dsp_biquad_stereo_f32_ansi( buffer, frames, stereo ) );
+  }
+
+  for( int s = 0; s < num_filters; ++s ) {
+    b0[s] = vld1_f32( stereo->coeffs[s][0] );
+    b1[s] = vld1_f32( stereo->coeffs[s][1] );
+    b2[s] = vld1_f32( stereo->coeffs[s][2] );
+    a1[s] = vld1_f32( stereo->coeffs[s][3] );
+    a2[s] = vld1_f32( stereo->coeffs[s][4] );
+    w0[s] = vld1_f32( stereo->w[s][0] );
+    w1[s] = vld1_f32( stereo->w[s][1] );
+  }
+
+  for( int i = 0; i < frames; ++i ) {
+#if DSP_SAMPLE_BITS == 32
+    // Convert the int32 pair to float
+    x = vcvt_f32_s32( vld1_s32( &buffer[2*i] ) );
+#else
+    // Sign extend the int16 pair to int32 and convert to float
+    memcpy( &pair, &buffer[2*i], sizeof( pair ) );
+    x = vcvt_f32_s32( vget_low_s32( vmovl_s16( vreinterpret_s16_s32( vdup_n_s32( pair ) ) ) ) );
+#endif
+
+    for( int s = 0; s < num_filters; ++s ) {
+      d = vsub_f32( vsub_f32( x, vmul_f32( a1[s], w0[s] ) ), vmul_f32( a2[s], w1[s] ) );
+      x = vadd_f32( vadd_f32( vmul_f32( b0[s], d ), vmul_f32( b1[s], w0[s] ) ), vmul_f32( b2[s], w1[s] ) );
+      w1[s] = w0[s];
+      w0[s] = d;
+    }
+
+    x = vmul_f32( x, gain );
+    gain = vadd_f32( gain, step );
+
+    limited = vcagt_f32( x, knee );
+    if( vget_lane_u32( limited, 0 ) | vget_lane_u32( limited, 1 ) ) {
+      vst1_f32( lanes, x );
+      lanes[0] = dsp_limit_sample( &stereo->clip[0], lanes[0] );
+      lanes[1] = dsp_limit_sample( &stereo->clip[1], lanes[1] );
+      x = vld1_f32( lanes );
+    }
+
+    // Truncate to int32 (and narrow back to the int16 pair)
+    xi = vcvt_s32_f32( x );
+#if DSP_SAMPLE_BITS == 32
+    vst1_s32( &buffer[2*i], xi );
+#else
+    pair = vget_lane_s32( vreinterpret_s32_s16( vmovn_s32( vcombine_s32( xi, xi ) ) ), 0 );
+    memcpy( &buffer[2*i], &pair, sizeof( pair ) );
+#endif
+  }
+
+  for( int s = 0; s < num_filters; ++s ) {
+    vst1_f32( stereo->w[s][0], w0[s] );
+    vst1_f32( stereo->w[s][1], w1[s] );
+  }
+
+  return( ESP_OK );
+}
+
+#else
+
+esp_err_t dsp_biquad_stereo_f32_simd( sample_t* buffer, int frames, dsp_stereo_t* stereo ) {
+  // No vector unit (e.g. the ESP32): the dual-lane scalar kernel is the fastest option
+  return( dsp_biquad_stereo_f32_ansi( buffer, frames, stereo ) );
+}
+
+#endif
@@ -0,0 +1,174 @@
+#include "dsp_process.h"
+
+//------------------------------------------------------------------------------------
+// Fixed-point biquad cascade (DSP_ENGINE_FIXED)
+//
+// Samples are 32 bit integers with DSP_Q31_SAMPLE_BITS fractional bits, so the I2S
+// samples convert to and from this format with a shift and never go through float.
+// Each filter is Direct Form I with its coefficients in 32 bits, scaled by the largest
+// power of two that still fits, and a 64 bit accumulator. The part of the accumulator
+// dropped when a stage output is rounded down is fed back into the next samples
+// through -a1 and -a2 rounded to integers (second order error feedback). For the low
+// frequency filters, whose poles sit next to z = 1, this cancels most of the rounding
+// noise the poles would otherwise amplify.
+//
+// Stage outputs saturate at DSP_Q31_STATE_MAX. With that limit and |coeff| < 2^31 the
+// five products and the feedback terms always fit in the accumulator.
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+// Quantize the float coefficients of a cascade (dsp_channel_t::coeffs layout). Fails if
+// a filter needs fewer than DSP_Q31_MIN_COEFF_BITS fractional bits; its coefficients are
+// then saturated.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_biquad_q31_quantize( float coeffs[][5], int num_filters, dsp_biquad_q31_t* coeffs_q31 ) {
+
+  esp_err_t   res = ESP_OK;
+  double      value[5];
+  double      max_value;
+  double      scaled;
+  int         shift;
+
+  if( num_filters < 0 || num_filters > DSP_MAX_FILTERS ) {
+    return( ESP_FAIL );
+  }
+
+  for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+    // b0, b1, b2 are added, a1 and a2 subtracted
+    max_value = 0;
+    for( int i = 0; i < 5; ++i ) {
+      value[i] = i < 3 ? coeffs[filter_id][i] : -coeffs[filter_id][i];
+      max_value = fmax( max_value, fabs( value[i] ) );
+    }
+
+    // Most fractional bits that keep every rounded coefficient within 32 bits
+    shift = 31;
+    while( shift > DSP_Q31_MIN_COEFF_BITS && round( ldexp( max_value, shift ) ) > INT32_MAX ) {
+      --shift;
+    }
+
+    for( int i = 0; i < 5; ++i ) {
+      scaled = round( ldexp( value[i], shift ) );
+
+      if( scaled > INT32_MAX || scaled < -INT32_MAX ) {
+        scaled = scaled > 0 ? INT32_MAX : -INT32_MAX;
+        res = ESP_FAIL;
+      }
+
+      coeffs_q31[filter_id].coeffs[i] = (int32_t) scaled;
+    }
+
+    coeffs_q31[filter_id].shift = shift;
+    coeffs_q31[filter_id].feedback[0] = (int) round( value[3] );
+    coeffs_q31[filter_id].feedback[1] = (int) round( value[4] );
+  }
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Filter the buffer in place through 'num_filters' fixed-point biquads. The state holds
+// x1, x2, y1, y2 and the last two rounding errors of each filter.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_biquad_cascade_q31( int32_t* buffer, int len, const dsp_biquad_q31_t* coeffs, int32_t state[][6], int num_filters ) {
+
+  dsp_biquad_q31_t  c[DSP_MAX_FILTERS];          // Local copies so stores to the buffer cannot alias them
+  int32_t           s[DSP_MAX_FILTERS][6];
+  int32_t           x;
+  int64_t           acc;
+  int64_t           y;
+  int               shift;
+
+  if( num_filters < 0 || num_filters > DSP_MAX_FILTERS ) {
+    return( ESP_FAIL );
+  }
+
+  memcpy( c, coeffs, num_filters*sizeof( c[0] ) );
+  memcpy( s, state, num_filters*sizeof( s[0] ) );
+
+  for( int i = 0; i < len; ++i ) {
+    x = buffer[i];
+
+    for( int filter_id = 0; filter_id < num_filters; ++filter_id ) {
+      int32_t*  w = s[filter_id];
+
+      shift = c[filter_id].shift;
+      acc = (int64_t) c[filter_id].coeffs[0]*x +
+            (int64_t) c[filter_id].coeffs[1]*w[0] +
+            (int64_t) c[filter_id].coeffs[2]*w[1] +
+            (int64_t) c[filter_id].coeffs[3]*w[2] +
+            (int64_t) c[filter_id].coeffs[4]*w[3] +
+            (int64_t) c[filter_id].feedback[0]*w[4] +
+            (int64_t) c[filter_id].feedback[1]*w[5];
+
+      // Round down, keeping what was dropped for the error feedback
+      y = acc >> shift;
+      w[5] = w[4];
+      w[4] = (int32_t) ( acc & ( ( (int64_t) 1 << shift ) - 1 ) );
+
+      if( y > DSP_Q31_STATE_MAX ) {
+        y = DSP_Q31_STATE_MAX;
+      } else if( y < -DSP_Q31_STATE_MAX ) {
+        y = -DSP_Q31_STATE_MAX;
+      }
+
+      w[1] = w[0];
+      w[0] = x;
+      w[3] = w[2];
+      w[2] = (int32_t) y;
+      x = (int32_t) y;
+    }
+
+    buffer[i] = x;
+  }
+
+  memcpy( state, s, num_filters*sizeof( s[0] ) );
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Output stage of the fixed-point engine, as dsp_output_f32: apply the ramped gain (in
+// DSP_Q31_GAIN_BITS fixed point), bend samples over the limiter knee towards full scale
+// and write every 'stride'th sample of the output. Only samples over the knee take the
+// division.
+//------------------------------------------------------------------------------------
+
+#define DSP_Q31_LIMITER_KNEE   ( (int64_t) ( DSP_LIMITER_KNEE*DSP_Q31_MAX_SAMPLE_VALUE ) )
+#define DSP_Q31_LIMITER_RANGE  ( DSP_Q31_MAX_SAMPLE_VALUE - DSP_Q31_LIMITER_KNEE )
+
+void dsp_output_q31( const int32_t* buffer, int len, sample_t* output, int stride, int32_t gain, int32_t step, dsp_clip_t* clip ) {
+
+  int64_t   sample_value;
+  int64_t   magnitude;
+  int64_t   over;
+  float     peak;
+
+  for( int i = 0; i < len; ++i ) {
+    sample_value = ( (int64_t) buffer[i]*gain ) >> DSP_Q31_GAIN_BITS;
+    gain += step;
+
+    magnitude = sample_value < 0 ? -sample_value : sample_value;
+    if( magnitude > DSP_Q31_LIMITER_KNEE ) {
+      ++clip->limit_count;
+      if( magnitude > DSP_Q31_MAX_SAMPLE_VALUE ) {
+        ++clip->clipping_count;
+      }
+      peak = (float) magnitude*DSP_MAX_SAMPLE_VALUE/DSP_Q31_MAX_SAMPLE_VALUE;
+      if( peak > clip->peak ) {
+        clip->peak = peak;
+      }
+
+      over = magnitude - DSP_Q31_LIMITER_KNEE;
+      magnitude = DSP_Q31_LIMITER_KNEE + over*DSP_Q31_LIMITER_RANGE/( DSP_Q31_LIMITER_RANGE + over );
+      sample_value = sample_value < 0 ? -magnitude : magnitude;
+    }
+
+    output[i*stride] = DSP_Q31_TO_SAMPLE( (int32_t) sample_value );
+  }
+}
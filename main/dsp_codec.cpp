@@ -0,0 +1,305 @@
+#include "dsp_process.h"
+#include "dsp_os.h"
+
+#define     CODEC_TABLE( regs )   { #regs, regs, (int) ( sizeof( regs )/sizeof( regs[0] ) ) }
+#define     CODEC_SEQUENCE( tables )  tables, (int) ( sizeof( tables )/sizeof( tables[0] ) )
+
+//------------------------------------------------------------------------------------
+// ES8388 codec set-up
+//
+// The codec is configured from tables of register writes, one per concern (power,
+// word length, output routing, volumes, input select), which a sequence lists in the
+// order they are written. A sequence is written in as few I2C transactions as
+// DSP_CODEC_BATCH allows, one register write after the other with repeated starts (the
+// ES8388 is not relied on to auto-increment), then every register it wrote is read
+// back in the same way and compared with the last value written to it. When a batched
+// transaction fails its registers are written or read again one at a time, so the
+// registers at fault are reported by name rather than as one error for the lot.
+//
+// The bus is reached through a dsp_i2c_t: the I2C driver on the ESP32, a register file
+// on the host (dsp_codec_sim), where the sequences are checked against the original
+// register writes.
+//------------------------------------------------------------------------------------
+
+typedef struct dsp_codec_table_t {
+  const char*             name;
+  const dsp_codec_reg_t*  regs;
+  int                     count;
+} dsp_codec_table_t;
+
+// Mute the DAC during set-up, power up all systems in slave mode, power up the DAC with
+// only LOUT1 / ROUT1 enabled, ADC sample rate = DAC sample rate
+static const dsp_codec_reg_t es8388_power_on[] = {
+  { ES8388_DACCONTROL3,   0x04 },
+  { ES8388_CONTROL2,      0x50 },
+  { ES8388_CHIPPOWER,     0x00 },
+  { ES8388_MASTERMODE,    0x00 },
+  { ES8388_DACPOWER,      0x30 },
+  { ES8388_CONTROL1,      0x12 }
+};
+
+// DAC word length and I2S format; MCLK / Fs = 256
+static const dsp_codec_reg_t es8388_dac_16[] = {
+  { ES8388_DACCONTROL1,   0x18 },
+  { ES8388_DACCONTROL2,   0x02 }
+};
+
+static const dsp_codec_reg_t es8388_dac_24[] = {
+  { ES8388_DACCONTROL1,   0x00 },
+  { ES8388_DACCONTROL2,   0x02 }
+};
+
+// DAC to output mixers; DAC and ADC use the same LRCK, MCLK input; output resistance
+static const dsp_codec_reg_t es8388_dac_route[] = {
+  { ES8388_DACCONTROL16,  0x00 },
+  { ES8388_DACCONTROL17,  0x90 },
+  { ES8388_DACCONTROL20,  0x90 },
+  { ES8388_DACCONTROL21,  0x80 },
+  { ES8388_DACCONTROL23,  0x00 }
+};
+
+// Power down the ADC while its input is configured
+static const dsp_codec_reg_t es8388_adc_off[] = {
+  { ES8388_ADCPOWER,      0xff }
+};
+
+// ADC stereo, 16 bit right-justified or 24 bit I2S; MCLK / Fs = 256
+static const dsp_codec_reg_t es8388_adc_16[] = {
+  { ES8388_ADCCONTROL3,   0x00 },
+  { ES8388_ADCCONTROL4,   0x0e },
+  { ES8388_ADCCONTROL5,   0x02 }
+};
+
+static const dsp_codec_reg_t es8388_adc_24[] = {
+  { ES8388_ADCCONTROL3,   0x00 },
+  { ES8388_ADCCONTROL4,   0x00 },
+  { ES8388_ADCCONTROL5,   0x02 }
+};
+
+// DAC digital volume 0 dB (unattenuated), ADC digital volume, LOUT1 / ROUT1 0 dB
+static const dsp_codec_reg_t es8388_volume[] = {
+  { ES8388_DACCONTROL5,   0x00 },
+  { ES8388_DACCONTROL4,   0x00 },
+  { ES8388_ADCCONTROL8,   0x20 },
+  { ES8388_ADCCONTROL9,   0x20 },
+  { ES8388_DACCONTROL24,  0x1e },
+  { ES8388_DACCONTROL25,  0x1e }
+};
+
+// AUX IN: LINPUT2 / RINPUT2 at +9 dB, then the ADC powered up without MIC bias
+static const dsp_codec_reg_t es8388_aux[] = {
+  { ES8388_ADCCONTROL1,   0x33 },
+  { ES8388_ADCCONTROL2,   0x50 }
+};
+
+static const dsp_codec_reg_t es8388_aux_on[] = {
+  { ES8388_ADCPOWER,      0x09 }
+};
+
+// Onboard microphones: LINPUT1 / RINPUT1 at +24 dB, then the ADC powered up with MIC bias
+static const dsp_codec_reg_t es8388_mics[] = {
+  { ES8388_ADCCONTROL1,   0x88 },
+  { ES8388_ADCCONTROL2,   0x00 }
+};
+
+static const dsp_codec_reg_t es8388_mics_on[] = {
+  { ES8388_ADCPOWER,      0x00 }
+};
+
+// Power up and unmute the DAC
+static const dsp_codec_reg_t es8388_power_up[] = {
+  { ES8388_DACPOWER,      0x3c },
+  { ES8388_DACCONTROL3,   0x00 }
+};
+
+static const dsp_codec_table_t es8388_boot_16[] = {
+  CODEC_TABLE( es8388_power_on ), CODEC_TABLE( es8388_dac_16 ), CODEC_TABLE( es8388_dac_route ), CODEC_TABLE( es8388_adc_off ),
+  CODEC_TABLE( es8388_adc_16 ), CODEC_TABLE( es8388_volume ), CODEC_TABLE( es8388_aux ), CODEC_TABLE( es8388_power_up ),
+  CODEC_TABLE( es8388_aux_on )
+};
+
+static const dsp_codec_table_t es8388_boot_24[] = {
+  CODEC_TABLE( es8388_power_on ), CODEC_TABLE( es8388_dac_24 ), CODEC_TABLE( es8388_dac_route ), CODEC_TABLE( es8388_adc_off ),
+  CODEC_TABLE( es8388_adc_24 ), CODEC_TABLE( es8388_volume ), CODEC_TABLE( es8388_aux ), CODEC_TABLE( es8388_power_up ),
+  CODEC_TABLE( es8388_aux_on )
+};
+
+static const dsp_codec_table_t es8388_input_aux[] = {
+  CODEC_TABLE( es8388_adc_off ), CODEC_TABLE( es8388_aux ), CODEC_TABLE( es8388_aux_on )
+};
+
+static const dsp_codec_table_t es8388_input_mics[] = {
+  CODEC_TABLE( es8388_adc_off ), CODEC_TABLE( es8388_mics ), CODEC_TABLE( es8388_mics_on )
+};
+
+static  const dsp_i2c_t*    dsp_codec_i2c = NULL;    // Bus the codec was set up on
+static  dsp_codec_stats_t   dsp_codec_stats;
+
+
+//------------------------------------------------------------------------------------
+// Write registers in one transaction; if that fails, one at a time to find and report
+// those at fault
+//------------------------------------------------------------------------------------
+
+static void dsp_codec_write( const dsp_codec_reg_t* regs, const char* const* names, int count ) {
+
+  esp_err_t   res;
+
+  ++ dsp_codec_stats.transactions;
+  if( dsp_codec_i2c->write( DSP_CODEC_ADDR, regs, count ) == ESP_OK ) {
+    return;
+  }
+
+  for( int i = 0; i < count; ++ i ) {
+    ++ dsp_codec_stats.transactions;
+    res = dsp_codec_i2c->write( DSP_CODEC_ADDR, &regs[ i ], 1 );
+    if( res != ESP_OK ) {
+      SERIAL.printf( "E-DSP: Codec register 0x%02x (%s) write failed = '%d'\r\n", regs[ i ].reg, names[ i ], res );
+      ++ dsp_codec_stats.failed;
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Read registers back in one transaction (one at a time if that fails) and compare them
+// with what was written
+//------------------------------------------------------------------------------------
+
+static void dsp_codec_verify( const dsp_codec_reg_t* expected, const char* const* names, int count ) {
+
+  uint8_t     regs[ DSP_CODEC_BATCH ];
+  uint8_t     values[ DSP_CODEC_BATCH ];
+  esp_err_t   res;
+
+  for( int i = 0; i < count; ++ i ) {
+    regs[ i ] = expected[ i ].reg;
+  }
+
+  ++ dsp_codec_stats.transactions;
+  res = dsp_codec_i2c->read( DSP_CODEC_ADDR, regs, values, count );
+
+  for( int i = 0; i < count; ++ i ) {
+    if( res != ESP_OK ) {
+      ++ dsp_codec_stats.transactions;
+      if( dsp_codec_i2c->read( DSP_CODEC_ADDR, &regs[ i ], &values[ i ], 1 ) != ESP_OK ) {
+        SERIAL.printf( "E-DSP: Codec register 0x%02x (%s) read failed\r\n", regs[ i ], names[ i ] );
+        ++ dsp_codec_stats.failed;
+        continue;
+      }
+    }
+    if( values[ i ] != expected[ i ].value ) {
+      SERIAL.printf( "E-DSP: Codec register 0x%02x (%s) reads 0x%02x, 0x%02x was written\r\n", regs[ i ], names[ i ],
+        values[ i ], expected[ i ].value );
+      ++ dsp_codec_stats.mismatched;
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Write a sequence of tables in batches, then read back the last value written to each
+// register. Returns ESP_FAIL if a register could not be written or read,
+// ESP_ERR_INVALID_RESPONSE if one reads back other than written.
+//------------------------------------------------------------------------------------
+
+static esp_err_t dsp_codec_run( const dsp_codec_table_t* tables, int num_tables ) {
+
+  dsp_codec_reg_t   regs[ DSP_CODEC_MAX_REGS ];
+  const char*       names[ DSP_CODEC_MAX_REGS ];
+  dsp_codec_reg_t   expected[ DSP_CODEC_MAX_REGS ];
+  const char*       expected_names[ DSP_CODEC_MAX_REGS ];
+  int64_t           start_us = dsp_os_time_us();
+  int               count = 0;
+  int               unique = 0;
+  int               batch;
+  int               later;
+
+  memset( &dsp_codec_stats, 0, sizeof( dsp_codec_stats ) );
+
+  for( int t = 0; t < num_tables; ++ t ) {
+    for( int i = 0; i < tables[ t ].count && count < DSP_CODEC_MAX_REGS; ++ i ) {
+      regs[ count ] = tables[ t ].regs[ i ];
+      names[ count ++ ] = tables[ t ].name;
+    }
+  }
+
+  for( int i = 0; i < count; i += batch ) {
+    batch = count - i < DSP_CODEC_BATCH ? count - i : DSP_CODEC_BATCH;
+    dsp_codec_write( &regs[ i ], &names[ i ], batch );
+  }
+  dsp_codec_stats.writes = count;
+
+  // Each register holds the last value written to it
+  for( int i = 0; i < count; ++ i ) {
+    for( later = i + 1; later < count && regs[ later ].reg != regs[ i ].reg; ++ later ) {
+    }
+    if( later == count ) {
+      expected[ unique ] = regs[ i ];
+      expected_names[ unique ++ ] = names[ i ];
+    }
+  }
+
+  for( int i = 0; i < unique; i += batch ) {
+    batch = unique - i < DSP_CODEC_BATCH ? unique - i : DSP_CODEC_BATCH;
+    dsp_codec_verify( &expected[ i ], &expected_names[ i ], batch );
+  }
+  dsp_codec_stats.reads = unique;
+  dsp_codec_stats.elapsed_us = (int) ( dsp_os_time_us() - start_us );
+
+  if( dsp_codec_stats.failed > 0 ) {
+    return( ESP_FAIL );
+  }
+
+  return( dsp_codec_stats.mismatched > 0 ? ESP_ERR_INVALID_RESPONSE : ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Set up the codec for 16 or 24 bit words with the AUX input, on the given bus
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_codec_init( const dsp_i2c_t* i2c, int word_bits ) {
+
+  if( word_bits != 16 && word_bits != 24 ) {
+    SERIAL.printf( "E-DSP: The codec takes 16 or 24 bit words\r\n" );
+    return( ESP_ERR_INVALID_ARG );
+  }
+
+  dsp_codec_i2c = i2c;
+
+  if( word_bits == 16 ) {
+    return( dsp_codec_run( CODEC_SEQUENCE( es8388_boot_16 ) ) );
+  } else {
+    return( dsp_codec_run( CODEC_SEQUENCE( es8388_boot_24 ) ) );
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Switch the ADC between the AUX input set up by dsp_codec_init() and the onboard
+// microphones (MIC bias on, +24 dB) for room measurements
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_codec_input( bool mics ) {
+
+  if( dsp_codec_i2c == NULL ) {
+    SERIAL.printf( "E-DSP: The codec is not set up\r\n" );
+    return( ESP_FAIL );
+  }
+
+  if( mics ) {
+    return( dsp_codec_run( CODEC_SEQUENCE( es8388_input_mics ) ) );
+  } else {
+    return( dsp_codec_run( CODEC_SEQUENCE( es8388_input_aux ) ) );
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// What the last sequence took
+//------------------------------------------------------------------------------------
+
+void dsp_codec_get_stats( dsp_codec_stats_t* stats ) {
+  *stats = dsp_codec_stats;
+}
@@ -16,6 +16,10 @@ dsp_channel_t DSP_Channels[DSP_NUM_CHANNELS] = {
       {0,0,0,0,0},
       {0,0,0,0,0}
     },
+    1,                  // Decimation: 1 = full rate, e.g. 8 runs delay and biquads at 5.5 kHz (multirate)
+    0,                  // Room correction FIR taps after the biquads (0 = none)
+    NULL,               // FIR coefficients (an array of that many floats, e.g. a filter exported from REW)
+    {1, 0},             // Input mix: gain of each input slot (left, right), e.g. {0.5, 0.5} for a mono sum
     NULL                // Data buffer pointer
   },
   {
@@ -35,6 +39,10 @@ dsp_channel_t DSP_Channels[DSP_NUM_CHANNELS] = {
       {0,0,0,0,0},
       {0,0,0,0,0}
     },
+    1,
+    0,
+    NULL,
+    {0, 1},
     NULL
   }
 };
\ No newline at end of file
@@ -0,0 +1,208 @@
+#include "dsp_process.h"
+
+//------------------------------------------------------------------------------------
+// Real FFT
+//
+// A real sequence of N samples is transformed as N/2 complex points (even samples real,
+// odd samples imaginary) by an iterative radix-2 FFT, then split into the spectrum of
+// the real sequence. The spectrum is packed into the same N floats: bin 0 (DC) and bin
+// N/2 (Nyquist), both real, in the first two, then the real and imaginary parts of
+// bins 1 to N/2 - 1.
+//
+// The inverse is not normalized: a forward transform followed by the inverse scales the
+// samples by N. Callers that multiply spectra fold 1/N into one of them.
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+// Set up the tables of a transform of 'size' real samples (a power of two, 4 or more)
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_fft_init( dsp_fft_t* fft, int size ) {
+
+  int       half = size/2;
+  int       bits = 0;
+  int       rev;
+
+  memset( fft, 0, sizeof( dsp_fft_t ) );
+
+  if( size < 4 || size > DSP_MAX_FFT_SIZE || ( size & ( size - 1 ) ) != 0 ) {
+    return( ESP_FAIL );
+  }
+
+  fft->twiddle = (float*) malloc( size*sizeof( float ) );
+  fft->bitrev = (uint16_t*) malloc( half*sizeof( uint16_t ) );
+
+  if( fft->twiddle == NULL || fft->bitrev == NULL ) {
+    dsp_fft_free( fft );
+    return( ESP_FAIL );
+  }
+
+  fft->size = size;
+
+  for( int k = 0; k < half; ++k ) {
+    fft->twiddle[2*k] = (float) cos( 2*PI*k/size );
+    fft->twiddle[2*k + 1] = (float) sin( 2*PI*k/size );
+  }
+
+  while( ( 1 << bits ) < half ) {
+    ++bits;
+  }
+  for( int k = 0; k < half; ++k ) {
+    rev = 0;
+    for( int b = 0; b < bits; ++b ) {
+      rev |= ( ( k >> b ) & 1 ) << ( bits - 1 - b );
+    }
+    fft->bitrev[k] = rev;
+  }
+
+  return( ESP_OK );
+}
+
+void dsp_fft_free( dsp_fft_t* fft ) {
+
+  free( fft->twiddle );
+  free( fft->bitrev );
+  fft->twiddle = NULL;
+  fft->bitrev = NULL;
+  fft->size = 0;
+}
+
+
+//------------------------------------------------------------------------------------
+// Complex FFT of the size/2 interleaved points in place, e^-i for the forward transform
+// (sign 1) and e^+i for the inverse (sign -1). Twiddle k of a stage of length 'len' is
+// entry k*size/len of the table.
+//------------------------------------------------------------------------------------
+
+static void dsp_fft_complex( const dsp_fft_t* fft, float* data, float sign ) {
+
+  const int     half = fft->size/2;
+  const float*  twiddle = fft->twiddle;
+  float*        a;
+  float*        b;
+  float         wr;
+  float         wi;
+  float         tr;
+  float         ti;
+  float         swap;
+  int           j;
+
+  for( int k = 0; k < half; ++k ) {
+    j = fft->bitrev[k];
+    if( k < j ) {
+      swap = data[2*k];     data[2*k] = data[2*j];         data[2*j] = swap;
+      swap = data[2*k + 1]; data[2*k + 1] = data[2*j + 1]; data[2*j + 1] = swap;
+    }
+  }
+
+  for( int len = 2; len <= half; len <<= 1 ) {
+    for( int k = 0; k < len/2; ++k ) {
+      wr = twiddle[2*k*( fft->size/len )];
+      wi = -sign*twiddle[2*k*( fft->size/len ) + 1];
+
+      for( int start = 0; start < half; start += len ) {
+        a = &data[2*( start + k )];
+        b = &data[2*( start + k + len/2 )];
+        tr = b[0]*wr - b[1]*wi;
+        ti = b[0]*wi + b[1]*wr;
+        b[0] = a[0] - tr;
+        b[1] = a[1] - ti;
+        a[0] += tr;
+        a[1] += ti;
+      }
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Forward transform of fft->size real samples into the packed spectrum, in place
+//------------------------------------------------------------------------------------
+
+void dsp_fft_forward( const dsp_fft_t* fft, float* data ) {
+
+  const int     half = fft->size/2;
+  const float*  twiddle = fft->twiddle;
+  float         er;
+  float         ei;
+  float         odr;
+  float         odi;
+  float         c;
+  float         s;
+  float         zr;
+
+  dsp_fft_complex( fft, data, 1.0f );
+
+  // Bins 0 and N/2 from point 0
+  zr = data[0];
+  data[0] = zr + data[1];
+  data[1] = zr - data[1];
+
+  // Bins k and N/2 - k together from points k and N/2 - k: the transforms of the even
+  // (E) and odd (O) samples, then X[k] = E + W^k O and X[N/2 - k] = conj( E - W^k O )
+  for( int k = 1; k <= half/2; ++k ) {
+    float*  zk = &data[2*k];
+    float*  zm = &data[2*( half - k )];
+
+    er = 0.5f*( zk[0] + zm[0] );
+    ei = 0.5f*( zk[1] - zm[1] );
+    odr = 0.5f*( zk[1] + zm[1] );
+    odi = 0.5f*( zm[0] - zk[0] );
+    c = twiddle[2*k];
+    s = twiddle[2*k + 1];
+
+    zk[0] = er + c*odr + s*odi;
+    zk[1] = ei + c*odi - s*odr;
+    zm[0] = er - c*odr - s*odi;
+    zm[1] = -ei + c*odi - s*odr;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Inverse transform of a packed spectrum into fft->size real samples (scaled by the
+// size), in place
+//------------------------------------------------------------------------------------
+
+void dsp_fft_inverse( const dsp_fft_t* fft, float* data ) {
+
+  const int     half = fft->size/2;
+  const float*  twiddle = fft->twiddle;
+  float         er;
+  float         ei;
+  float         dr;
+  float         di;
+  float         odr;
+  float         odi;
+  float         c;
+  float         s;
+  float         x0;
+
+  // Undo the split: Z[k] = E + i O with E = X[k] + conj( X[N/2 - k] ) and
+  // O = ( X[k] - conj( X[N/2 - k] ) ) W^-k, twice the points of the forward transform
+  x0 = data[0];
+  data[0] = x0 + data[1];
+  data[1] = x0 - data[1];
+
+  for( int k = 1; k <= half/2; ++k ) {
+    float*  xk = &data[2*k];
+    float*  xm = &data[2*( half - k )];
+
+    er = xk[0] + xm[0];
+    ei = xk[1] - xm[1];
+    dr = xk[0] - xm[0];
+    di = xk[1] + xm[1];
+    c = twiddle[2*k];
+    s = twiddle[2*k + 1];
+    odr = dr*c - di*s;
+    odi = dr*s + di*c;
+
+    xk[0] = er - odi;
+    xk[1] = ei + odr;
+    xm[0] = er + odi;
+    xm[1] = odr - ei;
+  }
+
+  dsp_fft_complex( fft, data, -1.0f );
+}
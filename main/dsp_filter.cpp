@@ -1,6 +1,28 @@
 #include "dsp_process.h"
 
-static float Biquad_Buff_F32[ DSP_MAX_SAMPLES ];  // Single channel input buffer for biquad function
+// Work buffers of one channel and block, sized by dsp_filter_set_block
+static float*    Biquad_Buff_F32 = NULL;          // Single channel input buffer for biquad function
+static float*    Xfade_Buff_F32 = NULL;           // Single channel buffer for the old cascade during a crossfade
+static int32_t*  Biquad_Buff_Q31 = NULL;          // Single channel buffer for the fixed-point engine
+static int32_t*  Xfade_Buff_Q31 = NULL;           // Fixed-point buffer for the old cascade during a crossfade
+static sample_t* Delay_Buff = NULL;               // Delayed samples taken out of a block longer than the delay
+static float*    Multirate_Buff_F32 = NULL;       // Resampling filter input with its history in front (multirate channels)
+static int       dsp_filter_block_frames = 0;     // Largest block the work buffers hold
+static int       dsp_filter_frame_multiple = 1;   // Blocks must be a multiple of this many frames (multirate channels)
+static bool      dsp_filter_multirate = false;    // A channel runs at a reduced rate
+static bool      dsp_filter_fir = false;          // A channel has a room correction FIR filter
+static dsp_mix_t dsp_filter_mix;                  // Input mix matrix of the active snapshots (audio path)
+static dsp_channel_t*  dsp_filter_channels = NULL;
+                                                  // Channels set up by dsp_filter_init (their FIR filters follow the block size)
+static int   dsp_filter_xfade_blocks = DSP_XFADE_BLOCKS;
+                                                  // Crossfade length given to new updates (see dsp_filter_set_transition)
+static int   dsp_filter_group = DSP_GROUP_FREE;   // Group publish lock (see dsp_filter_publish_begin)
+
+#if DSP_NUM_CHANNELS == 2
+static int   dsp_filter_mode = DSP_FILTER_MODE;  // Processing mode (see DSP_MODE_...)
+#else
+static int   dsp_filter_mode = DSP_MODE_CHANNEL;
+#endif
 
 
 //------------------------------------------------------------------------------------
@@ -9,6 +31,7 @@ static float Biquad_Buff_F32[ DSP_MAX_SAMPLES ];  // Single channel input buffer
 
 esp_err_t dsp_filter_info( dsp_channel_t* channels ) {
 
+  static const char* const  mix_kinds[] = { "identity", "routing only", "sparse", "dense" };
   dsp_channel_t*  channel;
 
   for( int channel_id=0; channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
@@ -17,53 +40,366 @@ esp_err_t dsp_filter_info( dsp_channel_t* channels ) {
     SERIAL.printf( "I-DSP: Channel: %s\r\n", channel->name );
     SERIAL.printf( "I-DSP:   Sampling freq = %d\r\n", DSP_SAMPLE_RATE );
     SERIAL.printf( "I-DSP:   Gain = %f dB\r\n", channel->gain_dB );
-    SERIAL.printf( "I-DSP:   Scaling factor = %f\r\n", channel->buffers->scaling_factor );
-    SERIAL.printf( "I-DSP:   Delay = %d millis\r\n", channel->delay_millis );
-    SERIAL.printf( "I-DSP:   Delay samples = %d\r\n", channel->buffers->delay_samples );
+    SERIAL.printf( "I-DSP:   Scaling factor = %f\r\n", channel->buffers->published->scaling_factor );
+    SERIAL.printf( "I-DSP:   Delay = %.3f millis\r\n", channel->delay_millis );
+    SERIAL.printf( "I-DSP:   Input mix =" );
+    for( int i = 0; i < DSP_NUM_CHANNELS; ++i ) {
+      SERIAL.printf( " %.3f", channel->mix[i] );
+    }
+    SERIAL.printf( "\r\n" );
+    if( channel->decimation > 1 ) {
+      SERIAL.printf( "I-DSP:   Multirate = 1/%d (%.1f Hz, passband to %.0f Hz, resampling delay %d samples)\r\n", channel->decimation,
+        (float) DSP_SAMPLE_RATE/channel->decimation, dsp_multirate_passband( channel->decimation ), dsp_multirate_delay( channel->decimation ) );
+    }
+    SERIAL.printf( "I-DSP:   Delay samples = %d + %.3f%s\r\n", channel->buffers->published->delay_samples, channel->buffers->published->delay_frac,
+      channel->decimation > 1 ? " (at the reduced rate)" : "" );
+    SERIAL.printf( "I-DSP:   Delay buffer = %d bytes (%d bytes saved)\r\n", (int) ( channel->buffers->published->delay_samples*sizeof( sample_t ) ),
+      (int) ( ( DSP_MAX_DELAY_SAMPLES - channel->buffers->published->delay_samples )*sizeof( sample_t ) ) );
     SERIAL.printf( "I-DSP:   Clipping count = %d\r\n", channel->buffers->clipping_count );
-    SERIAL.printf( "I-DSP:   Biquad filters = %d\r\n", channel->num_filters );
+    SERIAL.printf( "I-DSP:   Limited samples = %d (limiter gain %.2f dB)\r\n", channel->buffers->limit_count,
+      20*log10f( channel->buffers->limiter_target ) );
+    SERIAL.printf( "I-DSP:   Updates = %u (last swapped in after %u blocks)%s\r\n", channel->buffers->updates,
+      channel->buffers->swap_latency, __atomic_load_n( &channel->buffers->pending, __ATOMIC_ACQUIRE ) != NULL ? ", 1 pending" : "" );
+    SERIAL.printf( "I-DSP:   Update crossfade = %d blocks\r\n", channel->buffers->published->xfade_blocks );
+    if( channel->buffers->fir != NULL ) {
+      SERIAL.printf( "I-DSP:   FIR filter = %d taps in %d partitions of %d (FFT size %d, %d bytes)\r\n", channel->fir_taps,
+        channel->buffers->fir->partitions, channel->buffers->fir->block, channel->buffers->fir->size,
+        dsp_fir_memory( channel->fir_taps, channel->buffers->fir->block ) );
+    }
+    SERIAL.printf( "I-DSP:   Biquad filters = %d (%s)\r\n", channel->num_filters,
+      DSP_FILTER_ENGINE == DSP_ENGINE_FIXED ? "fixed point" : "float" );
 
     for( int i=0; i < channel->num_filters; ++i ) {
       SERIAL.printf( "I-DSP:   Filter %d coeffs = %8.6e %8.6e %8.6e %8.6e %8.6e\r\n",
         i, channel->coeffs[i][0], channel->coeffs[i][1], channel->coeffs[i][2], channel->coeffs[i][3], channel->coeffs[i][4] );
+      if( channel->decimation > 1 ) {
+        SERIAL.printf( "I-DSP:     redesigned = %8.6e %8.6e %8.6e %8.6e %8.6e\r\n",
+          channel->buffers->published->coeffs[i][0], channel->buffers->published->coeffs[i][1], channel->buffers->published->coeffs[i][2],
+          channel->buffers->published->coeffs[i][3], channel->buffers->published->coeffs[i][4] );
+      }
     }
   }
 
+  SERIAL.printf( "I-DSP: Input mix matrix = %s\r\n", mix_kinds[dsp_filter_mix.kind] );
+
   return( ESP_OK );
 }
 
 
 //------------------------------------------------------------------------------------
-// Initialize the DSP filters based on the channel configs
+// Report the channels that clipped since the last report. Called from the control
+// plane; the audio path only counts.
 //------------------------------------------------------------------------------------
 
-esp_err_t dsp_filter_init( dsp_channel_t* channels ) {
+esp_err_t dsp_filter_clip_report( dsp_channel_t* channels ) {
 
-  int             delay_samples;
   dsp_channel_t*  channel;
+  int             clipping_count;
+  int32_t         peak;
 
   for( int channel_id=0; channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
-
     channel = &channels[channel_id];
 
-    // Check if filter count is within limits
-    if( channel->num_filters < 0 || channel->num_filters > DSP_MAX_FILTERS ) {
-      SERIAL.printf( "E-DSP: ERROR: Invalid number of filters specified '%d'", channel->num_filters );
+    clipping_count = __atomic_load_n( &channel->buffers->clipping_count, __ATOMIC_RELAXED );
+    if( clipping_count == channel->buffers->clipping_reported ) {
+      continue;
+    }
+
+    peak = __atomic_exchange_n( &channel->buffers->clip_peak, 0, __ATOMIC_RELAXED );
+    SERIAL.printf( "I-DSP: Clipping in channel '%s' %d times with peak %+.1f dBFS (limiter gain %.2f dB)\r\n", channel->name,
+      clipping_count - channel->buffers->clipping_reported, 20*log10f( peak/65536.0f ),
+      20*log10f( channel->buffers->limiter_target ) );
+    channel->buffers->clipping_reported = clipping_count;
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Check the channel config is within limits and its biquad filters are stable
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_filter_validate( dsp_channel_t* channel ) {
+
+  float   a1;
+  float   a2;
+  float   cost;
+#if DSP_FILTER_ENGINE == DSP_ENGINE_FIXED
+  dsp_biquad_q31_t  coeffs_q31[DSP_MAX_FILTERS];
+#endif
+
+  // Check if filter count is within limits
+  if( channel->num_filters < 0 || channel->num_filters > DSP_MAX_FILTERS ) {
+    SERIAL.printf( "E-DSP: ERROR: Invalid number of filters specified '%d'\r\n", channel->num_filters );
+    return( ESP_FAIL );
+  }
+
+  // Check if specified gain is within limits
+  if( channel->gain_dB < -DSP_MAX_GAIN || channel->gain_dB > DSP_MAX_GAIN ) {
+    SERIAL.printf( "E-DSP: ERROR: Invalid gain setting for channel '%s'\r\n", channel->name );
+    return( ESP_FAIL );
+  }
+
+  // Check if specified delay is within limits
+  if( channel->delay_millis < 0 || channel->delay_millis > DSP_MAX_DELAY_MILLIS ) {
+    SERIAL.printf( "E-DSP: Invalid delay setting for channel '%s'\r\n", channel->name );
+    return( ESP_FAIL );
+  }
+
+  // Check the decimation factor (the fixed-point engine only runs at the full rate)
+  if( channel->decimation < 1 || channel->decimation > DSP_MAX_DECIMATION ||
+      ( DSP_FILTER_ENGINE == DSP_ENGINE_FIXED && channel->decimation != 1 ) ) {
+    SERIAL.printf( "E-DSP: Invalid decimation '%d' for channel '%s'\r\n", channel->decimation, channel->name );
+    return( ESP_FAIL );
+  }
+
+  // Check the FIR filter (float engine only)
+  if( channel->fir_taps < 0 || channel->fir_taps > DSP_MAX_FIR_TAPS || ( channel->fir_taps > 0 && channel->fir_coeffs == NULL ) ||
+      ( DSP_FILTER_ENGINE == DSP_ENGINE_FIXED && channel->fir_taps != 0 ) ) {
+    SERIAL.printf( "E-DSP: Invalid FIR filter of %d taps for channel '%s'\r\n", channel->fir_taps, channel->name );
+    return( ESP_FAIL );
+  }
+
+  // Check the input mix gains
+  for( int i = 0; i < DSP_NUM_CHANNELS; ++i ) {
+    if( !( fabsf( channel->mix[i] ) <= DSP_MAX_MIX_GAIN ) ) {
+      SERIAL.printf( "E-DSP: Invalid mix gain %f of input %d for channel '%s'\r\n", channel->mix[i], i, channel->name );
+      return( ESP_FAIL );
+    }
+  }
+
+  // Check the poles of each filter are inside the unit circle (stability triangle)
+  for( int filter_id = 0; filter_id < channel->num_filters; ++filter_id ) {
+    a1 = channel->coeffs[filter_id][3];
+    a2 = channel->coeffs[filter_id][4];
+
+    if( !( fabsf( a2 ) < 1.0 && fabsf( a1 ) < 1.0 + a2 ) ) {
+      SERIAL.printf( "E-DSP: Unstable filter %d in channel '%s' (a1 = %f, a2 = %f)\r\n", filter_id, channel->name, a1, a2 );
       return( ESP_FAIL );
     }
 
-    // Check if specified gain is within limits
-    if( channel->gain_dB < -DSP_MAX_GAIN || channel->gain_dB > DSP_MAX_GAIN ) {
-      SERIAL.printf( "E-DSP: ERROR: Invalid gain setting for channel '%s'", channel->name );
+    // A multirate channel can only redesign filters that act within its passband
+    if( channel->decimation > 1 && dsp_multirate_freq( channel->coeffs[filter_id] ) > dsp_multirate_passband( channel->decimation ) ) {
+      SERIAL.printf( "E-DSP: Filter %d in channel '%s' at %.0f Hz is above the multirate passband (%.0f Hz)\r\n", filter_id, channel->name,
+        dsp_multirate_freq( channel->coeffs[filter_id] ), dsp_multirate_passband( channel->decimation ) );
       return( ESP_FAIL );
     }
+  }
+
+  // A multirate channel with few filters saves less than the resampling costs (allowed, but noted). In the stereo
+  // modes it also takes dsp_filter() off the lockstep path.
+  cost = dsp_multirate_cost( channel->decimation );
+  if( dsp_filter_mode != DSP_MODE_CHANNEL && DSP_BIQUAD_TOPOLOGY == DSP_TOPOLOGY_DF2 ) {
+    cost += DSP_MULTIRATE_COST_PATH;
+  }
+  if( channel->decimation > 1 && channel->num_filters*( channel->decimation - 1 ) <= cost*channel->decimation ) {
+    SERIAL.printf( "I-DSP: Channel '%s' runs %d filters at 1/%d of the rate, which saves less than the resampling costs (about %.1f filters)\r\n",
+      channel->name, channel->num_filters, channel->decimation, cost );
+  }
+
+#if DSP_FILTER_ENGINE == DSP_ENGINE_FIXED
+  // Check the coefficients fit the fixed-point format
+  if( dsp_biquad_q31_quantize( channel->coeffs, channel->num_filters, coeffs_q31 ) != ESP_OK ) {
+    SERIAL.printf( "E-DSP: Filter coefficients of channel '%s' too large for the fixed-point engine\r\n", channel->name );
+    return( ESP_FAIL );
+  }
+#endif
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Build the parameter snapshot used by dsp_filter from the channel config
+//------------------------------------------------------------------------------------
+
+static void dsp_filter_params( const dsp_channel_t* channel, dsp_params_t* params ) {
+
+  double    delay;
+
+  params->num_filters = channel->num_filters;
+  memcpy( params->coeffs, channel->coeffs, sizeof( params->coeffs ) );
+
+  // A multirate channel runs its filters at the reduced rate (checked by dsp_filter_validate)
+  if( channel->decimation > 1 ) {
+    for( int filter_id = 0; filter_id < channel->num_filters; ++filter_id ) {
+      dsp_multirate_redesign( channel->coeffs[filter_id], channel->decimation, params->coeffs[filter_id] );
+    }
+  }
+
+  // Quantize the coefficients for the fixed-point engine (checked by dsp_filter_validate)
+  dsp_biquad_q31_quantize( params->coeffs, params->num_filters, params->coeffs_q31 );
+
+  // Set scaling factor
+  params->scaling_factor = exp10( channel->gain_dB/20.0 );
+  params->scaling_q31 = (int32_t) lround( ldexp( params->scaling_factor, DSP_Q31_GAIN_BITS ) );
+
+  // Calculate number of delay samples required, whole and fractional (the buffer is set up by the caller),
+  // at the rate the channel runs at
+  delay = (double) DSP_SAMPLE_RATE*channel->delay_millis/1000/channel->decimation;
+  params->delay_samples = (int) floor( delay );
+  params->delay_frac = delay - params->delay_samples;
+
+  params->xfade_blocks = dsp_filter_xfade_blocks;
+  memcpy( params->mix, channel->mix, sizeof( params->mix ) );
+}
+
+
+//------------------------------------------------------------------------------------
+// Set up the input mix matrix from the rows of the active snapshots (audio path, when
+// one of them changed)
+//------------------------------------------------------------------------------------
+
+static void dsp_filter_mix_setup( dsp_channel_t* channels ) {
+
+  float     gain[DSP_NUM_CHANNELS][DSP_NUM_CHANNELS];
+
+  for( int channel_id=0; channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
+    memcpy( gain[channel_id], channels[channel_id].buffers->active->mix, sizeof( gain[0] ) );
+  }
+
+  dsp_mix_setup( &dsp_filter_mix, gain );
+}
+
+
+//------------------------------------------------------------------------------------
+// Size the work buffers for blocks of up to 'frames' frames per channel. Only call this
+// while no block is being processed (before starting the audio task or while it is
+// stopped). The old buffers are kept if the new ones cannot be allocated.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_filter_set_block( int frames ) {
+
+  float*      biquad_f32 = NULL;
+  float*      xfade_f32 = NULL;
+  int32_t*    biquad_q31 = NULL;
+  int32_t*    xfade_q31 = NULL;
+  float*      multirate = NULL;
+  sample_t*   delay = NULL;
+  dsp_fir_t*  fir[DSP_NUM_CHANNELS] = { NULL };
+  dsp_channel_t*  channel;
+  bool        failed;
+
+  if( frames < DSP_MIN_BLOCK_FRAMES || frames > DSP_MAX_BLOCK_FRAMES ) {
+    SERIAL.printf( "E-DSP: Invalid block size '%d' (%d to %d frames)\r\n", frames, DSP_MIN_BLOCK_FRAMES, DSP_MAX_BLOCK_FRAMES );
+    return( ESP_FAIL );
+  }
+
+  if( frames % dsp_filter_frame_multiple != 0 ) {
+    SERIAL.printf( "E-DSP: Block size '%d' must be a multiple of the channel decimation (%d)\r\n", frames, dsp_filter_frame_multiple );
+    return( ESP_FAIL );
+  }
+
+  if( frames == dsp_filter_block_frames ) {
+    return( ESP_OK );
+  }
+
+  delay = (sample_t*) malloc( frames*sizeof( sample_t ) );
+#if DSP_FILTER_ENGINE == DSP_ENGINE_FIXED
+  biquad_q31 = (int32_t*) malloc( frames*sizeof( int32_t ) );
+  xfade_q31 = (int32_t*) malloc( frames*sizeof( int32_t ) );
+  failed = delay == NULL || biquad_q31 == NULL || xfade_q31 == NULL;
+#else
+  biquad_f32 = (float*) malloc( frames*sizeof( float ) );
+  xfade_f32 = (float*) malloc( frames*sizeof( float ) );
+  multirate = (float*) malloc( ( frames + DSP_MULTIRATE_MAX_TAPS )*sizeof( float ) );
+  failed = delay == NULL || biquad_f32 == NULL || xfade_f32 == NULL || multirate == NULL;
+#endif
+
+  // FIR filters partitioned for the new block size (they restart from silence)
+  for( int channel_id=0; dsp_filter_channels != NULL && channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
+    channel = &dsp_filter_channels[channel_id];
+    if( channel->buffers->fir != NULL && dsp_fir_create( &fir[channel_id], channel->fir_coeffs, channel->fir_taps,
+                                                        frames/channel->decimation ) != ESP_OK ) {
+      failed = true;
+    }
+  }
+
+  if( failed ) {
+    SERIAL.printf( "E-DSP: Unable to allocate work buffers for %d frames\r\n", frames );
+    for( int channel_id=0; channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
+      dsp_fir_free( fir[channel_id] );
+    }
+    free( delay );
+    free( biquad_f32 );
+    free( xfade_f32 );
+    free( biquad_q31 );
+    free( xfade_q31 );
+    free( multirate );
+    return( ESP_FAIL );
+  }
+
+  free( Delay_Buff );
+  free( Biquad_Buff_F32 );
+  free( Xfade_Buff_F32 );
+  free( Biquad_Buff_Q31 );
+  free( Xfade_Buff_Q31 );
+  free( Multirate_Buff_F32 );
+
+  Delay_Buff = delay;
+  Multirate_Buff_F32 = multirate;
+  Biquad_Buff_F32 = biquad_f32;
+  Xfade_Buff_F32 = xfade_f32;
+  Biquad_Buff_Q31 = biquad_q31;
+  Xfade_Buff_Q31 = xfade_q31;
+  dsp_filter_block_frames = frames;
+
+  for( int channel_id=0; dsp_filter_channels != NULL && channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
+    channel = &dsp_filter_channels[channel_id];
+    if( channel->buffers->fir != NULL ) {
+      dsp_fir_free( channel->buffers->fir );
+      channel->buffers->fir = fir[channel_id];
+    }
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Initialize the DSP filters based on the channel configs
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_filter_init( dsp_channel_t* channels ) {
+
+  dsp_channel_t*  channel;
+  int             multiple = 1;
+  int             lcm;
+
+  // Work buffers for the default block size, unless set up already
+  if( dsp_filter_block_frames == 0 && dsp_filter_set_block( DSP_BLOCK_FRAMES ) != ESP_OK ) {
+    return( ESP_FAIL );
+  }
+
+  // Each block must split evenly into the low-rate samples of every channel
+  for( int channel_id=0; channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
+    channel = &channels[channel_id];
 
-    // Check if specified delay is within limits
-    if( channel->delay_millis < 0 || channel->delay_millis > DSP_MAX_DELAY_MILLIS ) {
-      SERIAL.printf( "E-DSP: Invalid delay setting for channel '%s'", channel->name );
+    if( dsp_filter_validate( channel ) != ESP_OK ) {
       return( ESP_FAIL );
     }
 
+    // Least common multiple of the decimation factors
+    lcm = multiple;
+    while( lcm % channel->decimation != 0 ) {
+      lcm += multiple;
+    }
+    multiple = lcm;
+  }
+
+  if( dsp_filter_block_frames % multiple != 0 ) {
+    SERIAL.printf( "E-DSP: Block size '%d' must be a multiple of the channel decimation (%d)\r\n", dsp_filter_block_frames, multiple );
+    return( ESP_FAIL );
+  }
+  dsp_filter_frame_multiple = multiple;
+  dsp_filter_multirate = multiple > 1;
+  dsp_filter_fir = false;
+
+  for( int channel_id=0; channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
+
+    channel = &channels[channel_id];
+
     // Allocate the necessary data buffers for delay and biquad calculations
     channel->buffers = (dsp_buffer_t*) malloc( sizeof( dsp_buffer_t ) );
 
@@ -72,136 +408,1305 @@ esp_err_t dsp_filter_init( dsp_channel_t* channels ) {
       return( ESP_FAIL );
     }
 
-    // Set scaling factor
-    channel->buffers->scaling_factor = exp10( channel->gain_dB/20.0 );
+    // Set up the active parameter snapshot with a delay buffer of the configured length, no update pending
+    memset( channel->buffers->params, 0, sizeof( channel->buffers->params ) );
+    dsp_filter_params( channel, &channel->buffers->params[0] );
 
-    // Initialize biquad delay values for each filter
-    for( int filter_id = 0; filter_id < DSP_MAX_FILTERS; ++filter_id ) {
-      channel->buffers->biquad_w[filter_id][0] = 0.0;
-      channel->buffers->biquad_w[filter_id][1] = 0.0;
+    if( channel->buffers->params[0].delay_samples > 0 ) {
+      channel->buffers->params[0].delay_buff = (sample_t*) calloc( channel->buffers->params[0].delay_samples, sizeof( sample_t ) );
+
+      if( channel->buffers->params[0].delay_buff == NULL ) {
+        SERIAL.printf( "E-DSP: Unable to allocate delay buffer for channel '%s'", channel->name );
+        free( channel->buffers );
+        channel->buffers = NULL;
+        return( ESP_FAIL );
+      }
     }
 
-    // Set clipping count
+    channel->buffers->active = &channel->buffers->params[0];
+    channel->buffers->previous = NULL;
+    channel->buffers->published = &channel->buffers->params[0];
+    channel->buffers->published_prev = &channel->buffers->params[0];
+    channel->buffers->pending = NULL;
+    channel->buffers->blocks = 0;
+    channel->buffers->publish_block = 0;
+    channel->buffers->swap_latency = 0;
+    channel->buffers->updates = 0;
+    channel->buffers->xfade_blocks = 0;
+    channel->buffers->xfade_remaining = 0;
+    channel->buffers->xfade_filters = false;
+
+    // Initialize biquad delay values for each filter
+    memset( channel->buffers->biquad_w, 0, sizeof( channel->buffers->biquad_w ) );
+    memset( channel->buffers->biquad_q31, 0, sizeof( channel->buffers->biquad_q31 ) );
+
+    // Set clipping count and start the limiter without gain reduction
     channel->buffers->clipping_count = 0;
+    channel->buffers->limit_count = 0;
+    channel->buffers->clip_peak = 0;
+    channel->buffers->clipping_reported = 0;
+    channel->buffers->limiter_gain = 1.0;
+    channel->buffers->limiter_target = 1.0;
 
-    // Calculate number of delay samples required
-    delay_samples = DSP_SAMPLE_RATE*channel->delay_millis/1000;
+    // Start at the beginning of the (zeroed) delay buffer
+    channel->buffers->delay_offset = 0;
+    channel->buffers->delay_last = 0;
 
-    if( delay_samples > 0 ) {
-      // Set up the delay buffer
-      channel->buffers->delay_samples = delay_samples;
-      channel->buffers->delay_offset = 0;
-      memset( channel->buffers->delay_buff, 0, DSP_MAX_DELAY_SAMPLES*sizeof( sample_t ) );
-    } else {
-      // No delay buffer
-      channel->buffers->delay_samples = 0;
-      channel->buffers->delay_offset = 0;
+    // Design the resampling filters of a multirate channel
+    dsp_multirate_init( &channel->buffers->multirate, channel->decimation );
+
+    // Partition the FIR filter for the block size at the rate the channel runs at
+    channel->buffers->fir = NULL;
+    if( channel->fir_taps > 0 ) {
+      if( dsp_fir_create( &channel->buffers->fir, channel->fir_coeffs, channel->fir_taps,
+                          dsp_filter_block_frames/channel->decimation ) != ESP_OK ) {
+        SERIAL.printf( "E-DSP: Unable to allocate FIR filter for channel '%s' (%d bytes)\r\n", channel->name,
+          dsp_fir_memory( channel->fir_taps, dsp_filter_block_frames/channel->decimation ) );
+        free( channel->buffers->params[0].delay_buff );
+        free( channel->buffers );
+        channel->buffers = NULL;
+        return( ESP_FAIL );
+      }
+      dsp_filter_fir = true;
     }
   }
 
+  dsp_filter_mix_setup( channels );
+  dsp_filter_channels = channels;
+
   return( ESP_OK );
 };
 
 
 //------------------------------------------------------------------------------------
-// Process the audio buffer by cascading the biquad filters and applying delay/gain
+// Free the delay buffer of a snapshot unless another snapshot still refers to it or it
+// belongs to a preset
 //------------------------------------------------------------------------------------
 
-esp_err_t dsp_filter( dsp_channel_t* channels, sample_t* input_buffer, int buffer_len, bool* clip_flag ) {
-
-  esp_err_t        res;
-  dsp_channel_t*  channel;
-  int              input_samples;
-  float            sample_value;
-  float            prev_value;
-  float            scaling_factor;
-  int              delay_samples;
-  int              delay_offset;
-  sample_t*        delay_buff;
+static void dsp_filter_delay_release( dsp_buffer_t* buffers, dsp_params_t* params ) {
 
-  // Check if input sample count exceeded
-  input_samples = buffer_len/sizeof( sample_t )/2;
+  // A preset's delay buffer stays with the preset
+  if( params->delay_owned ) {
+    params->delay_buff = NULL;
+    params->delay_owned = false;
+    return;
+  }
 
-  if( input_samples > DSP_MAX_SAMPLES ) {
-    SERIAL.printf( "E-DSP: Too many input samples = '%d'", input_samples );
-    return( ESP_FAIL );
+  for( int i = 0; i < 3; ++i ) {
+    if( &buffers->params[i] != params && buffers->params[i].delay_buff == params->delay_buff ) {
+      params->delay_buff = NULL;
+      return;
+    }
   }
 
-  // Reset the clipping flag
-  *clip_flag = false;
+  free( params->delay_buff );
+  params->delay_buff = NULL;
+}
+
+
+//------------------------------------------------------------------------------------
+// Release the data buffers allocated by dsp_filter_init
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_filter_deinit( dsp_channel_t* channels ) {
+
+  dsp_buffer_t*   buffers;
+
+  if( channels == dsp_filter_channels ) {
+    dsp_filter_channels = NULL;
+    dsp_filter_fir = false;
+  }
 
   for( int channel_id=0; channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
+    buffers = channels[channel_id].buffers;
+    if( buffers == NULL ) {
+      continue;
+    }
 
-    channel = &channels[channel_id];
-    delay_samples = channel->buffers->delay_samples;
-    delay_offset = channel->buffers->delay_offset;
-    delay_buff = &channel->buffers->delay_buff[0];
-
-    if( delay_samples > 0 ) {
-      for( int i = 0; i < input_samples; ++i ) {
-        // Output the delayed samples from the delay buffer
-        Biquad_Buff_F32[i] = delay_buff[delay_offset];
-
-        // Replace the delay buffer sample with the next sample from the input stream
-        delay_buff[delay_offset] = input_buffer[i*DSP_NUM_CHANNELS  + channel_id];
-
-        // Increment the delay buffer pointer and wrap it when at end of delay buffer
-        ++ delay_offset;
-        if( delay_offset == delay_samples ) {
-          delay_offset = 0;
-        }
-      }
+    dsp_fir_free( buffers->fir );
 
-      // Update the buffer pointer
-      channel->buffers->delay_offset = delay_offset;
-    } else {
-      for( int i = 0; i < input_samples; ++ i ) {
-        // Output the delayed samples from the input buffer
-        Biquad_Buff_F32[i] = input_buffer[i*DSP_NUM_CHANNELS  + channel_id];
-      }
+    // Free each delay buffer once, snapshots can share them
+    for( int i = 0; i < 3; ++i ) {
+      dsp_filter_delay_release( buffers, &buffers->params[i] );
     }
 
-    // Process each biquad filter in the channel
-    if( channel->num_filters > 0 ) {
-      int filter_id = 0;
-      while( true ) {
-        res = dsps_biquad_f32_ae32( Biquad_Buff_F32,  Biquad_Buff_F32, input_samples, channel->coeffs[filter_id], channel->buffers->biquad_w[filter_id] );
+    free( buffers );
+    channels[channel_id].buffers = NULL;
+  }
 
-        if( res != ESP_OK ) {
-          SERIAL.printf( "E-DSP: ERROR: Failure during biquad processing = '%d'", res );
-          return( res );
-        }
+  return( ESP_OK );
+}
 
-        ++ filter_id;
-        if( filter_id == channel->num_filters ) {
-          break;
-        }
+
+//------------------------------------------------------------------------------------
+// Publish the channel config to the audio path, swapped in at the next block
+//
+// The audio path owns buffers->active (and buffers->previous while it
+// crossfades) and only ever exchanges buffers->pending with NULL, never while a
+// crossfade runs. So it only uses the last two snapshots published. The
+// control side (a single caller at a time, normally loop()) writes either the
+// snapshot it takes back from pending, or the third one.
+//
+// A new delay length gets a new delay buffer of exactly that length, which the
+// audio path fills from the old one when it swaps the snapshot in. Buffers are
+// only allocated and freed here (or with the preset bank), never on the audio path.
+//------------------------------------------------------------------------------------
+
+static esp_err_t dsp_filter_publish_snapshot( dsp_channel_t* channel, dsp_params_t* update ) {
+
+  dsp_buffer_t*   buffers = channel->buffers;
+  dsp_params_t*   params;
+  dsp_params_t*   expected;
+  dsp_params_t*   base;
+  bool            retracted;
+
+  if( buffers == NULL ) {
+    return( ESP_FAIL );
+  }
+
+  params = buffers->published;
+  expected = params;
+
+  // Take back the last update if it is still pending, otherwise it is in use
+  retracted = __atomic_compare_exchange_n( &buffers->pending, &expected, (dsp_params_t*) NULL, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE );
+
+  if( retracted ) {
+    base = buffers->published_prev;
+  } else {
+    params = &buffers->params[0];
+    while( params == buffers->published || params == buffers->published_prev ) {
+      ++params;
+    }
+    base = buffers->published;
+  }
+
+  // Keep the delay buffer the audio path swaps from if the length is unchanged, else reuse
+  // the one in the slot (the audio path refills it), take a prepared snapshot's own or
+  // allocate one of the new length
+  if( update->delay_samples == base->delay_samples ) {
+    update->delay_buff = base->delay_buff;
+    update->delay_owned = base->delay_owned;
+  } else if( update->delay_samples == params->delay_samples && params->delay_buff != NULL ) {
+    update->delay_buff = params->delay_buff;
+    update->delay_owned = params->delay_owned;
+  } else if( update->delay_buff != NULL ) {
+    // Prepared by dsp_filter_prepare, delay_owned set
+  } else if( update->delay_samples > 0 ) {
+    update->delay_buff = (sample_t*) malloc( update->delay_samples*sizeof( sample_t ) );
+
+    if( update->delay_buff == NULL ) {
+      SERIAL.printf( "E-DSP: Unable to allocate delay buffer for channel '%s'\r\n", channel->name );
+
+      // Put back the update taken back above
+      if( retracted ) {
+        __atomic_store_n( &buffers->pending, params, __ATOMIC_RELEASE );
       }
+      return( ESP_FAIL );
     }
+  } else {
+    update->delay_buff = NULL;
+    update->delay_owned = false;
+  }
+
+  if( params->delay_buff != update->delay_buff ) {
+    dsp_filter_delay_release( buffers, params );
+  }
+  *params = *update;
+
+  buffers->publish_block = __atomic_load_n( &buffers->blocks, __ATOMIC_RELAXED );
+  if( !retracted ) {
+    buffers->published_prev = buffers->published;
+  }
+  buffers->published = params;
 
-    scaling_factor = channel->buffers->scaling_factor;
+  __atomic_store_n( &buffers->pending, params, __ATOMIC_RELEASE );
 
-    // Copy results of filter processing back to the input buffer
-    prev_value = 0;
-    for( int i=0; i < input_samples; ++i ) {
-      sample_value = Biquad_Buff_F32[i]*scaling_factor;
+  return( ESP_OK );
+}
 
-      // Check if value out of range
-      if( sample_value < -DSP_MAX_SAMPLE_VALUE || sample_value > DSP_MAX_SAMPLE_VALUE ) {
+esp_err_t dsp_filter_publish( dsp_channel_t* channel ) {
 
-        SERIAL.printf( "I-DSP:  Clipping in channel '%s' with value '%f'\r\n", channel->name, sample_value );
+  dsp_params_t    update;
 
-        // Set clipping flag
-        *clip_flag = true;
-        ++channel->buffers->clipping_count;
+  dsp_filter_params( channel, &update );
+  update.delay_buff = NULL;
+  update.delay_owned = false;
 
-        // Set sample to limit audible distortion
-        sample_value = ( ( DSP_MAX_SAMPLE_VALUE*( sample_value < 0 ? -1 : 1 ) ) + prev_value)/2;
-      }
+  return( dsp_filter_publish_snapshot( channel, &update ) );
+}
+
+
+//------------------------------------------------------------------------------------
+// Prepared snapshots (preset bank)
+//
+// dsp_filter_prepare builds the snapshot of a validated channel config ahead of time,
+// with a delay buffer of its own, so dsp_filter_publish_params can hand it to the audio
+// path with no checks, no filter design and no allocation. The delay buffer belongs to
+// the prepared snapshot while it exists: the audio path may be using it after a switch,
+// so dsp_filter_unprepare frees it only if no snapshot of the channel refers to it, and
+// otherwise leaves it to be freed with the last one that does.
+//------------------------------------------------------------------------------------
 
-      input_buffer[i*DSP_NUM_CHANNELS  + channel_id] = sample_value;
-      prev_value = sample_value;
+esp_err_t dsp_filter_prepare( const dsp_channel_t* channel, dsp_params_t* params ) {
+
+  dsp_filter_params( channel, params );
+  params->delay_buff = NULL;
+  params->delay_owned = false;
+
+  if( params->delay_samples > 0 ) {
+    params->delay_buff = (sample_t*) calloc( params->delay_samples, sizeof( sample_t ) );
+
+    if( params->delay_buff == NULL ) {
+      SERIAL.printf( "E-DSP: Unable to allocate delay buffer for channel '%s'\r\n", channel->name );
+      return( ESP_FAIL );
+    }
+    params->delay_owned = true;
+  }
+
+  return( ESP_OK );
+}
+
+void dsp_filter_unprepare( dsp_channel_t* channel, dsp_params_t* params ) {
+
+  bool    in_use = false;
+
+  if( params->delay_buff == NULL ) {
+    return;
+  }
+
+  for( int i = 0; channel->buffers != NULL && i < 3; ++i ) {
+    if( channel->buffers->params[i].delay_buff == params->delay_buff ) {
+      channel->buffers->params[i].delay_owned = false;
+      in_use = true;
     }
+  }
+
+  if( !in_use ) {
+    free( params->delay_buff );
+  }
+  params->delay_buff = NULL;
+  params->delay_owned = false;
+}
+
+esp_err_t dsp_filter_publish_params( dsp_channel_t* channel, const dsp_params_t* prepared ) {
+
+  dsp_params_t    update = *prepared;
+
+  update.xfade_blocks = dsp_filter_xfade_blocks;
+
+  return( dsp_filter_publish_snapshot( channel, &update ) );
+}
+
+
+//------------------------------------------------------------------------------------
+// Group publish: the updates published between dsp_filter_publish_begin and
+// dsp_filter_publish_end are swapped in together, in the same block, on all channels.
+//
+// The audio path only picks up updates while it holds the group lock, which it tries
+// to take once per block if an update is pending and never waits for. The control side
+// holds it while it publishes the group; the audio path holds it for a few loads and
+// swaps at most, so the control side only ever spins briefly.
+//------------------------------------------------------------------------------------
+
+void dsp_filter_publish_begin( void ) {
+
+  int     expected = DSP_GROUP_FREE;
+
+  while( !__atomic_compare_exchange_n( &dsp_filter_group, &expected, DSP_GROUP_CONTROL, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) ) {
+    expected = DSP_GROUP_FREE;
+  }
+}
+
+void dsp_filter_publish_end( void ) {
+
+  __atomic_store_n( &dsp_filter_group, DSP_GROUP_FREE, __ATOMIC_RELEASE );
+}
+
+
+//------------------------------------------------------------------------------------
+// Runtime setters: validate the changed config, then publish it to the audio path
+//------------------------------------------------------------------------------------
+
+static esp_err_t dsp_filter_update( dsp_channel_t* channels, int channel_id, dsp_channel_t* update ) {
+
+  dsp_channel_t   current = channels[channel_id];
+
+  if( dsp_filter_validate( update ) != ESP_OK ) {
+    return( ESP_FAIL );
+  }
+
+  channels[channel_id] = *update;
+
+  if( dsp_filter_publish( &channels[channel_id] ) != ESP_OK ) {
+    channels[channel_id] = current;
+    return( ESP_FAIL );
+  }
+
+  return( ESP_OK );
+}
+
+esp_err_t dsp_filter_set_gain( dsp_channel_t* channels, int channel_id, float gain_dB ) {
+
+  dsp_channel_t   update;
+
+  if( channel_id < 0 || channel_id >= DSP_NUM_CHANNELS ) {
+    return( ESP_FAIL );
+  }
+
+  update = channels[channel_id];
+  update.gain_dB = gain_dB;
+
+  return( dsp_filter_update( channels, channel_id, &update ) );
+}
+
+esp_err_t dsp_filter_set_delay( dsp_channel_t* channels, int channel_id, float delay_millis ) {
+
+  dsp_channel_t   update;
+
+  if( channel_id < 0 || channel_id >= DSP_NUM_CHANNELS ) {
+    return( ESP_FAIL );
+  }
+
+  update = channels[channel_id];
+  update.delay_millis = delay_millis;
+
+  return( dsp_filter_update( channels, channel_id, &update ) );
+}
+
+esp_err_t dsp_filter_set_num_filters( dsp_channel_t* channels, int channel_id, int num_filters ) {
+
+  dsp_channel_t   update;
+
+  if( channel_id < 0 || channel_id >= DSP_NUM_CHANNELS ) {
+    return( ESP_FAIL );
+  }
+
+  update = channels[channel_id];
+  update.num_filters = num_filters;
+
+  return( dsp_filter_update( channels, channel_id, &update ) );
+}
+
+esp_err_t dsp_filter_set_coeffs( dsp_channel_t* channels, int channel_id, int filter_id, const float* coeffs ) {
+
+  dsp_channel_t   update;
+
+  if( channel_id < 0 || channel_id >= DSP_NUM_CHANNELS || filter_id < 0 || filter_id >= DSP_MAX_FILTERS ) {
+    return( ESP_FAIL );
+  }
+
+  update = channels[channel_id];
+  memcpy( update.coeffs[filter_id], coeffs, sizeof( update.coeffs[filter_id] ) );
+
+  return( dsp_filter_update( channels, channel_id, &update ) );
+}
+
+esp_err_t dsp_filter_set_mix( dsp_channel_t* channels, int channel_id, const float* mix ) {
+
+  dsp_channel_t   update;
+
+  if( channel_id < 0 || channel_id >= DSP_NUM_CHANNELS ) {
+    return( ESP_FAIL );
+  }
+
+  update = channels[channel_id];
+  memcpy( update.mix, mix, sizeof( update.mix ) );
+
+  return( dsp_filter_update( channels, channel_id, &update ) );
+}
+
+// Replace the filters from 'first' on with 'count' new ones in a single update (e.g. a fitted EQ)
+esp_err_t dsp_filter_set_filters( dsp_channel_t* channels, int channel_id, int first, int count, const float coeffs[][5] ) {
+
+  dsp_channel_t   update;
+
+  if( channel_id < 0 || channel_id >= DSP_NUM_CHANNELS || first < 0 || count < 0 || first + count > DSP_MAX_FILTERS ) {
+    return( ESP_FAIL );
+  }
+
+  update = channels[channel_id];
+  update.num_filters = first + count;
+  memcpy( update.coeffs[first], coeffs, count*sizeof( update.coeffs[0] ) );
+
+  return( dsp_filter_update( channels, channel_id, &update ) );
+}
+
+
+//------------------------------------------------------------------------------------
+// Set the number of blocks later updates are crossfaded over (0 swaps instantly)
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_filter_set_transition( int xfade_blocks ) {
+
+  if( xfade_blocks < 0 || xfade_blocks > DSP_MAX_XFADE_BLOCKS ) {
+    SERIAL.printf( "E-DSP: Invalid crossfade length '%d' (0 to %d blocks)\r\n", xfade_blocks, DSP_MAX_XFADE_BLOCKS );
+    return( ESP_FAIL );
+  }
+
+  dsp_filter_xfade_blocks = xfade_blocks;
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Fill the delay buffer of a new delay length from the current one (audio path). The
+// newest samples are kept; a longer delay starts with silence, a shorter one drops
+// the oldest samples.
+//------------------------------------------------------------------------------------
+
+static void dsp_filter_delay_resize( dsp_buffer_t* buffers, const dsp_params_t* active, const dsp_params_t* params ) {
+
+  int     old_samples = active->delay_samples;
+  int     new_samples = params->delay_samples;
+  int     keep = old_samples < new_samples ? old_samples : new_samples;
+  int     pad = new_samples - keep;
+  int     start;
+  int     len;
+
+  if( new_samples > 0 ) {
+    memset( params->delay_buff, 0, pad*sizeof( sample_t ) );
+
+    if( keep > 0 ) {
+      // The oldest sample is at delay_offset, the newest 'keep' start 'keep' before it
+      start = buffers->delay_offset + old_samples - keep;
+      if( start >= old_samples ) {
+        start -= old_samples;
+      }
+
+      len = old_samples - start < keep ? old_samples - start : keep;
+      memcpy( &params->delay_buff[pad], &active->delay_buff[start], len*sizeof( sample_t ) );
+      memcpy( &params->delay_buff[pad + len], active->delay_buff, ( keep - len )*sizeof( sample_t ) );
+    }
+  }
+
+  buffers->delay_offset = 0;
+}
+
+
+//------------------------------------------------------------------------------------
+// Swap in a pending parameter snapshot at the start of a block (audio path), if
+// dsp_filter_pick_up allows it this block.
+//------------------------------------------------------------------------------------
+
+static inline void dsp_filter_swap( dsp_buffer_t* buffers, bool pick_up ) {
+
+  dsp_params_t*   params;
+  dsp_params_t*   active;
+
+  if( pick_up && __atomic_load_n( &buffers->pending, __ATOMIC_RELAXED ) != NULL && buffers->xfade_remaining == 0 ) {
+    params = __atomic_exchange_n( &buffers->pending, (dsp_params_t*) NULL, __ATOMIC_ACQUIRE );
+
+    if( params != NULL ) {
+      active = buffers->active;
+
+      // Filters added by the update start from rest, the others keep their state
+      for( int filter_id = active->num_filters; filter_id < params->num_filters; ++filter_id ) {
+        memset( buffers->biquad_w[filter_id], 0, sizeof( buffers->biquad_w[0] ) );
+        memset( buffers->biquad_q31[filter_id], 0, sizeof( buffers->biquad_q31[0] ) );
+      }
+
+      // Move the delayed samples over to a new delay buffer
+      if( params->delay_buff != active->delay_buff ) {
+        dsp_filter_delay_resize( buffers, active, params );
+      }
+
+      // Crossfade from the old snapshot if the filters or the gain changed (delay changes are instant)
+      if( params->xfade_blocks > 0 ) {
+        buffers->xfade_filters = params->num_filters != active->num_filters ||
+          memcmp( params->coeffs, active->coeffs, params->num_filters*sizeof( params->coeffs[0] ) ) != 0;
+
+        if( buffers->xfade_filters || params->scaling_factor != active->scaling_factor ) {
+          memcpy( buffers->xfade_w, buffers->biquad_w, sizeof( buffers->xfade_w ) );
+          memcpy( buffers->xfade_q31, buffers->biquad_q31, sizeof( buffers->xfade_q31 ) );
+          buffers->previous = active;
+          buffers->xfade_blocks = params->xfade_blocks;
+          buffers->xfade_remaining = params->xfade_blocks;
+        }
+      }
+
+      buffers->active = params;
+      buffers->swap_latency = buffers->blocks - buffers->publish_block;
+      ++buffers->updates;
+    }
+  }
+
+  __atomic_store_n( &buffers->blocks, buffers->blocks + 1, __ATOMIC_RELAXED );
+}
+
+
+//------------------------------------------------------------------------------------
+// Decide whether the pending updates are swapped in this block (audio path). They are
+// taken all together or not at all: not while a group is being published, and not
+// while a channel with an update pending is still crossfading (an update arriving
+// during a crossfade waits for it to finish). Takes the group lock if they are;
+// dsp_filter releases it after the swaps.
+//------------------------------------------------------------------------------------
+
+static bool dsp_filter_pick_up( dsp_channel_t* channels ) {
+
+  int     expected = DSP_GROUP_FREE;
+  bool    pending = false;
+
+  // A plain load and branch per channel and block when no update is pending
+  for( int channel_id=0; channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
+    if( __atomic_load_n( &channels[channel_id].buffers->pending, __ATOMIC_RELAXED ) != NULL ) {
+      pending = true;
+    }
+  }
+
+  if( !pending || !__atomic_compare_exchange_n( &dsp_filter_group, &expected, DSP_GROUP_AUDIO, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) ) {
+    return( false );
+  }
+
+  for( int channel_id=0; channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
+    if( __atomic_load_n( &channels[channel_id].buffers->pending, __ATOMIC_RELAXED ) != NULL &&
+        channels[channel_id].buffers->xfade_remaining > 0 ) {
+      __atomic_store_n( &dsp_filter_group, DSP_GROUP_FREE, __ATOMIC_RELEASE );
+      return( false );
+    }
+  }
+
+  return( true );
+}
+
+
+//------------------------------------------------------------------------------------
+// Run one block of a crossfade on a single channel buffer, gain included. The old
+// cascade only runs when the filters changed, a gain-only change is a ramp. Both
+// weights are linear over the crossfade, so no exp10 per sample or per block.
+//------------------------------------------------------------------------------------
+
+static esp_err_t dsp_filter_transition( dsp_buffer_t* buffers, float* buffer, int input_samples ) {
+
+  dsp_params_t*   previous = buffers->previous;
+  dsp_params_t*   params = buffers->active;
+  esp_err_t       res;
+  float           step = 1.0/( buffers->xfade_blocks*input_samples );
+  float           t = (float) ( buffers->xfade_blocks - buffers->xfade_remaining )/buffers->xfade_blocks;
+  float           gain_old = previous->scaling_factor*( 1.0 - t );
+  float           gain_new = params->scaling_factor*t;
+  float           step_old = -previous->scaling_factor*step;
+  float           step_new = params->scaling_factor*step;
+  float           gain;
+  float           step_gain;
+
+  if( buffers->xfade_filters ) {
+    memcpy( Xfade_Buff_F32, buffer, input_samples*sizeof( float ) );
+
+    res = dsp_biquad_cascade_f32( Xfade_Buff_F32, input_samples, previous->coeffs, buffers->xfade_w, previous->num_filters );
+    if( res == ESP_OK ) {
+      res = dsp_biquad_cascade_f32( buffer, input_samples, params->coeffs, buffers->biquad_w, params->num_filters );
+    }
+
+    for( int i = 0; i < input_samples; ++i ) {
+      buffer[i] = Xfade_Buff_F32[i]*gain_old + buffer[i]*gain_new;
+      gain_old += step_old;
+      gain_new += step_new;
+    }
+  } else {
+    res = dsp_biquad_cascade_f32( buffer, input_samples, params->coeffs, buffers->biquad_w, params->num_filters );
+
+    gain = gain_old + gain_new;
+    step_gain = step_old + step_new;
+    for( int i = 0; i < input_samples; ++i ) {
+      buffer[i] *= gain;
+      gain += step_gain;
+    }
+  }
+
+  if( --buffers->xfade_remaining == 0 ) {
+    buffers->previous = NULL;
+  }
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Select the processing mode used by dsp_filter
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_filter_set_mode( int mode ) {
+
+  if( mode != DSP_MODE_CHANNEL && mode != DSP_MODE_STEREO && mode != DSP_MODE_STEREO_SIMD ) {
+    return( ESP_FAIL );
+  }
+
+  // The lockstep modes pair exactly two channels
+  if( mode != DSP_MODE_CHANNEL && DSP_NUM_CHANNELS != 2 ) {
+    return( ESP_FAIL );
+  }
+
+  dsp_filter_mode = mode;
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Apply the channel delay in place on the interleaved buffer
+//
+// The delay buffer holds the last delay_samples inputs, the oldest at delay_offset.
+// It is exchanged with the block in at most two runs (wrap-around), or when the delay
+// is shorter than the block, shifted in with at most two copies per direction. The
+// fractional part is a linear interpolation with the previous whole-sample output,
+// done in the same runs for a delay of a block or more (the 25 ms of dsp_config.h is
+// 1102.5 samples) and in a pass of its own for a shorter one. Whole-sample delays take
+// the plain runs.
+//------------------------------------------------------------------------------------
+
+// Round to the nearest whole sample without a library call
+static inline float dsp_filter_round( float value ) {
+#if DSP_SAMPLE_BITS == 32
+  // Floats are whole numbers from 2^23 up, below that round half away from zero
+  return( (float) (int32_t) ( value + ( value < 0 ? -0.5f : 0.5f ) ) );
+#else
+  // Exact for |value| < 2^22
+  return( ( value + 12582912.0f ) - 12582912.0f );
+#endif
+}
+
+// Exchange a run of the delay buffer with the block. 'prev' is the last whole-sample
+// output, carried from run to run.
+static inline void dsp_filter_delay_swap( sample_t* delay_buff, sample_t* buffer, int len, float frac, float* prev ) {
+
+  sample_t    sample;
+  float       last = *prev;
+
+  if( frac == 0.0 ) {
+    for( int i = 0; i < len; ++i ) {
+      sample = delay_buff[i];
+      delay_buff[i] = buffer[i*DSP_NUM_CHANNELS];
+      buffer[i*DSP_NUM_CHANNELS] = sample;
+    }
+    if( len > 0 ) {
+      last = buffer[( len - 1 )*DSP_NUM_CHANNELS];
+    }
+  } else {
+    for( int i = 0; i < len; ++i ) {
+      sample = delay_buff[i];
+      delay_buff[i] = buffer[i*DSP_NUM_CHANNELS];
+      buffer[i*DSP_NUM_CHANNELS] = dsp_filter_round( sample + frac*( last - sample ) );
+      last = sample;
+    }
+  }
+
+  *prev = last;
+}
+
+// The same while copying the channel out to a float buffer
+static inline void dsp_filter_delay_run( sample_t* delay_buff, const sample_t* buffer, int len, float* output, float frac, float* prev ) {
+
+  float       sample;
+  float       last = *prev;
+
+  if( frac == 0.0 ) {
+    for( int i = 0; i < len; ++i ) {
+      output[i] = delay_buff[i];
+      delay_buff[i] = buffer[i*DSP_NUM_CHANNELS];
+    }
+    if( len > 0 ) {
+      last = output[len - 1];
+    }
+  } else {
+    for( int i = 0; i < len; ++i ) {
+      sample = delay_buff[i];
+      delay_buff[i] = buffer[i*DSP_NUM_CHANNELS];
+      output[i] = dsp_filter_round( sample + frac*( last - sample ) );
+      last = sample;
+    }
+  }
+
+  *prev = last;
+}
+
+static void dsp_filter_delay_inplace( dsp_buffer_t* buffers, sample_t* input_buffer, int input_samples, int channel_id ) {
+
+  dsp_params_t*   params = buffers->active;
+  int             delay_samples = params->delay_samples;
+  int             delay_offset = buffers->delay_offset;
+  sample_t*       delay_buff = params->delay_buff;
+  sample_t*       buffer = &input_buffer[channel_id];
+  sample_t*       delayed = Delay_Buff;
+  float           frac = params->delay_frac;
+  float           prev = buffers->delay_last;
+  float           sample;
+  int             len;
+
+  if( delay_samples >= input_samples ) {
+    len = delay_samples - delay_offset < input_samples ? delay_samples - delay_offset : input_samples;
+    dsp_filter_delay_swap( &delay_buff[delay_offset], buffer, len, frac, &prev );
+    dsp_filter_delay_swap( delay_buff, &buffer[len*DSP_NUM_CHANNELS], input_samples - len, frac, &prev );
+    buffers->delay_last = prev;
+
+    delay_offset += input_samples;
+    if( delay_offset >= delay_samples ) {
+      delay_offset -= delay_samples;
+    }
+    buffers->delay_offset = delay_offset;
+    return;
+  } else if( delay_samples > 0 ) {
+    // Take out the delayed samples, keep the end of the block and move the rest up
+    len = delay_samples - delay_offset;
+    memcpy( delayed, &delay_buff[delay_offset], len*sizeof( sample_t ) );
+    memcpy( &delayed[len], delay_buff, delay_offset*sizeof( sample_t ) );
+
+    for( int i = 0; i < delay_samples; ++i ) {
+      delay_buff[i] = buffer[( input_samples - delay_samples + i )*DSP_NUM_CHANNELS];
+    }
+    for( int i = input_samples - 1; i >= delay_samples; --i ) {
+      buffer[i*DSP_NUM_CHANNELS] = buffer[( i - delay_samples )*DSP_NUM_CHANNELS];
+    }
+    for( int i = 0; i < delay_samples; ++i ) {
+      buffer[i*DSP_NUM_CHANNELS] = delayed[i];
+    }
+
+    delay_offset = 0;
+  }
+
+  buffers->delay_offset = delay_offset;
+
+  if( frac != 0.0 ) {
+    for( int i = 0; i < input_samples; ++i ) {
+      sample = buffer[i*DSP_NUM_CHANNELS];
+      buffer[i*DSP_NUM_CHANNELS] = dsp_filter_round( sample + frac*( prev - sample ) );
+      prev = sample;
+    }
+    buffers->delay_last = prev;
+  } else if( input_samples > 0 ) {
+    buffers->delay_last = buffer[( input_samples - 1 )*DSP_NUM_CHANNELS];
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Apply the channel delay while copying the channel out of the interleaved buffer
+// (per-channel path). Same delay buffer handling and result as dsp_filter_delay_inplace.
+//------------------------------------------------------------------------------------
+
+static void dsp_filter_delay_copy( dsp_buffer_t* buffers, const sample_t* input_buffer, int input_samples, int channel_id, float* output ) {
+
+  dsp_params_t*   params = buffers->active;
+  int             delay_samples = params->delay_samples;
+  int             delay_offset = buffers->delay_offset;
+  sample_t*       delay_buff = params->delay_buff;
+  const sample_t* buffer = &input_buffer[channel_id];
+  float           frac = params->delay_frac;
+  float           prev = buffers->delay_last;
+  float           sample;
+  int             len;
+
+  if( delay_samples >= input_samples ) {
+    len = delay_samples - delay_offset < input_samples ? delay_samples - delay_offset : input_samples;
+    dsp_filter_delay_run( &delay_buff[delay_offset], buffer, len, output, frac, &prev );
+    dsp_filter_delay_run( delay_buff, &buffer[len*DSP_NUM_CHANNELS], input_samples - len, &output[len], frac, &prev );
+    buffers->delay_last = prev;
+
+    delay_offset += input_samples;
+    if( delay_offset >= delay_samples ) {
+      delay_offset -= delay_samples;
+    }
+    buffers->delay_offset = delay_offset;
+    return;
+  } else {
+    // Delayed samples first, then the start of the block; the end of the block is kept
+    len = delay_samples - delay_offset;
+    for( int i = 0; i < len; ++i ) {
+      output[i] = delay_buff[delay_offset + i];
+    }
+    for( int i = 0; i < delay_offset; ++i ) {
+      output[len + i] = delay_buff[i];
+    }
+    for( int i = delay_samples; i < input_samples; ++i ) {
+      output[i] = buffer[( i - delay_samples )*DSP_NUM_CHANNELS];
+    }
+    for( int i = 0; i < delay_samples; ++i ) {
+      delay_buff[i] = buffer[( input_samples - delay_samples + i )*DSP_NUM_CHANNELS];
+    }
+
+    delay_offset = 0;
+  }
+
+  buffers->delay_offset = delay_offset;
+
+  if( frac != 0.0 ) {
+    for( int i = 0; i < input_samples; ++i ) {
+      sample = output[i];
+      output[i] = dsp_filter_round( sample + frac*( prev - sample ) );
+      prev = sample;
+    }
+    buffers->delay_last = prev;
+  } else if( input_samples > 0 ) {
+    buffers->delay_last = output[input_samples - 1];
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Apply the channel delay in place on the low-rate samples of a multirate channel. The
+// delay buffer keeps whole samples as the full-rate paths do, so the samples are
+// rounded (and held within full scale) on the way through; the delay buffer handling
+// and fractional part are those of dsp_filter_delay_copy.
+//------------------------------------------------------------------------------------
+
+static inline float dsp_filter_whole( float value ) {
+  return( dsp_filter_round( fminf( fmaxf( value, -DSP_MAX_SAMPLE_VALUE ), DSP_MAX_SAMPLE_VALUE ) ) );
+}
+
+static void dsp_filter_delay_float( dsp_buffer_t* buffers, float* buffer, int input_samples ) {
+
+  dsp_params_t*   params = buffers->active;
+  int             delay_samples = params->delay_samples;
+  int             delay_offset = buffers->delay_offset;
+  sample_t*       delay_buff = params->delay_buff;
+  sample_t*       kept = Delay_Buff;
+  float           frac = params->delay_frac;
+  float           prev;
+  float           sample;
+  int             len;
+
+  if( delay_samples == 0 && frac == 0.0 ) {
+    return;
+  }
+
+  if( delay_samples >= input_samples ) {
+    len = delay_samples - delay_offset < input_samples ? delay_samples - delay_offset : input_samples;
+    for( int i = 0; i < len; ++i ) {
+      sample = delay_buff[delay_offset + i];
+      delay_buff[delay_offset + i] = (sample_t) dsp_filter_whole( buffer[i] );
+      buffer[i] = sample;
+    }
+    for( int i = len; i < input_samples; ++i ) {
+      sample = delay_buff[i - len];
+      delay_buff[i - len] = (sample_t) dsp_filter_whole( buffer[i] );
+      buffer[i] = sample;
+    }
+
+    delay_offset += input_samples;
+    if( delay_offset >= delay_samples ) {
+      delay_offset -= delay_samples;
+    }
+  } else {
+    // Keep the end of the block, move the rest up behind the delayed samples
+    for( int i = 0; i < delay_samples; ++i ) {
+      kept[i] = (sample_t) dsp_filter_whole( buffer[input_samples - delay_samples + i] );
+    }
+    for( int i = input_samples - 1; i >= delay_samples; --i ) {
+      buffer[i] = dsp_filter_whole( buffer[i - delay_samples] );
+    }
+    len = delay_samples - delay_offset;
+    for( int i = 0; i < len; ++i ) {
+      buffer[i] = delay_buff[delay_offset + i];
+    }
+    for( int i = 0; i < delay_offset; ++i ) {
+      buffer[len + i] = delay_buff[i];
+    }
+    memcpy( delay_buff, kept, delay_samples*sizeof( sample_t ) );
+
+    delay_offset = 0;
+  }
+
+  buffers->delay_offset = delay_offset;
+
+  if( frac != 0.0 ) {
+    prev = buffers->delay_last;
+    for( int i = 0; i < input_samples; ++i ) {
+      sample = delay_samples > 0 ? buffer[i] : dsp_filter_whole( buffer[i] );
+      buffer[i] = sample + frac*( prev - sample );
+      prev = sample;
+    }
+    buffers->delay_last = (sample_t) prev;
+  } else if( input_samples > 0 ) {
+    buffers->delay_last = (sample_t) buffer[input_samples - 1];
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Gain and per-sample gain change for the output stage of a block: the scaling factor
+// times the limiter gain, ramped from where the last block ended to the new target
+//------------------------------------------------------------------------------------
+
+static inline void dsp_filter_limiter_ramp( const dsp_buffer_t* buffers, float scaling_factor, int input_samples, float* gain, float* step ) {
+
+  *gain = scaling_factor*buffers->limiter_gain;
+  *step = scaling_factor*( buffers->limiter_target - buffers->limiter_gain )/input_samples;
+}
+
+
+//------------------------------------------------------------------------------------
+// Account for the clipping of a block and set the limiter target for the next one. If
+// samples went over the knee the gain drops so the peak of the block would have stayed
+// under it; otherwise DSP_LIMITER_RELEASE of the gain reduction is recovered. Only
+// counters are updated here - the control plane reports them (dsp_filter_clip_report).
+//------------------------------------------------------------------------------------
+
+static void dsp_filter_limiter( dsp_buffer_t* buffers, const dsp_clip_t* clip, bool* clip_flag ) {
+
+  float     gain = buffers->limiter_target;
+  float     target;
+  int32_t   peak;
+
+  if( clip->limit_count > 0 ) {
+    target = gain*DSP_LIMITER_KNEE_VALUE/clip->peak;
+  } else {
+    target = gain + ( 1.0f - gain )*DSP_LIMITER_RELEASE;
+    if( target > 0.999f ) {
+      target = 1.0;
+    }
+  }
+
+  buffers->limiter_gain = gain;
+  buffers->limiter_target = target;
+  buffers->limit_count += clip->limit_count;
+
+  if( clip->clipping_count > 0 ) {
+    // Set clipping flag
+    *clip_flag = true;
+    buffers->clipping_count += clip->clipping_count;
+
+    // Keep the largest peak until the control plane takes it
+    peak = clip->peak < 32767.0f*DSP_MAX_SAMPLE_VALUE ? (int32_t) ( clip->peak*65536.0f/DSP_MAX_SAMPLE_VALUE ) : INT32_MAX;
+    if( peak > __atomic_load_n( &buffers->clip_peak, __ATOMIC_RELAXED ) ) {
+      __atomic_store_n( &buffers->clip_peak, peak, __ATOMIC_RELAXED );
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Account for the samples the input mix saturated at full scale, as clipping at 0 dBFS
+//------------------------------------------------------------------------------------
+
+static void dsp_filter_mix_clipped( dsp_buffer_t* buffers, int clipped, bool* clip_flag ) {
+
+  *clip_flag = true;
+  buffers->clipping_count += clipped;
+
+  if( __atomic_load_n( &buffers->clip_peak, __ATOMIC_RELAXED ) < 65536 ) {
+    __atomic_store_n( &buffers->clip_peak, 65536, __ATOMIC_RELAXED );
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Process both channels in lockstep directly on the interleaved buffer
+//------------------------------------------------------------------------------------
+
+static esp_err_t dsp_filter_stereo( dsp_channel_t* channels, sample_t* input_buffer, int input_samples, bool* clip_flag ) {
+
+  esp_err_t       res;
+  dsp_channel_t*  channel;
+  dsp_params_t*   params;
+  dsp_stereo_t    stereo;
+
+  DSP_PROFILE_MARK( mark );
+
+  stereo.num_filters = channels[0].buffers->active->num_filters > channels[1].buffers->active->num_filters ?
+    channels[0].buffers->active->num_filters : channels[1].buffers->active->num_filters;
+
+  for( int lane = 0; lane < 2; ++lane ) {
+    channel = &channels[lane];
+    params = channel->buffers->active;
+
+    dsp_filter_delay_inplace( channel->buffers, input_buffer, input_samples, lane );
+    DSP_PROFILE_STAGE( DSP_STAGE_DELAY, mark );
+
+    // Pair up the coefficients and state, padding the shorter cascade with pass-through filters
+    for( int filter_id = 0; filter_id < stereo.num_filters; ++filter_id ) {
+      if( filter_id < params->num_filters ) {
+        for( int i = 0; i < 5; ++i ) {
+          stereo.coeffs[filter_id][i][lane] = params->coeffs[filter_id][i];
+        }
+        stereo.w[filter_id][0][lane] = channel->buffers->biquad_w[filter_id][0];
+        stereo.w[filter_id][1][lane] = channel->buffers->biquad_w[filter_id][1];
+      } else {
+        stereo.coeffs[filter_id][0][lane] = 1.0;
+        for( int i = 1; i < 5; ++i ) {
+          stereo.coeffs[filter_id][i][lane] = 0.0;
+        }
+        stereo.w[filter_id][0][lane] = 0.0;
+        stereo.w[filter_id][1][lane] = 0.0;
+      }
+    }
+
+    dsp_filter_limiter_ramp( channel->buffers, params->scaling_factor, input_samples, &stereo.scaling_factor[lane], &stereo.scaling_step[lane] );
+    memset( &stereo.clip[lane], 0, sizeof( stereo.clip[lane] ) );
+    DSP_PROFILE_STAGE( DSP_STAGE_BIQUAD, mark );
+  }
+
+  if( dsp_filter_mode == DSP_MODE_STEREO_SIMD ) {
+    res = dsp_biquad_stereo_f32_simd( input_buffer, input_samples, &stereo );
+  } else {
+    res = dsp_biquad_stereo_f32_ansi( input_buffer, input_samples, &stereo );
+  }
+  DSP_PROFILE_STAGE( DSP_STAGE_BIQUAD, mark );
+
+  if( res != ESP_OK ) {
+    dsp_log( DSP_LOG_BIQUAD_FAILED, res, 0, 0 );
+    return( res );
+  }
+
+  for( int lane = 0; lane < 2; ++lane ) {
+    channel = &channels[lane];
+
+    for( int filter_id = 0; filter_id < channel->buffers->active->num_filters; ++filter_id ) {
+      channel->buffers->biquad_w[filter_id][0] = stereo.w[filter_id][0][lane];
+      channel->buffers->biquad_w[filter_id][1] = stereo.w[filter_id][1][lane];
+    }
+
+    dsp_filter_limiter( channel->buffers, &stereo.clip[lane], clip_flag );
+  }
+  DSP_PROFILE_STAGE( DSP_STAGE_OUTPUT, mark );
+
+  return( ESP_OK );
+}
+
+
+#if DSP_FILTER_ENGINE == DSP_ENGINE_FIXED
+
+//------------------------------------------------------------------------------------
+// Run one block of a crossfade with the fixed-point engine, as dsp_filter_transition.
+// The weights are ramped in DSP_Q31_GAIN_BITS fixed point.
+//------------------------------------------------------------------------------------
+
+static esp_err_t dsp_filter_transition_q31( dsp_buffer_t* buffers, int32_t* buffer, int input_samples ) {
+
+  dsp_params_t*   previous = buffers->previous;
+  dsp_params_t*   params = buffers->active;
+  esp_err_t       res;
+  int64_t         total = (int64_t) buffers->xfade_blocks*input_samples;
+  int64_t         done = (int64_t) ( buffers->xfade_blocks - buffers->xfade_remaining )*input_samples;
+  int32_t         gain_old = previous->scaling_q31 - (int32_t) ( previous->scaling_q31*done/total );
+  int32_t         gain_new = (int32_t) ( params->scaling_q31*done/total );
+  int32_t         step_old = (int32_t) ( -previous->scaling_q31/total );
+  int32_t         step_new = (int32_t) ( params->scaling_q31/total );
+
+  if( buffers->xfade_filters ) {
+    memcpy( Xfade_Buff_Q31, buffer, input_samples*sizeof( int32_t ) );
+
+    res = dsp_biquad_cascade_q31( Xfade_Buff_Q31, input_samples, previous->coeffs_q31, buffers->xfade_q31, previous->num_filters );
+    if( res == ESP_OK ) {
+      res = dsp_biquad_cascade_q31( buffer, input_samples, params->coeffs_q31, buffers->biquad_q31, params->num_filters );
+    }
+  } else {
+    res = dsp_biquad_cascade_q31( buffer, input_samples, params->coeffs_q31, buffers->biquad_q31, params->num_filters );
+    memcpy( Xfade_Buff_Q31, buffer, input_samples*sizeof( int32_t ) );
+  }
+
+  for( int i = 0; i < input_samples; ++i ) {
+    buffer[i] = (int32_t) ( ( (int64_t) Xfade_Buff_Q31[i]*gain_old + (int64_t) buffer[i]*gain_new ) >> DSP_Q31_GAIN_BITS );
+    gain_old += step_old;
+    gain_new += step_new;
+  }
+
+  if( --buffers->xfade_remaining == 0 ) {
+    buffers->previous = NULL;
+  }
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Process the audio buffer with the fixed-point engine. The samples stay integer from
+// the I2S buffer through delay, biquads, gain and clip back to the I2S buffer. Both
+// channels take this path whatever the processing mode.
+//------------------------------------------------------------------------------------
+
+static esp_err_t dsp_filter_fixed( dsp_channel_t* channels, sample_t* input_buffer, int input_samples, bool* clip_flag ) {
+
+  esp_err_t        res;
+  dsp_channel_t*   channel;
+  dsp_params_t*    params;
+  int32_t          scaling_factor;
+  int32_t          gain;
+  int32_t          step;
+  dsp_clip_t       clip;
+
+  DSP_PROFILE_MARK( mark );
+
+  for( int channel_id=0; channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
+
+    channel = &channels[channel_id];
+    params = channel->buffers->active;
+
+    // Delay in place, then copy the channel out of the interleaved buffer
+    dsp_filter_delay_inplace( channel->buffers, input_buffer, input_samples, channel_id );
+
+    for( int i=0; i < input_samples; ++i ) {
+      Biquad_Buff_Q31[i] = DSP_Q31_FROM_SAMPLE( input_buffer[i*DSP_NUM_CHANNELS + channel_id] );
+    }
+    DSP_PROFILE_STAGE( DSP_STAGE_DELAY, mark );
+
+    // Process the biquad filters in the channel
+    if( channel->buffers->xfade_remaining > 0 ) {
+      res = dsp_filter_transition_q31( channel->buffers, Biquad_Buff_Q31, input_samples );
+      scaling_factor = 1 << DSP_Q31_GAIN_BITS;
+    } else {
+      res = dsp_biquad_cascade_q31( Biquad_Buff_Q31, input_samples, params->coeffs_q31, channel->buffers->biquad_q31, params->num_filters );
+      scaling_factor = params->scaling_q31;
+    }
+    DSP_PROFILE_STAGE( DSP_STAGE_BIQUAD, mark );
+
+    if( res != ESP_OK ) {
+      dsp_log( DSP_LOG_BIQUAD_FAILED, res, 0, 0 );
+      return( res );
+    }
+
+    // Apply the gain and limiter and copy the results back to the input buffer. The ramp
+    // is set up in double so the gain is exact while the limiter is idle.
+    gain = (int32_t) ( scaling_factor*(double) channel->buffers->limiter_gain );
+    step = (int32_t) ( scaling_factor*(double) ( channel->buffers->limiter_target - channel->buffers->limiter_gain )/input_samples );
+    memset( &clip, 0, sizeof( clip ) );
+    dsp_output_q31( Biquad_Buff_Q31, input_samples, &input_buffer[channel_id], DSP_NUM_CHANNELS, gain, step, &clip );
+    dsp_filter_limiter( channel->buffers, &clip, clip_flag );
+    DSP_PROFILE_STAGE( DSP_STAGE_OUTPUT, mark );
+  }
+
+  return( ESP_OK );
+}
+
+#endif
+
+
+//------------------------------------------------------------------------------------
+// Process the audio buffer by cascading the biquad filters and applying delay/gain
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_filter( dsp_channel_t* channels, sample_t* input_buffer, int buffer_len, bool* clip_flag ) {
+
+  esp_err_t        res;
+  dsp_channel_t*  channel;
+  int              input_samples;
+  dsp_params_t*    params;
+  float            scaling_factor;
+  float            gain;
+  float            step;
+  dsp_clip_t       clip;
+  bool             transition = false;
+  dsp_multirate_t* multirate;
+  int              samples;
+  uint32_t         updates;
+  bool             remix = false;
+  bool             pick_up;
+  int              clipped[DSP_NUM_CHANNELS] = { 0 };
+
+  // Check if input sample count exceeded
+  input_samples = buffer_len/sizeof( sample_t )/DSP_NUM_CHANNELS;
+
+  if( input_samples > dsp_filter_block_frames ) {
+    dsp_log( DSP_LOG_TOO_MANY_SAMPLES, input_samples, dsp_filter_block_frames, 0 );
+    return( ESP_FAIL );
+  }
+
+  if( input_samples % dsp_filter_frame_multiple != 0 ) {
+    dsp_log( DSP_LOG_NOT_MULTIPLE, input_samples, dsp_filter_frame_multiple, 0 );
+    return( ESP_FAIL );
+  }
+
+  // Reset the clipping flag
+  *clip_flag = false;
+
+  DSP_PROFILE_MARK( mark );
+
+  // Pick up any parameter updates published since the last block, on all channels at once
+  pick_up = dsp_filter_pick_up( channels );
+  for( int channel_id=0; channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
+    updates = channels[channel_id].buffers->updates;
+    dsp_filter_swap( channels[channel_id].buffers, pick_up );
+    if( channels[channel_id].buffers->updates != updates ) {
+      remix = true;
+    }
+    if( channels[channel_id].buffers->xfade_remaining > 0 ) {
+      transition = true;
+    }
+  }
+  if( pick_up ) {
+    __atomic_store_n( &dsp_filter_group, DSP_GROUP_FREE, __ATOMIC_RELEASE );
+  }
+
+  // Mix the input slots into the channels (mix changes are instant, as delay changes)
+  if( remix ) {
+    dsp_filter_mix_setup( channels );
+  }
+  if( dsp_filter_mix.kind != DSP_MIX_IDENTITY ) {
+    dsp_mix_process( &dsp_filter_mix, input_buffer, input_samples, clipped );
+    for( int channel_id=0; channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
+      if( clipped[channel_id] > 0 ) {
+        dsp_filter_mix_clipped( channels[channel_id].buffers, clipped[channel_id], clip_flag );
+      }
+    }
+  }
+  DSP_PROFILE_STAGE( DSP_STAGE_MIX, mark );
+
+#if DSP_FILTER_ENGINE == DSP_ENGINE_FIXED
+  return( dsp_filter_fixed( channels, input_buffer, input_samples, clip_flag ) );
+#endif
+
+  // Blocks with a crossfade running, multirate channels, FIR filters and topologies other than Direct Form II take
+  // the per-channel path
+  if( dsp_filter_mode != DSP_MODE_CHANNEL && !transition && !dsp_filter_multirate && !dsp_filter_fir &&
+      DSP_BIQUAD_TOPOLOGY == DSP_TOPOLOGY_DF2 ) {
+    return( dsp_filter_stereo( channels, input_buffer, input_samples, clip_flag ) );
+  }
+
+  for( int channel_id=0; channel_id < DSP_NUM_CHANNELS ; ++channel_id ) {
+
+    channel = &channels[channel_id];
+    params = channel->buffers->active;
+    multirate = &channel->buffers->multirate;
+
+    if( multirate->decimation > 1 ) {
+      // Decimate the channel out of the interleaved buffer, then delay at the reduced rate
+      samples = input_samples/multirate->decimation;
+      dsp_multirate_decimate( multirate, &input_buffer[channel_id], DSP_NUM_CHANNELS, input_samples, Multirate_Buff_F32, Biquad_Buff_F32 );
+      dsp_filter_delay_float( channel->buffers, Biquad_Buff_F32, samples );
+    } else {
+      // Copy the channel out of the interleaved buffer through the delay buffer
+      samples = input_samples;
+      dsp_filter_delay_copy( channel->buffers, input_buffer, input_samples, channel_id, Biquad_Buff_F32 );
+    }
+    DSP_PROFILE_STAGE( DSP_STAGE_DELAY, mark );
+
+    // Process the biquad filters in the channel
+    if( channel->buffers->xfade_remaining > 0 ) {
+      res = dsp_filter_transition( channel->buffers, Biquad_Buff_F32, samples );
+      scaling_factor = 1.0;
+    } else {
+      res = dsp_biquad_cascade_f32( Biquad_Buff_F32, samples, params->coeffs, channel->buffers->biquad_w, params->num_filters );
+      scaling_factor = params->scaling_factor;
+    }
+    DSP_PROFILE_STAGE( DSP_STAGE_BIQUAD, mark );
+
+    if( res != ESP_OK ) {
+      dsp_log( DSP_LOG_BIQUAD_FAILED, res, 0, 0 );
+      return( res );
+    }
+
+    // Room correction FIR filter, one partition per block
+    if( channel->buffers->fir != NULL ) {
+      res = dsp_fir_process( channel->buffers->fir, Biquad_Buff_F32, samples );
+      DSP_PROFILE_STAGE( DSP_STAGE_FIR, mark );
+
+      if( res != ESP_OK ) {
+        dsp_log( DSP_LOG_FIR_BLOCK, channel_id, dsp_filter_block_frames, 0 );
+        return( res );
+      }
+    }
+
+    // Back to the full rate
+    if( multirate->decimation > 1 ) {
+      dsp_multirate_interpolate( multirate, Biquad_Buff_F32, samples, Multirate_Buff_F32, Biquad_Buff_F32 );
+    }
+
+    // Apply the gain and limiter and copy the results back to the input buffer
+    dsp_filter_limiter_ramp( channel->buffers, scaling_factor, input_samples, &gain, &step );
+    memset( &clip, 0, sizeof( clip ) );
+    dsp_output_f32( Biquad_Buff_F32, input_samples, &input_buffer[channel_id], DSP_NUM_CHANNELS, gain, step, &clip );
+    dsp_filter_limiter( channel->buffers, &clip, clip_flag );
+    DSP_PROFILE_STAGE( DSP_STAGE_OUTPUT, mark );
 
   }
   return( ESP_OK );
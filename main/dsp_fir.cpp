@@ -0,0 +1,167 @@
+#include "dsp_process.h"
+
+//------------------------------------------------------------------------------------
+// Room correction FIR filter
+//
+// Uniformly partitioned convolution (overlap-save): the filter is cut into partitions
+// of one block, each kept as the spectrum of an FFT at least twice the block long. Every
+// block the window of the last 'size' input samples is transformed once and stored in
+// a frequency-domain delay line holding the spectra of the last 'partitions' blocks;
+// partition p is multiplied with the spectrum of p blocks ago, the products summed and
+// transformed back, and the last block of the result is the output. The cost per
+// sample is two FFTs of twice the block plus one complex multiply-add per partition and
+// bin, against one multiply-add per tap for a direct FIR, and no latency is added: the
+// first partition acts on the block being processed.
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+// Set up the filter for 'taps' coefficients and blocks of 'block' samples
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_fir_create( dsp_fir_t** result, const float* coeffs, int taps, int block ) {
+
+  dsp_fir_t*  fir;
+  int         size = 4;
+  int         partitions = ( taps + block - 1 )/block;
+  int         len;
+  float*      spectrum;
+
+  *result = NULL;
+
+  if( taps <= 0 || block <= 0 || coeffs == NULL ) {
+    return( ESP_FAIL );
+  }
+
+  // FFT of at least twice the block, so the circular wrap of each partition stays clear of the output
+  while( size < 2*block ) {
+    size <<= 1;
+  }
+
+  fir = (dsp_fir_t*) calloc( 1, sizeof( dsp_fir_t ) );
+  if( fir == NULL ) {
+    return( ESP_FAIL );
+  }
+
+  fir->memory = (float*) calloc( ( 2*partitions + 2 )*size, sizeof( float ) );
+  if( fir->memory == NULL || dsp_fft_init( &fir->fft, size ) != ESP_OK ) {
+    dsp_fir_free( fir );
+    return( ESP_FAIL );
+  }
+
+  fir->taps = taps;
+  fir->block = block;
+  fir->size = size;
+  fir->partitions = partitions;
+  fir->current = 0;
+  fir->spectra = fir->memory;
+  fir->fdl = &fir->memory[partitions*size];
+  fir->window = &fir->memory[2*partitions*size];
+  fir->acc = &fir->memory[( 2*partitions + 1 )*size];
+
+  // Spectrum of each partition, with the 1/size of the inverse transform folded in
+  for( int p = 0; p < partitions; ++p ) {
+    spectrum = &fir->spectra[p*size];
+    len = taps - p*block < block ? taps - p*block : block;
+    for( int i = 0; i < len; ++i ) {
+      spectrum[i] = coeffs[p*block + i]/size;
+    }
+    dsp_fft_forward( &fir->fft, spectrum );
+  }
+
+  *result = fir;
+
+  return( ESP_OK );
+}
+
+void dsp_fir_free( dsp_fir_t* fir ) {
+
+  if( fir == NULL ) {
+    return;
+  }
+
+  dsp_fft_free( &fir->fft );
+  free( fir->memory );
+  free( fir );
+}
+
+
+//------------------------------------------------------------------------------------
+// Multiply two packed spectra and add the product to (or with 'first' store it in) a
+// third. Bins 0 and N/2 are real.
+//------------------------------------------------------------------------------------
+
+static inline void dsp_fir_mac( const float* x, const float* h, float* acc, int size, bool first ) {
+
+  if( first ) {
+    acc[0] = x[0]*h[0];
+    acc[1] = x[1]*h[1];
+    for( int i = 2; i < size; i += 2 ) {
+      acc[i] = x[i]*h[i] - x[i + 1]*h[i + 1];
+      acc[i + 1] = x[i]*h[i + 1] + x[i + 1]*h[i];
+    }
+  } else {
+    acc[0] += x[0]*h[0];
+    acc[1] += x[1]*h[1];
+    for( int i = 2; i < size; i += 2 ) {
+      acc[i] += x[i]*h[i] - x[i + 1]*h[i + 1];
+      acc[i + 1] += x[i]*h[i + 1] + x[i + 1]*h[i];
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Filter one block of fir->block samples in place
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_fir_process( dsp_fir_t* fir, float* buffer, int len ) {
+
+  const int   size = fir->size;
+  const int   block = fir->block;
+  float*      spectrum;
+  int         slot;
+
+  if( len != block ) {
+    return( ESP_FAIL );
+  }
+
+  // Slide the new block into the input window and store its spectrum as the newest in the delay line
+  memmove( fir->window, &fir->window[block], ( size - block )*sizeof( float ) );
+  memcpy( &fir->window[size - block], buffer, block*sizeof( float ) );
+
+  fir->current = fir->current + 1 < fir->partitions ? fir->current + 1 : 0;
+  spectrum = &fir->fdl[fir->current*size];
+  memcpy( spectrum, fir->window, size*sizeof( float ) );
+  dsp_fft_forward( &fir->fft, spectrum );
+
+  // Partition p with the input spectrum of p blocks ago
+  slot = fir->current;
+  for( int p = 0; p < fir->partitions; ++p ) {
+    dsp_fir_mac( &fir->fdl[slot*size], &fir->spectra[p*size], fir->acc, size, p == 0 );
+    slot = slot > 0 ? slot - 1 : fir->partitions - 1;
+  }
+
+  // The end of the window is clear of the circular wrap
+  dsp_fft_inverse( &fir->fft, fir->acc );
+  memcpy( buffer, &fir->acc[size - block], block*sizeof( float ) );
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Bytes of RAM a filter of 'taps' coefficients takes for blocks of 'block' samples
+//------------------------------------------------------------------------------------
+
+int dsp_fir_memory( int taps, int block ) {
+
+  int       size = 4;
+  int       partitions = ( taps + block - 1 )/block;
+
+  while( size < 2*block ) {
+    size <<= 1;
+  }
+
+  return( (int) ( ( 2*partitions + 3 )*size*sizeof( float ) + size/2*sizeof( uint16_t ) + sizeof( dsp_fir_t ) ) );
+}
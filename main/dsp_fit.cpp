@@ -0,0 +1,471 @@
+#include "dsp_process.h"
+
+//------------------------------------------------------------------------------------
+// Automatic EQ
+//
+// Fits a cascade of peaking and shelving biquads that flattens a response (measured or
+// loaded from a file) toward a target over DSP_FIT_LOW_HZ to DSP_FIT_HIGH_HZ. Filters
+// are added one at a time at the largest remaining deviation, and after each one all
+// filters are refined together by a Levenberg-Marquardt optimizer on their frequency,
+// gain and Q. Filters are added until the error is within DSP_FIT_TOLERANCE, the
+// filter limit is reached or another filter no longer helps.
+//
+// The optimizer spends nearly all of its time evaluating filter responses, so these
+// are not computed from the coefficients the way dsp_plot does: below 100 Hz the terms
+// of the biquad polynomial cancel unless they are rearranged around z = 1, and each
+// point still costs a division and a logarithm per polynomial. The filters are the bilinear transforms of analog prototypes, so the response at a
+// point is the prototype's at the warped frequency tan( pi f/fs )/tan( pi f0/fs ),
+// which is exact, stable in single precision and needs no trigonometry per point.
+// Each filter's response is cached, so a trial step only recomputes the filters it
+// moves. The work is bounded by DSP_FIT_ITERATIONS per filter, which keeps the fit
+// within a fixed time on the ESP32.
+//------------------------------------------------------------------------------------
+
+static const float  dsp_fit_delta[3] = { 0.002f, 0.01f, 0.002f };   // Finite difference steps of the parameters
+
+
+//------------------------------------------------------------------------------------
+// Set up the frequencies the fit is evaluated at
+//------------------------------------------------------------------------------------
+
+void dsp_fit_init( dsp_fit_t* fit ) {
+
+  memset( fit, 0, sizeof( dsp_fit_t ) );
+
+  for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+    fit->freq[p] = (float) ( DSP_FIT_LOW_HZ*pow( DSP_FIT_HIGH_HZ/DSP_FIT_LOW_HZ, (double) p/( DSP_FIT_POINTS - 1 ) ) );
+    fit->warp[p] = (float) tan( PI*fit->freq[p]/DSP_SAMPLE_RATE );
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Keep the parameters of a filter within range: frequency inside the band (so
+// multirate channels can run the filters), gain and Q within the DSP_FIT_ limits
+//------------------------------------------------------------------------------------
+
+static void dsp_fit_clamp( int type, float* param ) {
+
+  float   low[3] = { log2f( 0.8f*DSP_FIT_LOW_HZ ), -DSP_FIT_MAX_CUT, log2f( DSP_FIT_MIN_Q ) };
+  float   high[3] = { log2f( DSP_FIT_HIGH_HZ ), DSP_FIT_MAX_BOOST, log2f( DSP_FIT_MAX_Q ) };
+
+  // Shelves with a high Q overshoot
+  if( type != DSP_FIT_PEAK ) {
+    high[2] = log2f( 0.9f );
+  }
+
+  for( int j = 0; j < 3; ++j ) {
+    param[j] = param[j] < low[j] ? low[j] : param[j] > high[j] ? high[j] : param[j];
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Response in dB of one filter at every point, from the analog prototype
+//------------------------------------------------------------------------------------
+
+static void dsp_fit_response( dsp_fit_t* fit, int type, const float* param, float* response ) {
+
+  float   a = powf( 10, param[1]/40 );
+  float   a2 = a*a;
+  float   q2 = exp2f( -2*param[2] );                  // 1/Q^2
+  float   scale = 1/tanf( (float) PI*exp2f( param[0] )/DSP_SAMPLE_RATE );
+  float   w2;
+  float   num;
+  float   den;
+
+  for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+    w2 = fit->warp[p]*scale;
+    w2 *= w2;
+
+    if( type == DSP_FIT_LOW_SHELF ) {
+      num = a2*( ( a - w2 )*( a - w2 ) + a*w2*q2 );
+      den = ( 1 - a*w2 )*( 1 - a*w2 ) + a*w2*q2;
+    } else if( type == DSP_FIT_HIGH_SHELF ) {
+      num = a2*( ( 1 - a*w2 )*( 1 - a*w2 ) + a*w2*q2 );
+      den = ( a - w2 )*( a - w2 ) + a*w2*q2;
+    } else {
+      num = ( 1 - w2 )*( 1 - w2 );
+      den = num + w2*q2/a2;
+      num += a2*w2*q2;
+    }
+
+    response[p] = 10*log10f( num/den );
+  }
+
+  ++fit->evaluations;
+}
+
+
+//------------------------------------------------------------------------------------
+// Sum of the squared errors left with the given filter responses
+//------------------------------------------------------------------------------------
+
+static float dsp_fit_cost( const dsp_fit_t* fit, const float contrib[][DSP_FIT_POINTS] ) {
+
+  float   cost = 0;
+  float   r;
+
+  for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+    r = fit->error[p];
+    for( int k = 0; k < fit->num_filters; ++k ) {
+      r += contrib[k][p];
+    }
+    cost += r*r;
+  }
+
+  return( cost );
+}
+
+
+//------------------------------------------------------------------------------------
+// Solve the n x n system in fit->normal (right-hand side in column n) by Gaussian
+// elimination with partial pivoting, leaving the solution in column n
+//------------------------------------------------------------------------------------
+
+static esp_err_t dsp_fit_solve( dsp_fit_t* fit, int n ) {
+
+  float   (*m)[DSP_FIT_PARAMS + 1] = fit->normal;
+  float   factor;
+  float   swap;
+  int     pivot;
+
+  for( int col = 0; col < n; ++col ) {
+    pivot = col;
+    for( int row = col + 1; row < n; ++row ) {
+      if( fabsf( m[row][col] ) > fabsf( m[pivot][col] ) ) {
+        pivot = row;
+      }
+    }
+    if( !( fabsf( m[pivot][col] ) > 1e-12f ) ) {
+      return( ESP_FAIL );
+    }
+    if( pivot != col ) {
+      for( int j = col; j <= n; ++j ) {
+        swap = m[col][j];
+        m[col][j] = m[pivot][j];
+        m[pivot][j] = swap;
+      }
+    }
+    for( int row = col + 1; row < n; ++row ) {
+      factor = m[row][col]/m[col][col];
+      for( int j = col; j <= n; ++j ) {
+        m[row][j] -= factor*m[col][j];
+      }
+    }
+  }
+
+  for( int row = n - 1; row >= 0; --row ) {
+    for( int j = row + 1; j < n; ++j ) {
+      m[row][n] -= m[row][j]*m[j][n];
+    }
+    m[row][n] /= m[row][row];
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Refine all filters together with up to 'iterations' Levenberg-Marquardt steps
+//------------------------------------------------------------------------------------
+
+static void dsp_fit_optimize( dsp_fit_t* fit, int iterations ) {
+
+  int     n = 3*fit->num_filters;
+  float   residual[DSP_FIT_POINTS];
+  float   gradient[DSP_FIT_PARAMS];
+  float   param[DSP_MAX_FILTERS][3];
+  float   lambda = 0.01f;
+  float   cost = dsp_fit_cost( fit, fit->contrib );
+  float   trial_cost = cost;
+  float   sum;
+  bool    improved;
+
+  for( int iteration = 0; iteration < iterations; ++iteration ) {
+    for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+      residual[p] = fit->error[p];
+      for( int k = 0; k < fit->num_filters; ++k ) {
+        residual[p] += fit->contrib[k][p];
+      }
+    }
+
+    // Derivatives by finite differences, one filter response per parameter
+    for( int k = 0; k < fit->num_filters; ++k ) {
+      for( int j = 0; j < 3; ++j ) {
+        float*  column = fit->jacobian[3*k + j];
+
+        memcpy( param[0], fit->param[k], sizeof( param[0] ) );
+        param[0][j] += dsp_fit_delta[j];
+        dsp_fit_response( fit, fit->type[k], param[0], column );
+        for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+          column[p] = ( column[p] - fit->contrib[k][p] )/dsp_fit_delta[j];
+        }
+      }
+    }
+
+    for( int a = 0; a < n; ++a ) {
+      for( int b = 0; b <= a; ++b ) {
+        sum = 0;
+        for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+          sum += fit->jacobian[a][p]*fit->jacobian[b][p];
+        }
+        fit->hessian[a][b] = fit->hessian[b][a] = sum;
+      }
+      sum = 0;
+      for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+        sum += fit->jacobian[a][p]*residual[p];
+      }
+      gradient[a] = sum;
+    }
+
+    // Raise the damping until a step lowers the error
+    improved = false;
+    while( !improved && lambda < 1e6f ) {
+      for( int a = 0; a < n; ++a ) {
+        for( int b = 0; b < n; ++b ) {
+          fit->normal[a][b] = fit->hessian[a][b];
+        }
+        fit->normal[a][a] += lambda*( fit->hessian[a][a] + 1e-3f );
+        fit->normal[a][n] = -gradient[a];
+      }
+
+      if( dsp_fit_solve( fit, n ) == ESP_OK ) {
+        for( int k = 0; k < fit->num_filters; ++k ) {
+          for( int j = 0; j < 3; ++j ) {
+            param[k][j] = fit->param[k][j] + fit->normal[3*k + j][n];
+          }
+          dsp_fit_clamp( fit->type[k], param[k] );
+          dsp_fit_response( fit, fit->type[k], param[k], fit->trial[k] );
+        }
+        trial_cost = dsp_fit_cost( fit, fit->trial );
+        improved = trial_cost < cost;
+      }
+
+      if( improved ) {
+        memcpy( fit->param, param, fit->num_filters*sizeof( param[0] ) );
+        memcpy( fit->contrib, fit->trial, fit->num_filters*sizeof( fit->trial[0] ) );
+        lambda = lambda/3 > 1e-6f ? lambda/3 : 1e-6f;
+      } else {
+        lambda *= 4;
+      }
+    }
+
+    // Stop once a step gains next to nothing
+    if( !improved || cost - trial_cost < 1e-5f*cost ) {
+      break;
+    }
+    cost = trial_cost;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Start a new filter at the point the remaining error is largest, as far as a filter
+// may correct it: a peak as wide as the deviation, or a shelf if it sits at an edge
+// of the band and spreads into it
+//------------------------------------------------------------------------------------
+
+static void dsp_fit_add( dsp_fit_t* fit ) {
+
+  float   residual[DSP_FIT_POINTS];
+  float   score;
+  float   best_score = -1;
+  int     best = 0;
+  int     left;
+  int     right;
+  int     k = fit->num_filters;
+  float   octaves;
+  float   q;
+
+  for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+    residual[p] = fit->error[p];
+    for( int j = 0; j < fit->num_filters; ++j ) {
+      residual[p] += fit->contrib[j][p];
+    }
+    score = residual[p] > 0 ? fminf( residual[p], DSP_FIT_MAX_CUT ) : fminf( -residual[p], DSP_FIT_MAX_BOOST );
+    if( score > best_score ) {
+      best_score = score;
+      best = p;
+    }
+  }
+
+  // Width of the deviation at half its height
+  left = best;
+  while( left > 0 && residual[left - 1]*residual[best] > 0 && fabsf( residual[left - 1] ) > fabsf( residual[best] )/2 ) {
+    --left;
+  }
+  right = best;
+  while( right < DSP_FIT_POINTS - 1 && residual[right + 1]*residual[best] > 0 && fabsf( residual[right + 1] ) > fabsf( residual[best] )/2 ) {
+    ++right;
+  }
+
+  fit->type[k] = DSP_FIT_PEAK;
+  if( ( best == 0 && right >= DSP_FIT_POINTS/4 ) || ( best == DSP_FIT_POINTS - 1 && left <= 3*DSP_FIT_POINTS/4 ) ) {
+    fit->type[k] = best == 0 ? DSP_FIT_LOW_SHELF : DSP_FIT_HIGH_SHELF;
+    best = best == 0 ? right : left;
+  }
+
+  octaves = log2f( fit->freq[right]/fit->freq[left] );
+  octaves = octaves > 1.0f/( DSP_FIT_POINTS - 1 ) ? octaves : 1.0f/( DSP_FIT_POINTS - 1 );
+  q = sqrtf( exp2f( octaves ) )/( exp2f( octaves ) - 1 );
+
+  fit->param[k][0] = log2f( fit->freq[best] );
+  fit->param[k][1] = -residual[best];
+  fit->param[k][2] = log2f( q );
+  if( fit->type[k] != DSP_FIT_PEAK ) {
+    fit->param[k][1] = -residual[best == right ? 0 : DSP_FIT_POINTS - 1];
+    fit->param[k][2] = log2f( 0.7f );
+  }
+  dsp_fit_clamp( fit->type[k], fit->param[k] );
+  dsp_fit_response( fit, fit->type[k], fit->param[k], fit->contrib[k] );
+
+  ++fit->num_filters;
+}
+
+
+//------------------------------------------------------------------------------------
+// Design a biquad (the RBJ Audio EQ Cookbook filters) in the layout of
+// dsp_channel_t::coeffs: b0, b1, b2, a1, a2, normalized to a0 = 1
+//------------------------------------------------------------------------------------
+
+void dsp_fit_design( int type, float freq, float gain_dB, float q, float* coeffs ) {
+
+  double    a = pow( 10, gain_dB/40.0 );
+  double    w0 = 2*PI*freq/DSP_SAMPLE_RATE;
+  double    cs = cos( w0 );
+  double    alpha = sin( w0 )/( 2*q );
+  double    root = 2*sqrt( a )*alpha;
+  double    b[3];
+  double    d[3];
+
+  if( type == DSP_FIT_LOW_SHELF ) {
+    b[0] = a*( ( a + 1 ) - ( a - 1 )*cs + root );
+    b[1] = 2*a*( ( a - 1 ) - ( a + 1 )*cs );
+    b[2] = a*( ( a + 1 ) - ( a - 1 )*cs - root );
+    d[0] = ( a + 1 ) + ( a - 1 )*cs + root;
+    d[1] = -2*( ( a - 1 ) + ( a + 1 )*cs );
+    d[2] = ( a + 1 ) + ( a - 1 )*cs - root;
+  } else if( type == DSP_FIT_HIGH_SHELF ) {
+    b[0] = a*( ( a + 1 ) + ( a - 1 )*cs + root );
+    b[1] = -2*a*( ( a - 1 ) + ( a + 1 )*cs );
+    b[2] = a*( ( a + 1 ) + ( a - 1 )*cs - root );
+    d[0] = ( a + 1 ) - ( a - 1 )*cs + root;
+    d[1] = 2*( ( a - 1 ) - ( a + 1 )*cs );
+    d[2] = ( a + 1 ) - ( a - 1 )*cs - root;
+  } else {
+    b[0] = 1 + alpha*a;
+    b[1] = -2*cs;
+    b[2] = 1 - alpha*a;
+    d[0] = 1 + alpha/a;
+    d[1] = -2*cs;
+    d[2] = 1 - alpha/a;
+  }
+
+  coeffs[0] = (float) ( b[0]/d[0] );
+  coeffs[1] = (float) ( b[1]/d[0] );
+  coeffs[2] = (float) ( b[2]/d[0] );
+  coeffs[3] = (float) ( d[1]/d[0] );
+  coeffs[4] = (float) ( d[2]/d[0] );
+}
+
+
+//------------------------------------------------------------------------------------
+// Fit up to 'max_filters' filters to a response given in dB at fit->freq, toward a
+// target in dB at the same points (NULL for flat). The overall level is left to the
+// channel gain: the fit works on the deviation from the mean level, with dips limited
+// to DSP_FIT_MAX_BOOST deep (the RMS errors reported are of that).
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_fit_run( dsp_fit_t* fit, const float* response, const float* target, int max_filters ) {
+
+  float   saved[DSP_MAX_FILTERS][3];
+  float   level = 0;
+  float   rms;
+  float   swap;
+  int     saved_num;
+
+  if( max_filters < 0 || max_filters > DSP_MAX_FILTERS ) {
+    return( ESP_ERR_INVALID_ARG );
+  }
+
+  for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+    fit->error[p] = response[p] - ( target != NULL ? target[p] : 0 );
+    if( !isfinite( fit->error[p] ) ) {
+      return( ESP_ERR_INVALID_ARG );
+    }
+    level += fit->error[p]/DSP_FIT_POINTS;
+  }
+  // Dips are only filled as far as one filter may boost, or filters would pile up in them
+  for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+    fit->error[p] -= level;
+    fit->error[p] = fit->error[p] < -DSP_FIT_MAX_BOOST ? -DSP_FIT_MAX_BOOST : fit->error[p];
+  }
+
+  fit->num_filters = 0;
+  fit->evaluations = 0;
+  fit->rms_before = sqrtf( dsp_fit_cost( fit, fit->contrib )/DSP_FIT_POINTS );
+  fit->rms = fit->rms_before;
+
+  while( fit->num_filters < max_filters && fit->rms > DSP_FIT_TOLERANCE ) {
+    saved_num = fit->num_filters;
+    memcpy( saved, fit->param, sizeof( saved ) );
+
+    dsp_fit_add( fit );
+    dsp_fit_optimize( fit, DSP_FIT_ITERATIONS );
+    rms = sqrtf( dsp_fit_cost( fit, fit->contrib )/DSP_FIT_POINTS );
+
+    // Drop a filter that does not pay its way and put the others back
+    if( rms > fit->rms - 0.05f ) {
+      fit->num_filters = saved_num;
+      memcpy( fit->param, saved, sizeof( saved ) );
+      for( int k = 0; k < fit->num_filters; ++k ) {
+        dsp_fit_response( fit, fit->type[k], fit->param[k], fit->contrib[k] );
+      }
+      break;
+    }
+    fit->rms = rms;
+  }
+
+  // In order of frequency, as they are listed
+  for( int i = 1; i < fit->num_filters; ++i ) {
+    for( int k = i; k > 0 && fit->param[k][0] < fit->param[k - 1][0]; --k ) {
+      for( int j = 0; j < 3; ++j ) {
+        swap = fit->param[k][j];
+        fit->param[k][j] = fit->param[k - 1][j];
+        fit->param[k - 1][j] = swap;
+      }
+      saved_num = fit->type[k];
+      fit->type[k] = fit->type[k - 1];
+      fit->type[k - 1] = saved_num;
+    }
+  }
+
+  for( int k = 0; k < fit->num_filters; ++k ) {
+    dsp_fit_response( fit, fit->type[k], fit->param[k], fit->contrib[k] );
+    dsp_fit_design( fit->type[k], exp2f( fit->param[k][0] ), fit->param[k][1], exp2f( fit->param[k][2] ), fit->coeffs[k] );
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Print the fitted filters
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_fit_info( const dsp_fit_t* fit ) {
+
+  static const char*  type_names[] = { "peak", "low shelf", "high shelf" };
+
+  SERIAL.printf( "I-DSP: Fitted %d filters from %.0f Hz to %.0f Hz, RMS error %.2f dB -> %.2f dB (%d filter evaluations)\r\n",
+    fit->num_filters, DSP_FIT_LOW_HZ, DSP_FIT_HIGH_HZ, fit->rms_before, fit->rms, fit->evaluations );
+
+  for( int k = 0; k < fit->num_filters; ++k ) {
+    SERIAL.printf( "I-DSP:   %-10s %6.1f Hz  %+5.1f dB  Q %5.2f  {%.15f,%.15f,%.15f,%.15f,%.15f}\r\n",
+      type_names[fit->type[k]], exp2f( fit->param[k][0] ), fit->param[k][1], exp2f( fit->param[k][2] ),
+      fit->coeffs[k][0], fit->coeffs[k][1], fit->coeffs[k][2], fit->coeffs[k][3], fit->coeffs[k][4] );
+  }
+
+  return( ESP_OK );
+}
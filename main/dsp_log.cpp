@@ -0,0 +1,122 @@
+#include "dsp_process.h"
+#include "dsp_os.h"
+
+//------------------------------------------------------------------------------------
+// Log ring
+//
+// The audio path must not print: a SERIAL.printf() blocks until the UART and Telnet
+// have taken the text, about 90 us per character at 115200 baud. Instead it logs an
+// event id and up to DSP_LOG_MAX_ARGS numbers into a ring with a single writer, the
+// audio task, and dsp_loop() formats and prints them, DSP_LOG_DRAIN_MAX records per
+// call. Logging never waits: when the ring is full the record is counted as dropped
+// and the drops are reported with the next records printed. The head and tail are
+// free running counters, so no slot is left unused and no lock is needed.
+//------------------------------------------------------------------------------------
+
+typedef struct dsp_log_event_t {
+  const char*  format;                          // printf format of the event's arguments
+  bool         channel;                         // The first argument is a channel, printed as its name
+} dsp_log_event_t;
+
+static  dsp_log_record_t  dsp_log_ring[DSP_LOG_RING_LEN];
+static  uint32_t          dsp_log_head            = 0;      // Records written (audio side, atomic)
+static  uint32_t          dsp_log_tail            = 0;      // Records read (control side, atomic)
+static  uint32_t          dsp_log_drops           = 0;      // Records dropped while the ring was full (audio side, atomic)
+static  uint32_t          dsp_log_drops_reported  = 0;      // Drops already reported (control side)
+
+static const dsp_log_event_t  dsp_log_events[DSP_LOG_EVENTS] = {
+  { "E-DSP: ERROR: Failure during biquad processing = '%d'", false },
+  { "E-DSP: Too many input samples = '%d' (block size %d)", false },
+  { "E-DSP: Input samples = '%d' not a multiple of the decimation (%d)", false },
+  { "E-DSP: FIR filter of channel '%s' needs blocks of %d frames", true },
+  { "E-DSP: I2S read failed = '%d'", false },
+  { "E-DSP: Processing failed = '%d'", false },
+  { "E-DSP: I2S write failed = '%d'", false },
+  { "E-DSP: Block %d missed its deadline (%d us busy in a %d us period)", false }
+};
+
+
+//------------------------------------------------------------------------------------
+// Audio side: log an event (see DSP_LOG_...)
+//------------------------------------------------------------------------------------
+
+void dsp_log( int event, int32_t arg0, int32_t arg1, int32_t arg2 ) {
+
+  uint32_t            head = __atomic_load_n( &dsp_log_head, __ATOMIC_RELAXED );
+  dsp_log_record_t*   record;
+
+  if( head - __atomic_load_n( &dsp_log_tail, __ATOMIC_ACQUIRE ) >= DSP_LOG_RING_LEN ) {
+    __atomic_store_n( &dsp_log_drops, dsp_log_drops + 1, __ATOMIC_RELAXED );
+    return;
+  }
+
+  record = &dsp_log_ring[head % DSP_LOG_RING_LEN];
+  record->time_us = dsp_os_time_us();
+  record->event = event;
+  record->args[0] = arg0;
+  record->args[1] = arg1;
+  record->args[2] = arg2;
+
+  __atomic_store_n( &dsp_log_head, head + 1, __ATOMIC_RELEASE );
+}
+
+
+//------------------------------------------------------------------------------------
+// Control side: take the oldest record from the ring. Returns false if it is empty.
+//------------------------------------------------------------------------------------
+
+bool dsp_log_read( dsp_log_record_t* record ) {
+
+  uint32_t  tail = __atomic_load_n( &dsp_log_tail, __ATOMIC_RELAXED );
+
+  if( tail == __atomic_load_n( &dsp_log_head, __ATOMIC_ACQUIRE ) ) {
+    return( false );
+  }
+
+  *record = dsp_log_ring[tail % DSP_LOG_RING_LEN];
+  __atomic_store_n( &dsp_log_tail, tail + 1, __ATOMIC_RELEASE );
+
+  return( true );
+}
+
+uint32_t dsp_log_dropped() {
+  return( __atomic_load_n( &dsp_log_drops, __ATOMIC_RELAXED ) );
+}
+
+
+//------------------------------------------------------------------------------------
+// Control side: print up to max_records records, then any drops since the last call.
+// Returns the number of records printed.
+//------------------------------------------------------------------------------------
+
+int dsp_log_drain( dsp_channel_t* channels, int max_records ) {
+
+  dsp_log_record_t          record;
+  const dsp_log_event_t*    event;
+  uint32_t                  drops;
+  int                       count = 0;
+
+  while( count < max_records && dsp_log_read( &record ) ) {
+    ++count;
+    if( record.event < 0 || record.event >= DSP_LOG_EVENTS ) {
+      continue;
+    }
+
+    event = &dsp_log_events[record.event];
+    if( event->channel ) {
+      SERIAL.printf( event->format, record.args[0] >= 0 && record.args[0] < DSP_NUM_CHANNELS ? channels[record.args[0]].name : "?",
+        record.args[1], record.args[2] );
+    } else {
+      SERIAL.printf( event->format, record.args[0], record.args[1], record.args[2] );
+    }
+    SERIAL.printf( " at %.3f s\r\n", record.time_us/1e6 );
+  }
+
+  drops = dsp_log_dropped();
+  if( drops != dsp_log_drops_reported ) {
+    SERIAL.printf( "E-DSP: %u log records dropped, the log ring was full\r\n", drops - dsp_log_drops_reported );
+    dsp_log_drops_reported = drops;
+  }
+
+  return( count );
+}
@@ -0,0 +1,363 @@
+#include "dsp_process.h"
+
+//------------------------------------------------------------------------------------
+// Room measurement
+//
+// An exponential sine sweep is played on the DAC while the microphone is recorded, and
+// the recording is deconvolved into the impulse response of speaker and room. The
+// inverse filter is the time reversed sweep with its level raised 6 dB per octave, so
+// that sweep and inverse filter convolve to a band-limited impulse; the distortion
+// products of a nonlinear speaker arrive ahead of the linear response and stay out of
+// the impulse response window.
+//
+// Recording the whole sweep and deconvolving it in one FFT would take several times
+// its length in RAM. Instead the audio path captures chunks of one impulse response
+// length into two buffers, and the control side convolves each finished chunk with
+// the segment of the inverse filter that lands inside the impulse response window,
+// accumulating the results; the segment is generated from the sweep formula when it
+// is needed, so nothing of sweep length is ever stored. The memory taken depends on
+// the impulse response length only and a chunk has one chunk length of time to be
+// deconvolved before its buffer is needed again.
+//
+// The response is scaled so a direct connection of the output to the input measures
+// as a unit impulse, 0 dB at every frequency between the sweep limits.
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+// FFT size used to deconvolve chunks of 'ir_len' samples into 'ir_len' samples
+//------------------------------------------------------------------------------------
+
+static int dsp_measure_size( int ir_len ) {
+
+  int       size = 4;
+
+  // The chunk and the inverse filter segment, ir_len + chunk - 1 long, must not wrap
+  while( size < 2*ir_len - 1 ) {
+    size <<= 1;
+  }
+
+  return( size );
+}
+
+
+//------------------------------------------------------------------------------------
+// Set up a measurement with a sweep of 'seconds' played on output slot 'output' (-1 for
+// all) and recorded from input slot 'input', 'latency' samples after it was written
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_measure_create( dsp_measure_t** result, double seconds, int ir_len, int latency, int output, int input ) {
+
+  dsp_measure_t*  measure;
+  int             size = dsp_measure_size( ir_len );
+
+  *result = NULL;
+
+  if( seconds < 0.1 || seconds > DSP_MEASURE_MAX_SECONDS || ir_len < 256 || ir_len > DSP_MEASURE_MAX_IR_LEN ||
+      latency < 0 || output < -1 || output >= DSP_NUM_CHANNELS || input < 0 || input >= DSP_NUM_CHANNELS ) {
+    return( ESP_ERR_INVALID_ARG );
+  }
+
+  measure = (dsp_measure_t*) calloc( 1, sizeof( dsp_measure_t ) );
+  if( measure == NULL ) {
+    return( ESP_FAIL );
+  }
+
+  measure->memory = (float*) calloc( 3*ir_len + 2*size, sizeof( float ) );
+  if( measure->memory == NULL || dsp_fft_init( &measure->fft, size ) != ESP_OK ) {
+    dsp_measure_free( measure );
+    return( ESP_FAIL );
+  }
+
+  measure->sweep_len = (int) ( seconds*DSP_SAMPLE_RATE );
+  measure->rate = measure->sweep_len/log( DSP_MEASURE_END_HZ/DSP_MEASURE_START_HZ );
+  measure->omega = 2*PI*DSP_MEASURE_START_HZ/DSP_SAMPLE_RATE;
+  measure->growth = exp( 1/measure->rate );
+  measure->amplitude = (float) ( DSP_MEASURE_LEVEL*DSP_MAX_SAMPLE_VALUE );
+  measure->fade_in = DSP_MEASURE_FADE_MS*DSP_SAMPLE_RATE/1000;
+  measure->fade_out = measure->fade_in/4;
+  measure->output = output;
+  measure->input = input;
+  measure->ir_len = ir_len;
+  measure->pre = ir_len/16;
+  measure->latency = latency;
+  measure->chunk = ir_len;
+  measure->size = size;
+
+  // Capture until the end of the impulse response window has been recorded for the last sweep sample
+  measure->chunks = ( measure->sweep_len + latency - measure->pre + ir_len - 1 + measure->chunk - 1 )/measure->chunk;
+
+  measure->phase = 0;
+  measure->step = measure->omega*measure->rate*( measure->growth - 1 );
+
+  measure->capture[0] = measure->memory;
+  measure->capture[1] = &measure->memory[ir_len];
+  measure->ir = &measure->memory[2*ir_len];
+  measure->work = &measure->memory[3*ir_len];
+  measure->segment = &measure->memory[3*ir_len + size];
+
+  *result = measure;
+
+  return( ESP_OK );
+}
+
+void dsp_measure_free( dsp_measure_t* measure ) {
+
+  if( measure == NULL ) {
+    return;
+  }
+
+  dsp_fft_free( &measure->fft );
+  free( measure->memory );
+  free( measure );
+}
+
+
+//------------------------------------------------------------------------------------
+// Audio path: record the input slot into the current chunk and replace the block with
+// the next sweep samples (silence on the other outputs, and once the sweep is over)
+//------------------------------------------------------------------------------------
+
+void dsp_measure_block( dsp_measure_t* measure, sample_t* buffer, int frames ) {
+
+  float*    chunk;
+  float     scale = 1.0f/measure->amplitude;
+  float     value;
+  int       n;
+
+  for( int i = 0; i < frames; ++i, buffer += DSP_NUM_CHANNELS ) {
+    n = measure->position;
+
+    // A new chunk reuses the buffer of the chunk before last, which must have been deconvolved by now
+    if( measure->fill == 0 && measure->captured >= 2 &&
+        __atomic_load_n( &measure->processed, __ATOMIC_ACQUIRE ) < measure->captured - 1 ) {
+      __atomic_store_n( &measure->overrun, true, __ATOMIC_RELEASE );
+    }
+
+    if( measure->overrun || measure->captured == measure->chunks ) {
+      memset( buffer, 0, DSP_NUM_CHANNELS*sizeof( sample_t ) );
+      continue;
+    }
+
+    chunk = measure->capture[measure->captured & 1];
+    chunk[measure->fill] = buffer[measure->input]*scale;
+    if( ++measure->fill == measure->chunk ) {
+      measure->fill = 0;
+      __atomic_store_n( &measure->captured, measure->captured + 1, __ATOMIC_RELEASE );
+    }
+
+    value = 0;
+    if( n < measure->sweep_len ) {
+      value = measure->amplitude*sinf( (float) measure->phase );
+      if( n < measure->fade_in ) {
+        value *= 0.5f - 0.5f*cosf( (float) PI*n/measure->fade_in );
+      } else if( n >= measure->sweep_len - measure->fade_out ) {
+        value *= 0.5f - 0.5f*cosf( (float) PI*( measure->sweep_len - n )/measure->fade_out );
+      }
+
+      measure->phase += measure->step;
+      if( measure->phase >= 2*PI ) {
+        measure->phase -= 2*PI;
+      }
+      measure->step *= measure->growth;
+    }
+
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      buffer[channel_id] = ( measure->output < 0 || measure->output == channel_id ) ? (sample_t) lrintf( value ) : 0;
+    }
+
+    ++measure->position;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Deconvolve chunk 'index' into the impulse response. Impulse response sample m is
+// the recording convolved with the inverse filter at m + T - 1 + latency - pre, T the
+// sweep length, so chunk samples k0 to k0 + C - 1 need inverse filter samples a to
+// a + ir_len + C - 2, a = T - 1 + latency - pre - k0 - (C - 1). Inverse filter sample
+// j is sweep sample T - 1 - j weighted by 4 f/rate, f its frequency in cycles per
+// sample, which the recurrence walks down from the first sample of the segment.
+//------------------------------------------------------------------------------------
+
+static void dsp_measure_chunk( dsp_measure_t* measure, int index ) {
+
+  const float*  chunk = measure->capture[index & 1];
+  float*        work = measure->work;
+  float*        segment = measure->segment;
+  int           size = measure->size;
+  int           len = measure->ir_len + measure->chunk - 1;
+  int           a;
+  int           first;
+  int           last;
+  int           n;
+  double        phase;
+  double        back;
+  double        weight;
+  double        shrink = 1/measure->growth;
+  float         re;
+
+  a = measure->sweep_len - 1 + measure->latency - measure->pre - index*measure->chunk - ( measure->chunk - 1 );
+  first = a < 0 ? -a : 0;
+  last = measure->sweep_len - a < len ? measure->sweep_len - a : len;
+  if( first >= last ) {
+    return;
+  }
+
+  // Inverse filter segment, with the 1/size of the inverse transform folded in
+  n = measure->sweep_len - 1 - a - first;
+  phase = fmod( measure->omega*measure->rate*( exp( n/measure->rate ) - 1 ), 2*PI );
+  back = measure->omega*measure->rate*exp( ( n - 1 )/measure->rate )*( measure->growth - 1 );
+  weight = 2*measure->omega*exp( n/measure->rate )/( PI*measure->rate*size );
+
+  memset( segment, 0, size*sizeof( float ) );
+  for( int j = first; j < last; ++j ) {
+    segment[j] = (float) ( weight*sin( phase ) );
+    phase -= back;
+    if( phase < 0 ) {
+      phase += 2*PI;
+    }
+    back *= shrink;
+    weight *= shrink;
+  }
+
+  memcpy( work, chunk, measure->chunk*sizeof( float ) );
+  memset( &work[measure->chunk], 0, ( size - measure->chunk )*sizeof( float ) );
+
+  dsp_fft_forward( &measure->fft, work );
+  dsp_fft_forward( &measure->fft, segment );
+
+  work[0] *= segment[0];
+  work[1] *= segment[1];
+  for( int k = 2; k < size; k += 2 ) {
+    re = work[k]*segment[k] - work[k + 1]*segment[k + 1];
+    work[k + 1] = work[k]*segment[k + 1] + work[k + 1]*segment[k];
+    work[k] = re;
+  }
+
+  dsp_fft_inverse( &measure->fft, work );
+
+  for( int m = 0; m < measure->ir_len; ++m ) {
+    measure->ir[m] += work[measure->chunk - 1 + m];
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Control side: deconvolve the chunks captured so far and, after the last one, take the
+// frequency response. Returns DSP_MEASURE_CAPTURING, _DONE or _OVERRUN.
+//------------------------------------------------------------------------------------
+
+int dsp_measure_poll( dsp_measure_t* measure ) {
+
+  int       captured;
+
+  if( measure->done ) {
+    return( DSP_MEASURE_DONE );
+  }
+
+  captured = __atomic_load_n( &measure->captured, __ATOMIC_ACQUIRE );
+  while( measure->processed < captured && !__atomic_load_n( &measure->overrun, __ATOMIC_ACQUIRE ) ) {
+    dsp_measure_chunk( measure, measure->processed );
+    __atomic_store_n( &measure->processed, measure->processed + 1, __ATOMIC_RELEASE );
+  }
+
+  // Checked after the chunks: a buffer is never overwritten once the overrun is flagged
+  if( __atomic_load_n( &measure->overrun, __ATOMIC_ACQUIRE ) ) {
+    return( DSP_MEASURE_OVERRUN );
+  }
+
+  if( measure->processed < measure->chunks ) {
+    return( DSP_MEASURE_CAPTURING );
+  }
+
+  memcpy( measure->work, measure->ir, measure->ir_len*sizeof( float ) );
+  memset( &measure->work[measure->ir_len], 0, ( measure->size - measure->ir_len )*sizeof( float ) );
+  dsp_fft_forward( &measure->fft, measure->work );
+  measure->done = true;
+
+  return( DSP_MEASURE_DONE );
+}
+
+
+//------------------------------------------------------------------------------------
+// Level in dB of a packed spectrum of 'size' points, power averaged over the bins within
+// 'octaves' around 'freq' (the nearest bin if none are)
+//------------------------------------------------------------------------------------
+
+float dsp_measure_band( const float* spectrum, int size, double freq, double octaves ) {
+
+  int       low = (int) ceil( freq*pow( 2, -octaves/2 )*size/DSP_SAMPLE_RATE );
+  int       high = (int) floor( freq*pow( 2, octaves/2 )*size/DSP_SAMPLE_RATE );
+  double    power = 0;
+  double    bin_power;
+
+  if( low > high ) {
+    low = high = (int) lround( freq*size/DSP_SAMPLE_RATE );
+  }
+  low = low < 0 ? 0 : low;
+  high = high > size/2 ? size/2 : high;
+
+  for( int k = low; k <= high; ++k ) {
+    if( k == 0 ) {
+      bin_power = spectrum[0]*spectrum[0];
+    } else if( k == size/2 ) {
+      bin_power = spectrum[1]*spectrum[1];
+    } else {
+      bin_power = spectrum[2*k]*spectrum[2*k] + spectrum[2*k + 1]*spectrum[2*k + 1];
+    }
+    power += bin_power;
+  }
+
+  return( (float) ( 10*log10( power/( high - low + 1 ) + 1e-20 ) ) );
+}
+
+
+//------------------------------------------------------------------------------------
+// Bytes of RAM a measurement with an impulse response of 'ir_len' samples takes
+//------------------------------------------------------------------------------------
+
+int dsp_measure_memory( int ir_len ) {
+
+  int       size = dsp_measure_size( ir_len );
+
+  return( (int) ( ( 3*ir_len + 3*size )*sizeof( float ) + size/2*sizeof( uint16_t ) + sizeof( dsp_measure_t ) ) );
+}
+
+
+//------------------------------------------------------------------------------------
+// Print the arrival of the direct sound and the 1/3 octave frequency response
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_measure_report( const dsp_measure_t* measure ) {
+
+  int       peak = 0;
+  double    freq;
+
+  if( !measure->done ) {
+    return( ESP_FAIL );
+  }
+
+  for( int m = 1; m < measure->ir_len; ++m ) {
+    if( fabsf( measure->ir[m] ) > fabsf( measure->ir[peak] ) ) {
+      peak = m;
+    }
+  }
+
+  SERIAL.printf("I-DSP: Sweep of %.1f s from %.0f Hz to %.0f Hz at %.0f dBFS, impulse response of %d samples (%.1f ms)\r\n",
+    (double) measure->sweep_len/DSP_SAMPLE_RATE, DSP_MEASURE_START_HZ, DSP_MEASURE_END_HZ, 20*log10( DSP_MEASURE_LEVEL ),
+    measure->ir_len, 1000.0*measure->ir_len/DSP_SAMPLE_RATE );
+  SERIAL.printf("I-DSP: Direct sound %.2f ms after the I2S latency, peak %.1f dB\r\n",
+    1000.0*( peak - measure->pre )/DSP_SAMPLE_RATE, 20*log10( fabsf( measure->ir[peak] ) + 1e-10 ) );
+  SERIAL.printf("I-DSP: Frequency response (1/3 octave):\r\n");
+
+  for( int band = 0; ; ++band ) {
+    freq = 1000*pow( 2, ( band - 17 )/3.0 );
+    if( freq > DSP_MEASURE_END_HZ ) {
+      break;
+    }
+    SERIAL.printf("I-DSP:   %6.0f Hz  %+6.1f dB\r\n", freq, dsp_measure_band( measure->work, measure->size, freq, 1/3.0 ) );
+  }
+
+  return( ESP_OK );
+}
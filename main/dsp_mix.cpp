@@ -0,0 +1,305 @@
+#include "dsp_process.h"
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#elif defined( __ARM_NEON )
+#include <arm_neon.h>
+#endif
+
+// The full matrix has a vector kernel (two channels on SSE2/NEON)
+#if DSP_NUM_CHANNELS == 2 && ( defined( __SSE2__ ) || defined( __ARM_NEON ) ) && !defined( DSP_NO_SIMD )
+#define DSP_MIX_VECTOR      1
+#else
+#define DSP_MIX_VECTOR      0
+#endif
+
+//------------------------------------------------------------------------------------
+// Input mix matrix
+//
+// Before the channels are processed, channel c of each frame is replaced by the sum of
+// the I2S input slots weighted by row c of the matrix, so e.g. two subs can both be fed
+// the mono sum of left and right. All outputs of a frame are computed from the inputs
+// before any is written back, so the mix works in place on the interleaved buffer.
+//
+// dsp_mix_setup picks the cheapest kernel that computes the matrix exactly: none for
+// the identity, plain sample moves when every channel takes one input at unity gain,
+// a loop over the non-zero gains when at most a quarter of them are set, and the full
+// matrix otherwise. Per gain the loop costs about three times the unrolled full matrix,
+// hence the quarter; where the full matrix is vectorized it is always the faster one. Sums beyond full scale saturate and
+// are counted per channel.
+//------------------------------------------------------------------------------------
+
+
+//------------------------------------------------------------------------------------
+// Classify a matrix (row c = gains of the input slots in channel c) for dsp_mix_process
+//------------------------------------------------------------------------------------
+
+void dsp_mix_setup( dsp_mix_t* mix, const float gain[][DSP_NUM_CHANNELS] ) {
+
+  bool    identity = true;
+  bool    route = true;
+  int     non_zero = 0;
+
+  memset( mix, 0, sizeof( dsp_mix_t ) );
+  memcpy( mix->gain, gain, sizeof( mix->gain ) );
+
+  for( int c = 0; c < DSP_NUM_CHANNELS; ++c ) {
+    for( int i = 0; i < DSP_NUM_CHANNELS; ++i ) {
+      if( gain[c][i] != 0 ) {
+        mix->input[c][mix->count[c]++] = i;
+        mix->route[c] = i;
+      }
+    }
+
+    if( mix->count[c] != 1 || gain[c][mix->route[c]] != 1.0f ) {
+      route = false;
+    }
+    if( !route || mix->route[c] != c ) {
+      identity = false;
+    }
+    non_zero += mix->count[c];
+  }
+
+  if( identity ) {
+    mix->kind = DSP_MIX_IDENTITY;
+  } else if( route ) {
+    mix->kind = DSP_MIX_ROUTE;
+  } else if( !DSP_MIX_VECTOR && 4*non_zero <= DSP_NUM_CHANNELS*DSP_NUM_CHANNELS ) {
+    mix->kind = DSP_MIX_SPARSE;
+  } else {
+    mix->kind = DSP_MIX_DENSE;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Round a mixed value to the nearest sample, saturating (and counting) at full scale
+//------------------------------------------------------------------------------------
+
+static inline sample_t dsp_mix_sample( float value, int* clipped ) {
+
+  if( value > DSP_MAX_SAMPLE_VALUE ) {
+    ++*clipped;
+    return( DSP_MAX_SAMPLE_VALUE );
+  }
+  if( value < -DSP_MAX_SAMPLE_VALUE ) {
+    ++*clipped;
+    return( -DSP_MAX_SAMPLE_VALUE );
+  }
+
+  // copysignf keeps the rounding free of a branch on the sign of the signal
+  return( (sample_t) ( value + copysignf( 0.5f, value ) ) );
+}
+
+
+//------------------------------------------------------------------------------------
+// Every channel takes one input slot unchanged
+//------------------------------------------------------------------------------------
+
+static void dsp_mix_route( const dsp_mix_t* mix, sample_t* buffer, int frames ) {
+
+  sample_t    in[DSP_NUM_CHANNELS];
+  sample_t*   frame;
+
+  for( int i = 0; i < frames; ++i ) {
+    frame = &buffer[i*DSP_NUM_CHANNELS];
+    memcpy( in, frame, sizeof( in ) );
+    for( int c = 0; c < DSP_NUM_CHANNELS; ++c ) {
+      frame[c] = in[mix->route[c]];
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Every channel sums its inputs with a non-zero gain
+//------------------------------------------------------------------------------------
+
+static void dsp_mix_sparse( const dsp_mix_t* mix, sample_t* buffer, int frames, int* clipped ) {
+
+  float       in[DSP_NUM_CHANNELS];
+  sample_t*   frame;
+  float       sum;
+
+  for( int i = 0; i < frames; ++i ) {
+    frame = &buffer[i*DSP_NUM_CHANNELS];
+    for( int c = 0; c < DSP_NUM_CHANNELS; ++c ) {
+      in[c] = frame[c];
+    }
+    for( int c = 0; c < DSP_NUM_CHANNELS; ++c ) {
+      sum = 0;
+      for( int k = 0; k < mix->count[c]; ++k ) {
+        sum += mix->gain[c][mix->input[c][k]]*in[mix->input[c][k]];
+      }
+      frame[c] = dsp_mix_sample( sum, &clipped[c] );
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Full matrix, scalar. The loops run over the compile-time channel count, so the
+// compiler unrolls them and keeps the gains in registers.
+//------------------------------------------------------------------------------------
+
+void dsp_mix_dense_ansi( const dsp_mix_t* mix, sample_t* buffer, int frames, int* clipped ) {
+
+  float       gain[DSP_NUM_CHANNELS][DSP_NUM_CHANNELS];
+  float       in[DSP_NUM_CHANNELS];
+  sample_t*   frame;
+  float       sum;
+
+  memcpy( gain, mix->gain, sizeof( gain ) );
+
+  for( int i = 0; i < frames; ++i ) {
+    frame = &buffer[i*DSP_NUM_CHANNELS];
+    for( int c = 0; c < DSP_NUM_CHANNELS; ++c ) {
+      in[c] = frame[c];
+    }
+    for( int c = 0; c < DSP_NUM_CHANNELS; ++c ) {
+      sum = 0;
+      for( int k = 0; k < DSP_NUM_CHANNELS; ++k ) {
+        sum += gain[c][k]*in[k];
+      }
+      frame[c] = dsp_mix_sample( sum, &clipped[c] );
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Full matrix, vector version for two channels: a register holds two frames (l0 r0 l1
+// r1), the outputs are that times the diagonal gains plus the pair-swapped frames
+// (r0 l0 r1 l1) times the cross gains. Rounding is to nearest as the scalar kernels
+// (ties to even instead of away from zero).
+//------------------------------------------------------------------------------------
+
+#if DSP_MIX_VECTOR && defined( __SSE2__ )
+
+void dsp_mix_dense_simd( const dsp_mix_t* mix, sample_t* buffer, int frames, int* clipped ) {
+
+  const __m128  diag = _mm_setr_ps( mix->gain[0][0], mix->gain[1][1], mix->gain[0][0], mix->gain[1][1] );
+  const __m128  cross = _mm_setr_ps( mix->gain[0][1], mix->gain[1][0], mix->gain[0][1], mix->gain[1][0] );
+  const __m128  full = _mm_set1_ps( (float) DSP_MAX_SAMPLE_VALUE );
+  const __m128  sign = _mm_set1_ps( -0.0f );
+  __m128        x;
+  __m128i       xi;
+  int           over;
+  int           i;
+
+  for( i = 0; i + 2 <= frames; i += 2 ) {
+#if DSP_SAMPLE_BITS == 32
+    x = _mm_cvtepi32_ps( _mm_loadu_si128( (const __m128i*) &buffer[2*i] ) );
+#else
+    // Sign extend the four int16 samples to int32
+    xi = _mm_loadl_epi64( (const __m128i*) &buffer[2*i] );
+    x = _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpacklo_epi16( xi, xi ), 16 ) );
+#endif
+
+    x = _mm_add_ps( _mm_mul_ps( x, diag ), _mm_mul_ps( _mm_shuffle_ps( x, x, _MM_SHUFFLE( 2, 3, 0, 1 ) ), cross ) );
+
+    over = _mm_movemask_ps( _mm_cmpgt_ps( _mm_andnot_ps( sign, x ), full ) );
+    if( over != 0 ) {
+      clipped[0] += ( over & 1 ) + ( ( over >> 2 ) & 1 );
+      clipped[1] += ( ( over >> 1 ) & 1 ) + ( ( over >> 3 ) & 1 );
+      x = _mm_max_ps( _mm_min_ps( x, full ), _mm_xor_ps( full, sign ) );
+    }
+
+    xi = _mm_cvtps_epi32( x );
+#if DSP_SAMPLE_BITS == 32
+    _mm_storeu_si128( (__m128i*) &buffer[2*i], xi );
+#else
+    _mm_storel_epi64( (__m128i*) &buffer[2*i], _mm_packs_epi32( xi, xi ) );
+#endif
+  }
+
+  // Odd frame at the end
+  if( i < frames ) {
+    dsp_mix_dense_ansi( mix, &buffer[2*i], frames - i, clipped );
+  }
+}
+
+#elif DSP_MIX_VECTOR && defined( __ARM_NEON )
+
+void dsp_mix_dense_simd( const dsp_mix_t* mix, sample_t* buffer, int frames, int* clipped ) {
+
+  const float         diag_lanes[4] = { mix->gain[0][0], mix->gain[1][1], mix->gain[0][0], mix->gain[1][1] };
+  const float         cross_lanes[4] = { mix->gain[0][1], mix->gain[1][0], mix->gain[0][1], mix->gain[1][0] };
+  const float32x4_t   diag = vld1q_f32( diag_lanes );
+  const float32x4_t   cross = vld1q_f32( cross_lanes );
+  const float32x4_t   full = vdupq_n_f32( (float) DSP_MAX_SAMPLE_VALUE );
+  const float32x4_t   half = vdupq_n_f32( 0.5f );
+  const uint32x4_t    sign = vdupq_n_u32( 0x80000000 );
+  float32x4_t         x;
+  uint32x4_t          over;
+  uint32_t            lanes[4];
+  int32x4_t           xi;
+  int                 i;
+
+  for( i = 0; i + 2 <= frames; i += 2 ) {
+#if DSP_SAMPLE_BITS == 32
+    x = vcvtq_f32_s32( vld1q_s32( &buffer[2*i] ) );
+#else
+    x = vcvtq_f32_s32( vmovl_s16( vld1_s16( &buffer[2*i] ) ) );
+#endif
+
+    x = vmlaq_f32( vmulq_f32( x, diag ), vrev64q_f32( x ), cross );
+
+    over = vcagtq_f32( x, full );
+    if( vgetq_lane_u32( over, 0 ) | vgetq_lane_u32( over, 1 ) | vgetq_lane_u32( over, 2 ) | vgetq_lane_u32( over, 3 ) ) {
+      vst1q_u32( lanes, over );
+      clipped[0] += ( lanes[0] & 1 ) + ( lanes[2] & 1 );
+      clipped[1] += ( lanes[1] & 1 ) + ( lanes[3] & 1 );
+      x = vmaxq_f32( vminq_f32( x, full ), vnegq_f32( full ) );
+    }
+
+    // Add 0.5 with the sign of the value, then truncate
+    x = vaddq_f32( x, vreinterpretq_f32_u32( vorrq_u32( vandq_u32( vreinterpretq_u32_f32( x ), sign ), vreinterpretq_u32_f32( half ) ) ) );
+    xi = vcvtq_s32_f32( x );
+#if DSP_SAMPLE_BITS == 32
+    vst1q_s32( &buffer[2*i], xi );
+#else
+    vst1_s16( &buffer[2*i], vmovn_s32( xi ) );
+#endif
+  }
+
+  // Odd frame at the end
+  if( i < frames ) {
+    dsp_mix_dense_ansi( mix, &buffer[2*i], frames - i, clipped );
+  }
+}
+
+#else
+
+void dsp_mix_dense_simd( const dsp_mix_t* mix, sample_t* buffer, int frames, int* clipped ) {
+  // No vector unit (e.g. the ESP32) or more than two channels: the unrolled scalar kernel
+  dsp_mix_dense_ansi( mix, buffer, frames, clipped );
+}
+
+#endif
+
+
+//------------------------------------------------------------------------------------
+// Mix one block of the interleaved buffer in place. The saturated samples of each
+// channel are added to clipped[channel].
+//------------------------------------------------------------------------------------
+
+void dsp_mix_process( const dsp_mix_t* mix, sample_t* buffer, int frames, int* clipped ) {
+
+  switch( mix->kind ) {
+    case DSP_MIX_IDENTITY :
+      break;
+
+    case DSP_MIX_ROUTE :
+      dsp_mix_route( mix, buffer, frames );
+      break;
+
+    case DSP_MIX_SPARSE :
+      dsp_mix_sparse( mix, buffer, frames, clipped );
+      break;
+
+    default :
+      dsp_mix_dense_simd( mix, buffer, frames, clipped );
+      break;
+  }
+}
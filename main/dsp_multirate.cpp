@@ -0,0 +1,473 @@
+#include "dsp_process.h"
+
+//------------------------------------------------------------------------------------
+// Multirate channel path
+//
+// A channel with a decimation factor M > 1 is low-pass filtered and decimated by M,
+// runs its delay and biquad cascade at DSP_SAMPLE_RATE/M and is interpolated back.
+//
+// A power of two M goes through a cascade of log2 M half-band stages, each halving (or
+// doubling) the rate. The stages are maximally flat half-band filters: every other tap
+// is zero and the centre tap is 1/2, so with the symmetry a 7 tap stage takes 3 and an
+// 11 tap stage 4 multiplies per low-rate sample, and interpolating, one of each pair of
+// outputs is a copy of an input. Only the last stage has to keep aliases out of the
+// passband from close to its Nyquist frequency and takes 11 taps; the stages ahead of
+// it run at higher rates with a wider transition band and take 7. Per full-rate sample
+// that is at most 3 multiplies for the decimator and 2 for the interpolator.
+//
+// Any other M uses one linear phase FIR of M*DSP_MULTIRATE_PHASE_TAPS taps (Kaiser
+// windowed sinc cut off at the low-rate Nyquist frequency), evaluated in polyphase form:
+// the decimator only computes every M-th output, the interpolator runs M branches of
+// DSP_MULTIRATE_PHASE_TAPS taps on the low-rate samples, 6 multiply-adds per full-rate
+// sample each.
+//
+// The passband ends where aliases would no longer be DSP_MULTIRATE_STOPBAND down
+// (dsp_multirate_passband); content between there and the low-rate Nyquist frequency is
+// partly aliased, which leaves the channel's own low-pass filters to remove it, as they
+// do for a sub.
+//
+// The biquads are redesigned for the low rate: each one is taken back to the analog
+// domain and forward again with bilinear transforms prewarped at its natural frequency,
+// so the response matches at DC, at that frequency and closely in between.
+//------------------------------------------------------------------------------------
+
+#define DSP_MULTIRATE_BETA    ( 0.1102*( DSP_MULTIRATE_STOPBAND - 8.7 ) )   // Kaiser window for the stopband attenuation
+
+// Maximally flat half-band filters: the taps 1, 3 (and 5) away from the centre tap of 1/2
+static const float dsp_multirate_hb_short[] = { 9/32.0f, -1/32.0f };
+static const float dsp_multirate_hb_long[] = { 150/512.0f, -25/512.0f, 3/512.0f };
+
+
+// Zeroth order modified Bessel function of the first kind (Kaiser window)
+static double dsp_multirate_bessel_i0( double x ) {
+
+  double    sum = 1.0;
+  double    term = 1.0;
+
+  for( int k = 1; k < 50 && term > 1e-12*sum; ++k ) {
+    term *= ( x/( 2*k ) )*( x/( 2*k ) );
+    sum += term;
+  }
+
+  return( sum );
+}
+
+
+//------------------------------------------------------------------------------------
+// Design the resampling filter for a decimation factor and reset the filter history
+//------------------------------------------------------------------------------------
+
+// Half-band stages of a decimation factor, 0 if it is not a power of two
+static int dsp_multirate_stages( int decimation ) {
+
+  int       stages = 0;
+
+  while( decimation > 1 && decimation % 2 == 0 ) {
+    decimation /= 2;
+    ++stages;
+  }
+
+  return( decimation == 1 ? stages : 0 );
+}
+
+// Taps of half-band stage 'stage' (0 runs at the full rate)
+static inline int dsp_multirate_stage_taps( int stages, int stage ) {
+  return( stage == stages - 1 ? DSP_MULTIRATE_HB_LONG : DSP_MULTIRATE_HB_SHORT );
+}
+
+esp_err_t dsp_multirate_init( dsp_multirate_t* multirate, int decimation ) {
+
+  double    h[DSP_MULTIRATE_MAX_TAPS];
+  double    sum = 0;
+  double    center;
+  double    x;
+  int       taps = decimation*DSP_MULTIRATE_PHASE_TAPS;
+
+  if( decimation < 1 || decimation > DSP_MAX_DECIMATION ) {
+    return( ESP_FAIL );
+  }
+
+  memset( multirate, 0, sizeof( dsp_multirate_t ) );
+  multirate->decimation = decimation;
+  multirate->stages = dsp_multirate_stages( decimation );
+  multirate->taps = taps;
+
+  // The half-band stages use the fixed filters above
+  if( decimation == 1 || multirate->stages > 0 ) {
+    return( ESP_OK );
+  }
+
+  // Windowed sinc with its cut-off at the low-rate Nyquist frequency, unity gain at DC
+  center = ( taps - 1 )/2.0;
+  for( int k = 0; k < taps; ++k ) {
+    x = ( k - center )/decimation;
+    h[k] = ( x == 0 ? 1.0 : sin( PI*x )/( PI*x ) )*
+           dsp_multirate_bessel_i0( DSP_MULTIRATE_BETA*sqrt( 1 - ( ( k - center )/center )*( ( k - center )/center ) ) );
+    sum += h[k];
+  }
+
+  // The filter is symmetric, so the decimator uses it as is. Interpolator branch p holds
+  // taps p, p + M, ... in reverse order, scaled by M for the zeros left out; the branches
+  // are interleaved so tap t of all of them is contiguous.
+  for( int k = 0; k < taps; ++k ) {
+    multirate->fir[k] = h[k]/sum;
+  }
+  for( int t = 0; t < DSP_MULTIRATE_PHASE_TAPS; ++t ) {
+    for( int p = 0; p < decimation; ++p ) {
+      multirate->interp[t*decimation + p] = decimation*h[( DSP_MULTIRATE_PHASE_TAPS - 1 - t )*decimation + p]/sum;
+    }
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Frequency up to which a decimation factor passes the signal unchanged (Hz), and the
+// delay the two resampling filters add (samples at DSP_SAMPLE_RATE)
+//------------------------------------------------------------------------------------
+
+float dsp_multirate_passband( int decimation ) {
+
+  int       taps = decimation*DSP_MULTIRATE_PHASE_TAPS;
+  double    transition = ( DSP_MULTIRATE_STOPBAND - 7.95 )/( 14.36*( taps - 1 ) )*DSP_SAMPLE_RATE;
+
+  if( decimation <= 1 ) {
+    return( DSP_SAMPLE_RATE/2 );
+  }
+
+  if( dsp_multirate_stages( decimation ) > 0 ) {
+    return( (float) ( DSP_MULTIRATE_HB_EDGE*2*DSP_SAMPLE_RATE/decimation ) );
+  }
+
+  return( (float) ( DSP_SAMPLE_RATE/( 2.0*decimation ) - transition/2 ) );
+}
+
+int dsp_multirate_delay( int decimation ) {
+
+  int       stages = dsp_multirate_stages( decimation );
+  int       delay = 0;
+
+  if( decimation <= 1 ) {
+    return( 0 );
+  }
+
+  if( stages == 0 ) {
+    return( decimation*DSP_MULTIRATE_PHASE_TAPS - decimation );
+  }
+
+  // A stage of 2D + 1 taps at 1/2^s of the full rate: D input samples through the decimator
+  // less the one its output stands for, D through the interpolator
+  for( int stage = 0; stage < stages; ++stage ) {
+    delay += ( 1 << stage )*( dsp_multirate_stage_taps( stages, stage ) - 2 );
+  }
+
+  return( delay );
+}
+
+
+//------------------------------------------------------------------------------------
+// Cost of resampling a channel, in biquads run at the full rate: the multiply-adds per
+// full-rate sample of the resampling filters over the DSP_MULTIRATE_BIQUAD_MACS of a
+// biquad. Half-band stage s runs at 1/2^s of the full rate and yields one output per
+// two inputs: the decimator sums the ( taps + 1 )/2 taps that are not zero and the
+// centre tap, the interpolator computes one of each pair of outputs from ( taps + 1 )/2
+// taps and copies the other. The polyphase FIR takes DSP_MULTIRATE_PHASE_TAPS per
+// full-rate sample each way. This gives 1.3 biquads at M = 2, 1.55 at M = 4 and 1.74
+// at M = 16 (2.4 for the FIR); timed on the host against the per-channel biquad kernel
+// the stages take 1.0 to 1.4. Running N biquads at the reduced rate saves N*( 1 - 1/M ).
+//------------------------------------------------------------------------------------
+
+float dsp_multirate_cost( int decimation ) {
+
+  int       stages = dsp_multirate_stages( decimation );
+  int       taps;
+  float     macs = 0;
+
+  if( decimation <= 1 ) {
+    return( 0 );
+  }
+
+  if( stages == 0 ) {
+    macs = 2*DSP_MULTIRATE_PHASE_TAPS;
+  }
+  for( int stage = 0; stage < stages; ++stage ) {
+    taps = dsp_multirate_stage_taps( stages, stage );
+    macs += ( ( taps + 1 )/2 + 1 + ( taps + 1 )/2 )/(float) ( 2 << stage );
+  }
+
+  return( macs/DSP_MULTIRATE_BIQUAD_MACS );
+}
+
+
+//------------------------------------------------------------------------------------
+// Natural frequency of a biquad filter in Hz at DSP_SAMPLE_RATE: the frequency its poles
+// map to through the bilinear transform. 0 for a filter without poles.
+//------------------------------------------------------------------------------------
+
+float dsp_multirate_freq( const float* coeffs ) {
+
+  double    a1 = coeffs[3];
+  double    a2 = coeffs[4];
+
+  if( a1 == 0 && a2 == 0 ) {
+    return( 0 );
+  }
+
+  // tan( w/2 )^2 = ( 1 + a1 + a2 )/( 1 - a1 + a2 ), both positive for a stable filter
+  return( (float) ( 2*atan( sqrt( ( 1 + a1 + a2 )/( 1 - a1 + a2 ) ) )*DSP_SAMPLE_RATE/( 2*PI ) ) );
+}
+
+
+//------------------------------------------------------------------------------------
+// Redesign a biquad filter (b0, b1, b2, a1, a2 at DSP_SAMPLE_RATE) for the rate after
+// decimation. Filters without poles are prewarped at the passband edge; a plain gain
+// stays unchanged whatever the frequency.
+//------------------------------------------------------------------------------------
+
+void dsp_multirate_redesign( const float* coeffs, int decimation, float* redesigned ) {
+
+  double    b0 = coeffs[0];
+  double    b1 = coeffs[1];
+  double    b2 = coeffs[2];
+  double    a1 = coeffs[3];
+  double    a2 = coeffs[4];
+  double    freq = dsp_multirate_freq( coeffs );
+  double    w;
+  double    k1;
+  double    k2;
+  double    num[3];
+  double    den[3];
+  double    scale;
+
+  if( freq == 0 ) {
+    freq = dsp_multirate_passband( decimation );
+  }
+
+  w = 2*PI*freq/DSP_SAMPLE_RATE;
+  k1 = 1/tan( w/2 );
+  k2 = 1/tan( w*decimation/2 );
+
+  // Analog prototype: s^2, s and 1 terms of numerator and denominator, s = k1 ( z - 1 )/( z + 1 )
+  num[2] = b0 - b1 + b2;
+  num[1] = 2*k1*( b0 - b2 );
+  num[0] = k1*k1*( b0 + b1 + b2 );
+  den[2] = 1 - a1 + a2;
+  den[1] = 2*k1*( 1 - a2 );
+  den[0] = k1*k1*( 1 + a1 + a2 );
+
+  // Back to z at the low rate with s = k2 ( 1 - z^-1 )/( 1 + z^-1 )
+  scale = 1/( den[2]*k2*k2 + den[1]*k2 + den[0] );
+  redesigned[0] = (float) ( ( num[2]*k2*k2 + num[1]*k2 + num[0] )*scale );
+  redesigned[1] = (float) ( 2*( num[0] - num[2]*k2*k2 )*scale );
+  redesigned[2] = (float) ( ( num[2]*k2*k2 - num[1]*k2 + num[0] )*scale );
+  redesigned[3] = (float) ( 2*( den[0] - den[2]*k2*k2 )*scale );
+  redesigned[4] = (float) ( ( den[2]*k2*k2 - den[1]*k2 + den[0] )*scale );
+}
+
+
+//------------------------------------------------------------------------------------
+// Half-band stages. 'work' holds the stage history followed by its input; decimating,
+// output m is the filter output at the second input sample of pair m, interpolating,
+// input m gives outputs 2m (the odd taps) and 2m + 1 (the centre tap, a copy).
+//------------------------------------------------------------------------------------
+
+static void dsp_multirate_halfband_down( const float* work, int len, int taps, float* output ) {
+
+  float         x1, x3, x5, x7, x9, x11;
+
+  // The odd taps see the odd samples of the window, which moves on by one of them per
+  // output: each output loads that one and the centre sample
+  if( taps == DSP_MULTIRATE_HB_SHORT ) {
+    const float   k1 = dsp_multirate_hb_short[0];
+    const float   k3 = dsp_multirate_hb_short[1];
+
+    x1 = work[1];
+    x3 = work[3];
+    x5 = work[5];
+    for( int m = 0; m < len; ++m ) {
+      x7 = work[2*m + 7];
+      output[m] = 0.5f*work[2*m + 4] + k1*( x3 + x5 ) + k3*( x1 + x7 );
+      x1 = x3;
+      x3 = x5;
+      x5 = x7;
+    }
+  } else {
+    const float   k1 = dsp_multirate_hb_long[0];
+    const float   k3 = dsp_multirate_hb_long[1];
+    const float   k5 = dsp_multirate_hb_long[2];
+
+    x1 = work[1];
+    x3 = work[3];
+    x5 = work[5];
+    x7 = work[7];
+    x9 = work[9];
+    for( int m = 0; m < len; ++m ) {
+      x11 = work[2*m + 11];
+      output[m] = 0.5f*work[2*m + 6] + k1*( x5 + x7 ) + k3*( x3 + x9 ) + k5*( x1 + x11 );
+      x1 = x3;
+      x3 = x5;
+      x5 = x7;
+      x7 = x9;
+      x9 = x11;
+    }
+  }
+}
+
+static void dsp_multirate_halfband_up( const float* work, int len, int taps, float* output ) {
+
+  float         u0, u1, u2, u3, u4, u5;
+
+  // Scaled by 2 for the zeros left out. The window moves on by one input per input, so
+  // each loads only the new one.
+  if( taps == DSP_MULTIRATE_HB_SHORT ) {
+    const float   k1 = 2*dsp_multirate_hb_short[0];
+    const float   k3 = 2*dsp_multirate_hb_short[1];
+
+    u3 = work[0];
+    u2 = work[1];
+    u1 = work[2];
+    for( int m = 0; m < len; ++m ) {
+      u0 = work[m + 3];
+      output[2*m] = k1*( u1 + u2 ) + k3*( u0 + u3 );
+      output[2*m + 1] = u1;
+      u3 = u2;
+      u2 = u1;
+      u1 = u0;
+    }
+  } else {
+    const float   k1 = 2*dsp_multirate_hb_long[0];
+    const float   k3 = 2*dsp_multirate_hb_long[1];
+    const float   k5 = 2*dsp_multirate_hb_long[2];
+
+    u5 = work[0];
+    u4 = work[1];
+    u3 = work[2];
+    u2 = work[3];
+    u1 = work[4];
+    for( int m = 0; m < len; ++m ) {
+      u0 = work[m + 5];
+      output[2*m] = k1*( u2 + u3 ) + k3*( u1 + u4 ) + k5*( u0 + u5 );
+      output[2*m + 1] = u2;
+      u5 = u4;
+      u4 = u3;
+      u3 = u2;
+      u2 = u1;
+      u1 = u0;
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Low-pass filter and decimate 'len' samples (a multiple of the decimation factor) of a
+// channel in the interleaved buffer. 'work' holds len + taps - 1 floats.
+//------------------------------------------------------------------------------------
+
+void dsp_multirate_decimate( dsp_multirate_t* multirate, const sample_t* input, int stride, int len, float* work, float* output ) {
+
+  const int     decimation = multirate->decimation;
+  const int     taps = multirate->taps;
+  const float*  fir = multirate->fir;
+  const float*  x;
+  float         sum[4];
+  int           stage_taps;
+  int           t;
+
+  // Half-band stages: each one but the last leaves its output, half the length of its
+  // input, at the start of 'work' (behind the samples it reads), where the next one
+  // makes room for its history in front of it
+  if( multirate->stages > 0 ) {
+    for( int stage = 0; stage < multirate->stages; ++stage ) {
+      stage_taps = dsp_multirate_stage_taps( multirate->stages, stage );
+      if( stage == 0 ) {
+        for( int i = 0; i < len; ++i ) {
+          work[stage_taps - 1 + i] = input[i*stride];
+        }
+      } else {
+        memmove( &work[stage_taps - 1], work, len*sizeof( float ) );
+      }
+      memcpy( work, multirate->stage_decim_hist[stage], ( stage_taps - 1 )*sizeof( float ) );
+      dsp_multirate_halfband_down( work, len/2, stage_taps, stage == multirate->stages - 1 ? output : work );
+      memcpy( multirate->stage_decim_hist[stage], &work[len], ( stage_taps - 1 )*sizeof( float ) );
+      len /= 2;
+    }
+    return;
+  }
+
+  // History of the previous block in front of the new samples
+  memcpy( work, multirate->decim_hist, ( taps - 1 )*sizeof( float ) );
+  for( int i = 0; i < len; ++i ) {
+    work[taps - 1 + i] = input[i*stride];
+  }
+
+  // Output m is the filter output at the last input sample of group m. Four partial sums
+  // keep the multiply-adds from waiting on each other.
+  for( int m = 0; m < len/decimation; ++m ) {
+    x = &work[m*decimation + decimation - 1];
+    sum[0] = sum[1] = sum[2] = sum[3] = 0;
+    for( t = 0; t + 4 <= taps; t += 4 ) {
+      sum[0] += fir[t]*x[t];
+      sum[1] += fir[t + 1]*x[t + 1];
+      sum[2] += fir[t + 2]*x[t + 2];
+      sum[3] += fir[t + 3]*x[t + 3];
+    }
+    for( ; t < taps; ++t ) {
+      sum[0] += fir[t]*x[t];
+    }
+    output[m] = ( sum[0] + sum[1] ) + ( sum[2] + sum[3] );
+  }
+
+  memcpy( multirate->decim_hist, &work[len], ( taps - 1 )*sizeof( float ) );
+}
+
+
+//------------------------------------------------------------------------------------
+// Interpolate 'len' low-rate samples to len*decimation samples. 'work' holds
+// len*decimation + DSP_MULTIRATE_PHASE_TAPS - 1 floats (the half-band stages run
+// through it at up to half the full rate); input and output may be the same buffer.
+//------------------------------------------------------------------------------------
+
+void dsp_multirate_interpolate( dsp_multirate_t* multirate, const float* input, int len, float* work, float* output ) {
+
+  const int     decimation = multirate->decimation;
+  const float*  taps;
+  float*        out;
+  float         u;
+  int           stage_hist;
+
+  // Half-band stages from the lowest rate up, each doubling the length; the first one
+  // reads the input, the others the output of the one before
+  if( multirate->stages > 0 ) {
+    for( int stage = multirate->stages - 1; stage >= 0; --stage ) {
+      stage_hist = ( dsp_multirate_stage_taps( multirate->stages, stage ) - 1 )/2;
+      memcpy( work, multirate->stage_interp_hist[stage], stage_hist*sizeof( float ) );
+      memcpy( &work[stage_hist], stage == multirate->stages - 1 ? input : output, len*sizeof( float ) );
+      dsp_multirate_halfband_up( work, len, stage_hist*2 + 1, output );
+      memcpy( multirate->stage_interp_hist[stage], &work[len], stage_hist*sizeof( float ) );
+      len *= 2;
+    }
+    return;
+  }
+
+  memcpy( work, multirate->interp_hist, ( DSP_MULTIRATE_PHASE_TAPS - 1 )*sizeof( float ) );
+  memcpy( &work[DSP_MULTIRATE_PHASE_TAPS - 1], input, len*sizeof( float ) );
+
+  // All branches at once, tap by tap: the M outputs of a low-rate sample are independent sums
+  for( int m = 0; m < len; ++m ) {
+    out = &output[m*decimation];
+    u = work[m];
+    for( int p = 0; p < decimation; ++p ) {
+      out[p] = multirate->interp[p]*u;
+    }
+    for( int t = 1; t < DSP_MULTIRATE_PHASE_TAPS; ++t ) {
+      taps = &multirate->interp[t*decimation];
+      u = work[m + t];
+      for( int p = 0; p < decimation; ++p ) {
+        out[p] += taps[p]*u;
+      }
+    }
+  }
+
+  memcpy( multirate->interp_hist, &work[len], ( DSP_MULTIRATE_PHASE_TAPS - 1 )*sizeof( float ) );
+}
@@ -0,0 +1,76 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <rom/ets_sys.h>
+#include <xtensa/hal.h>
+#include <nvs.h>
+#include "dsp_os.h"
+
+#define DSP_OS_STORE_NAMESPACE  "dsp"           // NVS namespace of the records kept in flash
+
+//------------------------------------------------------------------------------------
+// FreeRTOS and NVS implementation of the OS abstraction (ESP32)
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_os_task_create( dsp_os_task_t task, const char* name, int stack_size, int priority, int core, void* arg ) {
+
+  BaseType_t  res;
+
+  res = xTaskCreatePinnedToCore( task, name, stack_size, arg, priority, NULL, core );
+
+  return( res == pdPASS ? ESP_OK : ESP_FAIL );
+}
+
+void dsp_os_task_exit() {
+  // FreeRTOS tasks must not return from their function
+  vTaskDelete( NULL );
+}
+
+int64_t dsp_os_time_us() {
+  return( esp_timer_get_time() );
+}
+
+// At least one tick, so that a short delay still lets lower priority tasks run
+void dsp_os_delay_ms( int millis ) {
+  vTaskDelay( millis > 0 && millis < portTICK_PERIOD_MS ? 1 : millis/portTICK_PERIOD_MS );
+}
+
+uint32_t dsp_os_cycles() {
+  return( xthal_get_ccount() );
+}
+
+uint32_t dsp_os_cycles_per_us() {
+  return( ets_get_cpu_frequency() );
+}
+
+// Records are NVS blobs in their own namespace (NVS is initialized by the Arduino core at start-up)
+esp_err_t dsp_os_store_read( const char* key, void* data, size_t* len ) {
+
+  nvs_handle  handle;
+  esp_err_t   res;
+
+  res = nvs_open( DSP_OS_STORE_NAMESPACE, NVS_READONLY, &handle );
+  if( res == ESP_OK ) {
+    res = nvs_get_blob( handle, key, data, len );
+    nvs_close( handle );
+  }
+
+  return( res == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_NOT_FOUND : res );
+}
+
+esp_err_t dsp_os_store_write( const char* key, const void* data, size_t len ) {
+
+  nvs_handle  handle;
+  esp_err_t   res;
+
+  res = nvs_open( DSP_OS_STORE_NAMESPACE, NVS_READWRITE, &handle );
+  if( res == ESP_OK ) {
+    res = nvs_set_blob( handle, key, data, len );
+    if( res == ESP_OK ) {
+      res = nvs_commit( handle );
+    }
+    nvs_close( handle );
+  }
+
+  return( res );
+}
@@ -0,0 +1,27 @@
+#ifndef _DSP_OS_H
+#define _DSP_OS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+//------------------------------------------------------------------------------------
+// Minimal OS abstraction used by the audio task and the preset bank. dsp_os.cpp
+// implements it on FreeRTOS and NVS for the ESP32; host/dsp_os_host.cpp implements it
+// with pthreads and files for Linux.
+//------------------------------------------------------------------------------------
+
+typedef void (*dsp_os_task_t)( void* arg );
+
+esp_err_t   dsp_os_task_create( dsp_os_task_t task, const char* name, int stack_size, int priority, int core, void* arg );
+void        dsp_os_task_exit();
+int64_t     dsp_os_time_us();
+void        dsp_os_delay_ms( int millis );
+uint32_t    dsp_os_cycles();                     // Free running cycle counter (wraps around)
+uint32_t    dsp_os_cycles_per_us();
+esp_err_t   dsp_os_store_read( const char* key, void* data, size_t* len );
+                                                 // Read a record kept in flash (*len: buffer size in, record length out)
+esp_err_t   dsp_os_store_write( const char* key, const void* data, size_t len );
+                                                 // Write a record to flash, replacing the one with that key
+
+#endif
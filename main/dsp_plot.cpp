@@ -1,12 +1,11 @@
 #include "dsp_process.h"
+#include "dsp_os.h"
 
-#define     FREQ_RANGE_LOW      20.0
-#define     FREQ_RANGE_HIGH     200.0
+#define     MAX_LABEL_WIDTH     ((int) (log10( DSP_PLOT_HIGH_HZ ) + 1))
+#define     CHART_WIDTH         DSP_PLOT_BANDS
 #define     CHART_DB_LOW        -30
 #define     CHART_DB_HIGH        +10
-#define     MAX_LABEL_WIDTH     ((int) (log10( FREQ_RANGE_HIGH ) + 1))
-#define     CHART_WIDTH         181
-#define     CHART_HEIGHT        20
+#define     CHART_HEIGHT        DSP_PLOT_CHART_HEIGHT
 #define     ROW_SCALING         ((float) (CHART_DB_HIGH - CHART_DB_LOW)/CHART_HEIGHT)
 #define     ROW_TICK            5
 #define     COL_TICK            10
@@ -15,82 +14,269 @@
 #define     LINE_MARKER         'O'
 #define     LINE_BAR            '|'
 
-static      float               ch_freq[ CHART_WIDTH ];
-static      float               ch_gain[ CHART_WIDTH ];
-static      int                 line_plot[ CHART_WIDTH ];
+#define     CHART_LINES         ( CHART_HEIGHT + 6 )   // Title, chart rows, frequency, phase and delay labels, blank line
+#define     NUM_PLOTS           ( DSP_NUM_CHANNELS + 1 ) // Each channel, then their sum
+#define     PLOT_GAIN           0                      // Response of a stage or a plot: gain in dB,
+#define     PLOT_PHASE          1                      // phase in radians (not wrapped)
+#define     PLOT_DELAY          2                      // group delay in samples
+#define     PLOT_SLOPE          3                      // and d ln|H|/dw, for the group delay of the sum
+#define     PLOT_VALUES         4
+
+#define     STATE_IDLE          0
+#define     STATE_COMPUTE       1
+#define     STATE_RENDER        2
+
+typedef struct dsp_plot_t {
+  float     freq[ CHART_WIDTH ];                     // Band table, computed once
+  float     w[ CHART_WIDTH ];                        // 2 pi freq/DSP_SAMPLE_RATE
+  float     u[ CHART_WIDTH ];                        // 1 - cos( w ), computed without cancellation
+  float     s[ CHART_WIDTH ];                        // sin( w )
+  float     s2[ CHART_WIDTH ];                       // sin( w )^2
+  bool      valid[ DSP_NUM_CHANNELS ][ DSP_MAX_FILTERS ];                  // The stage cache matches the coefficients below
+  float     coeffs[ DSP_NUM_CHANNELS ][ DSP_MAX_FILTERS ][ 5 ];            // Coefficients each stage was computed for
+  float     stage[ DSP_NUM_CHANNELS ][ DSP_MAX_FILTERS ][ PLOT_VALUES ][ CHART_WIDTH ];  // Response of each stage (see PLOT_...)
+  float     total[ NUM_PLOTS ][ PLOT_VALUES ][ CHART_WIDTH ];  // Response of each channel with its gain and delay, and of their sum
+  int       state;                                   // Job: STATE_...
+  int       format;                                  // DSP_PLOT_CHART or DSP_PLOT_CSV
+  int       plot;                                    // Channel computed or plot rendered (DSP_NUM_CHANNELS = the sum)
+  int       step;                                    // Stage computed or line rendered within it
+  int       stages_computed;                         // Stages that were not cached in the current job
+  int       line_plot[ CHART_WIDTH ];                // Chart row of each column of the plot being rendered
+} dsp_plot_t;
+
+static      dsp_plot_t*         dsp_plot_job = NULL; // Allocated by the first plot and kept for its caches
 
 
 //------------------------------------------------------------------------------------
-// Calculate values for transfer function plot
+// Response of one biquad at each band. B( z ) and A( z ) and their sums k*b[k]*z^-k are
+// evaluated around w = 0 from 1 - cos( w ) and sin( w ), so the low bands keep their
+// precision in float when the zeros and poles sit close to z = 1.
 //------------------------------------------------------------------------------------
 
-static void dsp_xfer_func( dsp_channel_t* chan, float freq_range_low, float freq_range_high, int freq_range_bands, int sample_rate, float* frequency, float* gain ) {
+static void dsp_plot_stage( const dsp_plot_t* plot, const float* coeffs, float response[][ CHART_WIDTH ] ) {
+
+  float     b0 = coeffs[ 0 ];
+  float     b1 = coeffs[ 1 ];
+  float     b2 = coeffs[ 2 ];
+  float     a1 = coeffs[ 3 ];
+  float     a2 = coeffs[ 4 ];
+  float     b_sum = b0 + b1 + b2;
+  float     a_sum = 1 + a1 + a2;
+  float     b_re, b_im, b_norm, bd_re, bd_im;
+  float     a_re, a_im, a_norm, ad_re, ad_im;
+  float     u, s, s2;
+
+  for( int band = 0; band < CHART_WIDTH; ++ band ) {
+    u = plot->u[ band ];
+    s = plot->s[ band ];
+    s2 = plot->s2[ band ];
+
+    b_re = b_sum - b1*u - 2*b2*s2;
+    b_im = -s*( b1 + 2*b2 - 2*b2*u );
+    bd_re = ( b1 + 2*b2 ) - b1*u - 4*b2*s2;
+    bd_im = -s*( b1 + 4*b2 - 4*b2*u );
+    a_re = a_sum - a1*u - 2*a2*s2;
+    a_im = -s*( a1 + 2*a2 - 2*a2*u );
+    ad_re = ( a1 + 2*a2 ) - a1*u - 4*a2*s2;
+    ad_im = -s*( a1 + 4*a2 - 4*a2*u );
+
+    b_norm = b_re*b_re + b_im*b_im + 1e-30f;
+    a_norm = a_re*a_re + a_im*a_im + 1e-30f;
+
+    // With D = sum k*p[k]*e^-jkw, the group delay of a polynomial P is Re( D/P ) and d ln|P|/dw is Im( D/P )
+    response[ PLOT_GAIN ][ band ] = 10*log10f( b_norm/a_norm );
+    response[ PLOT_PHASE ][ band ] = atan2f( b_im, b_re ) - atan2f( a_im, a_re );
+    response[ PLOT_DELAY ][ band ] = ( bd_re*b_re + bd_im*b_im )/b_norm - ( ad_re*a_re + ad_im*a_im )/a_norm;
+    response[ PLOT_SLOPE ][ band ] = ( bd_im*b_re - bd_re*b_im )/b_norm - ( ad_im*a_re - ad_re*a_im )/a_norm;
+  }
+}
 
-  float     freq_interval;
-  float     freq;
-  float     w;
-  float     phi[ freq_range_bands ];
-  double    coeffs[ 5 ];
-  int       band;
-  int       filter;
 
-  // Calculate interval based on the passed range
-  freq_interval = exp( log( freq_range_high/freq_range_low )/( freq_range_bands - 1 ) );
+//------------------------------------------------------------------------------------
+// Response of a channel from its stages, with its gain and its delay (including the
+// resampling delay of the multirate path; the FIR filter is not included)
+//------------------------------------------------------------------------------------
+
+static void dsp_plot_channel( dsp_plot_t* plot, const dsp_channel_t* chan, int chan_id ) {
 
-  for( band = 0; band < freq_range_bands; ++ band ) {
+  float*    total = plot->total[ chan_id ][ 0 ];
+  float     delay = chan->delay_millis*DSP_SAMPLE_RATE/1000 + dsp_multirate_delay( chan->decimation );
 
-    // Calculate band frequency
-    freq = freq_range_low*pow( freq_interval, band );
-    frequency[ band ] = freq;
+  for( int band = 0; band < CHART_WIDTH; ++ band ) {
+    plot->total[ chan_id ][ PLOT_GAIN ][ band ] = chan->gain_dB;
+    plot->total[ chan_id ][ PLOT_PHASE ][ band ] = -plot->w[ band ]*delay;
+    plot->total[ chan_id ][ PLOT_DELAY ][ band ] = delay;
+    plot->total[ chan_id ][ PLOT_SLOPE ][ band ] = 0;
+  }
 
-    // Calculate w value for the band
-    w = 2*PI*freq/sample_rate;
+  for( int filter = 0; filter < chan->num_filters; ++ filter ) {
+    const float*  stage = plot->stage[ chan_id ][ filter ][ 0 ];
 
-    // Calculate and save phi value for the band
-    phi[ band ] = 4*pow( sin( w/2 ),2 );
+    for( int i = 0; i < PLOT_VALUES*CHART_WIDTH; ++ i ) {
+      total[ i ] += stage[ i ];
+    }
   }
+}
 
-  // Calculate the dB value for each band by calculating for each filter
-  for( band = 0; band < freq_range_bands; ++ band ) {
-    gain[ band ] = 0.0;
 
-    for( filter=0; filter < chan->num_filters; ++ filter ) {
+//------------------------------------------------------------------------------------
+// Response of the channels played together. The group delay of the sum comes from the
+// derivative of each channel's response, dH/dw = H*( d ln|H|/dw - j delay ).
+//------------------------------------------------------------------------------------
 
-      for( int i = 0; i < 5; ++ i ) {
-        coeffs[ i ] = chan->coeffs[ filter ][ i ];
-      }
+static void dsp_plot_sum( dsp_plot_t* plot ) {
+
+  float     re, im, d_re, d_im;
+  float     mag, slope, cos_phi, sin_phi;
+
+  for( int band = 0; band < CHART_WIDTH; ++ band ) {
+    re = im = d_re = d_im = 0;
+
+    for( int chan_id = 0; chan_id < DSP_NUM_CHANNELS; ++ chan_id ) {
+      const float ( *total )[ CHART_WIDTH ] = plot->total[ chan_id ];
+
+      mag = powf( 10, total[ PLOT_GAIN ][ band ]/20 );
+      slope = total[ PLOT_SLOPE ][ band ];
+      cos_phi = mag*cosf( total[ PLOT_PHASE ][ band ] );
+      sin_phi = mag*sinf( total[ PLOT_PHASE ][ band ] );
 
-      gain[ band ] +=
-        10*log10(pow(coeffs[0]+coeffs[1]+coeffs[2],2)+(coeffs[0]*coeffs[2]*phi[band]-(coeffs[1]*(coeffs[0]+coeffs[2])+4*coeffs[0]*coeffs[2]))*phi[band]) -
-        10*log10(pow(1+coeffs[3]+coeffs[4],2)+(coeffs[4]*phi[band]-(coeffs[3]*(1+coeffs[4])+4*coeffs[4]))*phi[band]);
+      re += cos_phi;
+      im += sin_phi;
+      d_re += slope*cos_phi + total[ PLOT_DELAY ][ band ]*sin_phi;
+      d_im += slope*sin_phi - total[ PLOT_DELAY ][ band ]*cos_phi;
     }
+
+    mag = re*re + im*im + 1e-30f;
+    plot->total[ DSP_NUM_CHANNELS ][ PLOT_GAIN ][ band ] = 10*log10f( mag );
+    plot->total[ DSP_NUM_CHANNELS ][ PLOT_PHASE ][ band ] = atan2f( im, re );
+    plot->total[ DSP_NUM_CHANNELS ][ PLOT_DELAY ][ band ] = -( d_im*re - d_re*im )/mag;
   }
 }
 
 
 //------------------------------------------------------------------------------------
-// Plot the transfer curve for each channel to the serial output
+// Compute step: check one stage of a channel and recompute it if its coefficients
+// changed since it was cached, or add up the channel once all its stages are ready
 //------------------------------------------------------------------------------------
 
-esp_err_t dsp_plot( dsp_channel_t* channels ) {
+static void dsp_plot_compute( dsp_plot_t* plot, dsp_channel_t* channels ) {
+
+  dsp_channel_t*  chan;
+  int             filter = plot->step;
+
+  if( plot->plot == DSP_NUM_CHANNELS ) {
+    dsp_plot_sum( plot );
+    plot->state = STATE_RENDER;
+    plot->plot = 0;
+    plot->step = 0;
+    return;
+  }
+
+  chan = &channels[ plot->plot ];
+  if( filter < chan->num_filters ) {
+    if( !plot->valid[ plot->plot ][ filter ] || memcmp( plot->coeffs[ plot->plot ][ filter ], chan->coeffs[ filter ], sizeof( chan->coeffs[ 0 ] ) ) != 0 ) {
+      memcpy( plot->coeffs[ plot->plot ][ filter ], chan->coeffs[ filter ], sizeof( chan->coeffs[ 0 ] ) );
+      dsp_plot_stage( plot, chan->coeffs[ filter ], plot->stage[ plot->plot ][ filter ] );
+      plot->valid[ plot->plot ][ filter ] = true;
+      ++ plot->stages_computed;
+    }
+    ++ plot->step;
+  } else {
+    dsp_plot_channel( plot, chan, plot->plot );
+    ++ plot->plot;
+    plot->step = 0;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Place a value at each tick column of a label line, rounded to a resolution (so that
+// no "-0" is printed). text_line holds DSP_PLOT_LINE_LEN characters.
+//------------------------------------------------------------------------------------
+
+void dsp_plot_chart_labels( char* text_line, const float* values, float scale, float resolution, const char* format ) {
+
+  char      label[ 16 ];
+  float     value;
+  int       len;
+  int       pos;
+
+  memset( text_line, ' ', CHART_WIDTH + MAX_LABEL_WIDTH );
+  text_line[ CHART_WIDTH + MAX_LABEL_WIDTH ] = '\0';
+
+  for( int col = 0; col < CHART_WIDTH; col += COL_TICK ) {
+    value = roundf( values[ col ]*scale/resolution )*resolution + 0.0f;
+    len = snprintf( label, sizeof( label ), format, value );
+    pos = col == 0 ? 0 : col - len/2;
+    if( pos + len <= CHART_WIDTH + MAX_LABEL_WIDTH ) {
+      memcpy( text_line + pos, label, len );
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Draw a row of a chart (0 to CHART_HEIGHT) into text_line: the grid, and a marker in
+// each column whose value falls on the row, joined to the next column's. line_plot
+// holds the row of each column's value.
+//------------------------------------------------------------------------------------
+
+void dsp_plot_chart_row( char* text_line, const int* line_plot, int row ) {
 
-  int       row;
-  int       col;
   int       first_row;
   int       last_row;
-  float     dB_value;
-  int       point;
-  char      text_line[ CHART_WIDTH + MAX_LABEL_WIDTH + 1 ];
-  char      freq_text[ MAX_LABEL_WIDTH + 1];
 
-  for( int chan_id = 0; chan_id < DSP_NUM_CHANNELS; ++ chan_id ) {
+  // Blank out the line
+  if( ( ( row % ROW_TICK ) == 0 ) || ( row == CHART_HEIGHT ) ) {
+    memset( text_line, LINE_DASH, CHART_WIDTH );
+  } else {
+    memset( text_line, ' ', CHART_WIDTH );
+  }
+  text_line[ CHART_WIDTH ] = '\0';
+
+  for( int col = 0; col < CHART_WIDTH; ++ col ) {
+    if( ( col == 0 ) || ( col == CHART_WIDTH - 1 ) ) {
+      text_line[ col ] = LINE_BAR;
+    } else if( ( ( col % COL_TICK ) == 0 ) && ( ( row % ROW_TICK ) == 0 ) ) {
+      text_line[ col ] = LINE_CROSS;
+    }
+
+    first_row = line_plot[ col ];
 
-    dsp_xfer_func( &channels[ chan_id ], FREQ_RANGE_LOW, FREQ_RANGE_HIGH, CHART_WIDTH, DSP_SAMPLE_RATE, ch_freq, ch_gain );
+    if( row == first_row ) {
+      text_line[ col ] = LINE_MARKER;
+    } else if( col != CHART_WIDTH - 1 ) {
+      last_row = line_plot[ col + 1 ];
+      if( ( row - first_row )*( last_row - row ) > 0 ) {
+        if( abs( row - first_row ) <= abs( row - last_row ) ) {
+          text_line[ col ] = LINE_MARKER;
+        } else {
+          text_line[ col + 1 ] = LINE_MARKER;
+        }
+      }
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Render step: print one line of the ASCII chart of a plot
+//------------------------------------------------------------------------------------
+
+static void dsp_plot_chart_line( dsp_plot_t* plot, dsp_channel_t* channels ) {
+
+  const float ( *total )[ CHART_WIDTH ] = plot->total[ plot->plot ];
+  int       row = plot->step - 1;
+  int       col;
+  float     dB_value;
+  float     phase[ CHART_WIDTH ];
+  char      text_line[ DSP_PLOT_LINE_LEN ];
 
+  if( plot->step == 0 ) {
     for( col = 0; col < CHART_WIDTH; ++ col ) {
 
       // Convert y value to display range
-      dB_value = ch_gain[ col ] + channels[ chan_id ].gain_dB;
+      dB_value = total[ PLOT_GAIN ][ col ];
 
       if( dB_value < CHART_DB_LOW ) {
         dB_value = CHART_DB_LOW;
@@ -98,69 +284,156 @@ esp_err_t dsp_plot( dsp_channel_t* channels ) {
         dB_value = CHART_DB_HIGH;
       }
 
-      row = (round( -dB_value ) + CHART_DB_HIGH)/ROW_SCALING;
+      plot->line_plot[ col ] = (round( -dB_value ) + CHART_DB_HIGH)/ROW_SCALING;
+    }
 
-      line_plot[col] = row;
+    if( plot->plot < DSP_NUM_CHANNELS ) {
+      SERIAL.printf( "Channel: %s%s\r\n", channels[ plot->plot ].name, channels[ plot->plot ].fir_taps > 0 ? " (FIR filter not shown)" : "" );
+    } else {
+      SERIAL.printf( "Sum of all channels\r\n" );
     }
 
-    dB_value = CHART_DB_HIGH;
-    text_line[ CHART_WIDTH ] = '\0';
+  } else if( row <= CHART_HEIGHT ) {
+    dsp_plot_chart_row( text_line, plot->line_plot, row );
+    SERIAL.printf( "%+5.1f %s\r\n", CHART_DB_HIGH - row*ROW_SCALING, text_line );
 
-    SERIAL.printf( "Channel: %s\r\n", channels[ chan_id ].name );
-    for( row = 0; row <= CHART_HEIGHT; ++ row ) {
-      // Blank out the line
-      if( ( ( row % ROW_TICK ) == 0 ) || ( row == CHART_HEIGHT ) ) {
-        memset( text_line, LINE_DASH, CHART_WIDTH );
-      } else {
-        memset( text_line, ' ', CHART_WIDTH );
-      }
+  } else if( row == CHART_HEIGHT + 1 ) {
+    dsp_plot_chart_labels( text_line, plot->freq, 1, 1, "%.0f" );
+    SERIAL.printf( "   Hz %s\r\n", text_line );
 
-      for( col = 0; col < CHART_WIDTH; ++ col ) {
-        if( ( col == 0 ) || ( col == CHART_WIDTH - 1 ) ) {
-          text_line[ col ] = LINE_BAR;
-        } else if( ( ( col % COL_TICK ) == 0 ) && ( ( row % ROW_TICK ) == 0 ) ) {
-          text_line[ col ] = LINE_CROSS;
-        }
+  } else if( row == CHART_HEIGHT + 2 ) {
+    for( col = 0; col < CHART_WIDTH; ++ col ) {
+      phase[ col ] = remainderf( total[ PLOT_PHASE ][ col ], 2*PI );
+    }
+    dsp_plot_chart_labels( text_line, phase, 180/PI, 1, "%+.0f" );
+    SERIAL.printf( "  deg %s\r\n", text_line );
 
-        first_row = line_plot[ col ];
+  } else if( row == CHART_HEIGHT + 3 ) {
+    dsp_plot_chart_labels( text_line, total[ PLOT_DELAY ], 1000.0f/DSP_SAMPLE_RATE, 0.1f, "%.1f" );
+    SERIAL.printf( "   ms %s\r\n", text_line );
 
-        if( row == first_row ) {
-          text_line[ col ] = LINE_MARKER;
-        } else if( col != CHART_WIDTH - 1 ) {
-          last_row = line_plot[ col + 1 ];
-          if( ( row - first_row )*( last_row - row ) > 0 ) {
-            if( abs( row - first_row ) <= abs( row - last_row ) ) {
-              text_line[ col ] = LINE_MARKER;
-            } else {
-              text_line[ col + 1 ] = LINE_MARKER;
-            }
-          }
-        }
-      }
+  } else {
+    SERIAL.println();
+  }
 
-      SERIAL.printf( "%+5.1f %s\r\n", dB_value, text_line );
-      dB_value -= ROW_SCALING;
-    }
+  if( ++ plot->step == CHART_LINES ) {
+    ++ plot->plot;
+    plot->step = 0;
+  }
+}
 
-    memset( text_line, ' ', CHART_WIDTH + MAX_LABEL_WIDTH );
-    text_line[ CHART_WIDTH + MAX_LABEL_WIDTH ] = '\0';
 
-    for( col = 0; col < CHART_WIDTH; ++ col ) {
-      if( ( col % COL_TICK ) == 0 ) {
-          // Place the frequency value into the text line
-          sprintf( freq_text, "%d", (int) ( ch_freq[ col ] + 0.5 ) );
-
-          if( col == 0 ) {
-            memcpy( text_line, freq_text, strlen( freq_text ) );
-          } else {
-            memcpy( text_line + col - strlen( freq_text )/2, freq_text, strlen( freq_text ) );
-          }
-      }
+//------------------------------------------------------------------------------------
+// Render step: print one line of the CSV output (a header, then one line per band)
+//------------------------------------------------------------------------------------
+
+static void dsp_plot_csv_line( dsp_plot_t* plot, dsp_channel_t* channels ) {
+
+  const float ( *total )[ CHART_WIDTH ] = plot->total[ plot->plot ];
+  int       band = plot->step - 1;
+
+  if( plot->plot == 0 && plot->step == 0 ) {
+    SERIAL.printf( "channel,freq_hz,gain_db,phase_deg,group_delay_ms\r\n" );
+  } else if( band >= 0 ) {
+    SERIAL.printf( "%s,%.2f,%.2f,%.1f,%.3f\r\n", plot->plot < DSP_NUM_CHANNELS ? channels[ plot->plot ].name : "sum", plot->freq[ band ],
+      total[ PLOT_GAIN ][ band ], remainderf( total[ PLOT_PHASE ][ band ], 2*PI )*180/PI, total[ PLOT_DELAY ][ band ]*1000/DSP_SAMPLE_RATE );
+  }
+
+  if( ++ plot->step == CHART_WIDTH + 1 ) {
+    ++ plot->plot;
+    plot->step = 1;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Start plotting the response of each channel and of their sum: as an ASCII chart of
+// the gain with the phase and group delay at the tick frequencies, or as CSV lines.
+// The work is done by dsp_plot_poll() a slice at a time.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_plot_start( dsp_channel_t* channels, int format ) {
+
+  dsp_plot_t*   plot = dsp_plot_job;
+  double        w;
+
+  if( plot == NULL ) {
+    plot = (dsp_plot_t*) calloc( 1, sizeof( dsp_plot_t ) );
+    if( plot == NULL ) {
+      SERIAL.printf( "E-DSP: Unable to allocate %d bytes for the plot\r\n", (int) sizeof( dsp_plot_t ) );
+      return( ESP_FAIL );
     }
-    SERIAL.printf( "      %s\r\n", text_line );
 
-    SERIAL.println();
+    // Log-spaced bands, computed once in double
+    for( int band = 0; band < CHART_WIDTH; ++ band ) {
+      plot->freq[ band ] = DSP_PLOT_LOW_HZ*pow( DSP_PLOT_HIGH_HZ/DSP_PLOT_LOW_HZ, (double) band/( CHART_WIDTH - 1 ) );
+      w = 2*PI*plot->freq[ band ]/DSP_SAMPLE_RATE;
+      plot->w[ band ] = w;
+      plot->u[ band ] = 2*pow( sin( w/2 ), 2 );
+      plot->s[ band ] = sin( w );
+      plot->s2[ band ] = pow( sin( w ), 2 );
+    }
+    dsp_plot_job = plot;
   }
 
+  if( plot->state != STATE_IDLE ) {
+    SERIAL.printf( "E-DSP: A plot is already being printed\r\n" );
+    return( ESP_ERR_INVALID_ARG );
+  }
+
+  plot->format = format;
+  plot->plot = 0;
+  plot->step = 0;
+  plot->stages_computed = 0;
+  plot->state = STATE_COMPUTE;
+
   return( ESP_OK );
 }
+
+
+//------------------------------------------------------------------------------------
+// Carry on with a plot until the time budget is spent; at least one step (a stage
+// computed or a line printed) is taken per call. Returns true while there is more.
+//------------------------------------------------------------------------------------
+
+bool dsp_plot_poll( dsp_channel_t* channels, int budget_us ) {
+
+  dsp_plot_t*   plot = dsp_plot_job;
+  int64_t       start_us;
+
+  if( plot == NULL || plot->state == STATE_IDLE ) {
+    return( false );
+  }
+
+  start_us = dsp_os_time_us();
+  do {
+    if( plot->state == STATE_COMPUTE ) {
+      dsp_plot_compute( plot, channels );
+    } else if( plot->format == DSP_PLOT_CSV ) {
+      dsp_plot_csv_line( plot, channels );
+    } else {
+      dsp_plot_chart_line( plot, channels );
+    }
+
+    if( plot->state == STATE_RENDER && plot->plot == NUM_PLOTS ) {
+      plot->state = STATE_IDLE;
+      return( false );
+    }
+  } while( dsp_os_time_us() - start_us < budget_us );
+
+  return( true );
+}
+
+
+//------------------------------------------------------------------------------------
+// Stages that had to be computed for the last plot (the others came from the cache),
+// and the RAM the first plot allocates
+//------------------------------------------------------------------------------------
+
+int dsp_plot_stages_computed() {
+  return( dsp_plot_job != NULL ? dsp_plot_job->stages_computed : 0 );
+}
+
+int dsp_plot_memory() {
+  return( (int) sizeof( dsp_plot_t ) );
+}
@@ -0,0 +1,352 @@
+#include "dsp_process.h"
+#include "dsp_os.h"
+
+//------------------------------------------------------------------------------------
+// Preset bank
+//
+// A preset is a complete tuning of the channels: filters, gain, delay and input mix
+// (decimation and FIR filters stay as configured in dsp_config.h). Each is kept in
+// flash as a compact record under its own key, with the filters in use only:
+//
+//   uint32  DSP_PRESET_MAGIC
+//   uint8   DSP_PRESET_VERSION
+//   uint8   DSP_NUM_CHANNELS
+//   uint16  record length in bytes
+//   uint32  CRC-32 of the rest of the record
+//   char    name[DSP_PRESET_NAME_LEN], zero terminated
+//   per channel:
+//     float  gain_dB, delay_millis, mix[DSP_NUM_CHANNELS]
+//     uint8  num_filters
+//     float  coeffs[num_filters][5]
+//
+// All presets are read, checked with dsp_filter_validate() and prepared as ready
+// parameter snapshots, with their delay buffers, when the bank is loaded. A switch then
+// only copies the configs and publishes the snapshots: nothing is checked, designed or
+// allocated, and the audio task swaps them in at the start of its next block. The
+// preset switched to last is recorded in flash and switched to again at boot.
+//------------------------------------------------------------------------------------
+
+#define DSP_PRESET_LAST_KEY     "last"           // Key of the record holding the preset used last
+
+
+//------------------------------------------------------------------------------------
+// CRC-32 (IEEE 802.3) of a record, bit by bit: records are short and rarely checked
+//------------------------------------------------------------------------------------
+
+static uint32_t dsp_preset_crc( const uint8_t* data, int len ) {
+
+  uint32_t    crc = 0xFFFFFFFF;
+
+  for( int i = 0; i < len; ++i ) {
+    crc ^= data[i];
+    for( int bit = 0; bit < 8; ++bit ) {
+      crc = ( crc >> 1 ) ^ ( 0xEDB88320 & -( crc & 1 ) );
+    }
+  }
+
+  return( ~crc );
+}
+
+
+//------------------------------------------------------------------------------------
+// Write a record for the channel settings to 'record' (DSP_PRESET_MAX_LEN bytes) and
+// return its length
+//------------------------------------------------------------------------------------
+
+int dsp_preset_pack( const char* name, const dsp_channel_t* channels, uint8_t* record ) {
+
+  uint8_t*    p = record + DSP_PRESET_HEADER_LEN;
+  uint32_t    magic = DSP_PRESET_MAGIC;
+  uint32_t    crc;
+  uint16_t    len;
+  uint8_t     num_filters;
+
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    num_filters = (uint8_t) channels[channel_id].num_filters;
+    memcpy( p, &channels[channel_id].gain_dB, sizeof( float ) );
+    memcpy( p + 4, &channels[channel_id].delay_millis, sizeof( float ) );
+    memcpy( p + 8, channels[channel_id].mix, sizeof( channels[channel_id].mix ) );
+    p += 8 + sizeof( channels[channel_id].mix );
+    *p++ = num_filters;
+    memcpy( p, channels[channel_id].coeffs, num_filters*sizeof( channels[channel_id].coeffs[0] ) );
+    p += num_filters*sizeof( channels[channel_id].coeffs[0] );
+  }
+
+  len = (uint16_t) ( p - record );
+  memcpy( record, &magic, 4 );
+  record[4] = DSP_PRESET_VERSION;
+  record[5] = DSP_NUM_CHANNELS;
+  memcpy( record + 6, &len, 2 );
+  memset( record + 12, 0, DSP_PRESET_NAME_LEN );
+  strncpy( (char*) record + 12, name, DSP_PRESET_NAME_LEN - 1 );
+  crc = dsp_preset_crc( record + 12, len - 12 );
+  memcpy( record + 8, &crc, 4 );
+
+  return( len );
+}
+
+
+//------------------------------------------------------------------------------------
+// Read a record into the channel configs (only the preset's fields are changed).
+// Returns ESP_FAIL if the record is damaged or was written by another layout.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_preset_unpack( const uint8_t* record, int len, char* name, dsp_channel_t* channels ) {
+
+  const uint8_t*  p = record + DSP_PRESET_HEADER_LEN;
+  const uint8_t*  end = record + len;
+  uint32_t        magic;
+  uint32_t        crc;
+  uint16_t        record_len;
+  int             num_filters;
+
+  if( len < DSP_PRESET_HEADER_LEN ) {
+    return( ESP_FAIL );
+  }
+
+  memcpy( &magic, record, 4 );
+  memcpy( &record_len, record + 6, 2 );
+  memcpy( &crc, record + 8, 4 );
+  if( magic != DSP_PRESET_MAGIC || record[4] != DSP_PRESET_VERSION || record[5] != DSP_NUM_CHANNELS ||
+      record_len != len || crc != dsp_preset_crc( record + 12, len - 12 ) || record[12 + DSP_PRESET_NAME_LEN - 1] != 0 ) {
+    return( ESP_FAIL );
+  }
+
+  memcpy( name, record + 12, DSP_PRESET_NAME_LEN );
+
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    if( end - p < 9 + (int) sizeof( channels[channel_id].mix ) ) {
+      return( ESP_FAIL );
+    }
+    memcpy( &channels[channel_id].gain_dB, p, sizeof( float ) );
+    memcpy( &channels[channel_id].delay_millis, p + 4, sizeof( float ) );
+    memcpy( channels[channel_id].mix, p + 8, sizeof( channels[channel_id].mix ) );
+    p += 8 + sizeof( channels[channel_id].mix );
+    num_filters = *p++;
+    if( num_filters > DSP_MAX_FILTERS || end - p < num_filters*(int) sizeof( channels[channel_id].coeffs[0] ) ) {
+      return( ESP_FAIL );
+    }
+    channels[channel_id].num_filters = num_filters;
+    memcpy( channels[channel_id].coeffs, p, num_filters*sizeof( channels[channel_id].coeffs[0] ) );
+    p += num_filters*sizeof( channels[channel_id].coeffs[0] );
+  }
+
+  return( p == end ? ESP_OK : ESP_FAIL );
+}
+
+
+//------------------------------------------------------------------------------------
+// Check a record against the running channels and prepare it as a preset
+//------------------------------------------------------------------------------------
+
+static esp_err_t dsp_preset_prepare( dsp_preset_t* preset, dsp_channel_t* channels, const uint8_t* record, int len ) {
+
+  memcpy( preset->channels, channels, sizeof( preset->channels ) );
+  memset( preset->params, 0, sizeof( preset->params ) );
+  preset->used = false;
+
+  if( dsp_preset_unpack( record, len, preset->name, preset->channels ) != ESP_OK ) {
+    return( ESP_FAIL );
+  }
+
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    if( dsp_filter_validate( &preset->channels[channel_id] ) != ESP_OK ||
+        dsp_filter_prepare( &preset->channels[channel_id], &preset->params[channel_id] ) != ESP_OK ) {
+      for( int i = 0; i <= channel_id; ++i ) {
+        dsp_filter_unprepare( &channels[i], &preset->params[i] );
+      }
+      return( ESP_FAIL );
+    }
+  }
+
+  preset->used = true;
+
+  return( ESP_OK );
+}
+
+static void dsp_preset_release( dsp_preset_t* preset, dsp_channel_t* channels ) {
+
+  if( preset->used ) {
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      dsp_filter_unprepare( &channels[channel_id], &preset->params[channel_id] );
+    }
+    preset->used = false;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Read every preset from flash and prepare it, then switch to the one used last. Call
+// once the channels are set up by dsp_filter_init. A damaged or invalid preset is
+// reported and left out; the channels stay as configured if there is no preset to use.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_preset_load( dsp_preset_bank_t* bank, dsp_channel_t* channels ) {
+
+  uint8_t     record[DSP_PRESET_MAX_LEN];
+  char        key[16];
+  size_t      len;
+  uint8_t     last;
+  esp_err_t   res;
+
+  dsp_preset_free( bank, channels );
+
+  for( int preset_id = 0; preset_id < DSP_MAX_PRESETS; ++preset_id ) {
+    snprintf( key, sizeof( key ), "preset%d", preset_id );
+    len = sizeof( record );
+    res = dsp_os_store_read( key, record, &len );
+    if( res == ESP_ERR_NOT_FOUND ) {
+      continue;
+    }
+
+    if( res != ESP_OK || dsp_preset_prepare( &bank->presets[preset_id], channels, record, (int) len ) != ESP_OK ) {
+      SERIAL.printf( "E-DSP: Preset %d is damaged or invalid, left out\r\n", preset_id );
+    }
+  }
+
+  len = sizeof( last );
+  if( dsp_os_store_read( DSP_PRESET_LAST_KEY, &last, &len ) == ESP_OK && len == sizeof( last ) &&
+      last < DSP_MAX_PRESETS && bank->presets[last].used ) {
+    bank->stored = last;
+    return( dsp_preset_apply( bank, channels, last ) );
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Switch to a preset: the channels are published as one group, so the audio task swaps
+// them all in at the start of the same block (with the crossfade set by 'x', if any).
+// The choice is recorded in flash after the switch. Returns ESP_ERR_NOT_FOUND for an
+// empty slot.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_preset_apply( dsp_preset_bank_t* bank, dsp_channel_t* channels, int preset_id ) {
+
+  dsp_preset_t*   preset;
+  dsp_channel_t*  channel;
+  uint8_t         last = (uint8_t) preset_id;
+  esp_err_t       res = ESP_OK;
+
+  if( preset_id < 0 || preset_id >= DSP_MAX_PRESETS || !bank->presets[preset_id].used ) {
+    return( ESP_ERR_NOT_FOUND );
+  }
+
+  preset = &bank->presets[preset_id];
+  dsp_filter_publish_begin();
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    channel = &channels[channel_id];
+    channel->gain_dB = preset->channels[channel_id].gain_dB;
+    channel->delay_millis = preset->channels[channel_id].delay_millis;
+    channel->num_filters = preset->channels[channel_id].num_filters;
+    memcpy( channel->coeffs, preset->channels[channel_id].coeffs, sizeof( channel->coeffs ) );
+    memcpy( channel->mix, preset->channels[channel_id].mix, sizeof( channel->mix ) );
+    res |= dsp_filter_publish_params( channel, &preset->params[channel_id] );
+  }
+  dsp_filter_publish_end();
+
+  if( res != ESP_OK ) {
+    return( res );
+  }
+  bank->current = preset_id;
+
+  if( bank->stored != preset_id && dsp_os_store_write( DSP_PRESET_LAST_KEY, &last, sizeof( last ) ) == ESP_OK ) {
+    bank->stored = preset_id;
+  }
+
+  return( res );
+}
+
+
+//------------------------------------------------------------------------------------
+// Save the running channel settings as a preset (replacing the one in that slot)
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_preset_save( dsp_preset_bank_t* bank, dsp_channel_t* channels, int preset_id, const char* name ) {
+
+  static dsp_preset_t   preset;                 // Too large for the loop task's stack
+  uint8_t               record[DSP_PRESET_MAX_LEN];
+  uint8_t               last = (uint8_t) preset_id;
+  char                  key[16];
+  int                   len;
+
+  if( preset_id < 0 || preset_id >= DSP_MAX_PRESETS || name == NULL || name[0] == 0 || strlen( name ) >= DSP_PRESET_NAME_LEN ) {
+    SERIAL.printf( "E-DSP: Invalid preset %d (0 to %d, names of 1 to %d characters)\r\n", preset_id, DSP_MAX_PRESETS - 1,
+      DSP_PRESET_NAME_LEN - 1 );
+    return( ESP_ERR_INVALID_ARG );
+  }
+
+  len = dsp_preset_pack( name, channels, record );
+  if( dsp_preset_prepare( &preset, channels, record, len ) != ESP_OK ) {
+    SERIAL.printf( "E-DSP: The channel settings cannot be saved as a preset\r\n" );
+    return( ESP_FAIL );
+  }
+
+  snprintf( key, sizeof( key ), "preset%d", preset_id );
+  if( dsp_os_store_write( key, record, len ) != ESP_OK ) {
+    SERIAL.printf( "E-DSP: Unable to write preset %d to flash\r\n", preset_id );
+    dsp_preset_release( &preset, channels );
+    return( ESP_FAIL );
+  }
+
+  dsp_preset_release( &bank->presets[preset_id], channels );
+  bank->presets[preset_id] = preset;
+
+  // The channels run this preset now
+  bank->current = preset_id;
+  if( bank->stored != preset_id && dsp_os_store_write( DSP_PRESET_LAST_KEY, &last, sizeof( last ) ) == ESP_OK ) {
+    bank->stored = preset_id;
+  }
+
+  SERIAL.printf( "I-DSP: Saved preset %d '%s' (%d bytes)\r\n", preset_id, name, len );
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Release the prepared presets (their delay buffers go once the audio path lets go)
+//------------------------------------------------------------------------------------
+
+void dsp_preset_free( dsp_preset_bank_t* bank, dsp_channel_t* channels ) {
+
+  for( int preset_id = 0; preset_id < DSP_MAX_PRESETS; ++preset_id ) {
+    dsp_preset_release( &bank->presets[preset_id], channels );
+  }
+
+  bank->current = DSP_PRESET_NONE;
+  bank->stored = DSP_PRESET_NONE;
+}
+
+
+//------------------------------------------------------------------------------------
+// List the presets
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_preset_info( const dsp_preset_bank_t* bank ) {
+
+  const dsp_preset_t*   preset;
+  int                   used = 0;
+
+  for( int preset_id = 0; preset_id < DSP_MAX_PRESETS; ++preset_id ) {
+    used += bank->presets[preset_id].used ? 1 : 0;
+  }
+  SERIAL.printf( "I-DSP: Presets: %d of %d\r\n", used, DSP_MAX_PRESETS );
+
+  for( int preset_id = 0; preset_id < DSP_MAX_PRESETS; ++preset_id ) {
+    preset = &bank->presets[preset_id];
+    if( !preset->used ) {
+      continue;
+    }
+
+    SERIAL.printf( "I-DSP:   %d %-*s", preset_id, DSP_PRESET_NAME_LEN - 1, preset->name );
+    for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+      SERIAL.printf( "  %s: %d filters %+.1f dB %.2f ms", preset->channels[channel_id].name, preset->channels[channel_id].num_filters,
+        preset->channels[channel_id].gain_dB, preset->channels[channel_id].delay_millis );
+    }
+    SERIAL.printf( "%s\r\n", preset_id == bank->current ? "  (current)" : "" );
+  }
+
+  return( ESP_OK );
+}
@@ -7,37 +7,79 @@
 #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 #define I2S_NUM         I2S_NUM_0
 
-#define I2S_READLEN     DSP_MAX_SAMPLES*sizeof( sample_t )
-static  sample_t        i2s_buffer[DSP_MAX_SAMPLES];
+// One block is read, filtered and written per loop; each DMA buffer holds one block
+static  sample_t*       i2s_buffer           = NULL;
+static  int             i2s_block_frames     = DSP_BLOCK_FRAMES;
+static  int             i2s_dma_buf_count    = DSP_DMA_BUF_COUNT;
+
+static  esp_err_t       dsp_block_config( int block_frames, int dma_buf_count );
+static  esp_err_t       dsp_measure_start( int channel_id, double seconds, double ir_millis );
+static  esp_err_t       dsp_autoeq( int channel_id, int first );
+static  void            dsp_latency_info();
 
 #define I2C_NUM         I2C_NUM_0
-#define ES8388_ADDR     0x20
 
 static   const char*    TAG = "DSP_MAIN";    // Tag used in logging messages
-static  bool            dsp_filter_enabled   = true;
-static  bool            dsp_output_enabled   = true;
+static  volatile bool   dsp_filter_enabled   = true;
+static  volatile bool   dsp_output_enabled   = true;
+static  volatile bool   dsp_clip_detected    = false;  // Set by the audio task, cleared by dsp_loop
+static  dsp_measure_t*  dsp_measurement      = NULL;   // Measurement the audio task runs instead of the filters (atomic)
+static  dsp_measure_t*  dsp_measure_last     = NULL;   // Last measurement started, kept for its results
+static  uint32_t        dsp_measure_end_block = 0;     // Audio task block count when it was taken off the audio path
+static  dsp_preset_bank_t  dsp_presets;                // Preset bank, loaded from flash at start-up
 
 /*
  * ES8388 Configuration Code
- * Configure ES8388 audio codec over I2C for AUX IN input and headphone jack output
+ * The codec is configured for AUX IN input and headphone jack output from the register
+ * tables of dsp_codec.cpp, over the I2C driver below
  */
 
-static esp_err_t es_write_reg(uint8_t slave_add, uint8_t reg_add, uint8_t data)
+// Register writes, each a complete write message, joined by repeated starts into one transaction
+static esp_err_t es_i2c_write(uint8_t addr, const dsp_codec_reg_t* regs, int count)
 {
   esp_err_t res = ESP_OK;
 
   i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-  res |= i2c_master_start(cmd);
-  res |= i2c_master_write_byte(cmd, slave_add, 1 /*ACK_CHECK_EN*/);
-  res |= i2c_master_write_byte(cmd, reg_add, 1 /*ACK_CHECK_EN*/);
-  res |= i2c_master_write_byte(cmd, data, 1 /*ACK_CHECK_EN*/);
+  for( int i = 0; i < count; ++i ) {
+    res |= i2c_master_start(cmd);
+    res |= i2c_master_write_byte(cmd, addr, 1 /*ACK_CHECK_EN*/);
+    res |= i2c_master_write_byte(cmd, regs[i].reg, 1 /*ACK_CHECK_EN*/);
+    res |= i2c_master_write_byte(cmd, regs[i].value, 1 /*ACK_CHECK_EN*/);
+  }
   res |= i2c_master_stop(cmd);
-  res |= i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000 / portTICK_RATE_MS);
+  if( res == ESP_OK ) {
+    res = i2c_master_cmd_begin(I2C_NUM, cmd, 1000 / portTICK_RATE_MS);
+  }
+  i2c_cmd_link_delete(cmd);
+
+  return( res );
+}
+
+// Register reads (address written, repeated start, one byte read) joined into one transaction
+static esp_err_t es_i2c_read(uint8_t addr, const uint8_t* regs, uint8_t* values, int count)
+{
+  esp_err_t res = ESP_OK;
+
+  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+  for( int i = 0; i < count; ++i ) {
+    res |= i2c_master_start(cmd);
+    res |= i2c_master_write_byte(cmd, addr, 1 /*ACK_CHECK_EN*/);
+    res |= i2c_master_write_byte(cmd, regs[i], 1 /*ACK_CHECK_EN*/);
+    res |= i2c_master_start(cmd);
+    res |= i2c_master_write_byte(cmd, addr | 1, 1 /*ACK_CHECK_EN*/);
+    res |= i2c_master_read_byte(cmd, &values[i], I2C_MASTER_NACK);
+  }
+  res |= i2c_master_stop(cmd);
+  if( res == ESP_OK ) {
+    res = i2c_master_cmd_begin(I2C_NUM, cmd, 1000 / portTICK_RATE_MS);
+  }
   i2c_cmd_link_delete(cmd);
 
   return( res );
 }
 
+static const dsp_i2c_t es_i2c = { es_i2c_write, es_i2c_read };
+
 static esp_err_t es8388_init()
 {
   esp_err_t res = ESP_OK;
@@ -48,65 +90,18 @@ static esp_err_t es8388_init()
   i2c_config.sda_pullup_en = GPIO_PULLUP_ENABLE;
   i2c_config.scl_io_num = GPIO_NUM_23;
   i2c_config.scl_pullup_en = GPIO_PULLUP_ENABLE;
-  i2c_config.master.clk_speed = 100000;
+  i2c_config.master.clk_speed = DSP_CODEC_I2C_HZ;
 
   res |= i2c_param_config(I2C_NUM, &i2c_config);
   res |= i2c_driver_install(I2C_NUM, i2c_config.mode, 0, 0, 0);
+  if( res != ESP_OK ) {
+    return( res );
+  }
 
-  /* mute DAC during setup, power up all systems, slave mode */
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACCONTROL3, 0x04);
-  res |= es_write_reg(ES8388_ADDR, ES8388_CONTROL2, 0x50);
-  res |= es_write_reg(ES8388_ADDR, ES8388_CHIPPOWER, 0x00);
-  res |= es_write_reg(ES8388_ADDR, ES8388_MASTERMODE, 0x00);
-
-  /* power up DAC and enable only LOUT1 / ROUT1, ADC sample rate = DAC sample rate */
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACPOWER, 0x30);
-  res |= es_write_reg(ES8388_ADDR, ES8388_CONTROL1, 0x12);
-
-  /* DAC I2S setup: 16 bit word length, I2S format; MCLK / Fs = 256*/
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACCONTROL1, 0x18);
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACCONTROL2, 0x02);
-
-  /* DAC to output route mixer configuration */
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACCONTROL16, 0x00);
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACCONTROL17, 0x90);
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACCONTROL20, 0x90);
-
-  /* DAC and ADC use same LRCK, enable MCLK input; output resistance setup */
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACCONTROL21, 0x80);
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACCONTROL23, 0x00);
-
-  /* DAC volume control: 0dB (maximum, unattenuated)  */
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACCONTROL5, 0x00);
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACCONTROL4, 0x00);
-
-  /* power down ADC while configuring; volume: +9dB for both channels */
-  res |= es_write_reg(ES8388_ADDR, ES8388_ADCPOWER, 0xff);
-  res |= es_write_reg(ES8388_ADDR, ES8388_ADCCONTROL1, 0x33);
-
-  /* select LINPUT2 / RINPUT2 as ADC input; stereo; 16 bit word length, format right-justified, MCLK / Fs = 256 */
-  res |= es_write_reg(ES8388_ADDR, ES8388_ADCCONTROL2, 0x50);
-  res |= es_write_reg(ES8388_ADDR, ES8388_ADCCONTROL3, 0x00);
-  res |= es_write_reg(ES8388_ADDR, ES8388_ADCCONTROL4, 0x0e);
-  res |= es_write_reg(ES8388_ADDR, ES8388_ADCCONTROL5, 0x02);
-
-  /* set ADC volume */
-  res |= es_write_reg(ES8388_ADDR, ES8388_ADCCONTROL8, 0x20);
-  res |= es_write_reg(ES8388_ADDR, ES8388_ADCCONTROL9, 0x20);
-
-  /* set LOUT1 / ROUT1 volume: 0dB (unattenuated) */
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACCONTROL24, 0x1e);
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACCONTROL25, 0x1e);
-
-  /* power up and enable DAC; power up ADC (no MIC bias) */
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACPOWER, 0x3c);
-  res |= es_write_reg(ES8388_ADDR, ES8388_DACCONTROL3, 0x00);
-  res |= es_write_reg(ES8388_ADDR, ES8388_ADCPOWER, 0x09);
-
-  return( res );
+  /* 16 or 24 bit words on the I2S bus (DSP_SAMPLE_BITS) */
+  return( dsp_codec_init( &es_i2c, DSP_SAMPLE_BITS == 32 ? 24 : 16 ) );
 }
 
-
 /*
  * Flash LED
  */
@@ -157,7 +152,16 @@ esp_err_t dsp_command( char command ) {
       break;
 
     case 'p' :
-      res = dsp_plot( DSP_Channels );
+      res = dsp_plot_start( DSP_Channels, DSP_PLOT_CHART );
+      break;
+
+    case 't' :
+      res = dsp_task_info();
+      dsp_latency_info();
+      break;
+
+    case 'b' :
+      res = dsp_profile_info( DSP_Channels );
       break;
   }
 
@@ -166,25 +170,244 @@ esp_err_t dsp_command( char command ) {
 
 
 /*
- * dsp_init
+ * dsp_command_line - runtime parameter updates, applied glitch-free at the next block
+ *   g <channel> <gain dB>                       set the channel gain
+ *   l <channel> <delay ms>                      set the channel delay (fractions of a sample allowed)
+ *   n <channel> <count>                         set the number of biquad filters
+ *   c <channel> <filter> <b0> <b1> <b2> <a1> <a2>  set the coefficients of a biquad filter
+ *   m <channel> <gain> ...                      set the gain of each input slot in the channel's mix
+ *   x <blocks>                                  crossfade later updates over a number of blocks (0 = instant)
+ *   k <frames> [<buffers>]                      set the block size and number of DMA buffers (restarts the audio)
+ *   w <channel> [<seconds> [<ir ms>]]           measure the room with a sweep on a channel (-1 = all) and the microphones
+ *   a <channel> [<first filter>]                fit EQ filters to the last measurement, replacing the channel's filters from one on
+ *   u [<preset>]                                switch to a preset at the next block (list the presets without one)
+ *   v <preset> <name>                           save the channel settings as a preset
+ *   p csv                                       print the response of the channels and their sum as CSV lines
+ *   o [<points> [<decimation>]]                 stream the input (1), output (2) or both (3) to a TCP client on
+ *                                               DSP_TAP_PORT, averaging frames down by the decimation (0 = off)
+ *   f [<3|12> [csv]]                            analyze the output in bands of 1/3 or 1/12 octave and report the
+ *                                               levels every few seconds as a chart or CSV (0 = off, none = info)
+ * Returns ESP_ERR_NOT_FOUND if the line is not a parameter command.
  */
-esp_err_t dsp_init() {
+esp_err_t dsp_command_line( const char* command_line ) {
 
   esp_err_t res = ESP_OK;
+  int       channel_id;
+  int       filter_id;
+  int       block_frames;
+  int       decimation;
+  int       value;
+  float     gain_dB;
+  float     delay_millis;
+  float     seconds;
+  float     ir_millis;
+  float     coeffs[5];
+  float     mix[DSP_NUM_CHANNELS];
+  char      name[DSP_PRESET_NAME_LEN + 1];
+  const char* next;
+  char*     end;
+
+  switch( command_line[0] ) {
+    case 'k' :
+      value = i2s_dma_buf_count;
+      if( sscanf( command_line + 1, "%d %d", &block_frames, &value ) < 1 ) {
+        SERIAL.printf("E-DSP: Invalid arguments for command '%c'\r\n", command_line[0] );
+        return( ESP_ERR_INVALID_ARG );
+      }
+      return( dsp_block_config( block_frames, value ) );
+
+    case 'w' :
+      seconds = DSP_MEASURE_SECONDS;
+      ir_millis = 1000.0*DSP_MEASURE_IR_LEN/DSP_SAMPLE_RATE;
+      if( sscanf( command_line + 1, "%d %f %f", &channel_id, &seconds, &ir_millis ) < 1 ) {
+        SERIAL.printf("E-DSP: Invalid arguments for command '%c'\r\n", command_line[0] );
+        return( ESP_ERR_INVALID_ARG );
+      }
+      return( dsp_measure_start( channel_id, seconds, ir_millis ) );
+
+    case 'a' :
+      filter_id = 0;
+      if( sscanf( command_line + 1, "%d %d", &channel_id, &filter_id ) < 1 ) {
+        SERIAL.printf("E-DSP: Invalid arguments for command '%c'\r\n", command_line[0] );
+        return( ESP_ERR_INVALID_ARG );
+      }
+      return( dsp_autoeq( channel_id, filter_id ) );
+
+    case 'u' :
+      if( sscanf( command_line + 1, "%d", &value ) != 1 ) {
+        return( dsp_preset_info( &dsp_presets ) );
+      }
+      res = dsp_preset_apply( &dsp_presets, DSP_Channels, value );
+      if( res == ESP_OK ) {
+        SERIAL.printf("I-DSP: Switched to preset %d '%s'\r\n", value, dsp_presets.presets[value].name );
+      } else if( res == ESP_ERR_NOT_FOUND ) {
+        SERIAL.printf("E-DSP: No preset %d\r\n", value );
+      } else {
+        SERIAL.printf("E-DSP: Update rejected\r\n");
+      }
+      return( res );
 
-  SERIAL.printf("I-DSP: Initializing audio codec via I2C...\r\n");
+    case 'v' :
+      if( sscanf( command_line + 1, "%d %16s", &value, name ) != 2 ) {
+        SERIAL.printf("E-DSP: Invalid arguments for command '%c'\r\n", command_line[0] );
+        return( ESP_ERR_INVALID_ARG );
+      }
+      return( dsp_preset_save( &dsp_presets, DSP_Channels, value, name ) );
+
+    case 'o' :
+      decimation = 1;
+      if( sscanf( command_line + 1, "%d %d", &value, &decimation ) < 1 ) {
+        return( dsp_tap_info() );
+      }
+      res = dsp_tap_set( value, decimation );
+      if( res == ESP_ERR_INVALID_ARG ) {
+        SERIAL.printf("E-DSP: Tap points must be 0 to 3, the decimation 1 to %d and divide %d\r\n", DSP_TAP_MAX_DECIMATION, DSP_SAMPLE_RATE );
+        return( res );
+      }
+      return( res == ESP_OK ? dsp_tap_info() : res );
 
-  res |= es8388_init();
-  if (res != ESP_OK) {
-    SERIAL.printf("E-DSP: Audio codec initialization failed!\r\n");
-    return( res );
+    case 'f' :
+      if( sscanf( command_line + 1, "%d", &value ) != 1 ) {
+        return( dsp_rta_info() );
+      }
+      return( dsp_rta_start( value, strstr( command_line + 1, "csv" ) != NULL ? DSP_PLOT_CSV : DSP_PLOT_CHART ) );
+
+    case 'p' :
+      if( strcmp( command_line, "p csv" ) != 0 ) {
+        return( ESP_ERR_NOT_FOUND );
+      }
+      return( dsp_plot_start( DSP_Channels, DSP_PLOT_CSV ) );
+
+    case 'g' :
+      if( sscanf( command_line + 1, "%d %f", &channel_id, &gain_dB ) != 2 ) {
+        res = ESP_ERR_INVALID_ARG;
+      } else {
+        res = dsp_filter_set_gain( DSP_Channels, channel_id, gain_dB );
+      }
+      break;
+
+    case 'l' :
+      if( sscanf( command_line + 1, "%d %f", &channel_id, &delay_millis ) != 2 ) {
+        res = ESP_ERR_INVALID_ARG;
+      } else {
+        res = dsp_filter_set_delay( DSP_Channels, channel_id, delay_millis );
+      }
+      break;
+
+    case 'n' :
+      if( sscanf( command_line + 1, "%d %d", &channel_id, &value ) != 2 ) {
+        res = ESP_ERR_INVALID_ARG;
+      } else {
+        res = dsp_filter_set_num_filters( DSP_Channels, channel_id, value );
+      }
+      break;
+
+    case 'c' :
+      if( sscanf( command_line + 1, "%d %d %f %f %f %f %f", &channel_id, &filter_id,
+                  &coeffs[0], &coeffs[1], &coeffs[2], &coeffs[3], &coeffs[4] ) != 7 ) {
+        res = ESP_ERR_INVALID_ARG;
+      } else {
+        res = dsp_filter_set_coeffs( DSP_Channels, channel_id, filter_id, coeffs );
+      }
+      break;
+
+    case 'm' :
+      channel_id = (int) strtol( command_line + 1, &end, 10 );
+      res = end == command_line + 1 ? ESP_ERR_INVALID_ARG : ESP_OK;
+      for( int i = 0; i < DSP_NUM_CHANNELS && res == ESP_OK; ++i ) {
+        next = end;
+        mix[i] = strtof( next, &end );
+        if( end == next ) {
+          res = ESP_ERR_INVALID_ARG;
+        }
+      }
+      if( res == ESP_OK ) {
+        res = dsp_filter_set_mix( DSP_Channels, channel_id, mix );
+      }
+      break;
+
+    case 'x' :
+      if( sscanf( command_line + 1, "%d", &value ) != 1 ) {
+        res = ESP_ERR_INVALID_ARG;
+      } else if( dsp_filter_set_transition( value ) == ESP_OK ) {
+        SERIAL.printf("I-DSP: Updates are crossfaded over %d blocks\r\n", value );
+        return( ESP_OK );
+      } else {
+        return( ESP_FAIL );
+      }
+      break;
+
+    default :
+      return( ESP_ERR_NOT_FOUND );
+  }
+
+  if( res == ESP_ERR_INVALID_ARG ) {
+    SERIAL.printf("E-DSP: Invalid arguments for command '%c'\r\n", command_line[0] );
+  } else if( res != ESP_OK ) {
+    SERIAL.printf("E-DSP: Update rejected\r\n");
   } else {
-    SERIAL.printf("I-DSP: Audio codec initialization OK\r\n");
+    SERIAL.printf("I-DSP: Update published\r\n");
   }
 
-  /*******************/
+  return( res );
+}
 
-  SERIAL.printf("I-DSP: Initializing input I2S...\r\n");
+
+/*
+ * Audio task I/O: read from and write to the I2S driver, filter in between
+ */
+static esp_err_t dsp_i2s_read( sample_t* buffer, size_t buffer_len, size_t* bytes_read )
+{
+  return( i2s_read( I2S_NUM, buffer, buffer_len, bytes_read, 100 ) );
+}
+
+static esp_err_t dsp_i2s_process( sample_t* buffer, size_t buffer_len )
+{
+  esp_err_t res   = ESP_OK;
+  bool      clip_flag;
+  dsp_measure_t* measure = __atomic_load_n( &dsp_measurement, __ATOMIC_ACQUIRE );
+
+  if( measure != NULL ) {
+    // Play the sweep and record the microphone instead of filtering
+    dsp_measure_block( measure, buffer, buffer_len/( DSP_NUM_CHANNELS*sizeof( sample_t ) ) );
+  } else if( dsp_filter_enabled ) {
+    // Apply filters to buffer
+    res = dsp_filter( DSP_Channels, buffer, buffer_len, &clip_flag );
+    if( clip_flag ) {
+      dsp_clip_detected = true;
+    }
+  }
+
+  return( res );
+}
+
+static esp_err_t dsp_i2s_write( const sample_t* buffer, size_t buffer_len )
+{
+  size_t  i2s_bytes_written;
+
+  if( !dsp_output_enabled ) {
+    return( ESP_OK );
+  }
+
+  return( i2s_write( I2S_NUM, buffer, buffer_len, &i2s_bytes_written, 100 ) );
+}
+
+static const dsp_task_io_t  dsp_i2s_io = { dsp_i2s_read, dsp_i2s_process, dsp_i2s_write };
+
+
+/*
+ * dsp_i2s_init - install the I2S driver with DMA buffers of one block each and allocate
+ * the block buffer. Any previous driver and buffer must have been released.
+ */
+static esp_err_t dsp_i2s_init( int block_frames, int dma_buf_count )
+{
+  esp_err_t res;
+
+  i2s_buffer = (sample_t*) malloc( block_frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+  if( i2s_buffer == NULL ) {
+    SERIAL.printf("E-DSP: Unable to allocate the I2S buffer\r\n");
+    return( ESP_ERR_NO_MEM );
+  }
 
   i2s_config_t i2s_read_config;
 
@@ -194,8 +417,8 @@ esp_err_t dsp_init() {
   i2s_read_config.communication_format = I2S_COMM_FORMAT_I2S;
   i2s_read_config.channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT;
   i2s_read_config.intr_alloc_flags = ESP_INTR_FLAG_LEVEL2;
-  i2s_read_config.dma_buf_count = 3;
-  i2s_read_config.dma_buf_len = I2S_READLEN;
+  i2s_read_config.dma_buf_count = dma_buf_count;
+  i2s_read_config.dma_buf_len = block_frames;
   i2s_read_config.use_apll = 1;
   i2s_read_config.tx_desc_auto_clear = 1;
   i2s_read_config.fixed_mclk = 0;
@@ -206,8 +429,237 @@ esp_err_t dsp_init() {
   i2s_read_pin_config.data_out_num = GPIO_NUM_26;
   i2s_read_pin_config.data_in_num = GPIO_NUM_35;
 
-  i2s_driver_install(I2S_NUM, &i2s_read_config, 0, NULL);
-  i2s_set_pin(I2S_NUM, &i2s_read_pin_config);
+  res = i2s_driver_install(I2S_NUM, &i2s_read_config, 0, NULL);
+  if( res == ESP_OK ) {
+    res = i2s_set_pin(I2S_NUM, &i2s_read_pin_config);
+  }
+  if( res != ESP_OK ) {
+    SERIAL.printf("E-DSP: I2S driver installation failed\r\n");
+    i2s_driver_uninstall(I2S_NUM);
+    free( i2s_buffer );
+    i2s_buffer = NULL;
+    return( res );
+  }
+
+  i2s_block_frames = block_frames;
+  i2s_dma_buf_count = dma_buf_count;
+
+  return( ESP_OK );
+}
+
+
+/*
+ * dsp_i2s_deinit - release the I2S driver and the block buffer (audio task stopped)
+ */
+static void dsp_i2s_deinit()
+{
+  i2s_driver_uninstall(I2S_NUM);
+  free( i2s_buffer );
+  i2s_buffer = NULL;
+}
+
+
+/*
+ * dsp_latency_info - input to output latency of the I2S path. A block is written back
+ * into the TX DMA buffer that has just been sent, which is played again after the
+ * other buffers in the ring, so a sample leaves one full ring after it came in. The
+ * channel delays and the codec filters come on top.
+ */
+static void dsp_latency_info()
+{
+  int latency_samples = i2s_block_frames*i2s_dma_buf_count;
+
+  SERIAL.printf("I-DSP: Block = %d frames (%.2f ms), DMA buffers = %d, I2S latency = %d samples (%.2f ms)\r\n",
+    i2s_block_frames, 1000.0*i2s_block_frames/DSP_SAMPLE_RATE, i2s_dma_buf_count,
+    latency_samples, 1000.0*latency_samples/DSP_SAMPLE_RATE );
+}
+
+
+/*
+ * dsp_block_config - change the block size and the DMA depth at runtime. The audio
+ * task is stopped, the I2S driver reinstalled and the work buffers resized; on failure
+ * the previous configuration is restored.
+ */
+static esp_err_t dsp_block_config( int block_frames, int dma_buf_count )
+{
+  int       old_block_frames = i2s_block_frames;
+  int       old_dma_buf_count = i2s_dma_buf_count;
+  esp_err_t res;
+
+  if( __atomic_load_n( &dsp_measurement, __ATOMIC_ACQUIRE ) != NULL ) {
+    SERIAL.printf("E-DSP: Not while a measurement is running\r\n");
+    return( ESP_FAIL );
+  }
+
+  if( block_frames < DSP_MIN_BLOCK_FRAMES || block_frames > DSP_MAX_BLOCK_FRAMES ||
+      dma_buf_count < 2 || dma_buf_count > DSP_MAX_DMA_BUF_COUNT ) {
+    SERIAL.printf("E-DSP: Block size must be %d to %d frames, DMA buffers 2 to %d\r\n",
+      DSP_MIN_BLOCK_FRAMES, DSP_MAX_BLOCK_FRAMES, DSP_MAX_DMA_BUF_COUNT );
+    return( ESP_ERR_INVALID_ARG );
+  }
+
+  res = dsp_task_stop();
+  if( res != ESP_OK ) {
+    return( res );
+  }
+  dsp_i2s_deinit();
+
+  res = dsp_filter_set_block( block_frames );
+  if( res == ESP_OK ) {
+    res = dsp_i2s_init( block_frames, dma_buf_count );
+  }
+
+  if( res != ESP_OK ) {
+    SERIAL.printf("E-DSP: Restoring the previous block configuration\r\n");
+    dsp_filter_set_block( old_block_frames );
+    if( dsp_i2s_init( old_block_frames, old_dma_buf_count ) != ESP_OK ) {
+      return( ESP_FAIL );
+    }
+  }
+
+  if( dsp_task_start( &dsp_i2s_io, i2s_buffer, i2s_block_frames*DSP_NUM_CHANNELS*sizeof( sample_t ) ) != ESP_OK ) {
+    return( ESP_FAIL );
+  }
+
+  dsp_latency_info();
+
+  return( res );
+}
+
+
+/*
+ * dsp_measure_start - room measurement: play a sweep on an output channel (-1 for all)
+ * through the running audio task, bypassing the filters, and record the microphones.
+ * dsp_loop deconvolves the recording while the sweep plays, then prints the response
+ * and switches back to the AUX input. The I2S latency tells where the sweep comes back.
+ */
+static esp_err_t dsp_measure_start( int channel_id, double seconds, double ir_millis )
+{
+  dsp_measure_t*    measure;
+  dsp_task_stats_t  stats;
+  int               ir_len = (int) ( ir_millis*DSP_SAMPLE_RATE/1000 );
+  esp_err_t         res;
+
+  // The audio task must have let go of the previous measurement before it is freed
+  dsp_task_get_stats( &stats );
+  if( __atomic_load_n( &dsp_measurement, __ATOMIC_ACQUIRE ) != NULL ||
+      ( dsp_measure_last != NULL && stats.blocks == dsp_measure_end_block ) ) {
+    SERIAL.printf("E-DSP: A measurement is already running\r\n");
+    return( ESP_FAIL );
+  }
+
+  res = dsp_measure_create( &measure, seconds, ir_len, i2s_block_frames*i2s_dma_buf_count, channel_id, DSP_MEASURE_MIC_SLOT );
+  if( res == ESP_ERR_INVALID_ARG ) {
+    SERIAL.printf("E-DSP: Sweep must be 0.1 to %.0f s, impulse response %.0f to %.0f ms, channel -1 to %d\r\n",
+      DSP_MEASURE_MAX_SECONDS, 256000.0/DSP_SAMPLE_RATE, 1000.0*DSP_MEASURE_MAX_IR_LEN/DSP_SAMPLE_RATE, DSP_NUM_CHANNELS - 1 );
+    return( res );
+  } else if( res != ESP_OK ) {
+    SERIAL.printf("E-DSP: Unable to allocate %d bytes for the measurement\r\n", dsp_measure_memory( ir_len ) );
+    return( res );
+  }
+
+  dsp_measure_free( dsp_measure_last );
+  dsp_measure_last = measure;
+
+  res = dsp_codec_input( true );
+  if( res != ESP_OK ) {
+    SERIAL.printf("E-DSP: Unable to switch the codec to the microphones\r\n");
+    dsp_codec_input( false );
+    return( res );
+  }
+
+  SERIAL.printf("I-DSP: Measuring for %.1f s (%d bytes of RAM)...\r\n",
+    (double) measure->chunks*measure->chunk/DSP_SAMPLE_RATE, dsp_measure_memory( ir_len ) );
+  __atomic_store_n( &dsp_measurement, measure, __ATOMIC_RELEASE );
+
+  return( ESP_OK );
+}
+
+
+/*
+ * dsp_autoeq - fit peaking/shelf filters that flatten the last room measurement and put
+ * them on a channel from filter 'first' on, keeping the filters ahead of it (e.g. the
+ * crossover). The response is smoothed to 1/6 octave so the fit follows the room modes
+ * rather than the comb filtering of single reflections.
+ */
+static esp_err_t dsp_autoeq( int channel_id, int first )
+{
+  dsp_fit_t*  fit;
+  float       response[DSP_FIT_POINTS];
+  int64_t     start_us;
+  esp_err_t   res;
+
+  if( dsp_measure_last == NULL || !dsp_measure_last->done ) {
+    SERIAL.printf("E-DSP: No room measurement to fit, run 'w' first\r\n");
+    return( ESP_FAIL );
+  }
+  if( channel_id < 0 || channel_id >= DSP_NUM_CHANNELS || first < 0 || first >= DSP_MAX_FILTERS ) {
+    SERIAL.printf("E-DSP: Invalid arguments for command 'a'\r\n");
+    return( ESP_ERR_INVALID_ARG );
+  }
+
+  // Too large for the loop task's stack
+  fit = (dsp_fit_t*) malloc( sizeof( dsp_fit_t ) );
+  if( fit == NULL ) {
+    SERIAL.printf("E-DSP: Unable to allocate %d bytes for the fit\r\n", (int) sizeof( dsp_fit_t ) );
+    return( ESP_FAIL );
+  }
+
+  dsp_fit_init( fit );
+  for( int p = 0; p < DSP_FIT_POINTS; ++p ) {
+    response[p] = dsp_measure_band( dsp_measure_last->work, dsp_measure_last->size, fit->freq[p], 1/6.0 );
+  }
+
+  start_us = esp_timer_get_time();
+  res = dsp_fit_run( fit, response, NULL, DSP_MAX_FILTERS - first );
+  if( res == ESP_OK ) {
+    SERIAL.printf("I-DSP: Fit in %d ms\r\n", (int) ( ( esp_timer_get_time() - start_us )/1000 ) );
+    dsp_fit_info( fit );
+    res = dsp_filter_set_filters( DSP_Channels, channel_id, first, fit->num_filters, fit->coeffs );
+    if( res == ESP_OK ) {
+      SERIAL.printf("I-DSP: Update published\r\n");
+    } else {
+      SERIAL.printf("E-DSP: Update rejected\r\n");
+    }
+  } else {
+    SERIAL.printf("E-DSP: The measured response cannot be fitted\r\n");
+  }
+
+  free( fit );
+
+  return( res );
+}
+
+
+/*
+ * dsp_init
+ */
+esp_err_t dsp_init() {
+
+  esp_err_t res = ESP_OK;
+  int64_t   start_us;
+  dsp_codec_stats_t codec_stats;
+
+  SERIAL.printf("I-DSP: Initializing audio codec via I2C...\r\n");
+
+  res |= es8388_init();
+  dsp_codec_get_stats( &codec_stats );
+  if (res != ESP_OK) {
+    SERIAL.printf("E-DSP: Audio codec initialization failed!\r\n");
+    return( res );
+  } else {
+    SERIAL.printf("I-DSP: Audio codec initialization OK: %d registers written, %d read back in %d I2C transactions, %d us\r\n",
+      codec_stats.writes, codec_stats.reads, codec_stats.transactions, codec_stats.elapsed_us);
+  }
+
+  /*******************/
+
+  SERIAL.printf("I-DSP: Initializing input I2S...\r\n");
+
+  res = dsp_i2s_init( i2s_block_frames, i2s_dma_buf_count );
+  if( res != ESP_OK ) {
+    return( res );
+  }
 
   // set clipping LED to output
   gpio_set_direction(GPIO_NUM_22, GPIO_MODE_OUTPUT);
@@ -221,48 +673,84 @@ esp_err_t dsp_init() {
 
   SERIAL.printf("I-DSP: Setting up channels...\r\n");
 
+  res = dsp_filter_set_block( i2s_block_frames );
+  if( res != ESP_OK ) {
+      return( res );
+  }
+
   res = dsp_filter_init( DSP_Channels );
   if( res != ESP_OK ) {
       return( res );
   }
 
+  // Switch to the preset used last, ahead of the first block
+  start_us = esp_timer_get_time();
+  dsp_preset_load( &dsp_presets, DSP_Channels );
+  if( dsp_presets.current != DSP_PRESET_NONE ) {
+    SERIAL.printf("I-DSP: Preset %d '%s' restored in %d us\r\n", dsp_presets.current, dsp_presets.presets[dsp_presets.current].name,
+      (int) ( esp_timer_get_time() - start_us ) );
+  }
+
   res = dsp_filter_info( DSP_Channels );
+  if( res != ESP_OK ) {
+      return( res );
+  }
+
+  SERIAL.printf("I-DSP: Starting audio task...\r\n");
+
+  res = dsp_task_start( &dsp_i2s_io, i2s_buffer, i2s_block_frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+  if( res == ESP_OK ) {
+    dsp_latency_info();
+  }
 
   return( res );
 }
 
 
 /*
- * dsp_loop
+ * dsp_loop - control plane housekeeping, called from the Arduino loop().
+ * The audio itself is processed by the audio task started in dsp_init().
  */
 esp_err_t dsp_loop()
 {
-  size_t  i2s_bytes_read;
-  size_t  i2s_bytes_written;
-  bool    clip_flag;
+  static  unsigned long  dsp_clip_report_start = 0;
+  dsp_task_stats_t       stats;
+  int                    state;
 
-  esp_err_t res   = ESP_OK;
-  clip_flag       = false;
-  i2s_bytes_read  = I2S_READLEN;
+  // Check clipping LED
+  esp_led_flash( dsp_clip_detected, 100 );
+  dsp_clip_detected = false;
 
-  // Read buffer
-  i2s_read( I2S_NUM, i2s_buffer, I2S_READLEN, &i2s_bytes_read, 100 );
+  // Report clipping counted by the audio task, at most once per interval
+  if( esp_timer_get_time()/1000 - dsp_clip_report_start >= DSP_CLIP_REPORT_MS ) {
+    dsp_clip_report_start = esp_timer_get_time()/1000;
+    dsp_filter_clip_report( DSP_Channels );
+  }
 
-  if( dsp_filter_enabled ) {
-    // Apply filters to buffer
-    res = dsp_filter( DSP_Channels, i2s_buffer, i2s_bytes_read, &clip_flag );
-    if( res != ESP_OK ) {
-        return( res );
+  // Deconvolve what a running measurement has recorded; once complete go back to the AUX input and report
+  if( __atomic_load_n( &dsp_measurement, __ATOMIC_ACQUIRE ) != NULL ) {
+    state = dsp_measure_poll( dsp_measure_last );
+    if( state != DSP_MEASURE_CAPTURING ) {
+      __atomic_store_n( &dsp_measurement, NULL, __ATOMIC_RELEASE );
+      dsp_task_get_stats( &stats );
+      dsp_measure_end_block = stats.blocks;
+      dsp_codec_input( false );
+      if( state == DSP_MEASURE_DONE ) {
+        dsp_measure_report( dsp_measure_last );
+      } else {
+        SERIAL.printf("E-DSP: Measurement aborted, the recording overran the deconvolution\r\n");
+      }
     }
   }
 
-  if( dsp_output_enabled ) {
-    // Write out buffer
-    i2s_write( I2S_NUM, i2s_buffer, i2s_bytes_read, &i2s_bytes_written, 100 );
-  }
+  // Print what the audio task logged
+  dsp_log_drain( DSP_Channels, DSP_LOG_DRAIN_MAX );
 
-  // Check clipping LED
-  esp_led_flash( clip_flag, 100 );
+  // Carry on with a plot a slice at a time, so the rest of loop() keeps running
+  dsp_plot_poll( DSP_Channels, DSP_PLOT_BUDGET_US );
 
-  return( res );
-}
\ No newline at end of file
+  // Analyze the output and report its spectrum, under its own budget
+  dsp_rta_poll( DSP_Channels, DSP_RTA_BUDGET_US );
+
+  return( ESP_OK );
+}
@@ -1,3 +1,6 @@
+#ifndef _DSP_PROCESS_H
+#define _DSP_PROCESS_H
+
 #include <string.h>
 #include <math.h>
 #include <freertos/FreeRTOS.h>
@@ -16,38 +19,498 @@
 #define DSP_MAX_FILTERS        10                // Max number of biquad filters
 #define DSP_SAMPLE_RATE        44100             // The sample rate
 #define DSP_MAX_GAIN           24                // Maximum gain for the channel
-#define DSP_MAX_SAMPLES        512               // Maximum number of samples per channel each loop
+#define DSP_BLOCK_FRAMES       256               // Frames (samples per channel) per block at start-up
+#define DSP_MIN_BLOCK_FRAMES   8                 // Smallest block the I2S driver allows
+#define DSP_DMA_BUF_COUNT      12                // I2S DMA buffers (of one block each) at start-up
+#define DSP_MAX_DMA_BUF_COUNT  128               // Most DMA buffers the I2S driver allows
 #define DSP_MAX_DELAY_MILLIS   250               // Maximum delay allowed in milliseconds
 #define DSP_MAX_DELAY_SAMPLES  ((DSP_MAX_DELAY_MILLIS*DSP_SAMPLE_RATE)/1000+1)
 
+#define DSP_MAX_DECIMATION     16                // Largest multirate decimation factor of a channel
+#define DSP_MULTIRATE_PHASE_TAPS  6              // Taps per polyphase branch of the resampling filters
+#define DSP_MULTIRATE_MAX_TAPS ( DSP_MAX_DECIMATION*DSP_MULTIRATE_PHASE_TAPS )
+#define DSP_MULTIRATE_STOPBAND 80                // Stopband attenuation of the resampling filters in dB
+#define DSP_MULTIRATE_MAX_STAGES 4               // Half-band stages for a power of two decimation (log2 of DSP_MAX_DECIMATION)
+#define DSP_MULTIRATE_HB_SHORT 7                 // Taps of the half-band stages ahead of the last one
+#define DSP_MULTIRATE_HB_LONG  11                // Taps of the last (lowest rate) half-band stage
+#define DSP_MULTIRATE_HB_EDGE  0.047             // Passband edge of the half-band cascade, as a share of the rate into its last stage
+                                                 // (where the 11 tap stage still rejects the aliases by DSP_MULTIRATE_STOPBAND)
+#define DSP_MULTIRATE_BIQUAD_MACS 5              // Multiply-adds per sample of a biquad, the unit the resampling cost is counted in
+#define DSP_MULTIRATE_COST_PATH 2.9              // Biquads a multirate channel costs by moving dsp_filter() off the stereo lockstep path
+                                                 // (measured on the host)
+
+#define DSP_MAX_FIR_TAPS       8192              // Longest room correction FIR filter of a channel (about 16 bytes of RAM per tap)
+#define DSP_MAX_FFT_SIZE       65536             // Largest FFT (the bit reversal table is 16 bit)
+
+// Input mix matrix ahead of the channels: each channel takes a weighted sum of the I2S input slots
+#define DSP_MAX_MIX_GAIN       4.0               // Largest gain of an input in a channel's mix (+12 dB)
+#define DSP_MIX_IDENTITY       0                 // Every channel takes its own input slot unchanged (no work)
+#define DSP_MIX_ROUTE          1                 // Every channel takes one input slot unchanged (swapped or copied, no arithmetic)
+#define DSP_MIX_SPARSE         2                 // Channels only sum their inputs with a non-zero gain
+#define DSP_MIX_DENSE          3                 // Full matrix (more than a quarter of the gains set, or a vector kernel)
+
+// Room measurement: an exponential sine sweep is played and the microphones recorded, then deconvolved
+#define DSP_MEASURE_START_HZ   5.0               // First frequency of the sweep (the response is accurate from about two octaves up)
+#define DSP_MEASURE_END_HZ     20000.0           // Last frequency of the sweep
+#define DSP_MEASURE_LEVEL      0.25              // Sweep amplitude relative to full scale (-12 dBFS)
+#define DSP_MEASURE_FADE_MS    20                // Fade in of the sweep (the fade out is a quarter of it)
+#define DSP_MEASURE_SECONDS    3.0               // Sweep length by default
+#define DSP_MEASURE_MAX_SECONDS  30.0            // Longest sweep
+#define DSP_MEASURE_IR_LEN     4096              // Impulse response length by default (93 ms)
+#define DSP_MEASURE_MAX_IR_LEN 32768             // Longest impulse response (the FFT is twice as long)
+#define DSP_MEASURE_MIC_SLOT   0                 // I2S input slot of the measurement microphone
+#define DSP_MEASURE_CAPTURING  0                 // dsp_measure_poll(): sweep still playing or chunks left to deconvolve
+#define DSP_MEASURE_DONE       1                 // dsp_measure_poll(): impulse and frequency response ready
+#define DSP_MEASURE_OVERRUN    2                 // dsp_measure_poll(): a chunk was overwritten before it was deconvolved
+
+// Automatic EQ: peaking/shelf biquads fitted to flatten a response toward a target (dsp_fit.cpp)
+#define DSP_FIT_LOW_HZ         20.0              // Band the response is flattened over
+#define DSP_FIT_HIGH_HZ        200.0
+#define DSP_FIT_POINTS         64                // Log-spaced frequencies the fit is evaluated at (about 1/19 octave apart)
+#define DSP_FIT_MAX_BOOST      6.0               // Largest boost of a fitted filter in dB (room dips do not fill in)
+#define DSP_FIT_MAX_CUT        18.0              // Largest cut of a fitted filter in dB
+#define DSP_FIT_MIN_Q          0.5               // Q range of the peaking filters (shelves stay between 0.5 and 0.9)
+#define DSP_FIT_MAX_Q          12.0
+#define DSP_FIT_ITERATIONS     40                // Optimizer iterations after each filter is added (bounds the fit time)
+#define DSP_FIT_TOLERANCE      0.5               // RMS error in dB below which no more filters are added
+#define DSP_FIT_PEAK           0                 // Filter types of the fit
+#define DSP_FIT_LOW_SHELF      1
+#define DSP_FIT_HIGH_SHELF     2
+#define DSP_FIT_PARAMS         ( 3*DSP_MAX_FILTERS )
+
+// Frequency response plot ('p' command), computed and printed a slice at a time from dsp_loop (dsp_plot.cpp)
+#define DSP_PLOT_LOW_HZ        20.0              // Band plotted
+#define DSP_PLOT_HIGH_HZ       200.0
+#define DSP_PLOT_BANDS         181               // Log-spaced frequencies, one per chart column
+#define DSP_PLOT_BUDGET_US     2000              // Time each call of dsp_loop() spends on a plot (at least one line)
+#define DSP_PLOT_CHART         0                 // dsp_plot_start(): ASCII chart of the gain with the phase and group delay
+#define DSP_PLOT_CSV           1                 // dsp_plot_start(): CSV lines of the gain, phase and group delay per band
+#define DSP_PLOT_CHART_HEIGHT  20                // Rows of a chart below its top row (also drawn by the analyzer)
+#define DSP_PLOT_LINE_LEN      ( DSP_PLOT_BANDS + 8 )  // Longest line of a chart, terminating zero included
+
+// Preset bank: complete channel tunings kept in flash, one record per preset, switched within one block
+#define DSP_MAX_PRESETS        8                 // Presets in the bank
+#define DSP_PRESET_NAME_LEN    16                // Longest preset name, terminating zero included
+#define DSP_PRESET_MAGIC       0x50505344        // "DSPP", start of a preset record
+#define DSP_PRESET_VERSION     1                 // Layout of the preset records
+#define DSP_PRESET_NONE        -1                // No preset switched to since boot
+#define DSP_PRESET_HEADER_LEN  ( 12 + DSP_PRESET_NAME_LEN )
+#define DSP_PRESET_MAX_LEN     ( DSP_PRESET_HEADER_LEN + DSP_NUM_CHANNELS*( 9 + 4*DSP_NUM_CHANNELS + 20*DSP_MAX_FILTERS ) )
+                                                 // Largest record: header, then per channel gain, delay, mix, filter count and the filters used
+
+#define DSP_XFADE_BLOCKS       0                 // Blocks to crossfade runtime filter/gain updates over (0 = swap instantly)
+#define DSP_MAX_XFADE_BLOCKS   64                // Maximum crossfade length in blocks
+#define DSP_GROUP_FREE         0                 // Group publish lock: free, held by the control side, held by the audio path
+#define DSP_GROUP_CONTROL      1
+#define DSP_GROUP_AUDIO        2
+
+#define DSP_LIMITER_KNEE       0.89              // Level (relative to full scale, -1 dB) above which the soft-knee limiter acts
+#define DSP_LIMITER_RELEASE    0.05              // Share of the limiter gain reduction recovered per block
+#define DSP_CLIP_REPORT_MS     1000              // Interval at which the control plane reports clipping
+
+#define DSP_TASK_STACK         4096              // Stack size of the audio task
+#define DSP_TASK_PRIORITY      20                // Priority of the audio task (loop() runs at 1)
+#define DSP_TASK_CORE          1                 // Core the audio task is pinned to (WiFi runs on core 0)
+#define DSP_TASK_RETRY_MS      1                 // Wait after a failed read, so an I2S error cannot starve loop()
+
+// Log ring: the audio task logs events as an id and numbers, dsp_loop() prints them (dsp_log.cpp)
+#define DSP_LOG_RING_LEN       64                // Records the ring holds; more are counted as dropped
+#define DSP_LOG_MAX_ARGS       3                 // Numbers logged with an event
+#define DSP_LOG_DRAIN_MAX      8                 // Records printed per call of dsp_loop()
+#define DSP_LOG_BIQUAD_FAILED  0                 // Events and their arguments: error code
+#define DSP_LOG_TOO_MANY_SAMPLES 1               //   frames, block size
+#define DSP_LOG_NOT_MULTIPLE   2                 //   frames, decimation
+#define DSP_LOG_FIR_BLOCK      3                 //   channel, block size
+#define DSP_LOG_READ_FAILED    4                 //   error code
+#define DSP_LOG_PROCESS_FAILED 5                 //   error code
+#define DSP_LOG_WRITE_FAILED   6                 //   error code
+#define DSP_LOG_DEADLINE_MISS  7                 //   block, busy us, period us
+#define DSP_LOG_EVENTS         8
+
+// Audio tap: the audio task copies blocks into a ring, a network task streams them to a TCP client (dsp_tap.cpp)
+#define DSP_TAP_PORT           5005              // TCP port the tap listens on
+#define DSP_TAP_RING_BYTES     32768             // Size of the ring; blocks that do not fit are counted as dropped
+#define DSP_TAP_MAX_DECIMATION 16                // Most frames averaged into one streamed frame
+#define DSP_TAP_MAGIC          0x54505344        // "DSPT", start of a frame on the stream
+#define DSP_TAP_INPUT          1                 // Tap points (bits): the block as read, before processing
+#define DSP_TAP_OUTPUT         2                 //   the block as written, after processing
+#define DSP_TAP_POLL_MS        1                 // Time the network task sleeps when the ring is empty
+#define DSP_TAP_STACK          4096              // Stack size of the network task
+#define DSP_TAP_PRIORITY       2                 // Priority of the network task, above loop() and below the audio task
+#define DSP_TAP_CORE           0                 // Core the network task runs on, with WiFi
+
+// ES8388 codec set-up: register tables written in batched I2C transactions and read back (dsp_codec.cpp)
+#define DSP_CODEC_ADDR         0x20              // I2C address of the ES8388 (write address; reads set bit 0)
+#define DSP_CODEC_I2C_HZ       400000            // I2C clock (fast mode)
+#define DSP_CODEC_BATCH        32                // Most register writes or reads in one I2C transaction
+#define DSP_CODEC_MAX_REGS     64                // Most register writes in one sequence
+
+// Real-time analyzer of the output ('f' command): the audio task copies the output into a ring,
+// dsp_loop() decimates, transforms and reports it a slice at a time (dsp_rta.cpp)
+#define DSP_RTA_LOW_HZ         20.0              // Band centers analyzed
+#define DSP_RTA_HIGH_HZ        200.0
+#define DSP_RTA_MAX_BANDS      42                // Bands of 1/12 octave over DSP_RTA_LOW_HZ to DSP_RTA_HIGH_HZ, and a spare
+#define DSP_RTA_DECIMATION     16                // The output is decimated to 2756 Hz before the transform (passband 259 Hz)
+#define DSP_RTA_FFT_LEN        4096              // Decimated samples per spectrum: 0.67 Hz bins, a 1.5 s Hann window, 50% overlap
+#define DSP_RTA_RING_FRAMES    4096              // Output frames buffered for dsp_loop(); blocks that do not fit are counted as overruns
+#define DSP_RTA_CHUNK          256               // Frames decimated per step (divides DSP_RTA_RING_FRAMES)
+#define DSP_RTA_AVERAGING      0.25              // Weight of a new spectrum in the exponential average of the band levels
+#define DSP_RTA_BUDGET_US      2000              // Time each call of dsp_loop() spends on the analyzer (at least one step)
+#define DSP_RTA_REPORT_MS      3000              // Interval of the live report
+
+// Hot path timing of the audio task, reported by the 'b' command (compile out with -DDSP_PROFILE=0)
+#ifndef DSP_PROFILE
+#define DSP_PROFILE            1
+#endif
+#define DSP_PROFILE_BLOCKS     256               // Blocks kept in the timing ring
+
+#define DSP_STAGE_READ         0                 // Waiting for and reading the input block
+#define DSP_STAGE_MIX          1                 // Input mix matrix
+#define DSP_STAGE_DELAY        2                 // Delay lines (and copying the channels out of the I2S buffer, decimation)
+#define DSP_STAGE_BIQUAD       3                 // Biquad cascades (with gain and limiter in the stereo modes)
+#define DSP_STAGE_FIR          4                 // Room correction FIR filters
+#define DSP_STAGE_OUTPUT       5                 // Interpolation, gain, limiter and copying back to the I2S buffer
+#define DSP_STAGE_WRITE        6                 // Writing the output block
+#define DSP_STAGE_BLOCK        7                 // Whole block from input ready to output written
+#define DSP_PROFILE_STAGES     8
+
+#if DSP_PROFILE
+#define DSP_PROFILE_MARK( mark )              uint32_t mark = dsp_profile_cycles()
+#define DSP_PROFILE_STAGE( stage, mark )      dsp_profile_stage( stage, &mark )
+#define DSP_PROFILE_BLOCK( start, period_us ) dsp_profile_block( start, period_us )
+#else
+#define DSP_PROFILE_MARK( mark )
+#define DSP_PROFILE_STAGE( stage, mark )
+#define DSP_PROFILE_BLOCK( start, period_us )
+#endif
+
+// Biquad cascade kernel used by dsp_filter (select with -DDSP_BIQUAD_KERNEL=...)
+#define DSP_BIQUAD_STAGEWISE     0               // One dsps_biquad_f32 pass over the buffer per filter
+#define DSP_BIQUAD_CASCADE       1               // Portable single pass over the buffer for all filters
+#define DSP_BIQUAD_CASCADE_OPT   2               // Single pass, unrolled per filter count with state in registers
+
+#ifndef DSP_BIQUAD_KERNEL
+#define DSP_BIQUAD_KERNEL        DSP_BIQUAD_CASCADE_OPT
+#endif
+
+// Biquad filter structure used by the float engine (select with -DDSP_BIQUAD_TOPOLOGY=...). The
+// kernel setting above applies to Direct Form II; the stereo lockstep modes only run Direct Form II.
+#define DSP_TOPOLOGY_DF2         0               // Direct Form II (as the Espressif kernel)
+#define DSP_TOPOLOGY_TDF2        1               // Transposed Direct Form II
+#define DSP_TOPOLOGY_DF1_EF      2               // Direct Form I, compensated sums and error feedback (float only)
+#define DSP_TOPOLOGY_TDF2_MIXED  3               // Transposed Direct Form II with double precision state
+
+#ifndef DSP_BIQUAD_TOPOLOGY
+#define DSP_BIQUAD_TOPOLOGY      DSP_TOPOLOGY_DF2
+#endif
+
+#define DSP_BIQUAD_STATE_LEN     6               // Floats of state per biquad filter (enough for every topology)
+
+// Processing mode used by dsp_filter (select with -DDSP_FILTER_MODE=... or dsp_filter_set_mode)
+#define DSP_MODE_CHANNEL         0               // Each channel copied out of the interleaved buffer, filtered and written back
+#define DSP_MODE_STEREO          1               // Both channels filtered in lockstep on the interleaved buffer (dual-lane scalar)
+#define DSP_MODE_STEREO_SIMD     2               // As DSP_MODE_STEREO using SSE/NEON where available (dual-lane scalar otherwise)
+
+#ifndef DSP_FILTER_MODE
+#define DSP_FILTER_MODE          DSP_MODE_STEREO_SIMD
+#endif
+
+// Sample width on the I2S bus (select with -DDSP_SAMPLE_BITS=...): 16 bit words, or 32 bit
+// slots carrying the 24 bit samples of the codec (MSB aligned, low byte zero)
+#ifndef DSP_SAMPLE_BITS
+#define DSP_SAMPLE_BITS          16
+#endif
+
+#if DSP_SAMPLE_BITS == 32
+typedef  int32_t    sample_t;                    // Type defined for each sample input from the DAC
+#define DSP_MAX_SAMPLE_VALUE                     0x7FFFFF00    // 24 bit full scale in the 32 bit slot (exact as a float)
+#elif DSP_SAMPLE_BITS == 16
 typedef  int16_t    sample_t;                    // Type defined for each sample input from the DAC
-#define DSP_BITS_PER_SAMPLE                      (i2s_bits_per_sample_t) (sizeof( sample_t )*8)
 #define DSP_MAX_SAMPLE_VALUE                     ((1 << (DSP_BITS_PER_SAMPLE-1)) - 1)
+#else
+#error "DSP_SAMPLE_BITS must be 16 or 32"
+#endif
+#define DSP_BITS_PER_SAMPLE                      (i2s_bits_per_sample_t) (sizeof( sample_t )*8)
+#define DSP_MAX_BLOCK_FRAMES                     ( 4092/( DSP_NUM_CHANNELS*(int) sizeof( sample_t ) ) )
+                                                                // Largest block that fits one I2S DMA descriptor
+#define DSP_MAX_SAMPLES                          ( DSP_MAX_BLOCK_FRAMES*DSP_NUM_CHANNELS )    // Samples in the largest block
+#define DSP_LIMITER_KNEE_VALUE                   ( (float) ( DSP_LIMITER_KNEE*DSP_MAX_SAMPLE_VALUE ) )
+
+// Filter engine used by dsp_filter (select with -DDSP_FILTER_ENGINE=...)
+#define DSP_ENGINE_FLOAT         0               // Samples converted to float for the biquads, gain and clip
+#define DSP_ENGINE_FIXED         1               // Samples stay integer: fixed-point biquads with 64 bit accumulators
+
+#ifndef DSP_FILTER_ENGINE
+#define DSP_FILTER_ENGINE        DSP_ENGINE_FLOAT
+#endif
+
+// Fixed-point engine formats. Samples are held as 32 bit values with 24 bits up to full
+// scale, leaving headroom for the stages of a cascade; coefficients are scaled per filter.
+#define DSP_Q31_SAMPLE_BITS      23              // Fractional bits of a sample (full scale = 2^23)
+#define DSP_Q31_STATE_MAX        ((1 << 29) - 1) // Saturation limit of a filter stage output (+36 dB over full scale)
+#define DSP_Q31_MIN_COEFF_BITS   23              // Fewest fractional bits of a coefficient (|coeff| < 256)
+#define DSP_Q31_GAIN_BITS        27              // Fractional bits of the scaling factor (up to +24 dB)
+#if DSP_SAMPLE_BITS == 32
+#define DSP_Q31_FROM_SAMPLE( s ) ( (int32_t) (s) >> 8 )
+#define DSP_Q31_TO_SAMPLE( q )   ( (sample_t) ( (q)*256 ) )
+#else
+#define DSP_Q31_FROM_SAMPLE( s ) ( (int32_t) (s)*256 )
+#define DSP_Q31_TO_SAMPLE( q )   ( (sample_t) ( ( (q) + 128 ) >> 8 ) )                  // Rounded to the nearest sample
+#endif
+#define DSP_Q31_MAX_SAMPLE_VALUE DSP_Q31_FROM_SAMPLE( DSP_MAX_SAMPLE_VALUE )
 
 
 //------------------------------------------------------------------------------------
 // Type definitions
 //------------------------------------------------------------------------------------
 
-typedef struct dsp_buffer_t {
+typedef struct dsp_biquad_q31_t {
+  int32_t      coeffs[5];                        // b0, b1, b2, -a1, -a2 scaled by 2^shift
+  int          shift;                            // Fractional bits of the coefficients
+  int          feedback[2];                      // Error feedback weights (-a1 and -a2 rounded to integers)
+} dsp_biquad_q31_t;
+
+typedef struct dsp_params_t {
+  int          num_filters;                      // The number of biquad filters used in the channel
+  float        coeffs[DSP_MAX_FILTERS][5];       // The biquad coefficients for each of the filters
+  dsp_biquad_q31_t  coeffs_q31[DSP_MAX_FILTERS]; // The coefficients quantized for the fixed-point engine
   float        scaling_factor;                   // Factor used to scale values for specified gain
-  float        biquad_w[DSP_MAX_FILTERS][2];     // Array of historic W values for each biquad filter
-  int          delay_samples;                    // Number of calculated samples delayed in buffer
+  int32_t      scaling_q31;                      // Scaling factor for the fixed-point engine (DSP_Q31_GAIN_BITS)
+  int          delay_samples;                    // Number of whole samples delayed (length of the delay buffer)
+  float        delay_frac;                       // Fraction of a sample delayed on top (linear interpolation)
+  sample_t*    delay_buff;                       // Delay buffer of delay_samples samples, NULL if none (may be shared between snapshots)
+  bool         delay_owned;                      // The delay buffer belongs to a preset and is not freed with the snapshot
+  int          xfade_blocks;                     // Blocks to crossfade from the previous snapshot (0 = swap instantly)
+  float        mix[DSP_NUM_CHANNELS];            // Gain of each input slot in the channel (its row of the mix matrix)
+} dsp_params_t;
+
+typedef struct dsp_clip_t {
+  int          clipping_count;                   // Samples over full scale before the limiter
+  int          limit_count;                      // Samples reduced by the soft knee
+  float        peak;                             // Largest value before the soft knee (only tracked above the knee)
+} dsp_clip_t;
+
+typedef struct dsp_multirate_t {
+  int          decimation;                       // Decimation factor, 1 for a channel running at the full rate
+  int          stages;                           // Half-band stages of a power of two decimation, 0 for the polyphase FIR
+  int          taps;                             // Length of the polyphase resampling filter
+  float        fir[DSP_MULTIRATE_MAX_TAPS];      // Resampling low-pass filter (symmetric)
+  float        interp[DSP_MULTIRATE_MAX_TAPS];   // The filter split into reversed polyphase branches for interpolation
+  float        decim_hist[DSP_MULTIRATE_MAX_TAPS];          // Last taps - 1 inputs of the decimator
+  float        interp_hist[DSP_MULTIRATE_PHASE_TAPS];       // Last DSP_MULTIRATE_PHASE_TAPS - 1 inputs of the interpolator
+  float        stage_decim_hist[DSP_MULTIRATE_MAX_STAGES][DSP_MULTIRATE_HB_LONG];      // Last taps - 1 inputs of each half-band decimator
+  float        stage_interp_hist[DSP_MULTIRATE_MAX_STAGES][DSP_MULTIRATE_HB_LONG/2];   // Last ( taps - 1 )/2 inputs of each half-band interpolator
+} dsp_multirate_t;
+
+typedef struct dsp_mix_t {
+  int          kind;                             // Kernel the matrix needs (see DSP_MIX_...)
+  float        gain[DSP_NUM_CHANNELS][DSP_NUM_CHANNELS];    // Gain of input slot i in channel c
+  int          route[DSP_NUM_CHANNELS];          // Input slot each channel takes unchanged (DSP_MIX_ROUTE)
+  int          count[DSP_NUM_CHANNELS];          // Number of inputs with a non-zero gain in each channel (DSP_MIX_SPARSE)
+  int          input[DSP_NUM_CHANNELS][DSP_NUM_CHANNELS];   // Those inputs (DSP_MIX_SPARSE)
+} dsp_mix_t;
+
+typedef struct dsp_fft_t {
+  int          size;                             // Number of real samples transformed (a power of two)
+  float*       twiddle;                          // cos and sin of 2 pi k/size for k < size/2, interleaved
+  uint16_t*    bitrev;                           // Bit reversed order of the size/2 complex points
+} dsp_fft_t;
+
+typedef struct dsp_fir_t {
+  int          taps;                             // Length of the filter
+  int          block;                            // Samples per block, the length of a partition
+  int          size;                             // FFT size (a power of two, at least twice the block)
+  int          partitions;                       // Number of partitions
+  int          current;                          // Delay line slot of the newest input spectrum
+  float*       spectra;                          // Spectrum of each partition (packed, partitions*size floats)
+  float*       fdl;                              // Frequency-domain delay line: input spectra of the last 'partitions' blocks
+  float*       window;                           // Last 'size' input samples
+  float*       acc;                              // Sum of the partition products
+  float*       memory;                           // Allocation holding the four above
+  dsp_fft_t    fft;                              // Transform tables
+} dsp_fir_t;
+
+typedef struct dsp_measure_t {
+  int          sweep_len;                        // Sweep length in samples
+  double       rate;                             // Samples for the sweep frequency to rise by a factor e
+  double       omega;                            // Start frequency of the sweep in radians per sample
+  double       growth;                           // Factor the frequency rises by per sample, exp( 1/rate )
+  float        amplitude;                        // Sweep amplitude in sample units
+  int          fade_in;                          // Fade in and fade out in samples
+  int          fade_out;
+  int          output;                           // Output slot the sweep is played on, -1 for all
+  int          input;                            // Input slot the microphone is recorded from
+  int          ir_len;                           // Impulse response length in samples
+  int          pre;                              // Samples of the impulse response kept ahead of the direct sound
+  int          latency;                          // Output to input delay of the I2S path in samples
+  int          chunk;                            // Samples captured per chunk
+  int          chunks;                           // Chunks in the whole capture
+  int          size;                             // FFT size used to deconvolve a chunk
+  int          position;                         // Samples played and captured so far (owned by the audio path)
+  int          fill;                             // Samples in the chunk being captured (owned by the audio path)
+  double       phase;                            // Sweep phase and phase step of the next sample (owned by the audio path)
+  double       step;
+  int          captured;                         // Chunks captured (atomic, written by the audio path)
+  int          processed;                        // Chunks deconvolved (atomic, written by the control side)
+  bool         overrun;                          // The audio path caught up with a chunk not yet deconvolved
+  bool         done;                             // Impulse and frequency response ready (owned by the control side)
+  float*       capture[2];                       // Chunks being captured and deconvolved (chunk floats each)
+  float*       ir;                               // Impulse response, ir_len floats starting 'pre' samples ahead of the direct sound
+  float*       work;                             // Chunk spectrum, then the frequency response (packed, size floats)
+  float*       segment;                          // Spectrum of the inverse sweep segment of a chunk (size floats)
+  float*       memory;                           // Allocation holding the five above
+  dsp_fft_t    fft;                              // Transform tables
+} dsp_measure_t;
+
+typedef struct dsp_fit_t {
+  float        freq[DSP_FIT_POINTS];             // Frequencies the fit is evaluated at
+  float        warp[DSP_FIT_POINTS];             // tan( pi freq/DSP_SAMPLE_RATE ), the bilinear transform frequency of each
+  float        error[DSP_FIT_POINTS];            // Response minus target in dB, which the filters cancel
+  float        contrib[DSP_MAX_FILTERS][DSP_FIT_POINTS];   // Response of each filter in dB
+  float        trial[DSP_MAX_FILTERS][DSP_FIT_POINTS];     // Responses of a trial step
+  int          num_filters;                      // Filters fitted
+  int          type[DSP_MAX_FILTERS];            // Type of each (see DSP_FIT_...)
+  float        param[DSP_MAX_FILTERS][3];        // Frequency (log2 Hz), gain (dB) and Q (log2) of each
+  float        coeffs[DSP_MAX_FILTERS][5];       // The filters in the layout of dsp_channel_t::coeffs
+  float        jacobian[DSP_FIT_PARAMS][DSP_FIT_POINTS];   // Optimizer work: derivative of the response by each parameter
+  float        hessian[DSP_FIT_PARAMS][DSP_FIT_PARAMS];    // Optimizer work: Gauss-Newton approximation of the Hessian
+  float        normal[DSP_FIT_PARAMS][DSP_FIT_PARAMS + 1]; // Optimizer work: damped normal equations
+  float        rms_before;                       // RMS error in dB without and with the filters
+  float        rms;
+  int          evaluations;                      // Filter responses computed (each over all points)
+} dsp_fit_t;
+
+typedef struct dsp_buffer_t {
+  dsp_params_t   params[3];                      // Parameter snapshots: active, previous (during a crossfade) and pending
+  dsp_params_t*  active;                         // Snapshot used by dsp_filter (owned by the audio path)
+  dsp_params_t*  previous;                       // Snapshot faded out during a crossfade, NULL if none (owned by the audio path)
+  dsp_params_t*  pending;                        // Snapshot to swap in at the next block, NULL if none (atomic)
+  dsp_params_t*  published;                      // Snapshot most recently published (owned by the control side)
+  dsp_params_t*  published_prev;                 // Snapshot published before it (owned by the control side)
+  uint32_t     blocks;                           // Number of blocks processed
+  uint32_t     publish_block;                    // Block count when the pending snapshot was published
+  uint32_t     swap_latency;                     // Blocks between publishing and swapping in the last update
+  uint32_t     updates;                          // Number of updates swapped in
+  int          xfade_blocks;                     // Length of the running crossfade in blocks
+  int          xfade_remaining;                  // Blocks left in the running crossfade, 0 if none
+  bool         xfade_filters;                    // Crossfade runs the old and new cascades in parallel (else gain ramp only)
+  float        xfade_w[DSP_MAX_FILTERS][DSP_BIQUAD_STATE_LEN];  // Historic W values of the old cascade during a crossfade
+  float        biquad_w[DSP_MAX_FILTERS][DSP_BIQUAD_STATE_LEN]; // Array of historic W values for each biquad filter
+  int32_t      biquad_q31[DSP_MAX_FILTERS][6];   // Fixed-point engine state: x1, x2, y1, y2 and the last two rounding errors
+  int32_t      xfade_q31[DSP_MAX_FILTERS][6];    // Fixed-point state of the old cascade during a crossfade
   int          delay_offset;                     // Offset within the delay buffer for storing next set of input values
-  int         clipping_count;                    // Number of times audio clipped per channel
-  sample_t    delay_buff[DSP_MAX_DELAY_SAMPLES];
-                                                 // Sample delay buffer
+  sample_t     delay_last;                       // Last whole-sample delayed value (for the fractional delay)
+  float        limiter_gain;                     // Limiter gain at the start of the next block
+  float        limiter_target;                   // Limiter gain reached at the end of the next block
+  int          clipping_count;                   // Number of samples over full scale before the limiter (audio path)
+  int          limit_count;                      // Number of samples reduced by the soft knee (audio path)
+  int32_t      clip_peak;                        // Largest value before the limiter since the last report, relative to full scale in Q16 (atomic)
+  int          clipping_reported;                // Clipping count at the last report (control side)
+  dsp_multirate_t  multirate;                    // Resampling filters of a multirate channel
+  dsp_fir_t*   fir;                              // Room correction FIR filter, NULL if none
 } dsp_buffer_t;
 
+typedef struct dsp_stereo_t {
+  int          num_filters;                      // Number of filters in the longer of the two cascades
+  float        coeffs[DSP_MAX_FILTERS][5][2];    // Paired (left/right) biquad coefficients, padded with pass-through filters
+  float        w[DSP_MAX_FILTERS][2][2];         // Paired (left/right) historic W values
+  float        scaling_factor[2];                // Paired scaling factors (limiter gain included) at the start of the block
+  float        scaling_step[2];                  // Paired change of the scaling factors per frame (limiter ramp)
+  dsp_clip_t   clip[2];                          // Clipping and limiting in the block
+} dsp_stereo_t;
+
+typedef struct dsp_task_io_t {
+  esp_err_t    (*read)( sample_t* buffer, size_t buffer_len, size_t* bytes_read );
+                                                 // Wait for and read the next input block
+  esp_err_t    (*process)( sample_t* buffer, size_t buffer_len );
+                                                 // Process the block in place
+  esp_err_t    (*write)( const sample_t* buffer, size_t buffer_len );
+                                                 // Write the processed block
+} dsp_task_io_t;
+
+typedef struct dsp_log_record_t {
+  int64_t      time_us;                          // When it was logged (dsp_os_time_us)
+  int32_t      event;                            // DSP_LOG_...
+  int32_t      args[DSP_LOG_MAX_ARGS];
+} dsp_log_record_t;
+
+typedef struct dsp_tap_header_t {
+  uint32_t     magic;                            // DSP_TAP_MAGIC
+  uint32_t     sequence;                         // Block number, the same for the input and the output of a block
+  uint32_t     sample_rate;                      // Of the frames that follow, after decimation
+  uint32_t     dropped;                          // Blocks dropped since the tap started listening
+  uint16_t     frames;                           // Frames that follow, of interleaved little endian signed samples
+  uint8_t      channels;                         // Samples per frame
+  uint8_t      sample_bytes;                     // Bytes per sample
+  uint8_t      point;                            // DSP_TAP_INPUT or DSP_TAP_OUTPUT
+  uint8_t      reserved[3];
+} dsp_tap_header_t;
+
+typedef struct dsp_tap_stats_t {
+  uint32_t     blocks;                           // Blocks copied into the ring
+  uint32_t     dropped;                          // Blocks that did not fit in the ring
+  uint64_t     bytes_sent;                       // Bytes sent to clients
+  uint32_t     clients;                          // Connections accepted
+  bool         connected;                        // A client is connected
+} dsp_tap_stats_t;
+
+typedef struct dsp_codec_reg_t {
+  uint8_t      reg;                              // ES8388_... register
+  uint8_t      value;
+} dsp_codec_reg_t;
+
+typedef struct dsp_i2c_t {
+  esp_err_t    (*write)( uint8_t addr, const dsp_codec_reg_t* regs, int count );      // Write registers in one transaction
+  esp_err_t    (*read)( uint8_t addr, const uint8_t* regs, uint8_t* values, int count );  // Read registers in one transaction
+} dsp_i2c_t;
+
+typedef struct dsp_codec_stats_t {
+  int          writes;                           // Registers written and read back by the last sequence
+  int          reads;
+  int          transactions;                     // I2C transactions they took, retries of single registers included
+  int          failed;                           // Registers whose write or read failed
+  int          mismatched;                       // Registers that read back other than written
+  int          elapsed_us;                       // Time the last sequence took
+} dsp_codec_stats_t;
+
+typedef struct dsp_task_stats_t {
+  uint32_t     blocks;                           // Number of blocks processed
+  uint32_t     period_us;                        // Duration of one block at the sample rate
+  uint32_t     last_busy_us;                     // Time from input ready to output written for the last block
+  uint32_t     max_busy_us;                      // Longest busy time
+  uint64_t     total_busy_us;                    // Sum of busy times (for the average)
+  uint32_t     deadline_misses;                  // Blocks not finished before the next DMA buffer was due
+  uint32_t     late_reads;                       // Input buffers that arrived more than a period late
+  uint32_t     errors;                           // Failed reads, writes or processing
+  int64_t      first_write_us;                   // Time from dsp_task_start() to the first block written, 0 until then
+} dsp_task_stats_t;
+
 typedef struct dsp_channel_t {
   char*        name;                             // Name of the channel
   float        gain_dB;                          // The amount of gain added to the channel
-  int          delay_millis;                     // The delay (in millseconds) introduced into the channel
+  float        delay_millis;                     // The delay (in millseconds) introduced into the channel, fractions of a sample allowed
   int          num_filters;                      // The number of biquad filters used in the channel
   float        coeffs[DSP_MAX_FILTERS][5];       // The biquad coefficients for each of the filters
+  int          decimation;                       // Run delay and biquads at DSP_SAMPLE_RATE/decimation (1 = full rate)
+  int          fir_taps;                         // Length of the room correction FIR filter after the biquads (0 = none)
+  const float* fir_coeffs;                       // Its coefficients at the rate the channel runs at, NULL if none
+  float        mix[DSP_NUM_CHANNELS];            // Gain of each I2S input slot in the channel (1 in its own slot = straight through)
   dsp_buffer_t*  buffers;                        // Data buffer for the channel
 } dsp_channel_t;
 
+typedef struct dsp_preset_t {
+  bool         used;                             // The slot holds a valid preset
+  char         name[DSP_PRESET_NAME_LEN];        // Name of the preset
+  dsp_channel_t  channels[DSP_NUM_CHANNELS];     // Channel configs as validated (filters, gain, delay and mix from the preset)
+  dsp_params_t   params[DSP_NUM_CHANNELS];       // Their snapshots, ready to publish (see dsp_filter_prepare)
+} dsp_preset_t;
+
+typedef struct dsp_preset_bank_t {
+  int          current;                          // Preset last switched to, DSP_PRESET_NONE if none
+  int          stored;                           // Preset recorded in flash as the last one used, DSP_PRESET_NONE if none
+  dsp_preset_t presets[DSP_MAX_PRESETS];
+} dsp_preset_bank_t;
+
 
 //------------------------------------------------------------------------------------
 // Global variables
@@ -65,11 +528,156 @@ extern TelnetSpy      SerialAndTelnet;
 esp_err_t dsp_init();
 esp_err_t dsp_loop();
 esp_err_t dsp_command( char command );
+esp_err_t dsp_command_line( const char* command_line );
 esp_err_t dsp_filter_init( dsp_channel_t* channels );
+esp_err_t dsp_filter_set_block( int frames );
+esp_err_t dsp_filter_deinit( dsp_channel_t* channels );
+esp_err_t dsp_filter_validate( dsp_channel_t* channel );
+esp_err_t dsp_filter_publish( dsp_channel_t* channel );
+esp_err_t dsp_filter_prepare( const dsp_channel_t* channel, dsp_params_t* params );
+void      dsp_filter_unprepare( dsp_channel_t* channel, dsp_params_t* params );
+esp_err_t dsp_filter_publish_params( dsp_channel_t* channel, const dsp_params_t* prepared );
+void      dsp_filter_publish_begin( void );
+void      dsp_filter_publish_end( void );
+esp_err_t dsp_filter_set_gain( dsp_channel_t* channels, int channel_id, float gain_dB );
+esp_err_t dsp_filter_set_delay( dsp_channel_t* channels, int channel_id, float delay_millis );
+esp_err_t dsp_filter_set_num_filters( dsp_channel_t* channels, int channel_id, int num_filters );
+esp_err_t dsp_filter_set_coeffs( dsp_channel_t* channels, int channel_id, int filter_id, const float* coeffs );
+esp_err_t dsp_filter_set_mix( dsp_channel_t* channels, int channel_id, const float* mix );
+esp_err_t dsp_filter_set_filters( dsp_channel_t* channels, int channel_id, int first, int count, const float coeffs[][5] );
 esp_err_t dsp_filter_info( dsp_channel_t* channels );
+esp_err_t dsp_filter_clip_report( dsp_channel_t* channels );
 esp_err_t dsp_filter( dsp_channel_t* channels, sample_t* dsp_buffer, int buffer_len, bool* clip_flag );
-esp_err_t dsp_plot( dsp_channel_t* channels );
+esp_err_t dsp_filter_set_mode( int mode );
+esp_err_t dsp_filter_set_transition( int xfade_blocks );
+esp_err_t dsp_plot_start( dsp_channel_t* channels, int format );
+bool      dsp_plot_poll( dsp_channel_t* channels, int budget_us );
+int       dsp_plot_stages_computed();
+int       dsp_plot_memory();
+void      dsp_plot_chart_row( char* text_line, const int* line_plot, int row );
+void      dsp_plot_chart_labels( char* text_line, const float* values, float scale, float resolution, const char* format );
+
+esp_err_t dsp_preset_load( dsp_preset_bank_t* bank, dsp_channel_t* channels );
+esp_err_t dsp_preset_apply( dsp_preset_bank_t* bank, dsp_channel_t* channels, int preset_id );
+esp_err_t dsp_preset_save( dsp_preset_bank_t* bank, dsp_channel_t* channels, int preset_id, const char* name );
+void      dsp_preset_free( dsp_preset_bank_t* bank, dsp_channel_t* channels );
+esp_err_t dsp_preset_info( const dsp_preset_bank_t* bank );
+int       dsp_preset_pack( const char* name, const dsp_channel_t* channels, uint8_t* record );
+esp_err_t dsp_preset_unpack( const uint8_t* record, int len, char* name, dsp_channel_t* channels );
+
+esp_err_t dsp_task_start( const dsp_task_io_t* io, sample_t* buffer, size_t buffer_len );
+esp_err_t dsp_task_stop();
+esp_err_t dsp_task_info();
+void      dsp_task_get_stats( dsp_task_stats_t* stats );
+void      dsp_task_reset_stats();
+
+void      dsp_log( int event, int32_t arg0, int32_t arg1, int32_t arg2 );
+bool      dsp_log_read( dsp_log_record_t* record );
+uint32_t  dsp_log_dropped();
+int       dsp_log_drain( dsp_channel_t* channels, int max_records );
+
+esp_err_t dsp_tap_listen( int port );
+int       dsp_tap_port();
+esp_err_t dsp_tap_set( int points, int decimation );
+void      dsp_tap_block( int point, uint32_t sequence, const sample_t* buffer, int frames );
+void      dsp_tap_get_stats( dsp_tap_stats_t* stats );
+esp_err_t dsp_tap_info();
+
+esp_err_t dsp_codec_init( const dsp_i2c_t* i2c, int word_bits );
+esp_err_t dsp_codec_input( bool mics );
+void      dsp_codec_get_stats( dsp_codec_stats_t* stats );
+
+esp_err_t dsp_rta_start( int bands_per_octave, int format );
+void      dsp_rta_block( const sample_t* buffer, int frames );
+bool      dsp_rta_poll( dsp_channel_t* channels, int budget_us );
+int       dsp_rta_levels( int channel_id, float* freq, float* level_dB );
+esp_err_t dsp_rta_info();
+int       dsp_rta_memory();
+
+uint32_t  dsp_profile_cycles();
+void      dsp_profile_stage( int stage, uint32_t* mark );
+void      dsp_profile_block( uint32_t start, uint32_t period_us );
+void      dsp_profile_reset();
+uint32_t  dsp_profile_stage_cycles( int stage );
+esp_err_t dsp_profile_info( dsp_channel_t* channels );
+
+esp_err_t dsp_biquad_stagewise_f32( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters );
+esp_err_t dsp_biquad_cascade_f32_ansi( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters );
+esp_err_t dsp_biquad_cascade_f32_opt( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters );
+esp_err_t dsp_biquad_cascade_f32_tdf2( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters );
+esp_err_t dsp_biquad_cascade_f32_df1( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters );
+esp_err_t dsp_biquad_cascade_f32_mixed( float* buffer, int len, float coeffs[][5], float w[][DSP_BIQUAD_STATE_LEN], int num_filters );
+
+void      dsp_output_f32( const float* buffer, int len, sample_t* output, int stride, float gain, float step, dsp_clip_t* clip );
+void      dsp_output_q31( const int32_t* buffer, int len, sample_t* output, int stride, int32_t gain, int32_t step, dsp_clip_t* clip );
+
+esp_err_t dsp_biquad_q31_quantize( float coeffs[][5], int num_filters, dsp_biquad_q31_t* coeffs_q31 );
+esp_err_t dsp_biquad_cascade_q31( int32_t* buffer, int len, const dsp_biquad_q31_t* coeffs, int32_t state[][6], int num_filters );
+
+esp_err_t dsp_multirate_init( dsp_multirate_t* multirate, int decimation );
+float     dsp_multirate_passband( int decimation );
+int       dsp_multirate_delay( int decimation );
+float     dsp_multirate_cost( int decimation );
+float     dsp_multirate_freq( const float* coeffs );
+void      dsp_multirate_redesign( const float* coeffs, int decimation, float* redesigned );
+void      dsp_multirate_decimate( dsp_multirate_t* multirate, const sample_t* input, int stride, int len, float* work, float* output );
+void      dsp_multirate_interpolate( dsp_multirate_t* multirate, const float* input, int len, float* work, float* output );
+
+void      dsp_mix_setup( dsp_mix_t* mix, const float gain[][DSP_NUM_CHANNELS] );
+void      dsp_mix_process( const dsp_mix_t* mix, sample_t* buffer, int frames, int* clipped );
+void      dsp_mix_dense_ansi( const dsp_mix_t* mix, sample_t* buffer, int frames, int* clipped );
+void      dsp_mix_dense_simd( const dsp_mix_t* mix, sample_t* buffer, int frames, int* clipped );
+
+esp_err_t dsp_fft_init( dsp_fft_t* fft, int size );
+void      dsp_fft_free( dsp_fft_t* fft );
+void      dsp_fft_forward( const dsp_fft_t* fft, float* data );
+void      dsp_fft_inverse( const dsp_fft_t* fft, float* data );
+
+esp_err_t dsp_fir_create( dsp_fir_t** fir, const float* coeffs, int taps, int block );
+void      dsp_fir_free( dsp_fir_t* fir );
+esp_err_t dsp_fir_process( dsp_fir_t* fir, float* buffer, int len );
+int       dsp_fir_memory( int taps, int block );
+
+void      dsp_fit_init( dsp_fit_t* fit );
+esp_err_t dsp_fit_run( dsp_fit_t* fit, const float* response, const float* target, int max_filters );
+void      dsp_fit_design( int type, float freq, float gain_dB, float q, float* coeffs );
+esp_err_t dsp_fit_info( const dsp_fit_t* fit );
+
+esp_err_t dsp_measure_create( dsp_measure_t** measure, double seconds, int ir_len, int latency, int output, int input );
+void      dsp_measure_free( dsp_measure_t* measure );
+void      dsp_measure_block( dsp_measure_t* measure, sample_t* buffer, int frames );
+int       dsp_measure_poll( dsp_measure_t* measure );
+float     dsp_measure_band( const float* spectrum, int size, double freq, double octaves );
+int       dsp_measure_memory( int ir_len );
+esp_err_t dsp_measure_report( const dsp_measure_t* measure );
+
+esp_err_t dsp_biquad_stereo_f32_ansi( sample_t* buffer, int frames, dsp_stereo_t* stereo );
+esp_err_t dsp_biquad_stereo_f32_simd( sample_t* buffer, int frames, dsp_stereo_t* stereo );
+
+#if DSP_BIQUAD_TOPOLOGY == DSP_TOPOLOGY_TDF2
+#define dsp_biquad_cascade_f32   dsp_biquad_cascade_f32_tdf2
+#elif DSP_BIQUAD_TOPOLOGY == DSP_TOPOLOGY_DF1_EF
+#define dsp_biquad_cascade_f32   dsp_biquad_cascade_f32_df1
+#elif DSP_BIQUAD_TOPOLOGY == DSP_TOPOLOGY_TDF2_MIXED
+#define dsp_biquad_cascade_f32   dsp_biquad_cascade_f32_mixed
+#elif DSP_BIQUAD_KERNEL == DSP_BIQUAD_STAGEWISE
+#define dsp_biquad_cascade_f32   dsp_biquad_stagewise_f32
+#elif DSP_BIQUAD_KERNEL == DSP_BIQUAD_CASCADE
+#define dsp_biquad_cascade_f32   dsp_biquad_cascade_f32_ansi
+#else
+#define dsp_biquad_cascade_f32   dsp_biquad_cascade_f32_opt
+#endif
 
 extern "C" {
   esp_err_t dsps_biquad_f32_ae32(const float* input, float* output, int len, float* coef, float* w);
-}
\ No newline at end of file
+  esp_err_t dsps_biquad_f32_ansi(const float* input, float* output, int len, float* coef, float* w);
+}
+
+// Use the Xtensa assembly biquad on the ESP32 and the portable C version elsewhere (e.g. host builds)
+#if defined( __XTENSA__ )
+#define dsps_biquad_f32       dsps_biquad_f32_ae32
+#else
+#define dsps_biquad_f32       dsps_biquad_f32_ansi
+#endif
+
+#endif
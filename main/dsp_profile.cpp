@@ -0,0 +1,181 @@
+#include "dsp_process.h"
+#include "dsp_os.h"
+
+//------------------------------------------------------------------------------------
+// Hot path timing
+//
+// The audio task and dsp_filter() add the cycles spent in each stage of a block to the
+// current record (DSP_PROFILE_STAGE), and the task closes the record into a ring of the
+// last DSP_PROFILE_BLOCKS blocks once the block is written. The ring has one writer,
+// the audio task; the 'b' command copies it from the control side, drops the records
+// that were overwritten while it copied, and reports min/avg/max/p99 per stage and the
+// headroom left in the block period. With DSP_PROFILE set to 0 the markers compile to
+// nothing and the report says so.
+//------------------------------------------------------------------------------------
+
+#if DSP_PROFILE
+
+typedef struct dsp_profile_record_t {
+  uint32_t     cycles[DSP_PROFILE_STAGES];       // Cycles spent in each stage of the block
+} dsp_profile_record_t;
+
+static  dsp_profile_record_t  dsp_profile_ring[DSP_PROFILE_BLOCKS];
+static  dsp_profile_record_t  dsp_profile_current;                   // Record of the block in progress
+static  uint32_t              dsp_profile_blocks     = 0;            // Records closed so far (atomic)
+static  uint32_t              dsp_profile_period_us  = 0;            // Block period of the last record
+
+static  dsp_profile_record_t  dsp_profile_copy[DSP_PROFILE_BLOCKS];  // Control side copy of the ring
+static  uint32_t              dsp_profile_sorted[DSP_PROFILE_BLOCKS];
+
+static const char* const      dsp_profile_names[DSP_PROFILE_STAGES] = { "read", "mix", "delay", "biquad", "fir", "output", "write", "block" };
+
+
+//------------------------------------------------------------------------------------
+// Audio side
+//------------------------------------------------------------------------------------
+
+uint32_t dsp_profile_cycles() {
+  return( dsp_os_cycles() );
+}
+
+void dsp_profile_stage( int stage, uint32_t* mark ) {
+
+  uint32_t  now = dsp_os_cycles();
+
+  dsp_profile_current.cycles[stage] += now - *mark;
+  *mark = now;
+}
+
+void dsp_profile_block( uint32_t start, uint32_t period_us ) {
+
+  uint32_t  blocks = dsp_profile_blocks;
+
+  dsp_profile_current.cycles[DSP_STAGE_BLOCK] = dsp_os_cycles() - start;
+  dsp_profile_ring[blocks % DSP_PROFILE_BLOCKS] = dsp_profile_current;
+  memset( &dsp_profile_current, 0, sizeof( dsp_profile_current ) );
+
+  dsp_profile_period_us = period_us;
+  __atomic_store_n( &dsp_profile_blocks, blocks + 1, __ATOMIC_RELEASE );
+}
+
+void dsp_profile_reset() {
+
+  memset( &dsp_profile_current, 0, sizeof( dsp_profile_current ) );
+  __atomic_store_n( &dsp_profile_blocks, 0, __ATOMIC_RELEASE );
+}
+
+// Cycles spent so far in a stage of the block in progress (the benchmarks time dsp_filter() this way)
+uint32_t dsp_profile_stage_cycles( int stage ) {
+  return( dsp_profile_current.cycles[stage] );
+}
+
+
+//------------------------------------------------------------------------------------
+// Control side: report the stage timing of the blocks in the ring
+//------------------------------------------------------------------------------------
+
+static int dsp_profile_compare( const void* a, const void* b ) {
+  return( *(const uint32_t*) a < *(const uint32_t*) b ? -1 : *(const uint32_t*) a > *(const uint32_t*) b );
+}
+
+esp_err_t dsp_profile_info( dsp_channel_t* channels ) {
+
+  uint32_t    blocks = __atomic_load_n( &dsp_profile_blocks, __ATOMIC_ACQUIRE );
+  uint32_t    first = blocks > DSP_PROFILE_BLOCKS ? blocks - DSP_PROFILE_BLOCKS : 0;
+  uint32_t    blocks_after;
+  float       cycles_per_us = dsp_os_cycles_per_us();
+  float       period_us = dsp_profile_period_us;
+  int         num_filters = 0;
+  int         fir_taps = 0;
+  int         fir_channels = 0;
+  float       fir_us_per_tap;
+  int         count;
+  uint64_t    sum;
+  float       avg_us[DSP_PROFILE_STAGES];
+  float       p99_us[DSP_PROFILE_STAGES];
+  float       max_us[DSP_PROFILE_STAGES];
+
+  for( uint32_t i = first; i < blocks; ++i ) {
+    dsp_profile_copy[i % DSP_PROFILE_BLOCKS] = dsp_profile_ring[i % DSP_PROFILE_BLOCKS];
+  }
+
+  // Records the audio task reused (or was writing) while they were copied are dropped
+  blocks_after = __atomic_load_n( &dsp_profile_blocks, __ATOMIC_ACQUIRE );
+  if( blocks_after >= first + DSP_PROFILE_BLOCKS ) {
+    first = blocks_after - DSP_PROFILE_BLOCKS + 1;
+  }
+
+  count = blocks > first ? blocks - first : 0;
+  if( count == 0 || period_us == 0 ) {
+    SERIAL.printf( "I-DSP: No blocks timed yet\r\n" );
+    return( ESP_OK );
+  }
+
+  for( int channel_id = 0; channel_id < DSP_NUM_CHANNELS; ++channel_id ) {
+    num_filters += channels[channel_id].num_filters;
+    if( channels[channel_id].buffers->fir != NULL ) {
+      fir_taps += channels[channel_id].buffers->fir->partitions*channels[channel_id].buffers->fir->block;
+      ++fir_channels;
+    }
+  }
+
+  SERIAL.printf( "I-DSP: Stage timing over the last %d blocks (%.0f cycles/us, block period %.0f us)\r\n", count, cycles_per_us, period_us );
+  SERIAL.printf( "I-DSP:   %-8s %9s %9s %9s %9s\r\n", "stage", "min_us", "avg_us", "max_us", "p99_us" );
+
+  for( int stage = 0; stage < DSP_PROFILE_STAGES; ++stage ) {
+    sum = 0;
+    for( int i = 0; i < count; ++i ) {
+      dsp_profile_sorted[i] = dsp_profile_copy[( first + i ) % DSP_PROFILE_BLOCKS].cycles[stage];
+      sum += dsp_profile_sorted[i];
+    }
+    qsort( dsp_profile_sorted, count, sizeof( uint32_t ), dsp_profile_compare );
+
+    avg_us[stage] = sum/cycles_per_us/count;
+    max_us[stage] = dsp_profile_sorted[count - 1]/cycles_per_us;
+    p99_us[stage] = dsp_profile_sorted[( count*99 + 99 )/100 - 1]/cycles_per_us;
+
+    SERIAL.printf( "I-DSP:   %-8s %9.1f %9.1f %9.1f %9.1f\r\n", dsp_profile_names[stage],
+      dsp_profile_sorted[0]/cycles_per_us, avg_us[stage], max_us[stage], p99_us[stage] );
+  }
+
+  if( num_filters > 0 ) {
+    SERIAL.printf( "I-DSP:   Biquad per filter = %.2f us avg (%d filters)\r\n", avg_us[DSP_STAGE_BIQUAD]/num_filters, num_filters );
+  }
+  // The FIR cost grows with the partitions, so the headroom left tells how long the filters could get
+  if( fir_taps > 0 && avg_us[DSP_STAGE_FIR] > 0 ) {
+    fir_us_per_tap = avg_us[DSP_STAGE_FIR]/fir_taps;
+    SERIAL.printf( "I-DSP:   FIR = %.2f us avg per 1000 taps (%d taps), about %d taps per FIR channel would use up the average headroom\r\n",
+      1000*fir_us_per_tap, fir_taps, (int) ( ( fir_taps + ( period_us - avg_us[DSP_STAGE_BLOCK] )/fir_us_per_tap )/fir_channels ) );
+  }
+  SERIAL.printf( "I-DSP:   CPU headroom avg/p99/worst = %.1f/%.1f/%.1f %%\r\n",
+    100*( 1 - avg_us[DSP_STAGE_BLOCK]/period_us ), 100*( 1 - p99_us[DSP_STAGE_BLOCK]/period_us ),
+    100*( 1 - max_us[DSP_STAGE_BLOCK]/period_us ) );
+
+  return( ESP_OK );
+}
+
+#else
+
+uint32_t dsp_profile_cycles() {
+  return( 0 );
+}
+
+void dsp_profile_stage( int stage, uint32_t* mark ) {
+}
+
+void dsp_profile_block( uint32_t start, uint32_t period_us ) {
+}
+
+void dsp_profile_reset() {
+}
+
+uint32_t dsp_profile_stage_cycles( int stage ) {
+  return( 0 );
+}
+
+esp_err_t dsp_profile_info( dsp_channel_t* channels ) {
+  SERIAL.printf( "I-DSP: Stage timing not built in (DSP_PROFILE = 0)\r\n" );
+  return( ESP_OK );
+}
+
+#endif
@@ -0,0 +1,481 @@
+#include "dsp_process.h"
+#include "dsp_os.h"
+
+#define     CHART_WIDTH         DSP_PLOT_BANDS
+#define     CHART_HEIGHT        DSP_PLOT_CHART_HEIGHT
+#define     CHART_DB_LOW        -60
+#define     CHART_DB_HIGH       0
+#define     ROW_SCALING         ((float) (CHART_DB_HIGH - CHART_DB_LOW)/CHART_HEIGHT)
+#define     CHART_LINES         ( CHART_HEIGHT + 4 )   // Title, chart rows, frequency labels, blank line
+#define     FFT_HALF            ( DSP_RTA_FFT_LEN/2 )
+#define     CHUNK_OUT           ( DSP_RTA_CHUNK/DSP_RTA_DECIMATION )  // Decimated samples per chunk
+#define     DECIMATED_RATE      ( (float) DSP_SAMPLE_RATE/DSP_RTA_DECIMATION )
+#define     BIN_HZ              ( DECIMATED_RATE/DSP_RTA_FFT_LEN )
+#define     POWER_FLOOR         1e-12f                 // -120 dBFS, keeps the log of a silent band finite
+
+//------------------------------------------------------------------------------------
+// Real-time analyzer of the output
+//
+// The audio task only copies each output block into a frame ring (dsp_rta_block); the
+// analysis runs in dsp_loop() under a time budget, a step at a time, like the plot:
+//  - a chunk of the ring is low-pass filtered and decimated by DSP_RTA_DECIMATION with
+//    the multirate filter into a history of the last DSP_RTA_FFT_LEN samples of each
+//    channel, so a 4096 point transform resolves 0.67 Hz where the bass is;
+//  - each time half of the history is new, the history of one channel per step is Hann
+//    windowed and transformed, the bins are summed into bands of 1/3 or 1/12 octave
+//    (a bin on a band edge is split between the bands) and the band powers are
+//    averaged exponentially;
+//  - every DSP_RTA_REPORT_MS the averaged levels are printed in dBFS (0 dB is a full
+//    scale sine), as a chart on the grid of the 'p' command or as CSV, a line per step.
+// The ring has a single writer and a single reader with free running counters, as the
+// log ring; a block that does not fit is counted as an overrun and the window starts
+// over, so a spectrum never spans a gap.
+//------------------------------------------------------------------------------------
+
+typedef struct dsp_rta_t {
+  sample_t  ring[ DSP_RTA_RING_FRAMES ][ DSP_NUM_CHANNELS ];   // Output frames from the audio task
+  uint32_t  head;                                    // Frames written (audio side, atomic)
+  uint32_t  tail;                                    // Frames decimated (control side, atomic)
+  uint32_t  overruns;                                // Blocks that did not fit in the ring (audio side, atomic)
+  uint32_t  overruns_seen;                           // Overruns the history was restarted for
+
+  dsp_multirate_t decimator[ DSP_NUM_CHANNELS ];     // Decimation filter of each channel
+  float     work[ DSP_RTA_CHUNK + DSP_MULTIRATE_MAX_TAPS - 1 ];
+  float     history[ DSP_NUM_CHANNELS ][ DSP_RTA_FFT_LEN ];    // Last decimated samples, circular from history_pos
+  int       history_pos;                             // Oldest sample, where the next chunk goes
+  int       history_fill;                            // Samples in the history (up to DSP_RTA_FFT_LEN)
+  int       history_new;                             // Samples since the last spectrum
+  int       pending;                                 // Next channel to analyze, DSP_NUM_CHANNELS when none is due
+  float     spectrum[ DSP_RTA_FFT_LEN ];             // Transform of the windowed history (packed)
+  dsp_fft_t fft;                                     // Transform tables
+
+  int       bands_per_octave;                        // 3 or 12
+  int       num_bands;
+  float     center[ DSP_RTA_MAX_BANDS ];             // Band center frequencies (base 2, around 1 kHz)
+  float     edge[ DSP_RTA_MAX_BANDS + 1 ];           // Band edges in bins
+  float     power[ DSP_NUM_CHANNELS ][ DSP_RTA_MAX_BANDS ];    // Averaged band power relative to a full scale sine
+  int       averages[ DSP_NUM_CHANNELS ];            // Spectra averaged into power
+  int       col_band[ CHART_WIDTH ];                 // Band shown in each chart column
+  float     col_freq[ CHART_WIDTH ];                 // Frequency of each chart column, as in the 'p' chart
+
+  int       format;                                  // DSP_PLOT_CHART or DSP_PLOT_CSV
+  bool      rendering;                               // A report is being printed
+  int       plot;                                    // Channel being printed
+  int       step;                                    // Line printed within it
+  int       line_plot[ CHART_WIDTH ];                // Chart row of each column of the channel being printed
+  float     report[ DSP_NUM_CHANNELS ][ DSP_RTA_MAX_BANDS ];   // Levels in dBFS when the report started
+  int       report_averages[ DSP_NUM_CHANNELS ];
+  int       spectra;                                 // Spectra computed, and how many were in the last report
+  int       spectra_reported;
+  int64_t   report_us;                               // Time of the last report
+
+  int64_t   start_us;                                // Timing of dsp_rta_poll() since the start
+  int64_t   busy_us;
+  int       max_call_us;
+  int       steps;
+} dsp_rta_t;
+
+static      dsp_rta_t*          dsp_rta_job = NULL;  // Allocated by the first start and kept
+static      bool                dsp_rta_active = false;  // The audio task feeds the ring (atomic)
+
+
+//------------------------------------------------------------------------------------
+// Audio side: copy an output block into the ring while the analyzer runs
+//------------------------------------------------------------------------------------
+
+void dsp_rta_block( const sample_t* buffer, int frames ) {
+
+  dsp_rta_t*  rta;
+  uint32_t    head;
+  int         pos;
+  int         first;
+
+  if( !__atomic_load_n( &dsp_rta_active, __ATOMIC_ACQUIRE ) ) {
+    return;
+  }
+
+  rta = dsp_rta_job;
+  head = __atomic_load_n( &rta->head, __ATOMIC_RELAXED );
+  if( head + frames - __atomic_load_n( &rta->tail, __ATOMIC_ACQUIRE ) > DSP_RTA_RING_FRAMES ) {
+    __atomic_store_n( &rta->overruns, rta->overruns + 1, __ATOMIC_RELAXED );
+    return;
+  }
+
+  pos = head % DSP_RTA_RING_FRAMES;
+  first = frames < DSP_RTA_RING_FRAMES - pos ? frames : DSP_RTA_RING_FRAMES - pos;
+  memcpy( rta->ring[ pos ], buffer, first*sizeof( rta->ring[ 0 ] ) );
+  memcpy( rta->ring[ 0 ], buffer + first*DSP_NUM_CHANNELS, ( frames - first )*sizeof( rta->ring[ 0 ] ) );
+
+  __atomic_store_n( &rta->head, head + frames, __ATOMIC_RELEASE );
+}
+
+
+//------------------------------------------------------------------------------------
+// Bands of 1/bands_per_octave octave centered on 1 kHz*2^( k/bands_per_octave ), those
+// overlapping DSP_RTA_LOW_HZ to DSP_RTA_HIGH_HZ (the 20 Hz band is centered on 19.7 Hz),
+// and the band each chart column falls in
+//------------------------------------------------------------------------------------
+
+static void dsp_rta_bands( dsp_rta_t* rta, int bands_per_octave ) {
+
+  double    half = pow( 2.0, 0.5/bands_per_octave );
+  double    center;
+  int       k = (int) floor( bands_per_octave*log2( DSP_RTA_LOW_HZ/half/1000 ) );
+  int       band = 0;
+
+  rta->bands_per_octave = bands_per_octave;
+  for( ; band < DSP_RTA_MAX_BANDS; ++ k ) {
+    center = 1000*pow( 2.0, (double) k/bands_per_octave );
+    if( center*half <= DSP_RTA_LOW_HZ ) {
+      continue;
+    } else if( center/half >= DSP_RTA_HIGH_HZ ) {
+      break;
+    }
+    rta->center[ band ] = center;
+    rta->edge[ band ] = center/half/BIN_HZ;
+    rta->edge[ band + 1 ] = center*half/BIN_HZ;
+    ++ band;
+  }
+  rta->num_bands = band;
+
+  for( int col = 0; col < CHART_WIDTH; ++ col ) {
+    rta->col_freq[ col ] = DSP_PLOT_LOW_HZ*pow( DSP_PLOT_HIGH_HZ/DSP_PLOT_LOW_HZ, (double) col/( CHART_WIDTH - 1 ) );
+    band = 0;
+    while( band < rta->num_bands - 1 && rta->col_freq[ col ] >= rta->edge[ band + 1 ]*BIN_HZ ) {
+      ++ band;
+    }
+    rta->col_band[ col ] = band;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Step: decimate a chunk of the ring into the history of each channel
+//------------------------------------------------------------------------------------
+
+static void dsp_rta_decimate( dsp_rta_t* rta, uint32_t tail ) {
+
+  const sample_t* frames = rta->ring[ tail % DSP_RTA_RING_FRAMES ];
+
+  for( int chan = 0; chan < DSP_NUM_CHANNELS; ++ chan ) {
+    dsp_multirate_decimate( &rta->decimator[ chan ], frames + chan, DSP_NUM_CHANNELS, DSP_RTA_CHUNK, rta->work,
+      &rta->history[ chan ][ rta->history_pos ] );
+  }
+  __atomic_store_n( &rta->tail, tail + DSP_RTA_CHUNK, __ATOMIC_RELEASE );
+
+  rta->history_pos = ( rta->history_pos + CHUNK_OUT ) % DSP_RTA_FFT_LEN;
+  rta->history_fill = rta->history_fill < DSP_RTA_FFT_LEN ? rta->history_fill + CHUNK_OUT : DSP_RTA_FFT_LEN;
+  rta->history_new += CHUNK_OUT;
+
+  if( rta->history_fill == DSP_RTA_FFT_LEN && rta->history_new >= FFT_HALF && rta->pending == DSP_NUM_CHANNELS ) {
+    rta->history_new = 0;
+    rta->pending = 0;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Step: spectrum of one channel's history, summed into bands and averaged. The Hann
+// window 0.5 - 0.5 cos( 2 pi n/N ) comes from the cosines of the transform tables; its
+// power sum is 3N/8, so a full scale sine sums to N*3N/8/4 over its bins.
+//------------------------------------------------------------------------------------
+
+static void dsp_rta_analyze( dsp_rta_t* rta, int chan ) {
+
+  const float*  twiddle = rta->fft.twiddle;
+  const float*  history = rta->history[ chan ];
+  float*        x = rta->spectrum;
+  float         scale = 0.5f/DSP_MAX_SAMPLE_VALUE;
+  float         norm = 4/( (float) DSP_RTA_FFT_LEN*( 3*DSP_RTA_FFT_LEN/8 ) );
+  float         lo, hi, re, im, sum;
+  int           pos = rta->history_pos;
+  int           n;
+
+  for( n = 0; n < FFT_HALF; ++ n ) {
+    x[ n ] = history[ ( pos + n ) % DSP_RTA_FFT_LEN ]*scale*( 1 - twiddle[ 2*n ] );
+    x[ n + FFT_HALF ] = history[ ( pos + n + FFT_HALF ) % DSP_RTA_FFT_LEN ]*scale*( 1 + twiddle[ 2*n ] );
+  }
+  dsp_fft_forward( &rta->fft, x );
+
+  for( int band = 0; band < rta->num_bands; ++ band ) {
+    lo = rta->edge[ band ];
+    hi = rta->edge[ band + 1 ];
+    sum = 0;
+    for( n = (int) ( lo + 0.5f ); n <= (int) ( hi + 0.5f ) && n < FFT_HALF; ++ n ) {
+      re = x[ 2*n ];
+      im = x[ 2*n + 1 ];
+      sum += ( re*re + im*im )*( fminf( hi, n + 0.5f ) - fmaxf( lo, n - 0.5f ) );
+    }
+    sum *= norm;
+
+    if( rta->averages[ chan ] == 0 ) {
+      rta->power[ chan ][ band ] = sum;
+    } else {
+      rta->power[ chan ][ band ] += DSP_RTA_AVERAGING*( sum - rta->power[ chan ][ band ] );
+    }
+  }
+
+  ++ rta->averages[ chan ];
+  if( ++ rta->pending == DSP_NUM_CHANNELS ) {
+    ++ rta->spectra;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Render step: print one line of the chart of a channel's levels
+//------------------------------------------------------------------------------------
+
+static void dsp_rta_chart_line( dsp_rta_t* rta, dsp_channel_t* channels ) {
+
+  const float*  level = rta->report[ rta->plot ];
+  int       row = rta->step - 1;
+  float     dB_value;
+  char      text_line[ DSP_PLOT_LINE_LEN ];
+
+  if( rta->step == 0 ) {
+    for( int col = 0; col < CHART_WIDTH; ++ col ) {
+      // Convert y value to display range
+      dB_value = level[ rta->col_band[ col ] ];
+      if( dB_value < CHART_DB_LOW ) {
+        dB_value = CHART_DB_LOW;
+      } else if( dB_value > CHART_DB_HIGH ) {
+        dB_value = CHART_DB_HIGH;
+      }
+      rta->line_plot[ col ] = (round( -dB_value ) + CHART_DB_HIGH)/ROW_SCALING;
+    }
+    SERIAL.printf( "Analyzer: %s, dBFS per 1/%d octave, %d spectra averaged\r\n", channels[ rta->plot ].name,
+      rta->bands_per_octave, rta->report_averages[ rta->plot ] );
+
+  } else if( row <= CHART_HEIGHT ) {
+    dsp_plot_chart_row( text_line, rta->line_plot, row );
+    SERIAL.printf( "%+5.0f %s\r\n", CHART_DB_HIGH - row*ROW_SCALING, text_line );
+
+  } else if( row == CHART_HEIGHT + 1 ) {
+    dsp_plot_chart_labels( text_line, rta->col_freq, 1, 1, "%.0f" );
+    SERIAL.printf( "   Hz %s\r\n", text_line );
+
+  } else {
+    SERIAL.println();
+  }
+
+  if( ++ rta->step == CHART_LINES ) {
+    ++ rta->plot;
+    rta->step = 0;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Render step: print one line of the CSV output (a header, then one line per band)
+//------------------------------------------------------------------------------------
+
+static void dsp_rta_csv_line( dsp_rta_t* rta, dsp_channel_t* channels ) {
+
+  int       band = rta->step - 1;
+
+  if( rta->plot == 0 && rta->step == 0 ) {
+    SERIAL.printf( "channel,band_hz,level_dbfs\r\n" );
+  } else if( band >= 0 ) {
+    SERIAL.printf( "%s,%.2f,%.1f\r\n", channels[ rta->plot ].name, rta->center[ band ], rta->report[ rta->plot ][ band ] );
+  }
+
+  if( ++ rta->step == rta->num_bands + 1 ) {
+    ++ rta->plot;
+    rta->step = 1;
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Start the analyzer with bands of 1/3 or 1/12 octave, reported as a chart or CSV
+// (DSP_PLOT_CHART or DSP_PLOT_CSV), or stop it (0). Starting again starts over.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_rta_start( int bands_per_octave, int format ) {
+
+  dsp_rta_t*    rta = dsp_rta_job;
+
+  __atomic_store_n( &dsp_rta_active, false, __ATOMIC_RELEASE );
+  if( bands_per_octave == 0 ) {
+    SERIAL.printf( "I-DSP: Analyzer stopped\r\n" );
+    return( ESP_OK );
+  } else if( bands_per_octave != 3 && bands_per_octave != 12 ) {
+    SERIAL.printf( "E-DSP: The analyzer has bands of 1/3 or 1/12 octave\r\n" );
+    return( ESP_ERR_INVALID_ARG );
+  }
+
+  if( rta == NULL ) {
+    rta = (dsp_rta_t*) calloc( 1, sizeof( dsp_rta_t ) );
+    if( rta == NULL || dsp_fft_init( &rta->fft, DSP_RTA_FFT_LEN ) != ESP_OK ) {
+      SERIAL.printf( "E-DSP: Unable to allocate %d bytes for the analyzer\r\n", dsp_rta_memory() );
+      free( rta );
+      return( ESP_FAIL );
+    }
+    dsp_rta_job = rta;
+  }
+
+  for( int chan = 0; chan < DSP_NUM_CHANNELS; ++ chan ) {
+    dsp_multirate_init( &rta->decimator[ chan ], DSP_RTA_DECIMATION );
+    rta->averages[ chan ] = 0;
+  }
+  dsp_rta_bands( rta, bands_per_octave );
+  rta->history_pos = 0;
+  rta->history_fill = 0;
+  rta->history_new = 0;
+  rta->pending = DSP_NUM_CHANNELS;
+  rta->format = format;
+  rta->rendering = false;
+  rta->spectra = 0;
+  rta->spectra_reported = 0;
+  rta->busy_us = 0;
+  rta->max_call_us = 0;
+  rta->steps = 0;
+  rta->start_us = dsp_os_time_us();
+  rta->report_us = rta->start_us;
+
+  // Only the audio task moves the head; whatever it wrote before is skipped
+  rta->overruns_seen = __atomic_load_n( &rta->overruns, __ATOMIC_RELAXED );
+  __atomic_store_n( &rta->tail, __atomic_load_n( &rta->head, __ATOMIC_ACQUIRE ), __ATOMIC_RELEASE );
+  __atomic_store_n( &dsp_rta_active, true, __ATOMIC_RELEASE );
+
+  SERIAL.printf( "I-DSP: Analyzer on, %d bands of 1/%d octave, a spectrum every %.2f s\r\n", rta->num_bands,
+    bands_per_octave, FFT_HALF/DECIMATED_RATE );
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Carry on with the analyzer until the time budget is spent; at least one step (a chunk
+// decimated, a channel analyzed or a line printed) is taken per call. Decimation comes
+// first so a slow line never backs up the ring. Returns true while there is more.
+//------------------------------------------------------------------------------------
+
+bool dsp_rta_poll( dsp_channel_t* channels, int budget_us ) {
+
+  dsp_rta_t*    rta = dsp_rta_job;
+  int64_t       start_us;
+  int64_t       now_us;
+  uint32_t      tail;
+  uint32_t      overruns;
+  bool          more;
+
+  if( rta == NULL || !__atomic_load_n( &dsp_rta_active, __ATOMIC_ACQUIRE ) ) {
+    return( false );
+  }
+
+  start_us = dsp_os_time_us();
+  do {
+    // Frames were lost: start the window over
+    overruns = __atomic_load_n( &rta->overruns, __ATOMIC_RELAXED );
+    if( overruns != rta->overruns_seen ) {
+      rta->overruns_seen = overruns;
+      rta->history_fill = 0;
+      rta->history_new = 0;
+    }
+
+    tail = __atomic_load_n( &rta->tail, __ATOMIC_RELAXED );
+    now_us = dsp_os_time_us();
+    if( __atomic_load_n( &rta->head, __ATOMIC_ACQUIRE ) - tail >= DSP_RTA_CHUNK ) {
+      dsp_rta_decimate( rta, tail );
+    } else if( rta->pending < DSP_NUM_CHANNELS ) {
+      dsp_rta_analyze( rta, rta->pending );
+    } else if( rta->rendering ) {
+      if( rta->format == DSP_PLOT_CSV ) {
+        dsp_rta_csv_line( rta, channels );
+      } else {
+        dsp_rta_chart_line( rta, channels );
+      }
+      rta->rendering = rta->plot < DSP_NUM_CHANNELS;
+    } else if( rta->spectra != rta->spectra_reported && now_us - rta->report_us >= DSP_RTA_REPORT_MS*1000ll ) {
+      // Take the levels for the report, which is printed over the next steps
+      for( int chan = 0; chan < DSP_NUM_CHANNELS; ++ chan ) {
+        for( int band = 0; band < rta->num_bands; ++ band ) {
+          rta->report[ chan ][ band ] = 10*log10f( rta->power[ chan ][ band ] + POWER_FLOOR );
+        }
+        rta->report_averages[ chan ] = rta->averages[ chan ];
+      }
+      rta->spectra_reported = rta->spectra;
+      rta->report_us = now_us;
+      rta->plot = 0;
+      rta->step = 0;
+      rta->rendering = true;
+      continue;
+    } else {
+      break;
+    }
+    ++ rta->steps;
+  } while( dsp_os_time_us() - start_us < budget_us );
+
+  more = rta->rendering || rta->pending < DSP_NUM_CHANNELS || __atomic_load_n( &rta->head, __ATOMIC_ACQUIRE ) - rta->tail >= DSP_RTA_CHUNK;
+
+  now_us = dsp_os_time_us() - start_us;
+  rta->busy_us += now_us;
+  if( now_us > rta->max_call_us ) {
+    rta->max_call_us = (int) now_us;
+  }
+
+  return( more );
+}
+
+
+//------------------------------------------------------------------------------------
+// Averaged level in dBFS of each band of a channel and the band centers. Returns the
+// number of bands, 0 while the analyzer is off or has no spectrum yet.
+//------------------------------------------------------------------------------------
+
+int dsp_rta_levels( int channel_id, float* freq, float* level_dB ) {
+
+  dsp_rta_t*    rta = dsp_rta_job;
+
+  if( rta == NULL || !__atomic_load_n( &dsp_rta_active, __ATOMIC_ACQUIRE ) || channel_id < 0 || channel_id >= DSP_NUM_CHANNELS ||
+      rta->averages[ channel_id ] == 0 ) {
+    return( 0 );
+  }
+
+  for( int band = 0; band < rta->num_bands; ++ band ) {
+    freq[ band ] = rta->center[ band ];
+    level_dB[ band ] = 10*log10f( rta->power[ channel_id ][ band ] + POWER_FLOOR );
+  }
+
+  return( rta->num_bands );
+}
+
+
+//------------------------------------------------------------------------------------
+// Print the analyzer settings and what it costs the control loop
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_rta_info() {
+
+  dsp_rta_t*    rta = dsp_rta_job;
+  int64_t       wall_us;
+
+  if( rta == NULL || !__atomic_load_n( &dsp_rta_active, __ATOMIC_ACQUIRE ) ) {
+    SERIAL.printf( "I-DSP: Analyzer off (%d bytes when on)\r\n", dsp_rta_memory() );
+    return( ESP_OK );
+  }
+
+  wall_us = dsp_os_time_us() - rta->start_us + 1;
+  SERIAL.printf( "I-DSP: Analyzer: %d bands of 1/%d octave, %.1f to %.1f Hz, %s report every %d s\r\n", rta->num_bands,
+    rta->bands_per_octave, rta->center[ 0 ], rta->center[ rta->num_bands - 1 ], rta->format == DSP_PLOT_CSV ? "CSV" : "chart",
+    DSP_RTA_REPORT_MS/1000 );
+  SERIAL.printf( "I-DSP:   %d point FFT at %.2f Hz (decimated by %d): %.2f Hz bins, %.2f s Hann window, 50%% overlap\r\n",
+    DSP_RTA_FFT_LEN, DECIMATED_RATE, DSP_RTA_DECIMATION, BIN_HZ, DSP_RTA_FFT_LEN/DECIMATED_RATE );
+  SERIAL.printf( "I-DSP:   %d spectra per channel averaged (weight %.2f)\r\n", rta->averages[ 0 ], DSP_RTA_AVERAGING );
+  SERIAL.printf( "I-DSP:   CPU %.2f%% of the control loop's core, %d steps, longest call %d us (budget %d us)\r\n",
+    100.0*rta->busy_us/wall_us, rta->steps, rta->max_call_us, DSP_RTA_BUDGET_US );
+  SERIAL.printf( "I-DSP:   %u ring overruns, %d bytes\r\n", __atomic_load_n( &rta->overruns, __ATOMIC_RELAXED ), dsp_rta_memory() );
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// RAM the first start allocates: the state and the transform tables
+//------------------------------------------------------------------------------------
+
+int dsp_rta_memory() {
+  return( (int) ( sizeof( dsp_rta_t ) + DSP_RTA_FFT_LEN*sizeof( float ) + FFT_HALF*sizeof( uint16_t ) ) );
+}
@@ -0,0 +1,323 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include "dsp_process.h"
+#include "dsp_os.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL          0                         // lwip raises no SIGPIPE
+#endif
+
+#define DSP_TAP_PAD           0                         // Magic of the filler left where a frame did not fit before the end of the ring
+
+//------------------------------------------------------------------------------------
+// Audio tap
+//
+// Streams the blocks of the audio task to a TCP client, as they were read (before
+// processing) and as they were written (after), to listen to what the filters do. The
+// audio task copies each tapped block once, averaged down by the decimation, into a
+// byte ring behind a dsp_tap_header_t; a network task sends the frames straight from
+// the ring and releases them once sent. The ring has a single writer and a single
+// reader with free running head and tail counters, as the log ring. A frame is kept
+// in one piece: when it does not fit before the end of the ring the rest is padded and
+// it starts over at the beginning. The audio task never waits for the network: a block
+// that does not fit is counted as dropped, and its sequence number is missing from the
+// stream. Nothing is copied while no client is connected.
+//
+// The sockets are the POSIX API of lwip on the ESP32 and of the host on Linux.
+//------------------------------------------------------------------------------------
+
+typedef struct dsp_tap_t {
+  uint8_t*     ring;                                    // DSP_TAP_RING_BYTES, 4 byte aligned frames
+  uint32_t     head;                                    // Bytes written (audio side, atomic)
+  uint32_t     tail;                                    // Bytes sent (network side, atomic)
+  int          server;                                  // Listening socket, -1 until dsp_tap_listen()
+  int          port;
+  int          points;                                  // DSP_TAP_INPUT | DSP_TAP_OUTPUT (atomic)
+  int          decimation;                              // (atomic)
+  bool         connected;                               // (atomic)
+
+  // Audio side: frames averaged so far per tap point
+  int          acc_decimation[2];
+  int          acc_count[2];
+  int64_t      acc[2][DSP_NUM_CHANNELS];
+
+  dsp_tap_stats_t  stats;                               // blocks and dropped audio side, the rest network side
+} dsp_tap_t;
+
+static  dsp_tap_t   dsp_tap = { NULL, 0, 0, -1, 0, 0, 1, false };
+
+
+//------------------------------------------------------------------------------------
+// Audio side: copy a block into the ring if the tap point is on and a client connected
+//------------------------------------------------------------------------------------
+
+void dsp_tap_block( int point, uint32_t sequence, const sample_t* buffer, int frames ) {
+
+  int                 p = point == DSP_TAP_INPUT ? 0 : 1;
+  int                 decimation;
+  int                 out_frames;
+  uint32_t            head;
+  uint32_t            pos;
+  uint32_t            len;
+  uint32_t            pad = 0;
+  dsp_tap_header_t*   header;
+  sample_t*           out;
+
+  if( ( __atomic_load_n( &dsp_tap.points, __ATOMIC_RELAXED ) & point ) == 0 || !__atomic_load_n( &dsp_tap.connected, __ATOMIC_ACQUIRE ) ) {
+    return;
+  }
+
+  decimation = __atomic_load_n( &dsp_tap.decimation, __ATOMIC_RELAXED );
+  if( decimation != dsp_tap.acc_decimation[p] ) {
+    dsp_tap.acc_decimation[p] = decimation;
+    dsp_tap.acc_count[p] = 0;
+    memset( dsp_tap.acc[p], 0, sizeof( dsp_tap.acc[p] ) );
+  }
+
+  out_frames = ( dsp_tap.acc_count[p] + frames )/decimation;
+  len = ( sizeof( dsp_tap_header_t ) + out_frames*DSP_NUM_CHANNELS*sizeof( sample_t ) + 3 ) & ~3u;
+
+  head = __atomic_load_n( &dsp_tap.head, __ATOMIC_RELAXED );
+  pos = head % DSP_TAP_RING_BYTES;
+  if( pos + len > DSP_TAP_RING_BYTES ) {
+    pad = DSP_TAP_RING_BYTES - pos;
+  }
+  if( head + pad + len - __atomic_load_n( &dsp_tap.tail, __ATOMIC_ACQUIRE ) > DSP_TAP_RING_BYTES ) {
+    __atomic_store_n( &dsp_tap.stats.dropped, dsp_tap.stats.dropped + 1, __ATOMIC_RELAXED );
+    return;
+  }
+  if( pad > 0 ) {
+    *(uint32_t*) &dsp_tap.ring[pos] = DSP_TAP_PAD;
+    pos = 0;
+  }
+
+  header = (dsp_tap_header_t*) &dsp_tap.ring[pos];
+  header->magic = DSP_TAP_MAGIC;
+  header->sequence = sequence;
+  header->sample_rate = DSP_SAMPLE_RATE/decimation;
+  header->dropped = dsp_tap.stats.dropped;
+  header->frames = (uint16_t) out_frames;
+  header->channels = DSP_NUM_CHANNELS;
+  header->sample_bytes = sizeof( sample_t );
+  header->point = (uint8_t) point;
+  memset( header->reserved, 0, sizeof( header->reserved ) );
+
+  out = (sample_t*) ( header + 1 );
+  if( decimation == 1 ) {
+    memcpy( out, buffer, frames*DSP_NUM_CHANNELS*sizeof( sample_t ) );
+  } else {
+    // Average each run of 'decimation' frames, carrying a partial run over to the next block
+    int64_t*  acc = dsp_tap.acc[p];
+    int       count = dsp_tap.acc_count[p];
+
+    for( int i = 0; i < frames; ++i ) {
+      for( int ch = 0; ch < DSP_NUM_CHANNELS; ++ch ) {
+        acc[ch] += buffer[i*DSP_NUM_CHANNELS + ch];
+      }
+      if( ++count == decimation ) {
+        for( int ch = 0; ch < DSP_NUM_CHANNELS; ++ch ) {
+          *out++ = (sample_t) ( acc[ch]/decimation );
+          acc[ch] = 0;
+        }
+        count = 0;
+      }
+    }
+    dsp_tap.acc_count[p] = count;
+  }
+
+  __atomic_store_n( &dsp_tap.stats.blocks, dsp_tap.stats.blocks + 1, __ATOMIC_RELAXED );
+  __atomic_store_n( &dsp_tap.head, head + pad + len, __ATOMIC_RELEASE );
+}
+
+
+//------------------------------------------------------------------------------------
+// Network side: send a frame completely (false if the client has gone)
+//------------------------------------------------------------------------------------
+
+static bool dsp_tap_send( int client, const uint8_t* data, size_t len ) {
+
+  ssize_t   sent;
+
+  while( len > 0 ) {
+    sent = send( client, data, len, MSG_NOSIGNAL );
+    if( sent <= 0 ) {
+      return( false );
+    }
+    data += sent;
+    len -= sent;
+  }
+
+  return( true );
+}
+
+
+//------------------------------------------------------------------------------------
+// The network task: serve one client at a time, sending the frames as they come
+//------------------------------------------------------------------------------------
+
+static void dsp_tap_task( void* arg ) {
+
+  int                 client;
+  uint32_t            tail;
+  uint32_t            pos;
+  uint32_t            len;
+  dsp_tap_header_t*   header;
+
+  while( true ) {
+    client = accept( dsp_tap.server, NULL, NULL );
+    if( client < 0 ) {
+      dsp_os_delay_ms( 100 );
+      continue;
+    }
+
+    // Start from the next block, not from what was left in the ring
+    tail = __atomic_load_n( &dsp_tap.head, __ATOMIC_ACQUIRE );
+    __atomic_store_n( &dsp_tap.tail, tail, __ATOMIC_RELEASE );
+    ++dsp_tap.stats.clients;
+    __atomic_store_n( &dsp_tap.connected, true, __ATOMIC_RELEASE );
+
+    while( true ) {
+      if( tail == __atomic_load_n( &dsp_tap.head, __ATOMIC_ACQUIRE ) ) {
+        dsp_os_delay_ms( DSP_TAP_POLL_MS );
+        continue;
+      }
+
+      pos = tail % DSP_TAP_RING_BYTES;
+      header = (dsp_tap_header_t*) &dsp_tap.ring[pos];
+      if( header->magic == DSP_TAP_PAD ) {
+        tail += DSP_TAP_RING_BYTES - pos;
+      } else {
+        len = sizeof( dsp_tap_header_t ) + header->frames*header->channels*header->sample_bytes;
+        if( !dsp_tap_send( client, (const uint8_t*) header, len ) ) {
+          break;
+        }
+        dsp_tap.stats.bytes_sent += len;
+        tail += ( len + 3 ) & ~3u;
+      }
+      __atomic_store_n( &dsp_tap.tail, tail, __ATOMIC_RELEASE );
+    }
+
+    __atomic_store_n( &dsp_tap.connected, false, __ATOMIC_RELEASE );
+    close( client );
+  }
+}
+
+
+//------------------------------------------------------------------------------------
+// Listen for a client on a port (0 for any free port) and start the network task
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_tap_listen( int port ) {
+
+  struct sockaddr_in  addr;
+  socklen_t           addr_len = sizeof( addr );
+  int                 reuse = 1;
+  esp_err_t           res;
+
+  if( dsp_tap.server >= 0 ) {
+    return( ESP_OK );
+  }
+
+  if( dsp_tap.ring == NULL ) {
+    dsp_tap.ring = (uint8_t*) malloc( DSP_TAP_RING_BYTES );
+    if( dsp_tap.ring == NULL ) {
+      SERIAL.printf( "E-DSP: Unable to allocate the tap ring\r\n" );
+      return( ESP_FAIL );
+    }
+  }
+
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl( INADDR_ANY );
+  addr.sin_port = htons( port );
+
+  dsp_tap.server = socket( AF_INET, SOCK_STREAM, 0 );
+  if( dsp_tap.server < 0 ) {
+    SERIAL.printf( "E-DSP: Unable to create the tap socket\r\n" );
+    return( ESP_FAIL );
+  }
+  setsockopt( dsp_tap.server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
+
+  if( bind( dsp_tap.server, (struct sockaddr*) &addr, sizeof( addr ) ) != 0 || listen( dsp_tap.server, 1 ) != 0 ||
+      getsockname( dsp_tap.server, (struct sockaddr*) &addr, &addr_len ) != 0 ) {
+    SERIAL.printf( "E-DSP: Unable to listen on port %d for the tap\r\n", port );
+    close( dsp_tap.server );
+    dsp_tap.server = -1;
+    return( ESP_FAIL );
+  }
+  dsp_tap.port = ntohs( addr.sin_port );
+
+  res = dsp_os_task_create( dsp_tap_task, "dsp_tap", DSP_TAP_STACK, DSP_TAP_PRIORITY, DSP_TAP_CORE, NULL );
+  if( res != ESP_OK ) {
+    SERIAL.printf( "E-DSP: Unable to create the tap task\r\n" );
+    close( dsp_tap.server );
+    dsp_tap.server = -1;
+    return( res );
+  }
+
+  return( ESP_OK );
+}
+
+int dsp_tap_port() {
+  return( dsp_tap.server >= 0 ? dsp_tap.port : 0 );
+}
+
+
+//------------------------------------------------------------------------------------
+// Select the tap points (0 for none) and the decimation, listening on DSP_TAP_PORT
+// the first time a point is selected. The decimation must divide the sample rate.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_tap_set( int points, int decimation ) {
+
+  esp_err_t   res;
+
+  if( points < 0 || points > ( DSP_TAP_INPUT | DSP_TAP_OUTPUT ) ||
+      decimation < 1 || decimation > DSP_TAP_MAX_DECIMATION || DSP_SAMPLE_RATE % decimation != 0 ) {
+    return( ESP_ERR_INVALID_ARG );
+  }
+
+  if( points != 0 ) {
+    res = dsp_tap_listen( DSP_TAP_PORT );
+    if( res != ESP_OK ) {
+      return( res );
+    }
+  }
+
+  __atomic_store_n( &dsp_tap.decimation, decimation, __ATOMIC_RELAXED );
+  __atomic_store_n( &dsp_tap.points, points, __ATOMIC_RELAXED );
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Statistics
+//------------------------------------------------------------------------------------
+
+void dsp_tap_get_stats( dsp_tap_stats_t* stats ) {
+  stats->blocks = __atomic_load_n( &dsp_tap.stats.blocks, __ATOMIC_RELAXED );
+  stats->dropped = __atomic_load_n( &dsp_tap.stats.dropped, __ATOMIC_RELAXED );
+  stats->bytes_sent = dsp_tap.stats.bytes_sent;
+  stats->clients = dsp_tap.stats.clients;
+  stats->connected = __atomic_load_n( &dsp_tap.connected, __ATOMIC_ACQUIRE );
+}
+
+esp_err_t dsp_tap_info() {
+
+  dsp_tap_stats_t   stats;
+  int               points = dsp_tap.points;
+
+  dsp_tap_get_stats( &stats );
+
+  SERIAL.printf( "I-DSP: Audio tap %s, decimation %d (%d Hz)\r\n",
+    points == ( DSP_TAP_INPUT | DSP_TAP_OUTPUT ) ? "INPUT+OUTPUT" : points == DSP_TAP_INPUT ? "INPUT" : points == DSP_TAP_OUTPUT ? "OUTPUT" : "OFF",
+    dsp_tap.decimation, DSP_SAMPLE_RATE/dsp_tap.decimation );
+  if( dsp_tap.server >= 0 ) {
+    SERIAL.printf( "I-DSP:   Port %d, client %s (%u connections)\r\n", dsp_tap.port, stats.connected ? "CONNECTED" : "WAITING", stats.clients );
+  }
+  SERIAL.printf( "I-DSP:   Blocks = %u, dropped = %u, sent = %.1f kB\r\n", stats.blocks, stats.dropped, stats.bytes_sent/1024.0 );
+
+  return( ESP_OK );
+}
@@ -0,0 +1,222 @@
+#include "dsp_process.h"
+#include "dsp_os.h"
+
+//------------------------------------------------------------------------------------
+// Real-time audio task
+//
+// Runs the read/process/write cycle of the audio pipeline in its own high-priority task
+// so that WiFi, Telnet, OTA and serial handling in the Arduino loop() can no longer stall
+// the I2S stream. The I/O functions are supplied by the caller: the I2S driver on the
+// ESP32 and a simulated I2S clock in the host build.
+//
+// Every block is timed from the moment its input buffer was delivered. A block that
+// took longer than one block period to process and write back finished after the next
+// DMA buffer was due and is counted as a deadline miss. With DSP_PROFILE the time of
+// each stage is also recorded per block (see dsp_profile.cpp). Errors and misses are
+// logged through the log ring (see dsp_log.cpp), never printed from the task. The audio
+// tap (see dsp_tap.cpp) takes the block before it is processed and after it is written.
+//------------------------------------------------------------------------------------
+
+static  const dsp_task_io_t*  dsp_task_io          = NULL;
+static  sample_t*             dsp_task_buffer      = NULL;
+static  size_t                dsp_task_buffer_len  = 0;
+static  volatile bool         dsp_task_running     = false;
+static  volatile bool         dsp_task_active      = false;
+static  int64_t               dsp_task_start_us    = 0;
+static  volatile dsp_task_stats_t  dsp_task_stats;
+
+
+//------------------------------------------------------------------------------------
+// The audio task
+//------------------------------------------------------------------------------------
+
+static void dsp_task( void* arg ) {
+
+  esp_err_t   res;
+  size_t      bytes_read;
+  int64_t     ready_us;
+  int64_t     last_ready_us = 0;
+  uint32_t    busy_us;
+  uint32_t    period_us;
+  int         frames;
+  bool        missed = false;
+  bool        written = false;
+  bool        failed = false;
+
+  dsp_task_active = true;
+
+  while( dsp_task_running ) {
+    DSP_PROFILE_MARK( read_mark );
+
+    // Wait for the next input buffer
+    res = dsp_task_io->read( dsp_task_buffer, dsp_task_buffer_len, &bytes_read );
+    ready_us = dsp_os_time_us();
+
+    DSP_PROFILE_STAGE( DSP_STAGE_READ, read_mark );
+    DSP_PROFILE_MARK( ready_mark );
+
+    // Only the first failure of a run is logged, and the task waits before it retries
+    if( res != ESP_OK || bytes_read == 0 ) {
+      ++dsp_task_stats.errors;
+      if( !failed ) {
+        dsp_log( DSP_LOG_READ_FAILED, res, 0, 0 );
+      }
+      failed = true;
+      dsp_os_delay_ms( DSP_TASK_RETRY_MS );
+      continue;
+    }
+    failed = false;
+
+    frames = bytes_read/( DSP_NUM_CHANNELS*sizeof( sample_t ) );
+    period_us = (uint32_t) ( 1000000ll*frames/DSP_SAMPLE_RATE );
+
+    // An input buffer arriving more than a period late means the DMA ring ran over
+    if( dsp_task_stats.blocks > 0 && ready_us - last_ready_us > 2*period_us ) {
+      ++dsp_task_stats.late_reads;
+    }
+    last_ready_us = ready_us;
+
+    dsp_tap_block( DSP_TAP_INPUT, dsp_task_stats.blocks, dsp_task_buffer, frames );
+
+    res = dsp_task_io->process( dsp_task_buffer, bytes_read );
+    if( res != ESP_OK ) {
+      ++dsp_task_stats.errors;
+      dsp_log( DSP_LOG_PROCESS_FAILED, res, 0, 0 );
+    }
+
+    DSP_PROFILE_MARK( write_mark );
+
+    res = dsp_task_io->write( dsp_task_buffer, bytes_read );
+    if( res != ESP_OK ) {
+      ++dsp_task_stats.errors;
+      dsp_log( DSP_LOG_WRITE_FAILED, res, 0, 0 );
+    }
+
+    DSP_PROFILE_STAGE( DSP_STAGE_WRITE, write_mark );
+
+    // The write copied the block out, so tapping it now does not delay the output
+    dsp_tap_block( DSP_TAP_OUTPUT, dsp_task_stats.blocks, dsp_task_buffer, frames );
+    dsp_rta_block( dsp_task_buffer, frames );
+
+    DSP_PROFILE_BLOCK( ready_mark, period_us );
+
+    busy_us = (uint32_t) ( dsp_os_time_us() - ready_us );
+
+    // Update the statistics
+    if( !written ) {
+      dsp_task_stats.first_write_us = ready_us + busy_us - dsp_task_start_us;
+      written = true;
+    }
+    ++dsp_task_stats.blocks;
+    dsp_task_stats.period_us = period_us;
+    dsp_task_stats.last_busy_us = busy_us;
+    dsp_task_stats.total_busy_us += busy_us;
+    if( busy_us > dsp_task_stats.max_busy_us ) {
+      dsp_task_stats.max_busy_us = busy_us;
+    }
+    // Only the first miss of a run is logged; 't' shows how many there were
+    if( busy_us > period_us ) {
+      ++dsp_task_stats.deadline_misses;
+      if( !missed ) {
+        dsp_log( DSP_LOG_DEADLINE_MISS, dsp_task_stats.blocks - 1, busy_us, period_us );
+      }
+    }
+    missed = busy_us > period_us;
+  }
+
+  dsp_task_active = false;
+  dsp_os_task_exit();
+}
+
+
+//------------------------------------------------------------------------------------
+// Start the audio task
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_task_start( const dsp_task_io_t* io, sample_t* buffer, size_t buffer_len ) {
+
+  esp_err_t   res;
+
+  if( dsp_task_running ) {
+    return( ESP_FAIL );
+  }
+
+  dsp_task_io = io;
+  dsp_task_buffer = buffer;
+  dsp_task_buffer_len = buffer_len;
+  dsp_task_reset_stats();
+  dsp_profile_reset();
+  dsp_task_start_us = dsp_os_time_us();
+
+  dsp_task_running = true;
+
+  res = dsp_os_task_create( dsp_task, "dsp_audio", DSP_TASK_STACK, DSP_TASK_PRIORITY, DSP_TASK_CORE, NULL );
+  if( res != ESP_OK ) {
+    dsp_task_running = false;
+    SERIAL.printf( "E-DSP: Unable to create the audio task\r\n" );
+    return( res );
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Stop the audio task and wait until it has finished its current block
+//------------------------------------------------------------------------------------
+
+esp_err_t dsp_task_stop() {
+
+  dsp_task_running = false;
+
+  for( int wait_ms = 0; dsp_task_active; wait_ms += 10 ) {
+    if( wait_ms >= 1000 ) {
+      SERIAL.printf( "E-DSP: Audio task did not stop\r\n" );
+      return( ESP_FAIL );
+    }
+    dsp_os_delay_ms( 10 );
+  }
+
+  return( ESP_OK );
+}
+
+
+//------------------------------------------------------------------------------------
+// Statistics
+//------------------------------------------------------------------------------------
+
+void dsp_task_get_stats( dsp_task_stats_t* stats ) {
+  memcpy( stats, (const void*) &dsp_task_stats, sizeof( dsp_task_stats_t ) );
+}
+
+void dsp_task_reset_stats() {
+
+  int64_t   first_write_us = dsp_task_stats.first_write_us;
+
+  // The start-up time stays until the task is restarted
+  memset( (void*) &dsp_task_stats, 0, sizeof( dsp_task_stats_t ) );
+  dsp_task_stats.first_write_us = dsp_task_running ? first_write_us : 0;
+}
+
+esp_err_t dsp_task_info() {
+
+  dsp_task_stats_t  stats;
+
+  dsp_task_get_stats( &stats );
+
+  SERIAL.printf( "I-DSP: Audio task %s\r\n", dsp_task_active ? "RUNNING" : "STOPPED" );
+  SERIAL.printf( "I-DSP:   Blocks = %u\r\n", stats.blocks );
+  SERIAL.printf( "I-DSP:   Block period = %u us\r\n", stats.period_us );
+  SERIAL.printf( "I-DSP:   Busy time last/avg/max = %u/%u/%u us\r\n",
+    stats.last_busy_us, stats.blocks > 0 ? (uint32_t) ( stats.total_busy_us/stats.blocks ) : 0, stats.max_busy_us );
+  SERIAL.printf( "I-DSP:   Load = %.1f %%\r\n",
+    stats.blocks > 0 && stats.period_us > 0 ? 100.0*stats.total_busy_us/stats.blocks/stats.period_us : 0.0 );
+  SERIAL.printf( "I-DSP:   Deadline misses = %u\r\n", stats.deadline_misses );
+  SERIAL.printf( "I-DSP:   Late reads = %u\r\n", stats.late_reads );
+  SERIAL.printf( "I-DSP:   Errors = %u\r\n", stats.errors );
+  if( stats.first_write_us > 0 ) {
+    SERIAL.printf( "I-DSP:   First block written %.1f ms after the task started\r\n", stats.first_write_us/1000.0 );
+  }
+
+  return( ESP_OK );
+}
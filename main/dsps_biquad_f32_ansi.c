@@ -0,0 +1,26 @@
+#include <esp_err.h>
+
+//------------------------------------------------------------------------------------
+// Portable C version of the Espressif biquad filter (form II) in dsps_biquad_f32_ae32.S.
+// Used wherever the Xtensa assembly is not available, e.g. the host-side Linux build.
+//------------------------------------------------------------------------------------
+
+esp_err_t dsps_biquad_f32_ansi( const float* input, float* output, int len, float* coef, float* w ) {
+
+  float   d0;
+  float   w0 = w[0];
+  float   w1 = w[1];
+
+  for( int i = 0; i < len; ++i ) {
+    d0 = input[i] - coef[3]*w0 - coef[4]*w1;
+    output[i] = coef[0]*d0 + coef[1]*w0 + coef[2]*w1;
+    w1 = w0;
+    w0 = d0;
+  }
+
+  // Save the delay line for the next call
+  w[0] = w0;
+  w[1] = w1;
+
+  return( ESP_OK );
+}